@@ -13,6 +13,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <string>
 #include <android/log.h>
 
 #include "aether/common/xlogger/xloggerbase.h"
@@ -20,20 +21,55 @@
 #include "aether/common/autobuffer.h"
 
 
+// logcat 单条最多 4K 左右, 超出的部分会被丢掉
+static const size_t kLogcatMaxLength = 4000;
+
+// 超长日志分几条写给 logcat, 尽量在换行处断开
+static void __WriteLogcat(int _prio, const char* _tag, const char* _log) {
+    size_t len = strlen(_log);
+    if (len <= kLogcatMaxLength) {
+        __android_log_write(_prio, _tag, _log);
+        return;
+    }
+
+    char piece[kLogcatMaxLength + 1];
+    while (0 < len) {
+        size_t piece_len = len;
+        if (piece_len > kLogcatMaxLength) {
+            piece_len = kLogcatMaxLength;
+            const char* newline = (const char*)memrchr(_log, '\n', kLogcatMaxLength);
+            if (NULL != newline && (size_t)(newline - _log) >= kLogcatMaxLength / 2) piece_len = newline - _log + 1;
+        }
+        memcpy(piece, _log, piece_len);
+        piece[piece_len] = '\0';
+        __android_log_write(_prio, _tag, piece);
+        _log += piece_len;
+        len -= piece_len;
+    }
+}
+
 //这里不能加日志，会导致循环调用
 void ConsoleLog(const XLoggerInfo* _info, const char* _log) {
 	char result_log[2048] = {0};
+    const char* log = _log?_log:"NULL==log!!!";
+    int prio = _info ? _info->level+2 : ANDROID_LOG_WARN;
+    const char* tag = _info && _info->tag ? _info->tag : "";
     if (_info) {
         const char* filename = ExtractFileName(_info->filename);
         char strFuncName [128] = {0};
         ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
 
-        snprintf(result_log,  sizeof(result_log), "[%s, %s, %d]:%s", filename, strFuncName, _info->line, _log?_log:"NULL==log!!!");
-        __android_log_write(_info->level+2, _info->tag?_info->tag:"", (const char*)result_log);
+        int len = snprintf(result_log,  sizeof(result_log), "[%s, %s, %d]:%s", filename, strFuncName, _info->line, log);
+        if (0 <= len && (size_t)len >= sizeof(result_log)) {
+            // 放不下时拼到堆上, 不截断
+            std::string large((size_t)len + 1, '\0');
+            snprintf(&large[0], large.size(), "[%s, %s, %d]:%s", filename, strFuncName, _info->line, log);
+            __WriteLogcat(prio, tag, large.c_str());
+            return;
+        }
+        __WriteLogcat(prio, tag, result_log);
     } else {
-    	snprintf(result_log,  sizeof(result_log) , "%s", _log?_log:"NULL==log!!!");
-        __android_log_write(ANDROID_LOG_WARN, "", (const char*)result_log);
+        __WriteLogcat(prio, tag, log);
     }
     
 }
-
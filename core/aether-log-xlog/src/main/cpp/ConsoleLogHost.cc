@@ -0,0 +1,58 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in 
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * ConsoleLogHost.cc
+ *
+ * 主机构建(开发机/CI)用的控制台输出, 代替 ConsoleLog.cc 里的 logcat, 写到 stderr
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "aether/common/xlogger/xloggerbase.h"
+#include "aether/common/xlogger/loginfo_extract.h"
+
+
+//这里不能加日志，会导致循环调用
+void ConsoleLog(const XLoggerInfo* _info, const char* _log) {
+    static const char kLevelChars[] = "VDIWEF";
+	char result_log[2048] = {0};
+    const char* log = _log?_log:"NULL==log!!!";
+    int len = 0;
+    if (_info) {
+        const char* filename = ExtractFileName(_info->filename);
+        char strFuncName [128] = {0};
+        ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
+
+        char level = (_info->level >= kLevelVerbose && _info->level <= kLevelFatal) ? kLevelChars[_info->level] : 'N';
+        len = snprintf(result_log,  sizeof(result_log), "%c/%s [%s, %s, %d]:", level, _info->tag?_info->tag:"",
+                       filename, strFuncName, _info->line);
+    } else {
+    	len = snprintf(result_log,  sizeof(result_log) , "W/ ");
+    }
+    size_t log_len = strlen(log);
+    if (0 < len && (size_t)len + log_len + 2 <= sizeof(result_log)) {
+        memcpy(result_log + len, log, log_len);
+        memcpy(result_log + len + log_len, "\n", 2);
+        // 一次 fputs, 多线程输出不会交错在一行里
+        fputs(result_log, stderr);
+        return;
+    }
+
+    // 放不下时分几次写, 锁住 stderr 保证不和别的线程交错
+    flockfile(stderr);
+    fputs(result_log, stderr);
+    fwrite(log, 1, log_len, stderr);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
@@ -109,6 +109,43 @@ JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_flushModule
     aether::xlog::FlushModule(nameprefix_jstr.GetChar(), (bool)_is_sync);
 }
 
+DEFINE_FIND_STATIC_METHOD(KXlog_exportBundle, KXlog, "exportBundle",
+                          "(Ljava/lang/String;JJI)Z")
+JNIEXPORT jboolean JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_exportBundle
+        (JNIEnv *env, jclass, jstring _nameprefix, jlong _start_time, jlong _end_time, jint _fd) {
+    ScopedJstring nameprefix_jstr(env, _nameprefix);
+    return (jboolean)aether::xlog::ExportBundle(nameprefix_jstr.GetChar(), (int64_t)_start_time, (int64_t)_end_time, (int)_fd);
+}
+
+DEFINE_FIND_STATIC_METHOD(KXlog_getMetrics, KXlog, "getMetrics",
+                          "(Ljava/lang/String;)Ljava/lang/String;")
+JNIEXPORT jstring JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_getMetrics
+        (JNIEnv *env, jclass, jstring _nameprefix) {
+    ScopedJstring nameprefix_jstr(env, _nameprefix);
+    LogMetricsSnapshot snapshot;
+    if (!aether::xlog::GetMetrics(nameprefix_jstr.GetChar(), snapshot)) {
+        return nullptr;
+    }
+    return env->NewStringUTF(snapshot.ToJson().c_str());
+}
+
+DEFINE_FIND_STATIC_METHOD(KXlog_attach, KXlog, "attach", "(Ljava/lang/String;Ljava/lang/String;[B)J")
+JNIEXPORT jlong JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_attach
+        (JNIEnv *env, jclass, jstring _nameprefix, jstring _name, jbyteArray _data) {
+    if (nullptr == _data) return 0;
+    jsize len = env->GetArrayLength(_data);
+    if (0 == len) return 0;
+
+    ScopedJstring nameprefix_jstr(env, _nameprefix);
+    ScopedJstring name_jstr(env, _name);
+    // 附件在 native 层再复制一份排队, 这里只借用数组
+    jbyte* data = env->GetByteArrayElements(_data, nullptr);
+    if (nullptr == data) return 0;
+    uint32_t id = aether::xlog::Attach(nameprefix_jstr.GetChar(), name_jstr.GetChar(), data, (size_t)len);
+    env->ReleaseByteArrayElements(_data, data, JNI_ABORT);
+    return (jlong)id;
+}
+
 DEFINE_FIND_STATIC_METHOD(KXlog_getLogFiles, KXlog, "getLogFiles",
                           "(Ljava/lang/String;)[Ljava/lang/String;")
 JNIEXPORT jobjectArray JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_getLogFiles
@@ -439,6 +476,36 @@ JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setConsoleLogOpe
     appender_set_console_log((bool) _is_open);
 }
 
+DEFINE_FIND_STATIC_METHOD(KXlog_setTraceMode, KXlog, "setTraceMode", "(Z)V")
+JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setTraceMode
+        (JNIEnv *env, jclass, jboolean _is_open) {
+    appender_set_trace_mode((bool) _is_open);
+}
+
+DEFINE_FIND_STATIC_METHOD(KXlog_setCompressThreads, KXlog, "setCompressThreads", "(I)V")
+JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setCompressThreads
+        (JNIEnv *env, jclass, jint _threads) {
+    appender_set_compress_threads(0 < _threads ? (unsigned int) _threads : 0);
+}
+
+DEFINE_FIND_STATIC_METHOD(KXlog_setProcessName, KXlog, "setProcessName", "(Ljava/lang/String;)V")
+JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setProcessName
+        (JNIEnv *env, jclass, jstring _process_name) {
+    if (NULL == _process_name) {
+        appender_set_process_name(NULL);
+        return;
+    }
+
+    ScopedJstring process_name_jstr(env, _process_name);
+    appender_set_process_name(process_name_jstr.GetChar());
+}
+
+DEFINE_FIND_STATIC_METHOD(KXlog_setBlockHeaderV2, KXlog, "setBlockHeaderV2", "(Z)V")
+JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setBlockHeaderV2
+        (JNIEnv *env, jclass, jboolean _v2) {
+    appender_set_block_header_v2((bool) _v2);
+}
+
 DEFINE_FIND_STATIC_METHOD(KXlog_setMaxFileSize, KXlog, "setMaxFileSize", "(J)V")
 JNIEXPORT void JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_setMaxFileSize
         (JNIEnv *env, jclass, jlong _maxSize) {
@@ -500,6 +567,9 @@ JNIEXPORT jlong JNICALL Java_com_kernelflux_aether_log_xlog_Xlog_newXlogInstance
     config.is_compress_ = (bool)_is_compress;
     config.cachedir_ = cache_dir;
     config.cache_days_ = _cache_days;
+    config.process_name_ = appender_get_process_name();
+    config.compress_threads_ = appender_get_compress_threads();
+    config.block_header_v2_ = appender_get_block_header_v2();
     
     aether::comm::XloggerCategory* category = aether::xlog::NewXloggerInstance(config, (TLogLevel)_level);
     if (nullptr == category) {
@@ -11,8 +11,8 @@
 // limitations under the License.
 
 #include "xlogger/xloggerbase.h"
+#include "xlogger/xlogger_threadcontext.h"
 #include <unistd.h>
-#include <sys/syscall.h>
 #include <pthread.h>
 
 #ifdef __cplusplus
@@ -25,11 +25,7 @@ intmax_t xlogger_pid() {
 }
 
 intmax_t xlogger_tid() {
-#ifdef __NR_gettid
-    return (intmax_t)syscall(__NR_gettid);
-#else
-    return (intmax_t)syscall(SYS_gettid);
-#endif
+    return aether::comm::XloggerThreadContext::Current()->Tid();
 }
 
 intmax_t xlogger_maintid() {
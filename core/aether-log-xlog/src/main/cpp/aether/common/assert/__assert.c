@@ -68,7 +68,9 @@ EXPORT_FUNC void __ASSERT(const char * _pfile, int _line, const char * _pfunc, c
 
 void __ASSERTV2(const char * _pfile, int _line, const char * _pfunc, const char * _pexpression, const char * _format, va_list _list) {
     char assertlog[4096] = {'\0'};
-    XLoggerInfo info= {kLevelFatal};
+    XLoggerInfo info;
+    memset(&info, 0, sizeof(info));
+    info.level = kLevelFatal;
     int offset = 0;
 
     offset += snprintf(assertlog, sizeof(assertlog), "[ASSERT(%s)]", _pexpression);
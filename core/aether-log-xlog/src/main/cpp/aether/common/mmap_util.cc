@@ -12,11 +12,43 @@
 
 #include "mmap_util.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
+#ifndef _WIN32
+// 文件系统不支持 fallocate 时(EOPNOTSUPP/EINVAL)退回逐块写 0, 不再按整个大小分配堆内存
+static bool __AllocateBackingStore(const char* _filepath, unsigned int _size) {
+    int fd = open(_filepath, O_RDWR);
+    if (-1 == fd) return false;
+
+    int ret = posix_fallocate(fd, 0, _size);
+    if (0 != ret && EOPNOTSUPP != ret && EINVAL != ret) {
+        close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    if (0 != ret) {
+        static const char kZero[4096] = {0};
+        for (unsigned int offset = 0; ok && offset < _size;) {
+            size_t len = std::min((size_t)(_size - offset), sizeof(kZero));
+            ssize_t written = pwrite(fd, kZero, len, offset);
+            if (0 > written && EINTR == errno) continue;
+            ok = 0 < written;
+            if (ok) offset += (unsigned int)written;
+        }
+    }
+    close(fd);
+    return ok;
+}
+#endif
+
 bool IsMmapFileOpenSucc(const boost::iostreams::mapped_file& _mmmap_file) {
     return !_mmmap_file.operator !() && _mmmap_file.is_open();
 }
@@ -47,30 +79,21 @@ bool OpenMmapFile(const char* _filepath, unsigned int _size, boost::iostreams::m
     _mmmap_file.open(param);
 
     bool is_open = IsMmapFileOpenSucc(_mmmap_file);
+    // 缓冲区大小改过后旧文件长度对不上, 按新长度访问会越界; 旧文件由调用方先取出内容再删除
+    if (file_exist && is_open && _mmmap_file.size() != _size) {
+        _mmmap_file.close();
+        return false;
+    }
 #ifndef _WIN32
     if (!file_exist && is_open) {
 
         //Extending a file with ftruncate, thus creating a big hole, and then filling the hole by mod-ifying a shared mmap() can lead to SIGBUS when no space left
-        //the boost library uses ftruncate, so we pre-allocate the file's backing store by writing zero.
-        FILE* file = fopen(_filepath, "rb+");
-        if (NULL == file) {
-            _mmmap_file.close();
-            boost::filesystem::remove(_filepath);
-            return false;
-        }
-
-        char* zero_data = new char[_size];
-        memset(zero_data, 0, _size);
-
-        if (_size != fwrite(zero_data, sizeof(char), _size, file)) {
+        //the boost library uses ftruncate, so we pre-allocate the file's backing store.
+        if (!__AllocateBackingStore(_filepath, _size)) {
             _mmmap_file.close();
-            fclose(file);
             boost::filesystem::remove(_filepath);
-            delete[] zero_data;
             return false;
         }
-        fclose(file);
-        delete[] zero_data;
     }
 #endif
     return is_open;
@@ -0,0 +1,366 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * num_format.cc
+ *
+ * 浮点部分是 Florian Loitsch 的 Grisu2 ("Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", PLDI 2010). 输出一定能读回原值, 极少数值不是最短.
+ */
+
+#include "num_format.h"
+
+#include <cstring>
+
+namespace numfmt {
+
+static const char kDigits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+char* WriteUInt64(char* _out, uint64_t _value) {
+    char buffer[20];
+    char* pos = buffer + sizeof(buffer);
+    while (_value >= 100) {
+        unsigned index = (unsigned)(_value % 100) * 2;
+        _value /= 100;
+        pos -= 2;
+        memcpy(pos, kDigits2 + index, 2);
+    }
+    if (_value >= 10) {
+        pos -= 2;
+        memcpy(pos, kDigits2 + _value * 2, 2);
+    } else {
+        *--pos = (char)('0' + _value);
+    }
+
+    size_t len = buffer + sizeof(buffer) - pos;
+    memcpy(_out, pos, len);
+    return _out + len;
+}
+
+char* WriteInt64(char* _out, int64_t _value) {
+    uint64_t value = (uint64_t)_value;
+    if (_value < 0) {
+        *_out++ = '-';
+        value = 0 - value;
+    }
+    return WriteUInt64(_out, value);
+}
+
+size_t UInt64ToA(uint64_t _value, char* _out) {
+    char* end = WriteUInt64(_out, _value);
+    *end = '\0';
+    return end - _out;
+}
+
+size_t Int64ToA(int64_t _value, char* _out) {
+    char* end = WriteInt64(_out, _value);
+    *end = '\0';
+    return end - _out;
+}
+
+char* WriteDigits2(char* _out, unsigned _value) {
+    memcpy(_out, kDigits2 + (_value % 100) * 2, 2);
+    return _out + 2;
+}
+
+char* WriteDigits(char* _out, unsigned _value, int _width) {
+    char* pos = _out + _width;
+    while (pos - _out >= 2) {
+        pos -= 2;
+        memcpy(pos, kDigits2 + (_value % 100) * 2, 2);
+        _value /= 100;
+    }
+    if (pos > _out) *--pos = (char)('0' + _value % 10);
+    return _out + _width;
+}
+
+char* WriteDateTime(char* _out, const struct tm& _tm, int _millis) {
+    char* pos = WriteDigits(_out, (unsigned)(1900 + _tm.tm_year), 4);
+    *pos++ = '-';
+    pos = WriteDigits2(pos, (unsigned)(1 + _tm.tm_mon));
+    *pos++ = '-';
+    pos = WriteDigits2(pos, (unsigned)_tm.tm_mday);
+    *pos++ = ' ';
+    pos = WriteDigits2(pos, (unsigned)_tm.tm_hour);
+    *pos++ = ':';
+    pos = WriteDigits2(pos, (unsigned)_tm.tm_min);
+    *pos++ = ':';
+    pos = WriteDigits2(pos, (unsigned)_tm.tm_sec);
+    *pos++ = '.';
+    return WriteDigits(pos, (unsigned)_millis, 3);
+}
+
+namespace {
+
+// f * 2^e
+struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp() : f(0), e(0) {}
+    DiyFp(uint64_t _f, int _e) : f(_f), e(_e) {}
+};
+
+// 10^(-348 + 8 * i), 有效数字规格化到最高位为 1
+const uint64_t kCachedPowersF[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+const int16_t kCachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+}  // namespace
+
+static DiyFp __Normalize(DiyFp _value) {
+#if defined(__GNUC__) || defined(__clang__)
+    int shift = __builtin_clzll(_value.f);
+    return DiyFp(_value.f << shift, _value.e - shift);
+#else
+    while (0 == (_value.f & ((uint64_t)1 << 63))) {
+        _value.f <<= 1;
+        --_value.e;
+    }
+    return _value;
+#endif
+}
+
+// 乘积取高 64 位, 四舍五入
+static DiyFp __Multiply(const DiyFp& _x, const DiyFp& _y) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 product = (unsigned __int128)_x.f * _y.f;
+    uint64_t high = (uint64_t)(product >> 64);
+    if ((uint64_t)product & ((uint64_t)1 << 63)) ++high;
+    return DiyFp(high, _x.e + _y.e + 64);
+#else
+    const uint64_t kMask32 = 0xffffffffULL;
+    uint64_t a = _x.f >> 32, b = _x.f & kMask32;
+    uint64_t c = _y.f >> 32, d = _y.f & kMask32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & kMask32) + (bc & kMask32);
+    tmp += (uint64_t)1 << 31;
+    return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), _x.e + _y.e + 64);
+#endif
+}
+
+// 选 c = 10^-k, 使乘积的二进制指数落在 [-60, -32], 整数部分放得进 32 位
+static DiyFp __CachedPower(int _e, int& _k) {
+    double dk = (-61 - _e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) ++k;
+    unsigned index = (unsigned)((k >> 3) + 1);
+    _k = -(-348 + (int)(index << 3));
+    return DiyFp(kCachedPowersF[index], kCachedPowersE[index]);
+}
+
+static void __Round(char* _digits, int _len, uint64_t _delta, uint64_t _rest, uint64_t _ten_kappa, uint64_t _wp_w) {
+    while (_rest < _wp_w && _delta - _rest >= _ten_kappa
+           && (_rest + _ten_kappa < _wp_w || _wp_w - _rest > _rest + _ten_kappa - _wp_w)) {
+        --_digits[_len - 1];
+        _rest += _ten_kappa;
+    }
+}
+
+static const uint32_t kPow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+static void __DigitGen(const DiyFp& _w, const DiyFp& _mp, uint64_t _delta, char* _digits, int& _len, int& _k) {
+    const DiyFp one((uint64_t)1 << -_mp.e, _mp.e);
+    const uint64_t wp_w = _mp.f - _w.f;
+    uint32_t p1 = (uint32_t)(_mp.f >> -one.e);
+    uint64_t p2 = _mp.f & (one.f - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && p1 >= kPow10[kappa]) ++kappa;
+
+    _len = 0;
+    while (kappa > 0) {
+        uint32_t digit = p1 / kPow10[kappa - 1];
+        p1 %= kPow10[kappa - 1];
+        if (0 != digit || 0 != _len) _digits[_len++] = (char)('0' + digit);
+        --kappa;
+        uint64_t rest = ((uint64_t)p1 << -one.e) + p2;
+        if (rest <= _delta) {
+            _k += kappa;
+            __Round(_digits, _len, _delta, rest, (uint64_t)kPow10[kappa] << -one.e, wp_w);
+            return;
+        }
+    }
+
+    for (;;) {
+        p2 *= 10;
+        _delta *= 10;
+        char digit = (char)(p2 >> -one.e);
+        if (0 != digit || 0 != _len) _digits[_len++] = (char)('0' + digit);
+        p2 &= one.f - 1;
+        --kappa;
+        if (p2 < _delta) {
+            _k += kappa;
+            int index = -kappa;
+            __Round(_digits, _len, _delta, p2, one.f, wp_w * (index < 10 ? kPow10[index] : 0));
+            return;
+        }
+    }
+}
+
+// 值为 _f * 2^_e, 和相邻可表示值的中点为边界; 有效数字恰为 2 的幂时下边界的间距减半
+static void __Grisu2(uint64_t _f, int _e, bool _lower_closer, char* _digits, int& _len, int& _k) {
+    DiyFp plus = __Normalize(DiyFp((_f << 1) + 1, _e - 1));
+    DiyFp minus = _lower_closer ? DiyFp((_f << 2) - 1, _e - 2) : DiyFp((_f << 1) - 1, _e - 1);
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    DiyFp c_mk = __CachedPower(plus.e, _k);
+    DiyFp w = __Multiply(__Normalize(DiyFp(_f, _e)), c_mk);
+    DiyFp wp = __Multiply(plus, c_mk);
+    DiyFp wm = __Multiply(minus, c_mk);
+    ++wm.f;
+    --wp.f;
+    __DigitGen(w, wp, wp.f - wm.f, _digits, _len, _k);
+}
+
+// 值为 0.d1d2...dn * 10^_point: _point 在 (-6, 21] 内用小数形式, 否则用科学计数法
+static size_t __Prettify(char* _out, const char* _digits, int _len, int _point) {
+    char* pos = _out;
+    if (_len <= _point && _point <= 21) {
+        memcpy(pos, _digits, _len);
+        pos += _len;
+        memset(pos, '0', _point - _len);
+        pos += _point - _len;
+    } else if (0 < _point && _point <= 21) {
+        memcpy(pos, _digits, _point);
+        pos += _point;
+        *pos++ = '.';
+        memcpy(pos, _digits + _point, _len - _point);
+        pos += _len - _point;
+    } else if (-6 < _point && _point <= 0) {
+        *pos++ = '0';
+        *pos++ = '.';
+        memset(pos, '0', -_point);
+        pos += -_point;
+        memcpy(pos, _digits, _len);
+        pos += _len;
+    } else {
+        *pos++ = _digits[0];
+        if (1 < _len) {
+            *pos++ = '.';
+            memcpy(pos, _digits + 1, _len - 1);
+            pos += _len - 1;
+        }
+        int exponent = _point - 1;
+        *pos++ = 'e';
+        *pos++ = exponent < 0 ? '-' : '+';
+        if (exponent < 0) exponent = -exponent;
+        if (exponent >= 100) *pos++ = (char)('0' + exponent / 100);
+        if (exponent >= 10) {
+            pos = WriteDigits2(pos, (unsigned)(exponent % 100));
+        } else {
+            *pos++ = (char)('0' + exponent);
+        }
+    }
+    *pos = '\0';
+    return pos - _out;
+}
+
+// _f * 2^_e 的符号位之后的部分, 0/inf/nan 不走 Grisu2
+static size_t __FloatingToA(bool _negative, uint64_t _f, int _e, bool _lower_closer, char* _out) {
+    char* pos = _out;
+    if (_negative) *pos++ = '-';
+
+    char digits[24];
+    int len = 0;
+    int k = 0;
+    __Grisu2(_f, _e, _lower_closer, digits, len, k);
+    return pos - _out + __Prettify(pos, digits, len, len + k);
+}
+
+static size_t __SpecialToA(bool _negative, const char* _text, char* _out) {
+    char* pos = _out;
+    if (_negative) *pos++ = '-';
+    size_t len = strlen(_text);
+    memcpy(pos, _text, len + 1);
+    return pos + len - _out;
+}
+
+size_t DoubleToA(double _value, char* _out) {
+    uint64_t bits = 0;
+    memcpy(&bits, &_value, sizeof(bits));
+    bool negative = 0 != (bits >> 63);
+    int biased_e = (int)((bits >> 52) & 0x7ff);
+    uint64_t significand = bits & 0x000fffffffffffffULL;
+
+    if (0x7ff == biased_e) return 0 != significand ? __SpecialToA(false, "nan", _out) : __SpecialToA(negative, "inf", _out);
+    if (0 == biased_e && 0 == significand) return __SpecialToA(negative, "0", _out);
+
+    if (0 == biased_e) return __FloatingToA(negative, significand, 1 - 1075, false, _out);
+    return __FloatingToA(negative, significand | ((uint64_t)1 << 52), biased_e - 1075, 0 == significand && 1 < biased_e, _out);
+}
+
+size_t FloatToA(float _value, char* _out) {
+    uint32_t bits = 0;
+    memcpy(&bits, &_value, sizeof(bits));
+    bool negative = 0 != (bits >> 31);
+    int biased_e = (int)((bits >> 23) & 0xff);
+    uint32_t significand = bits & 0x007fffff;
+
+    if (0xff == biased_e) return 0 != significand ? __SpecialToA(false, "nan", _out) : __SpecialToA(negative, "inf", _out);
+    if (0 == biased_e && 0 == significand) return __SpecialToA(negative, "0", _out);
+
+    if (0 == biased_e) return __FloatingToA(negative, significand, 1 - 150, false, _out);
+    return __FloatingToA(negative, significand | ((uint64_t)1 << 23), biased_e - 150, 0 == significand && 1 < biased_e, _out);
+}
+
+}  // namespace numfmt
@@ -0,0 +1,51 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * num_format.h
+ *
+ * 日志里数字的格式化, 替代热路径上的 snprintf:
+ *   整数: 查两位数字表, 每次除 100
+ *   浮点: Grisu2, 输出能原样读回的最短(绝大多数情况下)十进制表示, 如 0.1 -> "0.1", 1e21 -> "1e+21"
+ *   日期时间: 定宽补零的字段
+ */
+
+#ifndef COMM_NUM_FORMAT_H_
+#define COMM_NUM_FORMAT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+namespace numfmt {
+
+const size_t kIntBufferSize = 21;       // "-9223372036854775808" + '\0'
+const size_t kDoubleBufferSize = 26;    // "-2.2250738585072014e-308" + '\0'
+const size_t kDateTimeLength = 23;      // "YYYY-MM-DD HH:mm:ss.SSS"
+
+// 以下写 '\0', 返回不含 '\0' 的长度
+size_t UInt64ToA(uint64_t _value, char* _out);
+size_t Int64ToA(int64_t _value, char* _out);
+size_t DoubleToA(double _value, char* _out);
+size_t FloatToA(float _value, char* _out);  // 按 float 的精度取最短, 1.1f -> "1.1"
+
+// 以下不写 '\0', 返回写完后的位置
+char* WriteUInt64(char* _out, uint64_t _value);
+char* WriteInt64(char* _out, int64_t _value);
+// 定宽补零, 超出宽度时只保留低位
+char* WriteDigits2(char* _out, unsigned _value);
+char* WriteDigits(char* _out, unsigned _value, int _width);
+char* WriteDateTime(char* _out, const struct tm& _tm, int _millis);
+
+}  // namespace numfmt
+
+#endif  // COMM_NUM_FORMAT_H_
@@ -35,6 +35,7 @@
 #include <string>
 
 #include "strutil.h"
+#include "num_format.h"
 
 template<typename T>
 char* string_cast_itoa(const T& value, char* result, uint8_t base = 10, bool upper_case=true) {
@@ -87,16 +88,17 @@ class string_cast {
 public:
     string_cast(char _value):value_(NULL) {  value_cache_[0] = _value; value_cache_[1] = '\0'; value_ = value_cache_;}
     
-    string_cast(int _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
-    string_cast(long _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
-    string_cast(long long _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
+    string_cast(int _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
+    string_cast(long _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
+    string_cast(long long _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
     
-    string_cast(unsigned int _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
-    string_cast(unsigned long _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
-    string_cast(unsigned long long _value, uint8_t base=10):value_(NULL) { string_cast_itoa(_value, value_cache_, base); value_ = value_cache_;}
+    string_cast(unsigned int _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
+    string_cast(unsigned long _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
+    string_cast(unsigned long long _value, uint8_t base=10):value_(NULL) { Itoa(_value, base);}
 
-    string_cast(float _value):value_(NULL) { snprintf(value_cache_, sizeof(value_cache_), "%E", _value); value_ = value_cache_; }
-    string_cast(double _value):value_(NULL) { snprintf(value_cache_, sizeof(value_cache_), "%E", _value); value_ = value_cache_; }
+    // 最短的能读回原值的十进制表示, 如 0.1 -> "0.1"
+    string_cast(float _value):value_(NULL) { numfmt::FloatToA(_value, value_cache_); value_ = value_cache_; }
+    string_cast(double _value):value_(NULL) { numfmt::DoubleToA(_value, value_cache_); value_ = value_cache_; }
     string_cast(long double _value):value_(NULL) { snprintf(value_cache_, sizeof(value_cache_), "%LE", _value); value_ = value_cache_;}
     
     string_cast(bool _value):value_(NULL) { if (_value) value_ = "true"; else value_ = "false"; value_cache_[0] = '\0';}
@@ -111,6 +113,18 @@ public:
 private:
     string_cast(const string_cast&);
     string_cast& operator=(const string_cast&);
+
+    template<typename T>
+    void Itoa(const T& _value, uint8_t _base) {
+        if (10 != _base) {
+            string_cast_itoa(_value, value_cache_, _base);
+        } else if (std::numeric_limits<T>::is_signed) {
+            numfmt::Int64ToA((int64_t)_value, value_cache_);
+        } else {
+            numfmt::UInt64ToA((uint64_t)_value, value_cache_);
+        }
+        value_ = value_cache_;
+    }
     
 private:
     const char* value_;
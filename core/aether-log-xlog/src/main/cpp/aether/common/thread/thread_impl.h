@@ -130,7 +130,7 @@ class Thread {
 
         int res = pthread_attr_init(&attr_);
         ASSERT2(0 == res, "res=%d", res);
-        if (_thread_name) strncpy(runable_ref_->thread_name, _thread_name, sizeof(runable_ref_->thread_name));
+        if (_thread_name) strncpy(runable_ref_->thread_name, _thread_name, sizeof(runable_ref_->thread_name) - 1);
     }
 
     Thread(const char* _thread_name = NULL, bool _outside_join = false)
@@ -141,7 +141,7 @@ class Thread {
 
         int res = pthread_attr_init(&attr_);
         ASSERT2(0 == res, "res=%d", res);
-        if (_thread_name) strncpy(runable_ref_->thread_name, _thread_name, sizeof(runable_ref_->thread_name));
+        if (_thread_name) strncpy(runable_ref_->thread_name, _thread_name, sizeof(runable_ref_->thread_name) - 1);
     }
 
     virtual ~Thread() {
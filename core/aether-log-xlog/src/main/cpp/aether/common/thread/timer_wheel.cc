@@ -0,0 +1,277 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * timer_wheel.cc
+ */
+
+#include "thread/timer_wheel.h"
+
+#include "assert/__assert.h"
+#include "time_utils.h"
+
+static const long kMaxWaitMs = 60 * 60 * 1000;
+
+TimerWheel* TimerWheel::Singleton() {
+    static TimerWheel* s_instance = new TimerWheel();
+    return s_instance;
+}
+
+TimerWheel::TimerWheel(unsigned int _tick_ms, const char* _thread_name)
+: tick_ms_(0 == _tick_ms ? 1 : _tick_ms)
+, base_time_(::gettickcount())
+, current_tick_(0)
+, next_id_(kInvalidTimerId)
+, stop_(false)
+, running_id_(kInvalidTimerId)
+, thread_(std::bind(&TimerWheel::__Run, this), _thread_name)
+, blocking_stop_(false)
+, blocking_thread_(std::bind(&TimerWheel::__RunBlocking, this), "timer_blocking") {
+}
+
+TimerWheel::~TimerWheel() {
+    ScopedLock lock(mutex_);
+    stop_ = true;
+    cond_.notifyAll(lock, true);
+    lock.unlock();
+
+    thread_.join();
+
+    // 还没执行的阻塞任务丢弃
+    ScopedLock blocking_lock(blocking_mutex_);
+    blocking_stop_ = true;
+    blocking_cond_.notifyAll(blocking_lock, true);
+    blocking_lock.unlock();
+
+    blocking_thread_.join();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(int64_t _after_ms, const std::function<void ()>& _task) {
+    ASSERT(_task);
+    if (!_task) return kInvalidTimerId;
+
+    ScopedLock lock(mutex_);
+    if (stop_) return kInvalidTimerId;
+
+    Slot tmp;
+    TimerNode node;
+    node.id = ++next_id_;
+    node.expire = __ExpireTick(_after_ms);
+    node.task = _task;
+    tmp.push_back(node);
+    __Place(tmp, tmp.begin());
+
+    thread_.start();
+    cond_.notifyAll(lock, true);
+    return node.id;
+}
+
+TimerWheel::TimerId TimerWheel::ScheduleBlocking(int64_t _after_ms, const std::function<void ()>& _task) {
+    ASSERT(_task);
+    if (!_task) return kInvalidTimerId;
+    return Schedule(_after_ms, std::bind(&TimerWheel::__PostBlocking, this, _task));
+}
+
+bool TimerWheel::Cancel(TimerId _id) {
+    ScopedLock lock(mutex_);
+    std::map<TimerId, Location>::iterator iter = index_.find(_id);
+    if (index_.end() == iter) {
+        // 已经取出来等着执行的直接去掉; 正在执行的等它结束, 调用方随后可以释放任务引用的对象
+        if (0 < expired_.erase(_id)) return true;
+        if (kInvalidTimerId != _id && thread_.tid() != ThreadUtil::currentthreadid()) {
+            while (running_id_ == _id) done_cond_.wait(lock);
+        }
+        return false;
+    }
+
+    wheel_[iter->second.level][iter->second.slot].erase(iter->second.it);
+    index_.erase(iter);
+    return true;
+}
+
+bool TimerWheel::Reschedule(TimerId _id, int64_t _after_ms) {
+    ScopedLock lock(mutex_);
+    std::map<TimerId, Location>::iterator iter = index_.find(_id);
+    if (index_.end() == iter) return false;
+
+    Slot& from = wheel_[iter->second.level][iter->second.slot];
+    Slot::iterator it = iter->second.it;
+    it->expire = __ExpireTick(_after_ms);
+    __Place(from, it);
+
+    cond_.notifyAll(lock, true);
+    return true;
+}
+
+size_t TimerWheel::Size() {
+    ScopedLock lock(mutex_);
+    return index_.size();
+}
+
+void TimerWheel::__Run() {
+    ScopedLock lock(mutex_);
+
+    while (!stop_) {
+        uint64_t now = __NowTick();
+        Slot expired;
+
+        while (current_tick_ <= now) {
+            // 中间没有事件的 tick 直接跳过, 设备休眠后醒来不需要逐个 tick 追赶
+            uint64_t next = __NextEventTick();
+            if (next > now) {
+                current_tick_ = now + 1;
+                break;
+            }
+            if (next > current_tick_) current_tick_ = next;
+
+            int idx = (int)(current_tick_ & kSlotMask);
+            if (0 == idx) {
+                for (int level = 1; level < kLevelCount; ++level) {
+                    if (!__Cascade(level)) break;
+                }
+            }
+            ++current_tick_;
+
+            Slot& slot = wheel_[0][idx];
+            for (Slot::iterator it = slot.begin(); it != slot.end(); ++it) {
+                index_.erase(it->id);
+                expired_.insert(it->id);
+            }
+            expired.splice(expired.end(), slot);
+        }
+
+        if (!expired.empty()) {
+            for (Slot::iterator it = expired.begin(); it != expired.end(); ++it) {
+                if (0 == expired_.erase(it->id)) continue;     // 执行前被取消了
+
+                running_id_ = it->id;
+                lock.unlock();
+                it->task();
+                lock.lock();
+                running_id_ = kInvalidTimerId;
+                done_cond_.notifyAll(lock);
+            }
+            expired.clear();
+            continue;
+        }
+
+        if (index_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        int64_t wait_ms = (int64_t)(base_time_ + __NextEventTick() * tick_ms_) - (int64_t)::gettickcount();
+        if (wait_ms <= 0) continue;
+        cond_.wait(lock, wait_ms > kMaxWaitMs ? kMaxWaitMs : (long)wait_ms);
+    }
+}
+
+void TimerWheel::__PostBlocking(const std::function<void ()>& _task) {
+    ScopedLock lock(blocking_mutex_);
+    if (blocking_stop_) return;
+
+    blocking_tasks_.push_back(_task);
+    blocking_thread_.start();
+    blocking_cond_.notifyAll(lock, true);
+}
+
+void TimerWheel::__RunBlocking() {
+    ScopedLock lock(blocking_mutex_);
+
+    while (!blocking_stop_) {
+        if (blocking_tasks_.empty()) {
+            blocking_cond_.wait(lock);
+            continue;
+        }
+
+        std::function<void ()> task;
+        task.swap(blocking_tasks_.front());
+        blocking_tasks_.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+uint64_t TimerWheel::__NowTick() const {
+    return (::gettickcount() - base_time_) / tick_ms_;
+}
+
+uint64_t TimerWheel::__ExpireTick(int64_t _after_ms) const {
+    if (_after_ms < 0) _after_ms = 0;
+    return __NowTick() + ((uint64_t)_after_ms + tick_ms_ - 1) / tick_ms_;
+}
+
+void TimerWheel::__Place(Slot& _from, Slot::iterator _it) {
+    // 超出最高层范围的任务先挂在最远的槽上, 进位时再重新分配
+    const uint64_t max_delta = (1ULL << (kSlotBits * kLevelCount)) - 1;
+    uint64_t expire = _it->expire < current_tick_ ? current_tick_ : _it->expire;
+    if (expire - current_tick_ > max_delta) expire = current_tick_ + max_delta;
+
+    uint64_t delta = expire - current_tick_;
+    int level = 0;
+    while (level < kLevelCount - 1 && delta >= (1ULL << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+
+    int slot = (int)((expire >> (kSlotBits * level)) & kSlotMask);
+    Slot& to = wheel_[level][slot];
+    to.splice(to.end(), _from, _it);
+
+    Location& location = index_[_it->id];
+    location.level = level;
+    location.slot = slot;
+    location.it = _it;
+}
+
+// 把高层当前槽的任务重新分配到低层, 该层槽下标为 0 时返回 true, 需要继续向上一层进位
+bool TimerWheel::__Cascade(int _level) {
+    int idx = (int)((current_tick_ >> (kSlotBits * _level)) & kSlotMask);
+
+    Slot tmp;
+    tmp.splice(tmp.end(), wheel_[_level][idx]);
+    while (!tmp.empty()) {
+        __Place(tmp, tmp.begin());
+    }
+
+    return 0 == idx;
+}
+
+// 最近一个需要处理的 tick: 第 0 层的到期槽或高层非空槽的进位点
+uint64_t TimerWheel::__NextEventTick() const {
+    uint64_t next = UINT64_MAX;
+
+    for (int k = 0; k < kSlotCount; ++k) {
+        uint64_t tick = current_tick_ + k;
+        if (!wheel_[0][tick & kSlotMask].empty()) {
+            next = tick;
+            break;
+        }
+    }
+
+    for (int level = 1; level < kLevelCount; ++level) {
+        int shift = kSlotBits * level;
+        uint64_t step = 1ULL << shift;
+        uint64_t boundary = (current_tick_ + step - 1) & ~(step - 1);
+
+        for (int k = 0; k < kSlotCount && boundary < next; ++k, boundary += step) {
+            if (!wheel_[level][(boundary >> shift) & kSlotMask].empty()) {
+                next = boundary;
+                break;
+            }
+        }
+    }
+
+    return next;
+}
@@ -0,0 +1,115 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ * timer_wheel.h
+ *
+ * 分层时间轮, 由一个线程驱动, 替代每个延时任务各起一个 Thread(...).start_after.
+ * 4 层 x 64 槽, 默认 tick 10ms, 覆盖约 46 小时, 更远的任务在最高层循环等待.
+ * 任务在驱动线程上串行执行, 回调里不要长时间阻塞; 会阻塞的任务(关闭文件、搬移目录)用 ScheduleBlocking.
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <map>
+#include <set>
+
+#include "thread/condition.h"
+#include "thread/lock.h"
+#include "thread/thread.h"
+
+class TimerWheel {
+  public:
+    typedef uint64_t TimerId;
+    static const TimerId kInvalidTimerId = 0;
+
+    // 进程级共享实例, 不会析构, 避免退出时与 BOOT_RUN_EXIT 的顺序问题
+    static TimerWheel* Singleton();
+
+    explicit TimerWheel(unsigned int _tick_ms = 10, const char* _thread_name = "timer_wheel");
+    ~TimerWheel();
+
+    TimerId Schedule(int64_t _after_ms, const std::function<void ()>& _task);
+    // 到期后交给后台线程执行, 不占用驱动线程; 这类任务之间串行. 交出去以后 Cancel 返回 false 且不等它结束
+    TimerId ScheduleBlocking(int64_t _after_ms, const std::function<void ()>& _task);
+    // 已执行或已取消返回 false. 任务正在执行时等它结束再返回(在驱动线程上调用时不等),
+    // 所以调用方不能持有任务里会拿的锁; 返回后任务一定不会再运行
+    bool Cancel(TimerId _id);
+    bool Reschedule(TimerId _id, int64_t _after_ms);
+    size_t Size();
+
+  private:
+    enum {
+        kSlotBits = 6,
+        kSlotCount = 1 << kSlotBits,
+        kSlotMask = kSlotCount - 1,
+        kLevelCount = 4,
+    };
+
+    struct TimerNode {
+        TimerId id;
+        uint64_t expire;    // tick
+        std::function<void ()> task;
+    };
+
+    typedef std::list<TimerNode> Slot;
+
+    struct Location {
+        int level;
+        int slot;
+        Slot::iterator it;
+    };
+
+  private:
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+    void __Run();
+    void __PostBlocking(const std::function<void ()>& _task);
+    void __RunBlocking();
+    uint64_t __NowTick() const;
+    uint64_t __ExpireTick(int64_t _after_ms) const;
+    void __Place(Slot& _from, Slot::iterator _it);
+    bool __Cascade(int _level);
+    uint64_t __NextEventTick() const;
+
+  private:
+    const unsigned int tick_ms_;
+    const uint64_t base_time_;
+    uint64_t current_tick_;     // 下一个待处理的 tick
+    TimerId next_id_;
+    bool stop_;
+
+    Slot wheel_[kLevelCount][kSlotCount];
+    std::map<TimerId, Location> index_;
+    std::set<TimerId> expired_;     // 已到期、还没轮到执行的任务
+    TimerId running_id_;            // 正在执行的任务
+
+    Mutex mutex_;
+    Condition cond_;
+    Condition done_cond_;
+    Thread thread_;
+
+    // ScheduleBlocking 的任务队列, 第一次用到时才起线程
+    std::list<std::function<void ()> > blocking_tasks_;
+    bool blocking_stop_;
+    Mutex blocking_mutex_;
+    Condition blocking_cond_;
+    Thread blocking_thread_;
+};
+
+#endif  // TIMER_WHEEL_H_
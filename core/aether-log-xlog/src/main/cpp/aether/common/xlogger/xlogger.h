@@ -19,13 +19,18 @@
 #ifndef XLOGGER_H_
 #define XLOGGER_H_
 
+#include <cstdarg>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <sys/cdefs.h>
 #include <sys/time.h>
 
 #include "aether/common/string_cast.h"
 #include "xloggerbase.h"
+#include "xlogger_threadcontext.h"
+#include "xlogger_trace.h"
 #include "preprocessor.h"
 
 #ifdef XLOGGER_DISABLE
@@ -38,6 +43,7 @@
 #endif
 
 #ifdef __cplusplus
+#include <algorithm>
 #include <string>
 
 template <bool x> struct XLOGGER_STATIC_ASSERTION_FAILURE;
@@ -54,13 +60,36 @@ const struct TypeSafeFormat {TypeSafeFormat(){}} __tsf__;
 const struct XLoggerTag {XLoggerTag(){}} __xlogger_tag__;
 const struct XLoggerInfoNull {XLoggerInfoNull(){}} __xlogger_info_null__;
 
+// 类型安全格式化的参数先统一转成 string_cast, 临时对象活到整条语句结束
+inline const string_cast& __xlogger_tsf_arg(const string_cast& _value) { return _value; }
+
+// printf 格式追加到 _message, 放不下栈上的缓冲区时直接格式化到 _message 末尾, 不截断
+inline void __xlogger_vappend(std::string& _message, const char* _format, va_list _list) {
+	char temp[4096] = {'\0'};
+	va_list list;
+	va_copy(list, _list);
+	int len = vsnprintf(temp, sizeof(temp), _format, _list);
+	if ((int)sizeof(temp) <= len) {
+		size_t pos = _message.size();
+		_message.resize(pos + len + 1);
+		vsnprintf(&_message[pos], len + 1, _format, list);
+		_message.resize(pos + len);
+	} else if (0 < len) {
+		_message.append(temp, len);
+	}
+	va_end(list);
+}
+
 
 class XMessage {
 public:
-	XMessage(): m_message() { m_message.reserve(512); }
-	XMessage(std::string& _holder):m_message(_holder){}
+	XMessage(): m_buffer(), m_message(m_buffer.String()) {}
+	XMessage(std::string& _holder): m_buffer(), m_message(m_buffer.String()) { m_message = _holder; }
+	XMessage(const XMessage& _other): m_buffer(), m_message(m_buffer.String()) { m_message = _other.m_message; }
 	~XMessage() {}
 
+	XMessage& operator=(const XMessage& _other) { m_message = _other.m_message; return *this; }
+
 public:
 	const std::string& Message() const { return m_message;}
 	std::string& Message() { return m_message;}
@@ -92,41 +121,30 @@ public:
 #endif
 	XMessage& VPrintf(const char* _format, va_list _list);
 
-#define XLOGGER_FORMAT_ARGS(n) PP_ENUM_TRAILING_PARAMS(n, const string_cast& a)
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(0));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(1));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(2));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(3));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(4));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(5));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(6));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(7));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(8));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(9));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(10));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(11));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(12));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(13));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(14));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(15));
-	XMessage&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(16));
-#undef XLOGGER_FORMAT_ARGS
+	template <typename... Args>
+	XMessage& operator()(const TypeSafeFormat&, const char* _format, const Args&... _args) {
+		if (_format != NULL) TypeSafeFormatArgs(_format, __xlogger_tsf_arg(_args)...);
+		return *this;
+	}
 
 private:
+	// 最多 16 个参数, 多了编译不过
+	template <typename... Casts>
+	void TypeSafeFormatArgs(const char* _format, const Casts&... _args) {
+		const string_cast* args[16] = { &_args... };
+		DoTypeSafeFormat(_format, args);
+	}
 	void DoTypeSafeFormat(const char* _format, const string_cast** _args);
 
 private:
-//	  XMessage(const XMessage&);
-//	  XMessage& operator=(const XMessage&);
-
-private:
-	std::string m_message;
+	aether::comm::XloggerMessageBuffer m_buffer;
+	std::string& m_message;
 };
 
 class XLogger {
 public:
 	XLogger(TLogLevel _level, const char* _tag, const char* _file, const char* _func, int _line, bool (*_hook)(XLoggerInfo& _info, std::string& _log))
-	:m_info(), m_message(), m_isassert(false), m_exp(NULL),m_hook(_hook), m_isinfonull(false) {
+	:m_info(), m_buffer(), m_message(m_buffer.String()), m_isassert(false), m_exp(NULL),m_hook(_hook), m_isinfonull(false) {
 		m_info.level = _level;
 		m_info.tag = _tag;
 		m_info.filename = _file;
@@ -137,8 +155,6 @@ public:
 		m_info.pid = -1;
 		m_info.tid = -1;
 		m_info.maintid = -1;
-
-		m_message.reserve(512);
 	}
 	
 	~XLogger() {
@@ -207,27 +223,18 @@ public:
 #endif
 	XLogger& VPrintf(const char* _format, va_list _list);
 
-#define XLOGGER_FORMAT_ARGS(n) PP_ENUM_TRAILING_PARAMS(n, const string_cast& a)
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(0));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(1));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(2));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(3));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(4));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(5));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(6));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(7));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(8));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(9));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(10));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(11));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(12));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(13));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(14));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(15));
-	XLogger&  operator()(const TypeSafeFormat&, const char*_format XLOGGER_FORMAT_ARGS(16));
-#undef XLOGGER_FORMAT_ARGS
+	template <typename... Args>
+	XLogger& operator()(const TypeSafeFormat&, const char* _format, const Args&... _args) {
+		if (_format != NULL) TypeSafeFormatArgs(_format, __xlogger_tsf_arg(_args)...);
+		return *this;
+	}
 
 private:
+	template <typename... Casts>
+	void TypeSafeFormatArgs(const char* _format, const Casts&... _args) {
+		const string_cast* args[16] = { &_args... };
+		DoTypeSafeFormat(_format, args);
+	}
 	void DoTypeSafeFormat(const char* _format, const string_cast** _args);
 	
 private:
@@ -236,7 +243,8 @@ private:
 	
 private:
 	XLoggerInfo m_info;
-	std::string m_message;
+	aether::comm::XloggerMessageBuffer m_buffer;
+	std::string& m_message;
 	bool m_isassert;
 	const char* m_exp;
 	bool (*m_hook)(XLoggerInfo& _info, std::string& _log);
@@ -247,9 +255,16 @@ private:
 class XScopeTracer {
 public:
 	XScopeTracer(TLogLevel _level, const char* _tag, const char* _name, const char* _file, const char* _func, int _line, const char* _log)
-	:m_enable(xlogger_IsEnabledFor(_level)), m_info(), m_tv() {
+	:m_enable(xlogger_IsEnabledFor(_level)), m_trace(false), m_info(), m_tv() {
 		m_info.level = _level;
 
+		// trace 模式下只记两个二进制事件, 不格式化文本
+		if (m_enable && aether::comm::XloggerTrace::IsEnabled()) {
+			m_trace = true;
+			aether::comm::XloggerTrace::Begin(_name, _log);
+			return;
+		}
+
 		if (m_enable) {
 			m_info.tag = _tag;
 			m_info.filename = _file;
@@ -271,13 +286,33 @@ public:
 	}
 
 	~XScopeTracer() {
+		if (m_trace) {
+			aether::comm::XloggerTrace::End(m_exitmsg.c_str());
+			return;
+		}
+
 		if (m_enable) {
 			timeval tv;
 			gettimeofday(&tv, NULL);
 			m_info.timeval = tv;
 			long timeSpan = (tv.tv_sec - m_tv.tv_sec) * 1000 + (tv.tv_usec - m_tv.tv_usec) / 1000;
-			char strout[1024] = {'\0'};
-			snprintf(strout, sizeof(strout), "<- %s +%ld, %s", m_name, timeSpan, m_exitmsg.c_str());
+
+			// "<- 名字 +耗时, 退出信息", 超长的退出信息截掉
+			char strout[1024];
+			char* pos = strout;
+			memcpy(pos, "<- ", 3);
+			pos += 3;
+			size_t len = strlen(m_name);
+			memcpy(pos, m_name, len);
+			pos += len;
+			*pos++ = ' ';
+			*pos++ = '+';
+			pos = numfmt::WriteInt64(pos, timeSpan);
+			*pos++ = ',';
+			*pos++ = ' ';
+			len = std::min(m_exitmsg.size(), (size_t)(strout + sizeof(strout) - 1 - pos));
+			memcpy(pos, m_exitmsg.data(), len);
+			pos[len] = '\0';
 			xlogger_Write(&m_info, strout);
 		}
 	}
@@ -290,6 +325,7 @@ private:
 
 private:
 	bool m_enable;
+	bool m_trace;
 	XLoggerInfo m_info;
 	char m_name[128];
 	timeval m_tv;
@@ -322,9 +358,7 @@ inline XMessage& XMessage::VPrintf(const char* _format, va_list _list) {
 		return *this;
 	}
 
-	char temp[4096] = {'\0'};
-	vsnprintf(temp, 4096, _format, _list);
-	m_message += temp;
+	__xlogger_vappend(m_message, _format, _list);
 	return *this;
 }
 
@@ -341,41 +375,6 @@ inline XMessage& XMessage::operator()(const char* _format, ...) {
 	return *this;
 }
 
-#define XLOGGER_FORMAT_ARGS(n) PP_ENUM_TRAILING_PARAMS(n, const string_cast& a)
-#define XLOGGER_VARIANT_ARGS(n) PP_ENUM_PARAMS(n, &a)
-#define XLOGGER_VARIANT_ARGS_NULL(n) PP_ENUM(n, NULL)
-#define XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(n, m) \
-		inline XMessage& XMessage::operator()(const TypeSafeFormat&, const char* _format XLOGGER_FORMAT_ARGS(n)) { \
-		if (_format != NULL) { \
-			const string_cast* args[16] = { XLOGGER_VARIANT_ARGS(n) PP_COMMA_IF(PP_AND(n, m)) XLOGGER_VARIANT_ARGS_NULL(m) }; \
-			DoTypeSafeFormat(_format, args); \
-		} \
-		return *this;\
-	}
-
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(0, 16)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(1, 15)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(2, 14)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(3, 13)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(4, 12)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(5, 11)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(6, 10)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(7, 9)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(8, 8)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(9, 7)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(10, 6)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(11, 5)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(12, 4)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(13, 3)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(14, 2)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(15, 1)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(16, 0)
-
-#undef XLOGGER_FORMAT_ARGS
-#undef XLOGGER_VARIANT_ARGS
-#undef XLOGGER_VARIANT_ARGS_NULL
-#undef XLOGGER_TYPESAFE_FORMAT_IMPLEMENT
-
 inline void XMessage::DoTypeSafeFormat(const char* _format, const string_cast** _args) {
 
 	const char* current = _format;
@@ -384,8 +383,11 @@ inline void XMessage::DoTypeSafeFormat(const char* _format, const string_cast**
 	{
 	   if ('%' != *current)
 	   {
-		   m_message += *current;
-			++current;
+			// 两个 % 之间的原文一次追加
+			const char* next = strchr(current, '%');
+			if (NULL == next) next = current + strlen(current);
+			m_message.append(current, next - current);
+			current = next;
 			continue;
 	   }
 
@@ -452,9 +454,7 @@ inline XLogger& XLogger::VPrintf(const char* _format, va_list _list) {
 		return *this;
 	}
 
-	char temp[4096] = {'\0'};
-	vsnprintf(temp, 4096, _format, _list);
-	m_message += temp;
+	__xlogger_vappend(m_message, _format, _list);
 	return *this;
 }
 
@@ -474,42 +474,6 @@ inline XLogger& XLogger::operator()(const char* _format, ...) {
 	return *this;
 }
 
-#define XLOGGER_FORMAT_ARGS(n) PP_ENUM_TRAILING_PARAMS(n, const string_cast& a)
-#define XLOGGER_VARIANT_ARGS(n) PP_ENUM_PARAMS(n, &a)
-#define XLOGGER_VARIANT_ARGS_NULL(n) PP_ENUM(n, NULL)
-#define XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(n, m) \
-		inline XLogger& XLogger::operator()(const TypeSafeFormat&, const char* _format XLOGGER_FORMAT_ARGS(n)) { \
-		if (_format != NULL) { \
-			const string_cast* args[16] = { XLOGGER_VARIANT_ARGS(n) PP_COMMA_IF(PP_AND(n, m)) XLOGGER_VARIANT_ARGS_NULL(m) }; \
-			DoTypeSafeFormat(_format, args); \
-		} \
-		return *this;\
-	}
-
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(0, 16)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(1, 15)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(2, 14)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(3, 13)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(4, 12)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(5, 11)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(6, 10)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(7, 9)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(8, 8)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(9, 7)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(10, 6)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(11, 5)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(12, 4)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(13, 3)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(14, 2)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(15, 1)
-XLOGGER_TYPESAFE_FORMAT_IMPLEMENT(16, 0)
-
-
-#undef XLOGGER_FORMAT_ARGS
-#undef XLOGGER_VARIANT_ARGS
-#undef XLOGGER_VARIANT_ARGS_NULL
-#undef XLOGGER_TYPESAFE_FORMAT_IMPLEMENT
-
 inline void XLogger::DoTypeSafeFormat(const char* _format, const string_cast** _args) {
 
 	const char* current = _format;
@@ -518,8 +482,10 @@ inline void XLogger::DoTypeSafeFormat(const char* _format, const string_cast** _
 	{
 	   if ('%' != *current)
 	   {
-		   m_message += *current;
-			++current;
+			const char* next = strchr(current, '%');
+			if (NULL == next) next = current + strlen(current);
+			m_message.append(current, next - current);
+			current = next;
 			continue;
 	   }
 
@@ -708,6 +674,10 @@ __inline void  __xlogger_c_write(const XLoggerInfo* _info, const char* _log, ...
 #define xexitmsg_function(...)			   ____xloger_anonymous_function_scope_20151022____.Exit(xmessage2(__VA_ARGS__).String())
 #define xexitmsg_function_if(exp, ...)	   if((!exp)); else ____xloger_anonymous_function_scope_20151022____.Exit(xmessage2(__VA_ARGS__).String())
 
+// 只在 trace 模式下记录, 不写文本日志
+#define xtrace_counter(name, value)		aether::comm::XloggerTrace::Counter(name, (int64_t)(value))
+#define xtrace_instant(name, ...)		aether::comm::XloggerTrace::Instant(name, XLOGGER_SCOPE_MESSAGE(__VA_ARGS__))
+
 
 #define TSF __tsf__,
 #define XTAG __xlogger_tag__,
@@ -11,8 +11,11 @@
 // limitations under the License.
 
 #include "xlogger_category.h"
+#include <cstdarg>
+#include <cstdio>
 #include <functional>
-#include "../thread/thread.h"
+#include <string>
+#include "../thread/timer_wheel.h"
 
 namespace aether {
 namespace comm {
@@ -24,7 +27,7 @@ XloggerCategory* XloggerCategory::NewInstance(
 }
 
 void XloggerCategory::DelayRelease(XloggerCategory* _category) {
-    Thread(std::bind(&__Release, _category)).start_after(5000);
+    TimerWheel::Singleton()->Schedule(5000, std::bind(&__Release, _category));
 }
 
 void XloggerCategory::__Release(XloggerCategory* _category) {
@@ -58,8 +61,19 @@ void XloggerCategory::VPrint(const XLoggerInfo* _info, const char* _format, va_l
         info->level = kLevelFatal;
         __WriteImpl(_info, "NULL == _format");
     } else {
+        // 放不下时按实际长度重新格式化, 不截断
         char temp[4096] = {'\0'};
-        vsnprintf(temp, 4096, _format, _list);
+        va_list list;
+        va_copy(list, _list);
+        int len = vsnprintf(temp, sizeof(temp), _format, _list);
+        if ((int)sizeof(temp) <= len) {
+            std::string large((size_t)len + 1, '\0');
+            vsnprintf(&large[0], large.size(), _format, list);
+            va_end(list);
+            __WriteImpl(_info, large.c_str());
+            return;
+        }
+        va_end(list);
         __WriteImpl(_info, temp);
     }
 }
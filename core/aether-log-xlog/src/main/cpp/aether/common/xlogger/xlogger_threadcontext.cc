@@ -0,0 +1,152 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "xlogger_threadcontext.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "../thread/tss.h"
+
+namespace aether {
+namespace comm {
+
+static intmax_t __GetTid() {
+#ifdef __NR_gettid
+    return (intmax_t)syscall(__NR_gettid);
+#else
+    return (intmax_t)syscall(SYS_gettid);
+#endif
+}
+
+static Tss* sg_tss = NULL;
+
+XloggerThreadContext* XloggerThreadContext::Current() {
+    static Tss* s_tss = __CreateTss();
+    XloggerThreadContext* context = (XloggerThreadContext*)s_tss->get();
+    if (NULL == context) {
+        context = new XloggerThreadContext();
+        s_tss->set(context);
+    }
+    return context;
+}
+
+Tss* XloggerThreadContext::__CreateTss() {
+    pthread_atfork(NULL, NULL, &XloggerThreadContext::__OnForkChild);
+    // 故意不析构, 进程退出时其他线程可能还在写日志
+    sg_tss = new Tss(&XloggerThreadContext::__Destroy);
+    return sg_tss;
+}
+
+// 子进程里只剩调用 fork 的线程, 它的 tid 变了; 线程名也重新读, 并在子进程的日志里再记一次
+void XloggerThreadContext::__OnForkChild() {
+    if (NULL == sg_tss) return;
+    XloggerThreadContext* context = (XloggerThreadContext*)sg_tss->get();
+    if (NULL == context) return;
+    context->tid_ = __GetTid();
+    context->name_loaded_ = false;
+    context->name_reported_ = false;
+}
+
+XloggerThreadContext::XloggerThreadContext()
+: tid_(__GetTid()), name_loaded_(false), name_reported_(false), localtime_valid_(false), localtime_sec_(0), scratch_(NULL), scratch_busy_(false), message_count_(0) {
+    memset(name_, 0, sizeof(name_));
+    memset(&localtime_, 0, sizeof(localtime_));
+}
+
+XloggerThreadContext::~XloggerThreadContext() {
+    free(scratch_);
+    for (size_t i = 0; i < message_count_; ++i) delete messages_[i];
+}
+
+void XloggerThreadContext::__Destroy(void* _context) {
+    delete (XloggerThreadContext*)_context;
+}
+
+const char* XloggerThreadContext::Name() {
+    if (!name_loaded_) {
+        name_loaded_ = true;
+#ifdef __linux__
+        if (0 != prctl(PR_GET_NAME, name_, 0, 0, 0)) name_[0] = '\0';
+#endif
+        name_[sizeof(name_) - 1] = '\0';
+    }
+    return name_;
+}
+
+bool XloggerThreadContext::TakeNameReport() {
+    if (name_reported_) return false;
+    name_reported_ = true;
+    return '\0' != Name()[0];
+}
+
+const struct tm& XloggerThreadContext::LocalTime(time_t _sec) {
+    if (!localtime_valid_ || _sec != localtime_sec_) {
+        localtime_r(&_sec, &localtime_);
+        localtime_sec_ = _sec;
+        localtime_valid_ = true;
+    }
+    return localtime_;
+}
+
+std::string* XloggerThreadContext::AcquireMessage() {
+    XloggerThreadContext* context = Current();
+    if (0 < context->message_count_) return context->messages_[--context->message_count_];
+
+    std::string* message = new std::string();
+    message->reserve(kMessageReserve);
+    return message;
+}
+
+void XloggerThreadContext::ReleaseMessage(std::string* _message) {
+    XloggerThreadContext* context = Current();
+    if (context->message_count_ < kMessageSlots && _message->capacity() <= kMessageKeepLength) {
+        _message->clear();
+        context->messages_[context->message_count_++] = _message;
+        return;
+    }
+    delete _message;
+}
+
+XloggerScratchBuffer::XloggerScratchBuffer()
+: context_(XloggerThreadContext::Current()), ptr_(NULL) {
+    if (!context_->scratch_busy_) {
+        if (NULL == context_->scratch_) {
+            context_->scratch_ = (char*)malloc(XloggerThreadContext::kScratchLength);
+        }
+        if (NULL != context_->scratch_) {
+            context_->scratch_busy_ = true;
+            ptr_ = context_->scratch_;
+            return;
+        }
+    }
+
+    context_ = NULL;
+    ptr_ = (char*)malloc(XloggerThreadContext::kScratchLength);
+}
+
+XloggerScratchBuffer::~XloggerScratchBuffer() {
+    if (NULL != context_) {
+        context_->scratch_busy_ = false;
+    } else {
+        free(ptr_);
+    }
+}
+
+}  // namespace comm
+}  // namespace aether
@@ -0,0 +1,118 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * xlogger_threadcontext.h
+ *
+ * 每个线程一份的日志上下文, 首次使用时创建, 线程退出时由 Tss 回收.
+ * 缓存 tid、线程名和最近一秒的本地时间, 并提供一块可复用(不清零)的格式化缓冲区和几个保留容量的消息字符串.
+ * fork 后子进程里的缓存 tid 和线程名由 pthread_atfork 的子进程回调重置.
+ */
+
+#ifndef XLOGGER_THREADCONTEXT_H_
+#define XLOGGER_THREADCONTEXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+class Tss;
+
+namespace aether {
+namespace comm {
+
+class XloggerThreadContext {
+  public:
+    static const size_t kScratchLength = 16 * 1024;  // tell perry,ray if you want modify size.
+    static const size_t kMessageSlots = 4;             // XLogger/XMessage 嵌套层数超过时临时分配
+    static const size_t kMessageReserve = 512;
+    static const size_t kMessageKeepLength = 16 * 1024;  // 超长消息用完就释放, 不留在池里
+
+    static XloggerThreadContext* Current();
+
+    intmax_t Tid() const { return tid_; }
+    // prctl(PR_GET_NAME) 只读一次, 之后线程改名不会反映到日志里
+    const char* Name();
+    // 线程名不进每条日志头, 每个线程(fork 后的子进程里再一次)只在第一条日志前单独记一行; 返回 true 时该记
+    bool TakeNameReport();
+    // localtime_r 按秒缓存, 同一秒内的日志不再查时区
+    const struct tm& LocalTime(time_t _sec);
+
+    // 从当前线程的池里取一个空字符串, 池空时新建; 归还到归还时所在线程的池, 所以可以跨线程持有
+    static std::string* AcquireMessage();
+    static void ReleaseMessage(std::string* _message);
+
+  private:
+    friend class XloggerScratchBuffer;
+
+    XloggerThreadContext();
+    ~XloggerThreadContext();
+    XloggerThreadContext(const XloggerThreadContext&);
+    XloggerThreadContext& operator=(const XloggerThreadContext&);
+
+    static Tss* __CreateTss();
+    static void __Destroy(void* _context);
+    static void __OnForkChild();
+
+  private:
+    intmax_t tid_;
+    bool name_loaded_;
+    bool name_reported_;
+    char name_[16];
+    bool localtime_valid_;
+    time_t localtime_sec_;
+    struct tm localtime_;
+    char* scratch_;
+    bool scratch_busy_;
+    std::string* messages_[kMessageSlots];
+    size_t message_count_;
+};
+
+// XLogger/XMessage 的消息存储, 稳定状态下格式化日志不再分配堆内存
+class XloggerMessageBuffer {
+  public:
+    XloggerMessageBuffer() : message_(XloggerThreadContext::AcquireMessage()) {}
+    ~XloggerMessageBuffer() { XloggerThreadContext::ReleaseMessage(message_); }
+
+    std::string& String() const { return *message_; }
+
+  private:
+    XloggerMessageBuffer(const XloggerMessageBuffer&);
+    XloggerMessageBuffer& operator=(const XloggerMessageBuffer&);
+
+  private:
+    std::string* message_;
+};
+
+// 借用当前线程的格式化缓冲区, 同一线程嵌套使用时退化为临时堆内存
+class XloggerScratchBuffer {
+  public:
+    XloggerScratchBuffer();
+    ~XloggerScratchBuffer();
+
+    char* Ptr() const { return ptr_; }
+    size_t Length() const { return XloggerThreadContext::kScratchLength; }
+
+  private:
+    XloggerScratchBuffer(const XloggerScratchBuffer&);
+    XloggerScratchBuffer& operator=(const XloggerScratchBuffer&);
+
+  private:
+    XloggerThreadContext* context_;
+    char* ptr_;
+};
+
+}  // namespace comm
+}  // namespace aether
+
+#endif  // XLOGGER_THREADCONTEXT_H_
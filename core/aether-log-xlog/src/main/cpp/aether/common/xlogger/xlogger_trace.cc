@@ -0,0 +1,268 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * xlogger_trace.cc
+ */
+
+#include "xlogger_trace.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "../thread/lock.h"
+#include "../thread/spinlock.h"
+#include "../thread/tss.h"
+#include "xlogger_threadcontext.h"
+
+namespace aether {
+namespace comm {
+
+const char XloggerTrace::kFrameMagic[kFrameMagicLen] = {'\0', 'x', 't', 'r', '1'};
+
+// 缓冲区里的一条事件: u8 类型 | u64 时间 | u16 载荷长度 | 载荷(和帧里的格式相同), 取帧时把时间换成差值
+static const size_t kRecordHeaderLen = 1 + 8 + 2;
+static const size_t kRingCapacity = 8 * 1024;
+
+static std::atomic<xlogger_trace_sink_t> sg_sink(NULL);
+static std::atomic<bool> sg_enabled(false);
+static std::atomic<uint64_t> sg_dropped(0);
+
+namespace {
+
+struct TraceRing {
+    SpinLock lock;          // 写入方追加和取帧方交换缓冲区, 都只持有很短时间
+    Mutex drain;            // 同一时间只有一个取帧方, 保护 spare
+    char* active;
+    size_t active_len;
+    char* spare;
+    intmax_t tid;
+
+    TraceRing()
+    : active((char*)malloc(kRingCapacity)), active_len(0), spare((char*)malloc(kRingCapacity))
+    , tid(XloggerThreadContext::Current()->Tid()) {}
+    ~TraceRing() {
+        free(active);
+        free(spare);
+    }
+};
+
+}  // namespace
+
+// 故意不析构, 进程退出时其他线程可能还在写. FlushAll 在锁外取帧, 线程退出时 ring 要等它取完才释放, 所以用 shared_ptr
+static Mutex& sg_rings_mutex = *(new Mutex());
+static std::list<std::shared_ptr<TraceRing> >& sg_rings = *(new std::list<std::shared_ptr<TraceRing> >());
+
+static size_t __PutVarint(char* _out, uint64_t _value) {
+    size_t len = 0;
+    while (_value >= 0x80) {
+        _out[len++] = (char)(_value | 0x80);
+        _value >>= 7;
+    }
+    _out[len++] = (char)_value;
+    return len;
+}
+
+static size_t __PutString(char* _out, const char* _str, size_t _max_len) {
+    size_t len = NULL == _str ? 0 : strnlen(_str, _max_len);
+    size_t pos = __PutVarint(_out, len);
+    if (0 < len) memcpy(_out + pos, _str, len);
+    return pos + len;
+}
+
+static void __PutFixed(std::string& _out, uint64_t _value, size_t _len) {
+    for (size_t i = 0; i < _len; ++i) _out += (char)(_value >> (8 * i));
+}
+
+// 交换出 active 里的事件, 时间改成差值后拼成一帧交给 sink. 调用方持有 _ring->drain
+static void __DrainLocked(TraceRing* _ring) {
+    size_t len = 0;
+    {
+        ScopedSpinLock lock(_ring->lock);
+        std::swap(_ring->active, _ring->spare);
+        len = _ring->active_len;
+        _ring->active_len = 0;
+    }
+    if (0 == len) return;
+
+    xlogger_trace_sink_t sink = sg_sink.load(std::memory_order_acquire);
+    if (NULL == sink) return;
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t now_ns = XloggerTrace::NowNs();
+
+    const char* data = _ring->spare;
+    uint64_t first_ns = 0;
+    memcpy(&first_ns, data + 1, 8);
+
+    std::string frame;
+    frame.reserve(XloggerTrace::kFrameHeaderLen + len);
+    frame.append(XloggerTrace::kFrameMagic, XloggerTrace::kFrameMagicLen);
+    __PutFixed(frame, 0, 4);    // 长度最后回填
+    __PutFixed(frame, (uint64_t)getpid(), 4);
+    __PutFixed(frame, (uint64_t)_ring->tid, 8);
+    __PutFixed(frame, (uint64_t)((int64_t)tv.tv_sec * 1000000 + tv.tv_usec), 8);
+    __PutFixed(frame, now_ns, 8);
+    __PutFixed(frame, first_ns, 8);
+
+    uint64_t last_ns = first_ns;
+    char varint[10];
+    for (size_t pos = 0; pos + kRecordHeaderLen <= len;) {
+        uint64_t ts_ns = 0;
+        uint16_t payload_len = 0;
+        memcpy(&ts_ns, data + pos + 1, 8);
+        memcpy(&payload_len, data + pos + 9, 2);
+
+        frame += data[pos];
+        frame.append(varint, __PutVarint(varint, ts_ns - last_ns));
+        frame.append(data + pos + kRecordHeaderLen, payload_len);
+        last_ns = ts_ns;
+        pos += kRecordHeaderLen + payload_len;
+    }
+
+    uint32_t frame_len = (uint32_t)(frame.size() - XloggerTrace::kFrameMagicLen - 4);
+    for (size_t i = 0; i < 4; ++i) frame[XloggerTrace::kFrameMagicLen + i] = (char)(frame_len >> (8 * i));
+    sink(frame.data(), frame.size());
+}
+
+static void __DestroyRing(void* _ring) {
+    std::shared_ptr<TraceRing>* ring = (std::shared_ptr<TraceRing>*)_ring;
+    {
+        ScopedLock lock(sg_rings_mutex);
+        sg_rings.remove(*ring);
+    }
+    {
+        ScopedLock lock((*ring)->drain);
+        __DrainLocked(ring->get());
+    }
+    delete ring;
+}
+
+static TraceRing* __CurrentRing() {
+    static Tss* s_tss = new Tss(&__DestroyRing);
+    std::shared_ptr<TraceRing>* ring = (std::shared_ptr<TraceRing>*)s_tss->get();
+    if (NULL != ring) return ring->get();
+
+    ring = new std::shared_ptr<TraceRing>(new TraceRing());
+    if (NULL == (*ring)->active || NULL == (*ring)->spare) {
+        delete ring;
+        return NULL;
+    }
+    s_tss->set(ring);
+    ScopedLock lock(sg_rings_mutex);
+    sg_rings.push_back(*ring);
+    return ring->get();
+}
+
+static bool __TryAppend(TraceRing* _ring, const char* _record, size_t _len) {
+    ScopedSpinLock lock(_ring->lock);
+    if (_ring->active_len + _len > kRingCapacity) return false;
+    memcpy(_ring->active + _ring->active_len, _record, _len);
+    _ring->active_len += _len;
+    return true;
+}
+
+static void __Append(char _type, const char* _name, const char* _msg, bool _has_value, int64_t _value) {
+    if (!XloggerTrace::IsEnabled()) return;
+
+    char record[kRecordHeaderLen + 2 * 10 + XloggerTrace::kMaxNameLen + XloggerTrace::kMaxMsgLen];
+    size_t len = kRecordHeaderLen;
+    if (XloggerTrace::kEventEnd != _type) len += __PutString(record + len, _name, XloggerTrace::kMaxNameLen);
+    if (_has_value) {
+        len += __PutVarint(record + len, ((uint64_t)_value << 1) ^ (uint64_t)(_value >> 63));
+    } else {
+        len += __PutString(record + len, _msg, XloggerTrace::kMaxMsgLen);
+    }
+
+    uint64_t ts_ns = XloggerTrace::NowNs();
+    uint16_t payload_len = (uint16_t)(len - kRecordHeaderLen);
+    record[0] = _type;
+    memcpy(record + 1, &ts_ns, 8);
+    memcpy(record + 9, &payload_len, 2);
+
+    TraceRing* ring = __CurrentRing();
+    if (NULL == ring) return;
+    if (__TryAppend(ring, record, len)) return;
+
+    // 写满了自己取一帧; 正在被 FlushAll 取时不等, 这条丢掉
+    ScopedLock drain(ring->drain, false);
+    if (drain.trylock()) {
+        __DrainLocked(ring);
+        drain.unlock();
+        if (__TryAppend(ring, record, len)) return;
+    }
+    sg_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void XloggerTrace::SetSink(xlogger_trace_sink_t _sink) {
+    sg_sink.store(_sink, std::memory_order_release);
+}
+
+void XloggerTrace::SetEnabled(bool _enabled) {
+    sg_enabled.store(_enabled, std::memory_order_relaxed);
+}
+
+bool XloggerTrace::IsEnabled() {
+    return sg_enabled.load(std::memory_order_relaxed) && NULL != sg_sink.load(std::memory_order_relaxed);
+}
+
+void XloggerTrace::Begin(const char* _name, const char* _msg) {
+    __Append(kEventBegin, _name, _msg, false, 0);
+}
+
+void XloggerTrace::End(const char* _msg) {
+    __Append(kEventEnd, NULL, _msg, false, 0);
+}
+
+void XloggerTrace::Counter(const char* _name, int64_t _value) {
+    __Append(kEventCounter, _name, NULL, true, _value);
+}
+
+void XloggerTrace::Instant(const char* _name, const char* _msg) {
+    __Append(kEventInstant, _name, _msg, false, 0);
+}
+
+void XloggerTrace::FlushAll() {
+    // sink 会拿缓冲区的锁, 同步模式下还直接写文件; 锁里只取出 ring 列表, 放开后再逐个取帧
+    std::vector<std::shared_ptr<TraceRing> > rings;
+    {
+        ScopedLock lock(sg_rings_mutex);
+        rings.assign(sg_rings.begin(), sg_rings.end());
+    }
+    for (size_t i = 0; i < rings.size(); ++i) {
+        ScopedLock drain(rings[i]->drain);
+        __DrainLocked(rings[i].get());
+    }
+}
+
+uint64_t XloggerTrace::Dropped() {
+    return sg_dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t XloggerTrace::NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+}  // namespace comm
+}  // namespace aether
@@ -0,0 +1,78 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * xlogger_trace.h
+ *
+ * 二进制 trace: scope 开始/结束、计数和瞬时事件编码成紧凑的二进制事件, 时间戳取单调时钟的纳秒.
+ * 每个线程一块缓冲区, 写满或日志落盘前整理成一帧交给 sink, sink 把整帧当作一条记录写进日志流;
+ * 解码器把帧从文本里摘掉, 需要时导出成 Chrome/Perfetto 的 trace event JSON.
+ *
+ * 帧格式(小端):
+ *   "\0xtr1" | u32 之后的字节数 | u32 pid | u64 tid | i64 取帧时的墙上时间(us) | u64 同一时刻的单调时钟(ns)
+ *   | u64 第一个事件的单调时钟(ns) | 事件...
+ * 事件: u8 类型 | varint 和上一个事件的时间差(ns) | 按类型:
+ *   B/I: varint 长度 + 名字, varint 长度 + 附加信息
+ *   E:   varint 长度 + 附加信息
+ *   C:   varint 长度 + 名字, zigzag varint 值
+ * 文本日志里不会出现 '\0', 解码器按 magic 找帧.
+ */
+
+#ifndef XLOGGER_TRACE_H_
+#define XLOGGER_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace aether {
+namespace comm {
+
+typedef void (*xlogger_trace_sink_t)(const void* _frame, size_t _len);
+
+class XloggerTrace {
+  public:
+    static const char kFrameMagic[];
+    static const size_t kFrameMagicLen = 5;
+    static const size_t kFrameHeaderLen = kFrameMagicLen + 4 + 4 + 8 + 8 + 8 + 8;
+    static const size_t kMaxNameLen = 128;      // 超出的部分截掉
+    static const size_t kMaxMsgLen = 512;
+
+    enum TEventType {
+        kEventBegin = 'B',
+        kEventEnd = 'E',
+        kEventCounter = 'C',
+        kEventInstant = 'I',
+    };
+
+    // 日志引擎打开时设置, 关闭时置为 NULL; 没有 sink 时事件直接丢弃
+    static void SetSink(xlogger_trace_sink_t _sink);
+    // 打开后 XScopeTracer 写二进制事件, 不再写两行文本
+    static void SetEnabled(bool _enabled);
+    static bool IsEnabled();
+
+    static void Begin(const char* _name, const char* _msg);
+    static void End(const char* _msg);
+    static void Counter(const char* _name, int64_t _value);
+    static void Instant(const char* _name, const char* _msg);
+
+    // 把所有线程缓冲区里的事件整理成帧交给 sink, 日志引擎在落盘前调用
+    static void FlushAll();
+    // 缓冲区满且正在被取帧时丢掉的事件数
+    static uint64_t Dropped();
+
+    static uint64_t NowNs();
+};
+
+}  // namespace comm
+}  // namespace aether
+
+#endif  // XLOGGER_TRACE_H_
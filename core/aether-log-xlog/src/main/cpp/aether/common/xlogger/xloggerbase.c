@@ -6,6 +6,7 @@
 
 #include "xlogger/xloggerbase.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "compiler_util.h"
 
@@ -122,9 +123,16 @@ void __xlogger_VPrint_impl(const XLoggerInfo* _info, const char* _format, va_lis
         info->level = kLevelFatal;
         __xlogger_Write_impl(_info, "NULL == _format");
     } else {
+        // 短日志用栈上的缓冲区, 放不下时按实际长度在堆上重新格式化, 不截断
         char temp[4096] = {'\0'};
-        vsnprintf(temp, 4096, _format, _list);
-        __xlogger_Write_impl(_info, temp);
+        va_list list;
+        va_copy(list, _list);
+        int len = vsnprintf(temp, sizeof(temp), _format, _list);
+        char* large = (int)sizeof(temp) <= len ? (char*)malloc((size_t)len + 1) : NULL;
+        if (NULL != large) vsnprintf(large, (size_t)len + 1, _format, list);
+        va_end(list);
+        __xlogger_Write_impl(_info, NULL != large ? large : temp);
+        free(large);
     }
 }
 
@@ -44,18 +44,22 @@
 #include <algorithm>
 
 #include <functional>  // For std::bind (C++11 standard, replaces std::bind)
+#include <memory>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/filesystem.hpp>
 
 #include "lock.h"
 #include "thread/condition.h"
 #include "thread/thread.h"
+#include "thread/timer_wheel.h"
 #include "scope_recursion_limit.h"
 #include "bootrun.h"
 #include "tickcount.h"
 #include "autobuffer.h"
 #include "ptrbuffer.h"
 #include "xlogger/xloggerbase.h"
+#include "xlogger/xlogger_threadcontext.h"
+#include "xlogger/xlogger_trace.h"
 #include "time_utils.h"
 #include "strutil.h"
 #include "mmap_util.h"
@@ -68,6 +72,13 @@
 #endif
 
 #include "log_buffer.h"
+#include "log_compress_pool.h"
+#include "log_file_writer.h"
+#include "log_file_mover.h"
+#include "log_retention.h"
+#include "log_metrics.h"
+#include "log_record_chunk.h"
+#include "log_attachment.h"
 
 #define LOG_EXT "xlog"
 
@@ -81,9 +92,11 @@ static std::string sg_cache_logdir;
 static std::string sg_logfileprefix;
 
 static Mutex sg_mutex_log_file;
-static FILE* sg_logfile = NULL;
-static time_t sg_openfiletime = 0;
+static LogFileWriter sg_logfile;
 static std::string sg_current_dir;
+// 写缓存目录还是日志目录, 只在重新打开文件时判断
+static bool sg_write_cache = false;
+static bool sg_cache_logs = false;
 
 static Mutex sg_mutex_buffer_async;
 #ifdef _WIN32
@@ -93,6 +106,7 @@ static Condition sg_cond_buffer_async;
 #endif
 
 static LogBuffer* sg_log_buff = NULL;
+static LogAttachmentQueue sg_attachments;   // 异步模式下等异步线程写的附件, 由 sg_mutex_buffer_async 保护
 
 static volatile bool sg_log_close = true;
 
@@ -107,13 +121,32 @@ static bool sg_consolelog_open = false;
 static uint64_t sg_max_file_size = 0; // 0, will not split log file.
 static int sg_cache_log_days = 0;   // 0, will not cache logs
 
+void xlogger_appender(const XLoggerInfo* _info, const char* _log);
 static void __async_log_thread();
+static void __appender_write_attachments(ScopedLock& _lock);
 static Thread sg_thread_async(&__async_log_thread);
 
-static const unsigned int kBufferBlockLength = 150 * 1024;
+static const unsigned int kMinBufferSize = 64 * 1024;
+static const unsigned int kMaxBufferSize = 8 * 1024 * 1024;
+static const unsigned int kMaxBufferSegments = 16;
+static unsigned int sg_buffer_size = 150 * 1024;
+static unsigned int sg_buffer_segments = 1;
+static unsigned int sg_compress_threads = 0;    // 大于 0 时流水线压缩, 下次 appender_open 生效
+static char* sg_buffer_mem = NULL;  // mmap 失败时的堆内存
+static std::string sg_process_name; // 非空时是多进程模式, 下次 appender_open 生效
+static bool sg_block_header_v2 = false; // 写 v2 block header, 下次 appender_open 生效
+static int sg_mmap_lock = -1;
+static bool sg_fast_open = false;
+static Mutex sg_mutex_open_deferred;
+static std::function<void()> sg_open_deferred;  // 快速打开留给异步线程的建目录、恢复和头部信息
+static LogMetrics sg_metrics;   // 进程内累计, 重新打开不清零
+static unsigned int sg_metrics_interval_s = 0;
+static uint64_t sg_metrics_summary_us = 0;
 static const long kMaxLogAliveTime = 10 * 24 * 60 * 60;    // 10 days in second
 static const long kMinLogAliveTime = 24 * 60 * 60;    // 1 days in second
 static long sg_max_alive_time = kMaxLogAliveTime;
+static uint64_t sg_max_total_size = 0;  // 0, no quota
+static LogRetention::ModuleId sg_retention_id = LogRetention::kInvalidModuleId;
 static std::string sg_log_extra_msg;
 
 static boost::iostreams::mapped_file& sg_mmmap_file = *(new boost::iostreams::mapped_file);
@@ -253,92 +286,6 @@ static void __make_logfilename(const timeval& _tv, const std::string& _logdir, c
     _filepath[_len - 1] = '\0';
 }
 
-static void __del_timeout_file(const std::string& _log_path) {
-    time_t now_time = time(NULL);
-    
-    boost::filesystem::path path(_log_path);
-    
-    if (boost::filesystem::exists(path) && boost::filesystem::is_directory(path)){
-        boost::filesystem::directory_iterator end_iter;
-        for (boost::filesystem::directory_iterator iter(path); iter != end_iter; ++iter) {
-            time_t file_modify_time = boost::filesystem::last_write_time(iter->path());
-            
-            if (now_time > file_modify_time && now_time - file_modify_time > sg_max_alive_time) {
-                if(boost::filesystem::is_regular_file(iter->status())
-                && iter->path().extension() == (std::string(".") + LOG_EXT)) {
-                    boost::filesystem::remove(iter->path());
-                } 
-                if (boost::filesystem::is_directory(iter->status())) {
-                    std::string filename = iter->path().filename().string();
-                    if (filename.size() == 8 && filename.find_first_not_of("0123456789") == std::string::npos) {
-                        boost::filesystem::remove_all(iter->path());
-                    }
-                }
-            }
-        }
-    }
-}
-
-static bool __append_file(const std::string& _src_file, const std::string& _dst_file) {
-    if (_src_file == _dst_file) {
-        return false;
-    }
-
-    if (!boost::filesystem::exists(_src_file)) {
-        return false;
-    }
-    
-    if (0 == boost::filesystem::file_size(_src_file)){
-        return true;
-    }
-
-    FILE* src_file = fopen(_src_file.c_str(), "rb");
-
-    if (NULL == src_file) {
-        return false;
-    }
-
-    FILE* dest_file = fopen(_dst_file.c_str(), "ab");
-
-    if (NULL == dest_file) {
-        fclose(src_file);
-        return false;
-    }
-
-    fseek(src_file, 0, SEEK_END);
-    long src_file_len = ftell(src_file);
-    long dst_file_len = ftell(dest_file);
-    fseek(src_file, 0, SEEK_SET);
-
-    char buffer[4096] = {0};
-
-    while (true) {
-        if (feof(src_file)) break;
-
-        size_t read_ret = fread(buffer, 1, sizeof(buffer), src_file);
-
-        if (read_ret == 0)   break;
-
-        if (ferror(src_file)) break;
-
-        fwrite(buffer, 1, read_ret, dest_file);
-
-        if (ferror(dest_file))  break;
-    }
-
-    if (dst_file_len + src_file_len > ftell(dest_file)) {
-        ftruncate(fileno(dest_file), dst_file_len);
-        fclose(src_file);
-        fclose(dest_file);
-        return false;
-    }
-
-    fclose(src_file);
-    fclose(dest_file);
-
-    return true;
-}
-
 static void __move_old_files(const std::string& _src_path, const std::string& _dest_path, const std::string& _nameprefix) {
     if (_src_path == _dest_path) {
         return;
@@ -349,7 +296,6 @@ static void __move_old_files(const std::string& _src_path, const std::string& _d
         return;
     }
     
-    ScopedLock lock_file(sg_mutex_log_file);
     time_t now_time = time(NULL);
     
     boost::filesystem::directory_iterator end_iter;
@@ -359,18 +305,27 @@ static void __move_old_files(const std::string& _src_path, const std::string& _d
             continue;
         }
         
+        time_t file_modify_time = boost::filesystem::last_write_time(iter->path());
         if (sg_cache_log_days > 0) {
-            time_t file_modify_time = boost::filesystem::last_write_time(iter->path());
             if (now_time > file_modify_time && (now_time - file_modify_time) < sg_cache_log_days * 24 * 60 * 60) {
                 continue;
             }
         }
         
-        if (!__append_file(iter->path().string(), sg_logdir + "/" + iter->path().filename().string())) {
+        // 常驻的描述符可能正指向这个缓存文件, 删除前先关掉. 一天内写过的文件落盘线程还可能重新打开,
+        // 搬移时拿着文件锁; 更早的文件不会再写, 放开锁, 拷贝期间不挡落盘
+        ScopedLock lock_file(sg_mutex_log_file);
+        if (sg_logfile.Path() == iter->path().string()) {
+            sg_logfile.Close();
+        } else if (now_time - file_modify_time >= 24 * 60 * 60) {
+            lock_file.unlock();
+        }
+
+        std::string dst = sg_logdir + "/" + iter->path().filename().string();
+        if (!MoveLogFile(iter->path().string(), dst)) {
             break;
         }
-        
-        boost::filesystem::remove(iter->path());
+        LogRetention::Singleton()->OnFileMoved(iter->path().string(), dst);
     }
 }
 
@@ -391,53 +346,48 @@ static void __writetips2console(const char* _tips_format, ...) {
     ConsoleLog(&info, tips_info);
 }
 
-static bool __writefile(const void* _data, size_t _len, FILE* _file) {
-    if (NULL == _file) {
+static bool __writefile(const void* _data, size_t _len) {
+    if (!sg_logfile.IsOpen()) {
         assert(false);
         return false;
     }
 
-    long before_len = ftell(_file);
-    if (before_len < 0) return false;
-
-    if (1 != fwrite(_data, _len, 1, _file)) {
-        int err = ferror(_file);
+    if (!sg_logfile.Write(_data, _len)) {
+        int err = errno;
 
         __writetips2console("write file error:%d", err);
 
-        ftruncate(fileno(_file), before_len);
-        fseek(_file, 0, SEEK_END);
-
         char err_log[256] = {0};
         snprintf(err_log, sizeof(err_log), "\nwrite file error:%d\n", err);
 
         AutoBuffer tmp_buff;
         sg_log_buff->Write(err_log, strnlen(err_log, sizeof(err_log)), tmp_buff);
 
-        fwrite(tmp_buff.Ptr(), tmp_buff.Length(), 1, _file);
+        sg_logfile.Write(tmp_buff.Ptr(), tmp_buff.Length());
 
         return false;
     }
 
+    LogRetention::Singleton()->OnFileWritten(sg_retention_id, sg_logfile.Path(), sg_logfile.Size());
     return true;
 }
 
+// 同一目录、同一天、没被删除、没超过大小上限时继续用已打开的描述符
+static bool __logfile_reusable(const std::string& _log_dir, time_t _now) {
+    if (!sg_logfile.IsOpen() || sg_current_dir != _log_dir) return false;
+    if (sg_max_file_size > 0 && sg_logfile.Size() >= sg_max_file_size) return false;
+
+    return sg_logfile.IsValid(_now);
+}
+
 static bool __openlogfile(const std::string& _log_dir) {
     if (sg_logdir.empty()) return false;
 
     struct timeval tv;
     gettimeofday(&tv, NULL);
 
-    if (NULL != sg_logfile) {
-        time_t sec = tv.tv_sec;
-        tm tcur = *localtime((const time_t*)&sec);
-        tm filetm = *localtime(&sg_openfiletime);
-
-        if (filetm.tm_year == tcur.tm_year && filetm.tm_mon == tcur.tm_mon && filetm.tm_mday == tcur.tm_mday && sg_current_dir == _log_dir) return true;
-
-        fclose(sg_logfile);
-        sg_logfile = NULL;
-    }
+    if (__logfile_reusable(_log_dir, tv.tv_sec)) return true;
+    sg_logfile.Close();
 
     static time_t s_last_time = 0;
     static uint64_t s_last_tick = 0;
@@ -446,28 +396,25 @@ static bool __openlogfile(const std::string& _log_dir) {
     uint64_t now_tick = gettickcount();
     time_t now_time = tv.tv_sec;
 
-    sg_openfiletime = tv.tv_sec;
     sg_current_dir = _log_dir;
 
     char logfilepath[1024] = {0};
     __make_logfilename(tv, _log_dir, sg_logfileprefix.c_str(), LOG_EXT, logfilepath , 1024);
 
     if (now_time < s_last_time) {
-        sg_logfile = fopen(s_last_file_path, "ab");
+        bool open_success = sg_logfile.Open(s_last_file_path);
 
-        if (NULL == sg_logfile) {
+        if (!open_success) {
             __writetips2console("open file error:%d %s, path:%s", errno, strerror(errno), s_last_file_path);
         }
 
 #ifdef __APPLE__
-        assert(sg_logfile);
+        assert(open_success);
 #endif
-        return NULL != sg_logfile;
+        return open_success;
     }
 
-    sg_logfile = fopen(logfilepath, "ab");
-
-    if (NULL == sg_logfile) {
+    if (!sg_logfile.Open(logfilepath)) {
         __writetips2console("open file error:%d %s, path:%s", errno, strerror(errno), logfilepath);
     }
 
@@ -482,12 +429,12 @@ static bool __openlogfile(const std::string& _log_dir) {
         char now_time_str[64] = {0};
         strftime(now_time_str, sizeof(now_time_str), "%Y-%m-%d %z %H:%M:%S", &tm_tmp);
 
-        char log[1024] = {0};
+        char log[1024 + 256] = {0};  // 路径最长 1023, 再加上两个时间和数字
         snprintf(log, sizeof(log), "[F][ last log file:%s from %s to %s, time_diff:%ld, tick_diff:%" PRIu64 "\n", s_last_file_path, last_time_str, now_time_str, now_time-s_last_time, now_tick-s_last_tick);
 
         AutoBuffer tmp_buff;
         sg_log_buff->Write(log, strnlen(log, sizeof(log)), tmp_buff);
-        __writefile(tmp_buff.Ptr(), tmp_buff.Length(), sg_logfile);
+        if (sg_logfile.IsOpen()) __writefile(tmp_buff.Ptr(), tmp_buff.Length());
     }
 
     memcpy(s_last_file_path, logfilepath, sizeof(s_last_file_path));
@@ -495,17 +442,13 @@ static bool __openlogfile(const std::string& _log_dir) {
     s_last_time = now_time;
 
 #ifdef __APPLE__
-    assert(sg_logfile);
+    assert(sg_logfile.IsOpen());
 #endif
-    return NULL != sg_logfile;
+    return sg_logfile.IsOpen();
 }
 
 static void __closelogfile() {
-    if (NULL == sg_logfile) return;
-
-    sg_openfiletime = 0;
-    fclose(sg_logfile);
-    sg_logfile = NULL;
+    sg_logfile.Close();
 }
 
 static bool __cache_logs() {
@@ -540,10 +483,7 @@ static void __log2file(const void* _data, size_t _len, bool _move_file) {
 
     if (sg_cache_logdir.empty()) {
         if (__openlogfile(sg_logdir)) {
-            __writefile(_data, _len, sg_logfile);
-            if (kAppednerAsync == sg_mode) {
-                __closelogfile();
-            }
+            __writefile(_data, _len);
         }
         return;
     }
@@ -553,48 +493,38 @@ static void __log2file(const void* _data, size_t _len, bool _move_file) {
     char logcachefilepath[1024] = {0};
 
     __make_logfilename(tv, sg_cache_logdir, sg_logfileprefix.c_str(), LOG_EXT, logcachefilepath , 1024);
-    
-    bool cache_logs = __cache_logs();
-    if ((cache_logs || boost::filesystem::exists(logcachefilepath)) && __openlogfile(sg_cache_logdir)) {
-        __writefile(_data, _len, sg_logfile);
-        if (kAppednerAsync == sg_mode) {
-            __closelogfile();
-        }
+
+    // 文件还能继续用时沿用上次的选择, 不再每次落盘都 exists/statfs
+    if (!__logfile_reusable(sg_current_dir, tv.tv_sec)) {
+        sg_cache_logs = __cache_logs();
+        sg_write_cache = sg_cache_logs || boost::filesystem::exists(logcachefilepath);
+    }
+
+    if (sg_write_cache && __openlogfile(sg_cache_logdir)) {
+        __writefile(_data, _len);
         
-        if (cache_logs || !_move_file) {
+        if (sg_cache_logs || !_move_file) {
             return;
         }
 
         char logfilepath[1024] = {0};
         __make_logfilename(tv, sg_logdir, sg_logfileprefix.c_str(), LOG_EXT, logfilepath , 1024);
-        if (__append_file(logcachefilepath, logfilepath)) {
-            if (kAppednerSync == sg_mode) {
-                __closelogfile();
-            }
-            boost::filesystem::remove(logcachefilepath);
+        // 缓存文件要被删掉, 先关掉常驻的描述符
+        __closelogfile();
+        if (MoveLogFile(logcachefilepath, logfilepath)) {
+            LogRetention::Singleton()->OnFileMoved(logcachefilepath, logfilepath);
         }
         return;
     }
     
     bool write_sucess = false;
-    bool open_success = __openlogfile(sg_logdir);
-    if (open_success) {
-        write_sucess = __writefile(_data, _len, sg_logfile);
-        if (kAppednerAsync == sg_mode) {
-            __closelogfile();
-        }
+    if (__openlogfile(sg_logdir)) {
+        write_sucess = __writefile(_data, _len);
     }
 
     if (!write_sucess) {
-        if (open_success && kAppednerSync == sg_mode) {
-            __closelogfile();
-        }
-
         if (__openlogfile(sg_cache_logdir)) {
-            __writefile(_data, _len, sg_logfile);
-            if (kAppednerAsync == sg_mode) {
-                __closelogfile();
-            }
+            __writefile(_data, _len);
         }
     }
 
@@ -619,53 +549,266 @@ static void __writetips2file(const char* _tips_format, ...) {
     __log2file(tmp_buff.Ptr(), tmp_buff.Length(), false);
 }
 
+// 只执行一次; 异步线程还没来得及做就关闭时由关闭的线程做, 正在做时关闭要等它做完
+static void __run_open_deferred() {
+    ScopedLock lock(sg_mutex_open_deferred);
+    std::function<void()> deferred;
+    deferred.swap(sg_open_deferred);
+    if (deferred) deferred();
+}
+
+static void __flush2file(const void* _data, size_t _len, bool _move_file) {
+    uint64_t begin_us = LogMetrics::NowUs();
+    __log2file(_data, _len, _move_file);
+    sg_metrics.OnFlush(_len, LogMetrics::NowUs() - begin_us);
+}
+
+static void __write_metrics_summary() {
+    unsigned int interval_s = sg_metrics_interval_s;
+    if (0 == interval_s || sg_log_close) return;
+
+    uint64_t now_us = LogMetrics::NowUs();
+    if (now_us - sg_metrics_summary_us < (uint64_t)interval_s * 1000000) return;
+    sg_metrics_summary_us = now_us;
+
+    LogMetricsSnapshot snapshot;
+    sg_metrics.GetSnapshot(snapshot);
+    xlogger_appender(NULL, snapshot.Summary().c_str());
+}
+
+// trace 帧原样作为一条记录写入, 不经过格式化
+static void __appender_write_trace(const void* _frame, size_t _len) {
+    if (kAppednerSync == sg_mode) {
+        AutoBuffer tmp_buff;
+        {
+            ScopedLock lock(sg_mutex_buffer_async);
+            if (NULL == sg_log_buff || !sg_log_buff->Write(_frame, _len, tmp_buff)) return;
+        }
+        __flush2file(tmp_buff.Ptr(), tmp_buff.Length(), false);
+        return;
+    }
+
+    ScopedLock lock(sg_mutex_buffer_async);
+    if (NULL == sg_log_buff) return;
+    if (!sg_log_buff->Write(_frame, _len)) sg_metrics.OnDrop(kLogDropBufferFull, -1);
+}
+
 static void __async_log_thread() {
+    __run_open_deferred();
+
     while (true) {
+        // 摘要和各线程的 trace 事件先进缓冲区, 随这一轮一起落盘
+        __write_metrics_summary();
+        aether::comm::XloggerTrace::FlushAll();
 
+        // 先取关闭标记, 落盘期间放开了锁, 这期间写进来的(包括关闭时的结束标记)再落一轮
+        bool closing = sg_log_close;
         ScopedLock lock_buffer(sg_mutex_buffer_async);
 
         if (NULL == sg_log_buff) break;
 
-        AutoBuffer tmp;
-        sg_log_buff->Flush(tmp);
+        __appender_write_attachments(lock_buffer);
+        if (NULL == sg_log_buff) break;
+        sg_log_buff->FlushSegments(lock_buffer, [](const void* _data, size_t _len, const LogBlockStat&) {
+            __flush2file(_data, _len, true);
+        });
+        sg_metrics.SetBufferFill(sg_log_buff->GetData().Length(), sg_log_buff->SegmentLength());
         lock_buffer.unlock();
 
-        if (NULL != tmp.Ptr())  __log2file(tmp.Ptr(), tmp.Length(), true);
+        if (closing) break;
+        if (sg_log_close) continue;
+
+        long wait_ms = 15 * 60 * 1000;
+        if (0 < sg_metrics_interval_s) wait_ms = std::min(wait_ms, (long)sg_metrics_interval_s * 1000);
+        sg_cond_buffer_async.wait(wait_ms);
+    }
+}
+
+typedef std::function<size_t(char*, size_t)> FrameSource;
+
+// 每帧单独加密成一个 block 直接落盘
+static bool __appender_frames_sync(const FrameSource& _next, int _level, const char* _tag) {
+    aether::comm::XloggerScratchBuffer temp;
+    if (NULL == temp.Ptr()) {
+        sg_metrics.OnDrop(kLogDropNoMemory, _level);
+        return false;
+    }
+
+    size_t len = 0;
+    while (0 < (len = _next(temp.Ptr(), temp.Length()))) {
+        AutoBuffer tmp_buff;
+        if (!sg_log_buff->Write(temp.Ptr(), len, tmp_buff, _level, 0, _tag)) {
+            sg_metrics.OnDrop(kLogDropBufferFull, _level);
+            return false;
+        }
+        sg_metrics.OnRecord(len);
+
+        __flush2file(tmp_buff.Ptr(), tmp_buff.Length(), false);
+    }
+    return true;
+}
 
-        if (sg_log_close) break;
+// 写入方就地落盘腾出段, 持有 sg_mutex_buffer_async, 落盘期间放开
+static void __appender_flush_inline(ScopedLock& _lock) {
+    // 快速打开时目录可能还没建, 先替异步线程做完
+    _lock.unlock();
+    __run_open_deferred();
+    _lock.lock();
+    if (NULL == sg_log_buff) return;
+    sg_log_buff->FlushSegments(_lock, [](const void* _data, size_t _len, const LogBlockStat&) {
+        __flush2file(_data, _len, true);
+    });
+}
 
-        sg_cond_buffer_async.wait(15 * 60 * 1000);
+// 逐帧压缩进缓冲区; 过半时换到空闲段并叫醒异步线程落盘.
+// 没有空闲段可换、写不下时才就地落盘腾出段再写, 落盘期间别的线程的日志可能夹在帧之间
+static bool __appender_frames_async(ScopedLock& _lock, const FrameSource& _next, int _level, const char* _tag) {
+    aether::comm::XloggerScratchBuffer temp;
+    if (NULL == temp.Ptr()) {
+        sg_metrics.OnDrop(kLogDropNoMemory, _level);
+        return false;
+    }
+
+    std::function<void()> flush = [&_lock]() { __appender_flush_inline(_lock); };
+
+    size_t len = 0;
+    while (0 < (len = _next(temp.Ptr(), temp.Length()))) {
+        // 过半就先封口换段, 封口的段交给异步线程落盘, 写入方不等 IO
+        if (sg_log_buff->GetData().Length() >= sg_log_buff->SegmentLength()/2) {
+            sg_log_buff->Seal();
+            sg_cond_buffer_async.notifyAll();
+        }
+        bool written = NULL != sg_log_buff && sg_log_buff->Write(temp.Ptr(), len, _level, 0, _tag);
+        if (!written && NULL != sg_log_buff) {
+            flush();
+            written = NULL != sg_log_buff && sg_log_buff->Write(temp.Ptr(), len, _level, 0, _tag);
+        }
+        if (!written) {
+            sg_metrics.OnDrop(NULL == sg_log_buff ? kLogDropClosed : kLogDropBufferFull, _level);
+            return false;
+        }
+        sg_metrics.OnRecord(len);
+    }
+    sg_metrics.SetBufferFill(sg_log_buff->GetData().Length(), sg_log_buff->SegmentLength());
+    return true;
+}
+
+static void __appender_chunks_sync(const XLoggerInfo* _info, const char* _log) {
+    LogRecordChunker chunker(_info, _log);
+    __appender_frames_sync([&chunker](char* _buffer, size_t _len) { return chunker.Next(_buffer, _len); },
+                           _info ? _info->level : -1, _info ? _info->tag : NULL);
+}
+
+static void __appender_chunks_async(ScopedLock& _lock, const XLoggerInfo* _info, const char* _log) {
+    int level = _info ? _info->level : -1;
+    LogRecordChunker chunker(_info, _log);
+    if (!__appender_frames_async(_lock, [&chunker](char* _buffer, size_t _len) { return chunker.Next(_buffer, _len); },
+                                 level, _info ? _info->tag : NULL)) {
+        return;
+    }
+
+    if (sg_log_buff->GetData().Length() >= sg_log_buff->SegmentLength()*1/3 || kLevelFatal == level) {
+       sg_cond_buffer_async.notifyAll();
+    }
+}
+
+// 异步线程和 appender_flush_sync 调用, 持有 sg_mutex_buffer_async
+static void __appender_write_attachments(ScopedLock& _lock) {
+    LogAttachment attachment;
+    while (NULL != sg_log_buff && sg_attachments.Pop(attachment)) {
+        __appender_frames_async(_lock, [&attachment](char* _buffer, size_t _len) { return attachment.Next(_buffer, _len); },
+                                -1, NULL);
     }
 }
 
 static void __appender_sync(const XLoggerInfo* _info, const char* _log) {
+    if (LogRecordChunk::IsLarge(_log)) {
+        __appender_chunks_sync(_info, _log);
+        return;
+    }
+
+    int level = _info ? _info->level : -1;
 
-    char temp[16 * 1024] = {0};     // tell perry,ray if you want modify size.
-    PtrBuffer log(temp, 0, sizeof(temp));
+    aether::comm::XloggerScratchBuffer temp;
+    if (NULL == temp.Ptr()) {
+        sg_metrics.OnDrop(kLogDropNoMemory, level);
+        return;
+    }
+
+    PtrBuffer log(temp.Ptr(), 0, temp.Length());
     log_formater(_info, _log, log);
 
     AutoBuffer tmp_buff;
-    if (!sg_log_buff->Write(log.Ptr(), log.Length(), tmp_buff))   return;
+    if (!sg_log_buff->Write(log.Ptr(), log.Length(), tmp_buff, level, 0, _info ? _info->tag : NULL)) {
+        sg_metrics.OnDrop(kLogDropBufferFull, level);
+        return;
+    }
+    sg_metrics.OnRecord(log.Length());
 
-    __log2file(tmp_buff.Ptr(), tmp_buff.Length(), false);
+    __flush2file(tmp_buff.Ptr(), tmp_buff.Length(), false);
 }
 
 static void __appender_async(const XLoggerInfo* _info, const char* _log) {
-    ScopedLock lock(sg_mutex_buffer_async);
-    if (NULL == sg_log_buff) return;
+    int level = _info ? _info->level : -1;
+
+    ScopedLock lock(sg_mutex_buffer_async, false);
+    if (lock.trylock()) {
+        sg_metrics.OnLockWait(false, 0);
+    } else {
+        uint64_t begin_us = LogMetrics::NowUs();
+        lock.lock();
+        sg_metrics.OnLockWait(true, LogMetrics::NowUs() - begin_us);
+    }
+    if (NULL == sg_log_buff) {
+        sg_metrics.OnDrop(kLogDropClosed, level);
+        return;
+    }
+    if (LogRecordChunk::IsLarge(_log)) {
+        __appender_chunks_async(lock, _info, _log);
+        return;
+    }
 
-    char temp[16*1024] = {0};       //tell perry,ray if you want modify size.
-    PtrBuffer log_buff(temp, 0, sizeof(temp));
+    aether::comm::XloggerScratchBuffer temp;
+    if (NULL == temp.Ptr()) {
+        sg_metrics.OnDrop(kLogDropNoMemory, level);
+        return;
+    }
+
+    PtrBuffer log_buff(temp.Ptr(), 0, temp.Length());
     log_formater(_info, _log, log_buff);
 
-    if (sg_log_buff->GetData().Length() >= kBufferBlockLength*4/5) {
-       int ret = snprintf(temp, sizeof(temp), "[F][ sg_buffer_async.Length() >= BUFFER_BLOCK_LENTH*4/5, len: %d\n", (int)sg_log_buff->GetData().Length());
-       log_buff.Length(ret, ret);
+    // 多段时先换段; 没有空闲段可换时流水线模式下跟着落盘, 否则换成告警
+    if (sg_log_buff->GetData().Length() >= sg_log_buff->SegmentLength()*4/5 && !sg_log_buff->Seal()) {
+        if (sg_log_buff->IsPipeline()) {
+            __appender_flush_inline(lock);
+            if (NULL == sg_log_buff) {
+                sg_metrics.OnDrop(kLogDropClosed, level);
+                return;
+            }
+        } else {
+            int ret = snprintf(temp.Ptr(), temp.Length(), "[F][ sg_buffer_async.Length() >= BUFFER_BLOCK_LENTH*4/5, len: %d\n", (int)sg_log_buff->GetData().Length());
+            log_buff.Length(ret, ret);
+        }
     }
 
-    if (!sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length())) return;
+    bool written = sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length(), level, 0, _info ? _info->tag : NULL);
+    // 流水线模式下段都在等压缩、落盘时写入方跟着落盘, 等出空闲段再写, 不丢日志.
+    // 落盘期间放开了锁, 别的写入方可能又把段写满, 那就再来一轮; 空段都写不下时不再重试
+    while (!written && NULL != sg_log_buff && sg_log_buff->IsPipeline()) {
+        __appender_flush_inline(lock);
+        if (NULL == sg_log_buff) break;
+        bool contended = 0 < sg_log_buff->GetData().Length();
+        written = sg_log_buff->Write(log_buff.Ptr(), (unsigned int)log_buff.Length(), level, 0, _info ? _info->tag : NULL);
+        if (!contended) break;
+    }
+    if (!written) {
+        sg_metrics.OnDrop(NULL == sg_log_buff ? kLogDropClosed : kLogDropBufferFull, level);
+        return;
+    }
+    sg_metrics.OnRecord(log_buff.Length());
+    sg_metrics.SetBufferFill(sg_log_buff->GetData().Length(), sg_log_buff->SegmentLength());
 
-    if (sg_log_buff->GetData().Length() >= kBufferBlockLength*1/3 || (NULL!=_info && kLevelFatal == _info->level)) {
+    if (sg_log_buff->GetData().Length() >= sg_log_buff->SegmentLength()*1/3 || (NULL!=_info && kLevelFatal == _info->level)) {
        sg_cond_buffer_async.notifyAll();
     }
 
@@ -674,7 +817,10 @@ static void __appender_async(const XLoggerInfo* _info, const char* _log) {
 ////////////////////////////////////////////////////////////////////////////////////
 
 void xlogger_appender(const XLoggerInfo* _info, const char* _log) {
-    if (sg_log_close) return;
+    if (sg_log_close) {
+        sg_metrics.OnDrop(kLogDropClosed, _info ? _info->level : -1);
+        return;
+    }
 
     SCOPE_ERRNO();
 
@@ -760,37 +906,15 @@ const char* xlogger_dump(const void* _dumpbuffer, size_t _len) {
 
     ASSERT(NULL != sg_tss_dumpfile.get());
 
-    struct timeval tv = {0};
-    gettimeofday(&tv, NULL);
-    time_t sec = tv.tv_sec;
-    tm tcur = *localtime((const time_t*)&sec);
-
-    char forder_name [128] = {0};
-    snprintf(forder_name, sizeof(forder_name), "%d%02d%02d", 1900 + tcur.tm_year, 1 + tcur.tm_mon, tcur.tm_mday);
-
-    std::string filepath =  sg_logdir + "/" + forder_name + "/";
-
-    if (!boost::filesystem::exists(filepath))
-        boost::filesystem::create_directory(filepath);
-    
-
-    char file_name [128] = {0};
-    snprintf(file_name, sizeof(file_name), "%d%02d%02d%02d%02d%02d_%d.dump", 1900 + tcur.tm_year, 1 + tcur.tm_mon, tcur.tm_mday,
-             tcur.tm_hour, tcur.tm_min, tcur.tm_sec, (int)_len);
-    filepath += file_name;
-
-    FILE* fileid = fopen(filepath.c_str(), "wb");
-
-    if (NULL == fileid) {
-        ASSERT2(NULL != fileid, "%s, errno:(%d, %s)", filepath.c_str(), errno, strerror(errno));
-        return "";
-    }
-
-    fwrite(_dumpbuffer, _len, 1, fileid);
-    fclose(fileid);
+    // 整块数据作为附件随日志写入, 解码时用 xlogdecode -a 取出; 这里只留前 512 字节的十六进制
+    uint32_t id = appender_attach("dump", _dumpbuffer, _len);
 
     char* dump_log = (char*)sg_tss_dumpfile.get();
-    dump_log += snprintf(dump_log, 4096, "\n dump file to %s :\n", filepath.c_str());
+    if (0 != id) {
+        dump_log += snprintf(dump_log, 4096, "\n dump attachment %08x, %d bytes :\n", id, (int)_len);
+    } else {
+        dump_log += snprintf(dump_log, 4096, "\n dump %d bytes, attach fail :\n", (int)_len);
+    }
 
     int dump_len = 0;
 
@@ -803,6 +927,35 @@ const char* xlogger_dump(const void* _dumpbuffer, size_t _len) {
     return (const char*)sg_tss_dumpfile.get();
 }
 
+uint32_t appender_attach(const char* _name, const void* _data, size_t _len) {
+    if (NULL == _data || 0 == _len || LogAttachment::kMaxLength < _len) return 0;
+    if (sg_log_close) {
+        sg_metrics.OnDrop(kLogDropClosed, -1);
+        return 0;
+    }
+
+    // 在锁外复制
+    LogAttachment attachment(_name, _data, _len);
+    uint32_t id = attachment.Id();
+
+    if (kAppednerSync == sg_mode) {
+        return __appender_frames_sync([&attachment](char* _buffer, size_t _len) { return attachment.Next(_buffer, _len); },
+                                      -1, NULL) ? id : 0;
+    }
+
+    ScopedLock lock(sg_mutex_buffer_async);
+    if (NULL == sg_log_buff) {
+        sg_metrics.OnDrop(kLogDropClosed, -1);
+        return 0;
+    }
+    if (!sg_attachments.Push(attachment)) {
+        sg_metrics.OnDrop(kLogDropBufferFull, -1);
+        return 0;
+    }
+    sg_cond_buffer_async.notifyAll();
+    return id;
+}
+
 
 static void get_mark_info(char* _info, size_t _infoLen) {
     struct timeval tv;
@@ -814,75 +967,42 @@ static void get_mark_info(char* _info, size_t _infoLen) {
     snprintf(_info, _infoLen, "[%" PRIdMAX ",%" PRIdMAX "][%s]", xlogger_pid(), xlogger_tid(), tmp_time);
 }
 
-void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key, bool _is_compress) {
-    assert(_dir);
-    assert(_nameprefix);
-    
-    if (!sg_log_close) {
-        __writetips2file("appender has already been opened. _dir:%s _nameprefix:%s", _dir, _nameprefix);
-        return;
-    }
-
-    xlogger_SetAppender(&xlogger_appender);
-    
+static void __make_log_dirs(const std::string& _dir) {
     boost::filesystem::create_directories(_dir);
-    tickcount_t tick;
-    tick.gettickcount();
-    Thread(std::bind(&__del_timeout_file, _dir)).start_after(2 * 60 * 1000);
-    
-    tick.gettickcount();
+    if (!sg_cache_logdir.empty()) boost::filesystem::create_directories(sg_cache_logdir);
 
 #ifdef __APPLE__
-    setAttrProtectionNone(_dir);
+    setAttrProtectionNone(_dir.c_str());
+    if (!sg_cache_logdir.empty()) setAttrProtectionNone(sg_cache_logdir.c_str());
 #endif
+}
 
-    char mmap_file_path[512] = {0};
-    snprintf(mmap_file_path, sizeof(mmap_file_path), "%s/%s.mmap3", sg_cache_logdir.empty()?_dir:sg_cache_logdir.c_str(), _nameprefix);
-
-    bool use_mmap = false;
-    if (OpenMmapFile(mmap_file_path, kBufferBlockLength, sg_mmmap_file))  {
-        sg_log_buff = new LogBuffer(sg_mmmap_file.data(), kBufferBlockLength, _is_compress, _pub_key);
-        use_mmap = true;
-    } else {
-        char* buffer = new char[kBufferBlockLength];
-        sg_log_buff = new LogBuffer(buffer, kBufferBlockLength, _is_compress, _pub_key);
-        use_mmap = false;
-    }
-
-    if (NULL == sg_log_buff->GetData().Ptr()) {
-        if (use_mmap && sg_mmmap_file.is_open())  CloseMmapFile(sg_mmmap_file);
-        return;
-    }
-
-
-    AutoBuffer buffer;
-    sg_log_buff->Flush(buffer);
+static void __write_recovered(const AutoBuffer& _buffer) {
+    if (NULL == _buffer.Ptr()) return;
 
-    ScopedLock lock(sg_mutex_log_file);
-    sg_logdir = _dir;
-    sg_logfileprefix = _nameprefix;
-    sg_log_close = false;
-    appender_setmode(_mode);
-    lock.unlock();
-    
     char mark_info[512] = {0};
     get_mark_info(mark_info, sizeof(mark_info));
 
-    if (buffer.Ptr()) {
-        __writetips2file("~~~~~ begin of mmap ~~~~~\n");
-        __log2file(buffer.Ptr(), buffer.Length(), false);
-        __writetips2file("~~~~~ end of mmap ~~~~~%s\n", mark_info);
-    }
+    __writetips2file("~~~~~ begin of mmap ~~~~~\n");
+    __log2file(_buffer.Ptr(), _buffer.Length(), false);
+    __writetips2file("~~~~~ end of mmap ~~~~~%s\n", mark_info);
+}
 
-    tickcountdiff_t get_mmap_time = tickcount_t().gettickcount() - tick;
+static void __write_open_header(TAppenderMode _mode, bool _use_mmap, bool _fast_open, tickcountdiff_t _open_time) {
+    char mark_info[512] = {0};
+    get_mark_info(mark_info, sizeof(mark_info));
 
     char appender_info[728] = {0};
     snprintf(appender_info, sizeof(appender_info), "^^^^^^^^^^" __DATE__ "^^^" __TIME__ "^^^^^^^^^^%s", mark_info);
 
     xlogger_appender(NULL, appender_info);
     char logmsg[256] = {0};
-    snprintf(logmsg, sizeof(logmsg), "get mmap time: %" PRIu64, (int64_t)get_mmap_time);
+    snprintf(logmsg, sizeof(logmsg), "appender open time: %" PRIu64 ", fast open:%d", (int64_t)_open_time, _fast_open);
     xlogger_appender(NULL, logmsg);
+    if (!sg_process_name.empty()) {
+        snprintf(logmsg, sizeof(logmsg), "appender process:%s, pid:%d", sg_process_name.c_str(), (int)getpid());
+        xlogger_appender(NULL, logmsg);
+    }
 
     xlogger_appender(NULL, "AETHER_PATH: " AETHER_PATH);
     xlogger_appender(NULL, "AETHER_REVISION: " AETHER_REVISION);
@@ -912,7 +1032,7 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
         xlogger_appender(NULL, "=== End Header Info ===");
     }
 
-    snprintf(logmsg, sizeof(logmsg), "log appender mode:%d, use mmap:%d", (int)_mode, use_mmap);
+    snprintf(logmsg, sizeof(logmsg), "log appender mode:%d, use mmap:%d", (int)_mode, _use_mmap);
     xlogger_appender(NULL, logmsg);
     
     if (!sg_cache_logdir.empty()) {
@@ -924,6 +1044,106 @@ void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefi
     boost::filesystem::space_info info = boost::filesystem::space(sg_logdir);
     snprintf(logmsg, sizeof(logmsg), "log dir space info, capacity:%" PRIuMAX" free:%" PRIuMAX" available:%" PRIuMAX, info.capacity, info.free, info.available);
     xlogger_appender(NULL, logmsg);
+}
+
+void appender_open(TAppenderMode _mode, const char* _dir, const char* _nameprefix, const char* _pub_key, bool _is_compress) {
+    assert(_dir);
+    assert(_nameprefix);
+    
+    if (!sg_log_close) {
+        __writetips2file("appender has already been opened. _dir:%s _nameprefix:%s", _dir, _nameprefix);
+        return;
+    }
+
+    tickcount_t tick;
+    tick.gettickcount();
+
+    xlogger_SetAppender(&xlogger_appender);
+
+    // 同步模式每条日志都直接落盘, 快速打开没有意义
+    bool fast_open = sg_fast_open && kAppednerAsync == _mode;
+    if (!fast_open) __make_log_dirs(_dir);
+
+    // 目录里其他实例不认领的日志都按这里的保留时间清理, 首次清理在 2 分钟后
+    std::vector<std::string> retention_dirs(1, _dir);
+    if (!sg_cache_logdir.empty()) retention_dirs.push_back(sg_cache_logdir);
+    sg_retention_id = LogRetention::Singleton()->Register("", retention_dirs, sg_max_alive_time, sg_max_total_size);
+
+    std::string mmap_dir = sg_cache_logdir.empty() ? std::string(_dir) : sg_cache_logdir;
+    std::string mmap_prefix = LogBuffer::MmapPrefix(_nameprefix, sg_process_name);
+    // 流水线压缩时段数至少比压缩线程多一个, 压缩线程各压一段时写入方还有段可写
+    unsigned int segments = sg_buffer_segments;
+    if (0 < sg_compress_threads) {
+        LogCompressPool::Singleton()->Reserve(sg_compress_threads);
+        segments = std::max(segments, std::min(sg_compress_threads + 1, kMaxBufferSegments));
+    }
+    std::string mmap_file_path = LogBuffer::MmapPath(mmap_dir, mmap_prefix, segments);
+    size_t buffer_len = (size_t)sg_buffer_size * segments;
+
+    // 快速打开只有首次启动、mmap 所在目录还不存在时才同步建目录
+    if (fast_open && !boost::filesystem::exists(mmap_dir)) boost::filesystem::create_directories(mmap_dir);
+
+    // 另一个进程用着同一个前缀(或同一个进程名)时不碰它的 mmap, 这次只用堆内存
+    bool own_mmap = LogBuffer::LockMmap(mmap_dir, mmap_prefix, sg_mmap_lock);
+    if (!own_mmap) {
+        __writetips2console("mmap of %s is used by another process, use memory buffer", mmap_prefix.c_str());
+    }
+
+    // 缓冲区大小或段数改过时, 按旧布局留下的 mmap 文件先取出日志再删除
+    std::shared_ptr<AutoBuffer> buffer(new AutoBuffer);
+    if (!fast_open && own_mmap) LogBuffer::RecoverStaleMmap(mmap_dir, mmap_prefix, mmap_file_path, buffer_len, *buffer, NULL);
+
+    bool use_mmap = own_mmap && OpenMmapFile(mmap_file_path.c_str(), (unsigned int)buffer_len, sg_mmmap_file);
+
+    if (use_mmap)  {
+        sg_log_buff = new LogBuffer(sg_mmmap_file.data(), buffer_len, _is_compress, _pub_key, segments);
+    } else {
+        sg_buffer_mem = new char[buffer_len];
+        sg_log_buff = new LogBuffer(sg_buffer_mem, buffer_len, _is_compress, _pub_key, segments);
+    }
+
+    if (NULL == sg_log_buff->GetData().Ptr()) {
+        if (use_mmap && sg_mmmap_file.is_open())  CloseMmapFile(sg_mmmap_file);
+        LogBuffer::UnlockMmap(sg_mmap_lock);
+        return;
+    }
+    sg_log_buff->SetMetrics(&sg_metrics);
+    sg_log_buff->SetPipeline(0 < sg_compress_threads);
+    sg_log_buff->SetHeaderV2(sg_block_header_v2);
+    sg_metrics_summary_us = LogMetrics::NowUs();
+
+    // 上次没落盘的日志取出来单独写, 不和本次的日志混在同一块里
+    sg_log_buff->Flush(*buffer);
+
+    if (fast_open) {
+        // 线程启动很快, 打开耗时算到这里为止; 收尾工作在异步线程第一次落盘前执行, 这期间的写入照常进缓冲区
+        tickcountdiff_t open_time = tickcount_t().gettickcount() - tick;
+        std::string logdir(_dir);
+        ScopedLock lock_deferred(sg_mutex_open_deferred);
+        sg_open_deferred = [=]() {
+            __make_log_dirs(logdir);
+            AutoBuffer stale;
+            if (own_mmap) LogBuffer::RecoverStaleMmap(mmap_dir, mmap_prefix, mmap_file_path, buffer_len, stale, NULL);
+            __write_recovered(stale);
+            __write_recovered(*buffer);
+            __write_open_header(_mode, use_mmap, true, open_time);
+        };
+    }
+
+    ScopedLock lock(sg_mutex_log_file);
+    sg_logdir = _dir;
+    sg_logfileprefix = _nameprefix;
+    // 多进程模式下各进程追加同一个日志文件
+    sg_logfile.SetShared(!sg_process_name.empty());
+    sg_log_close = false;
+    appender_setmode(_mode);
+    lock.unlock();
+
+    if (!fast_open) {
+        __write_recovered(*buffer);
+        __write_open_header(_mode, use_mmap, false, tickcount_t().gettickcount() - tick);
+    }
+    aether::comm::XloggerTrace::SetSink(&__appender_write_trace);
 
     BOOT_RUN_EXIT(appender_close);
 
@@ -938,18 +1158,15 @@ void appender_open_with_cache(TAppenderMode _mode, const std::string& _cachedir,
     sg_logdir = _logdir;
     sg_cache_log_days = _cache_days;
 
+    // 缓存目录在 appender_open 里和日志目录一起创建
     if (!_cachedir.empty()) {
         sg_cache_logdir = _cachedir;
-        boost::filesystem::create_directories(_cachedir);
 
-        Thread(std::bind(&__del_timeout_file, _cachedir)).start_after(2 * 60 * 1000);
-        // "_nameprefix" must explicitly convert to "std::string", or when the thread is ready to run, "_nameprefix" has been released.
-        Thread(std::bind(&__move_old_files, _cachedir, _logdir, std::string(_nameprefix))).start_after(3 * 60 * 1000);
+        // "_nameprefix" must explicitly convert to "std::string", or when the timer fires, "_nameprefix" has been released.
+        // 搬移要拷贝整个缓存目录, 在时间轮的后台线程上做
+        TimerWheel::Singleton()->ScheduleBlocking(3 * 60 * 1000, std::bind(&__move_old_files, _cachedir, _logdir, std::string(_nameprefix)));
     }
 
-#ifdef __APPLE__
-    setAttrProtectionNone(_cachedir.c_str());
-#endif
     appender_open(_mode, _logdir.c_str(), _nameprefix, _pub_key, _is_compress);
 
 }
@@ -959,6 +1176,7 @@ void appender_flush() {
 }
 
 void appender_flush_sync() {
+    aether::comm::XloggerTrace::FlushAll();
     if (kAppednerSync == sg_mode) {
         return;
     }
@@ -967,24 +1185,30 @@ void appender_flush_sync() {
     
     if (NULL == sg_log_buff) return;
 
-    AutoBuffer tmp;
-    sg_log_buff->Flush(tmp);
-
-    lock_buffer.unlock();
-
-    if (tmp.Ptr())  __log2file(tmp.Ptr(), tmp.Length(), false);
+    __appender_write_attachments(lock_buffer);
+    if (NULL == sg_log_buff) return;
+    sg_log_buff->FlushSegments(lock_buffer, [](const void* _data, size_t _len, const LogBlockStat&) {
+        __flush2file(_data, _len, false);
+    });
+    sg_metrics.SetBufferFill(sg_log_buff->GetData().Length(), sg_log_buff->SegmentLength());
 
 }
 
 void appender_close() {
     if (sg_log_close) return;
 
+    __run_open_deferred();
+
     char mark_info[512] = {0};
     get_mark_info(mark_info, sizeof(mark_info));
     char appender_info[728] = {0};
     snprintf(appender_info, sizeof(appender_info), "$$$$$$$$$$" __DATE__ "$$$" __TIME__ "$$$$$$$$$$%s\n", mark_info);
     xlogger_appender(NULL, appender_info);
 
+    // 关闭前把各线程缓冲的 trace 事件写进去
+    aether::comm::XloggerTrace::FlushAll();
+    aether::comm::XloggerTrace::SetSink(NULL);
+
     sg_log_close = true;
 
     sg_cond_buffer_async.notifyAll();
@@ -994,20 +1218,28 @@ void appender_close() {
 
     
     ScopedLock buffer_lock(sg_mutex_buffer_async);
+    // 异步线程最后一轮之后才排进来的附件
+    for (size_t i = sg_attachments.Clear(); 0 < i; --i) sg_metrics.OnDrop(kLogDropClosed, -1);
+    // 先等压缩线程放开段再解除映射
+    delete sg_log_buff;
+    sg_log_buff = NULL;
     if (sg_mmmap_file.is_open()) {
-        if (!sg_mmmap_file.operator !()) memset(sg_mmmap_file.data(), 0, kBufferBlockLength);
+        if (!sg_mmmap_file.operator !()) memset(sg_mmmap_file.data(), 0, sg_mmmap_file.size());
 
         CloseMmapFile(sg_mmmap_file);
     } else {
-        delete[] (char*)((sg_log_buff->GetData()).Ptr());
+        delete[] sg_buffer_mem;
+        sg_buffer_mem = NULL;
     }
-
-    delete sg_log_buff;
-    sg_log_buff = NULL;
+    LogBuffer::UnlockMmap(sg_mmap_lock);
     buffer_lock.unlock();
 
     ScopedLock lock(sg_mutex_log_file);
     __closelogfile();
+    lock.unlock();
+
+    LogRetention::Singleton()->Unregister(sg_retention_id);
+    sg_retention_id = LogRetention::kInvalidModuleId;
 }
 
 void appender_setmode(TAppenderMode _mode) {
@@ -1049,8 +1281,60 @@ void appender_set_max_file_size(uint64_t _max_byte_size) {
 void appender_set_max_alive_duration(long _max_time) {
 	if (_max_time >= kMinLogAliveTime) {
 		sg_max_alive_time = _max_time;
+		LogRetention::Singleton()->SetMaxAliveTime(sg_retention_id, _max_time);
 	}
 }
+
+void appender_set_buffer_size(unsigned int _segment_size, unsigned int _segments) {
+    sg_buffer_size = std::min(std::max(_segment_size, kMinBufferSize), kMaxBufferSize);
+    sg_buffer_segments = std::min(std::max(_segments, 1u), kMaxBufferSegments);
+}
+
+void appender_set_fast_open(bool _fast_open) {
+    sg_fast_open = _fast_open;
+}
+
+void appender_set_compress_threads(unsigned int _threads) {
+    sg_compress_threads = std::min(_threads, (unsigned int)LogCompressPool::kMaxThreads);
+}
+
+unsigned int appender_get_compress_threads() {
+    return sg_compress_threads;
+}
+
+void appender_set_process_name(const char* _process_name) {
+    sg_process_name = NULL == _process_name ? "" : _process_name;
+}
+
+const char* appender_get_process_name() {
+    return sg_process_name.c_str();
+}
+
+void appender_set_block_header_v2(bool _v2) {
+    sg_block_header_v2 = _v2;
+}
+
+bool appender_get_block_header_v2() {
+    return sg_block_header_v2;
+}
+
+void appender_set_metrics_interval(unsigned int _seconds) {
+    sg_metrics_interval_s = _seconds;
+    sg_cond_buffer_async.notifyAll();
+}
+
+void appender_set_trace_mode(bool _is_open) {
+    aether::comm::XloggerTrace::SetEnabled(_is_open);
+}
+
+void appender_get_metrics(LogMetricsSnapshot& _snapshot) {
+    sg_metrics.GetSnapshot(_snapshot);
+}
+
+void appender_set_max_total_size(uint64_t _max_byte_size) {
+    sg_max_total_size = _max_byte_size;
+    LogRetention::Singleton()->SetQuota(sg_retention_id, _max_byte_size);
+}
 void appender_setExtraMSg(const char* _msg, unsigned int _len) {
     if (_msg == NULL || _len == 0) {
         sg_log_extra_msg.clear();
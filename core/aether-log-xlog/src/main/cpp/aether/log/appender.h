@@ -51,6 +51,103 @@ void appender_set_max_file_size(uint64_t _max_byte_size);
  */
 void appender_set_max_alive_duration(long _max_time);
 
+/*
+ * Size of the mmap buffer, takes effect on the next appender_open. With more than one segment,
+ * a full segment is flushed while writers continue in the next one.
+ *
+ * @param _segment_size    Byte size of each segment, default is 150KB, clamped to [64KB, 8MB].
+ * @param _segments        Number of segments, default is 1, at most 16.
+ */
+void appender_set_buffer_size(unsigned int _segment_size, unsigned int _segments);
+
+/*
+ * Fast open for the async mode, takes effect on the next appender_open. appender_open only maps the
+ * buffer and returns; directory creation, recovery of the previous buffer, header lines and disk
+ * space probes run on the async thread before its first flush. Writes are buffered meanwhile.
+ * The open time is written to the header either way.
+ *
+ * @param _fast_open    Default is false.
+ */
+void appender_set_fast_open(bool _fast_open);
+
+/*
+ * Pipelined compression for the async mode, takes effect on the next appender_open. Writers only
+ * copy (and encrypt) records into the buffer; each sealed segment is compressed and encrypted as a
+ * whole, with its own deflate stream, on a pool of threads shared by all instances, and the async
+ * thread writes the results in order. The buffer gets at least _threads + 1 segments. When every
+ * segment is waiting, writers flush inline instead of dropping records.
+ *
+ * @param _threads    Compression threads, default is 0 (compress on the writing thread), at most 8.
+ */
+void appender_set_compress_threads(unsigned int _threads);
+unsigned int appender_get_compress_threads();
+
+/*
+ * Multi-process mode for processes sharing one log directory, takes effect on the next
+ * appender_open. Each process maps its own buffer <prefix>@<process_name>.mmap3 and appends to
+ * the shared day files under an advisory lock, so blocks of different processes never interleave.
+ * With v2 block headers (appender_set_block_header_v2) blocks carry the pid and xlogdecode -m
+ * merges the processes by time. Without a process name a second process opening the same prefix
+ * falls back to a memory buffer instead of sharing the mmap.
+ *
+ * @param _process_name    Unique name per process, e.g. "main", "push"; NULL or "" disables.
+ */
+void appender_set_process_name(const char* _process_name);
+const char* appender_get_process_name();
+
+/*
+ * Block header format, takes effect on the next appender_open. v2 headers record the millisecond
+ * time range, record count, pid, a level mask and a tag Bloom filter, so queries skip blocks
+ * without decoding them. Decoders that only know the upstream Mars format (magics 0x06-0x09)
+ * drop every record of a v2 block; enable it only once all readers use xlogdecode / LogDecoder.
+ *
+ * @param _v2    Default is false (v1 headers).
+ */
+void appender_set_block_header_v2(bool _v2);
+bool appender_get_block_header_v2();
+
+/*
+ * Write a one-line metrics summary (records, bytes after compression/encryption, drops, flush and
+ * lock wait percentiles, buffer fill) into the log every _seconds, from the async thread.
+ *
+ * @param _seconds    0 disables the summary. Default is 0.
+ */
+void appender_set_metrics_interval(unsigned int _seconds);
+
+/*
+ * Record xscope/xfunction scopes, xtrace_counter and xtrace_instant as binary events with
+ * monotonic ns timestamps instead of text lines. Events are buffered per thread and written into
+ * the log stream before each flush; the decoder strips them from the text and can export them as
+ * Chrome trace-event JSON (xlogdecode -x).
+ *
+ * @param _is_open    Default is false.
+ */
+void appender_set_trace_mode(bool _is_open);
+
+/*
+ * Store a binary blob inside the log stream, compressed and encrypted like text records, so it is
+ * covered by retention and upload together with the log files. The data is copied and handed to
+ * the async thread (written on the calling thread in sync mode); the decoder extracts it as a file
+ * named after the returned id (xlogdecode -a). Log the id to refer to the attachment.
+ *
+ * @param _name    Short name kept with the data, may be NULL; truncated to 64 bytes.
+ * @return         Reference id, 0 if the appender is closed, _len is 0 or above 4MB, or too many
+ *                 attachments are waiting for the async thread.
+ */
+uint32_t appender_attach(const char* _name, const void* _data, size_t _len);
+
+/*
+ * Counters of the global appender, accumulated since the process started.
+ */
+void appender_get_metrics(struct LogMetricsSnapshot& _snapshot);
+
+/*
+ * Total size quota of log files not claimed by other instances, oldest files are deleted first.
+ *
+ * @param _max_byte_size    Max total byte size, default is 0, meaning no quota.
+ */
+void appender_set_max_total_size(uint64_t _max_byte_size);
+
 /*
  * Set custom header information to be written to log file
  *
@@ -0,0 +1,959 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * xlog_bench.cc
+ *
+ * xlogbench [-d workdir] [-o output] [-f filter] [-q]
+ * 日志引擎的性能基准: xlogger 前端、数字格式化、格式化、LogBuffer 写入、TEA 加密、XloggerAppender 多线程吞吐、流水线压缩、共享文件写入、write(2) 和 io_uring 对比、落盘延迟、GetPeriodLogs、时间轮.
+ * 结果以 JSON 输出, 每项一个对象, 方便 CI 里对比前后两次的数据.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <getopt.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "autobuffer.h"
+#include "num_format.h"
+#include "ptrbuffer.h"
+#include "thread/timer_wheel.h"
+#include "verinfo.h"
+#include "xloggerbase.h"
+#include "aether/common/xlogger/xlogger.h"
+#include "appender.h"
+#include "log_buffer.h"
+#include "log_file_writer.h"
+#include "xlog_config.h"
+#include "xlogger_appender.h"
+#include "crypt/log_crypt.h"
+#include "crypt/micro-ecc-master/uECC.h"
+
+extern void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log);
+
+using aether::xlog::XLogConfig;
+using aether::xlog::XloggerAppender;
+
+// 替换全局 operator new, 统计前端每条日志的堆分配次数
+static std::atomic<uint64_t> sg_allocs(0);
+
+void* operator new(size_t _size) {
+    sg_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(0 < _size ? _size : 1);
+    if (NULL == ptr) abort();
+    return ptr;
+}
+
+void operator delete(void* _ptr) noexcept {
+    free(_ptr);
+}
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    std::vector<std::pair<std::string, std::string> > params;
+    std::vector<std::pair<std::string, double> > metrics;
+};
+
+struct BenchContext {
+    std::string workdir;
+    std::string filter;
+    bool quick = false;
+    std::string pubkey;  // 临时生成的服务端公钥, 只用来打开加密
+    std::vector<BenchResult> results;
+    int failures = 0;    // 校验不通过的项数, 非 0 时进程返回 1
+};
+
+const size_t kSegmentSize = 150 * 1024;
+const char* const kLogBody = "bench: request finished, uid=1024 cost=37ms status=200 path=/api/v1/feed?page=3&size=20";
+
+uint64_t __NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void __FillInfo(XLoggerInfo& _info, TLogLevel _level) {
+    memset(&_info, 0, sizeof(_info));
+    _info.level = _level;
+    _info.tag = "bench";
+    _info.filename = "/src/aether/bench/xlog_bench.cc";
+    _info.func_name = "void __Bench(BenchContext&)";
+    _info.line = 128;
+    gettimeofday(&_info.timeval, NULL);
+    _info.pid = getpid();
+    _info.tid = 1;
+    _info.maintid = 1;
+}
+
+uint64_t __ThreadCpuNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+size_t __Iterations(const BenchContext& _ctx, size_t _full) {
+    return _ctx.quick ? std::max<size_t>(_full / 20, 1) : _full;
+}
+
+bool __Selected(const BenchContext& _ctx, const std::string& _name) {
+    return _ctx.filter.empty() || std::string::npos != _name.find(_ctx.filter);
+}
+
+void __AddThroughput(BenchResult& _result, size_t _ops, uint64_t _bytes, uint64_t _elapsed_ns) {
+    double seconds = (double)_elapsed_ns / 1e9;
+    _result.metrics.push_back(std::make_pair("iterations", (double)_ops));
+    _result.metrics.push_back(std::make_pair("elapsed_ms", (double)_elapsed_ns / 1e6));
+    _result.metrics.push_back(std::make_pair("ns_per_op", 0 < _ops ? (double)_elapsed_ns / _ops : 0));
+    _result.metrics.push_back(std::make_pair("ops_per_sec", 0 < seconds ? _ops / seconds : 0));
+    if (0 < _bytes) _result.metrics.push_back(std::make_pair("bytes_per_sec", 0 < seconds ? _bytes / seconds : 0));
+}
+
+void __AddPercentiles(BenchResult& _result, std::vector<uint64_t>& _samples_ns) {
+    if (_samples_ns.empty()) return;
+    std::sort(_samples_ns.begin(), _samples_ns.end());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < _samples_ns.size(); ++i) sum += _samples_ns[i];
+
+    const double kPercentiles[] = {50, 90, 99};
+    const char* const kNames[] = {"p50_us", "p90_us", "p99_us"};
+    _result.metrics.push_back(std::make_pair("samples", (double)_samples_ns.size()));
+    _result.metrics.push_back(std::make_pair("mean_us", (double)sum / _samples_ns.size() / 1e3));
+    for (size_t i = 0; i < sizeof(kPercentiles) / sizeof(kPercentiles[0]); ++i) {
+        size_t index = std::min(_samples_ns.size() - 1, (size_t)(_samples_ns.size() * kPercentiles[i] / 100));
+        _result.metrics.push_back(std::make_pair(kNames[i], (double)_samples_ns[index] / 1e3));
+    }
+    _result.metrics.push_back(std::make_pair("max_us", (double)_samples_ns.back() / 1e3));
+}
+
+XloggerAppender* __NewAppender(const BenchContext& _ctx, const std::string& _name, TAppenderMode _mode,
+                               unsigned int _segments = 1, unsigned int _compress_threads = 0) {
+    XLogConfig config;
+    config.mode_ = _mode;
+    config.logdir_ = _ctx.workdir + "/" + _name;
+    config.nameprefix_ = "bench";
+    config.is_compress_ = true;
+    config.persist_inventory_ = false;
+    config.buffer_segments_ = _segments;
+    config.compress_threads_ = _compress_threads;
+    return XloggerAppender::NewInstance(config, 0);
+}
+
+void __DiscardLog(const XLoggerInfo* _info, const char* _log) {}
+
+// xinfo2 各种写法从判断级别到交给 appender 的开销, appender 直接丢弃; 先写一条让线程的消息缓存就位
+template <typename Log>
+void __BenchFrontendCase(BenchContext& _ctx, const std::string& _name, Log _log) {
+    if (!__Selected(_ctx, _name)) return;
+
+    size_t iterations = __Iterations(_ctx, 1000000);
+    _log(0);
+    uint64_t allocs = sg_allocs.load(std::memory_order_relaxed);
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        _log(i);
+    }
+    uint64_t elapsed = __NowNs() - begin;
+    allocs = sg_allocs.load(std::memory_order_relaxed) - allocs;
+
+    BenchResult result;
+    result.name = _name;
+    __AddThroughput(result, iterations, 0, elapsed);
+    result.metrics.push_back(std::make_pair("allocs_per_op", (double)allocs / iterations));
+    _ctx.results.push_back(result);
+}
+
+void __BenchFrontend(BenchContext& _ctx) {
+    TLogLevel level = xlogger_Level();
+    xlogger_appender_t appender = xlogger_SetAppender(&__DiscardLog);
+    xlogger_SetLevel(kLevelVerbose);
+
+    const std::string path = "/api/v1/feed?page=3&size=20";
+    __BenchFrontendCase(_ctx, "frontend/typesafe", [&path](size_t _i) {
+        xinfo2(TSF"bench: request %_ finished, uid=%_ cost=%_ms status=%_ path=%_", _i, 1024, 37, 200, path);
+    });
+    __BenchFrontendCase(_ctx, "frontend/printf", [](size_t _i) {
+        xinfo2("bench: request %zu finished, uid=%d cost=%dms status=%d path=%s", _i, 1024, 37, 200, "/api/v1/feed?page=3&size=20");
+    });
+    __BenchFrontendCase(_ctx, "frontend/stream", [&path](size_t _i) {
+        xinfo2() << "bench: request " << _i << " finished, uid=" << 1024 << " path=" << path;
+    });
+
+    xlogger_SetLevel(level);
+    xlogger_SetAppender(appender);
+}
+
+// 数字格式化和 snprintf 对比, 每组 kernel/snprintf 两项; 输入每轮不同, 避免被优化掉
+template <typename Format>
+void __BenchNumberCase(BenchContext& _ctx, const std::string& _name, Format _format) {
+    if (!__Selected(_ctx, _name)) return;
+
+    size_t iterations = __Iterations(_ctx, 2000000);
+    char buffer[64];
+    uint64_t bytes = 0;
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        bytes += _format(i, buffer);
+    }
+    uint64_t elapsed = __NowNs() - begin;
+
+    BenchResult result;
+    result.name = _name;
+    __AddThroughput(result, iterations, bytes, elapsed);
+    _ctx.results.push_back(result);
+}
+
+void __BenchNumFormat(BenchContext& _ctx) {
+    __BenchNumberCase(_ctx, "num_format/int/kernel", [](size_t _i, char* _out) {
+        return numfmt::Int64ToA((int64_t)(_i * 2654435761ULL) - 1000000000, _out);
+    });
+    __BenchNumberCase(_ctx, "num_format/int/snprintf", [](size_t _i, char* _out) {
+        return (size_t)snprintf(_out, 64, "%lld", (long long)((int64_t)(_i * 2654435761ULL) - 1000000000));
+    });
+
+    // 有限位小数和随机位的 double 各一半
+    __BenchNumberCase(_ctx, "num_format/double/kernel", [](size_t _i, char* _out) {
+        double value = (0 == (_i & 1)) ? (double)(_i % 100000) / 1000.0 : (double)(_i * 2654435761ULL) / 3.0e7;
+        return numfmt::DoubleToA(value, _out);
+    });
+    __BenchNumberCase(_ctx, "num_format/double/snprintf", [](size_t _i, char* _out) {
+        double value = (0 == (_i & 1)) ? (double)(_i % 100000) / 1000.0 : (double)(_i * 2654435761ULL) / 3.0e7;
+        return (size_t)snprintf(_out, 64, "%.17g", value);
+    });
+
+    struct tm tm;
+    time_t now = time(NULL);
+    localtime_r(&now, &tm);
+    __BenchNumberCase(_ctx, "num_format/datetime/kernel", [&tm](size_t _i, char* _out) {
+        return (size_t)(numfmt::WriteDateTime(_out, tm, (int)(_i % 1000)) - _out);
+    });
+    __BenchNumberCase(_ctx, "num_format/datetime/snprintf", [&tm](size_t _i, char* _out) {
+        return (size_t)snprintf(_out, 64, "%04d-%02d-%02d %02d:%02d:%02d.%03d", 1900 + tm.tm_year, 1 + tm.tm_mon,
+                                tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(_i % 1000));
+    });
+}
+
+void __BenchFormater(BenchContext& _ctx) {
+    const std::string name = "formater";
+    if (!__Selected(_ctx, name)) return;
+
+    char buffer[16 * 1024];
+    XLoggerInfo info;
+    __FillInfo(info, kLevelInfo);
+
+    size_t iterations = __Iterations(_ctx, 1000000);
+    uint64_t bytes = 0;
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        PtrBuffer log(buffer, 0, sizeof(buffer));
+        log_formater(&info, kLogBody, log);
+        bytes += log.Length();
+    }
+    uint64_t elapsed = __NowNs() - begin;
+
+    BenchResult result;
+    result.name = name;
+    __AddThroughput(result, iterations, bytes, elapsed);
+    _ctx.results.push_back(result);
+}
+
+void __BenchBufferWrite(BenchContext& _ctx, bool _compress, bool _crypt) {
+    const std::string name = std::string("buffer_write/") + (_compress ? "compress" : "raw") + "/" + (_crypt ? "crypt" : "plain");
+    if (!__Selected(_ctx, name)) return;
+
+    // 和异步模式一样, 写到一段的 1/3 就取走
+    std::vector<char> memory(kSegmentSize);
+    LogBuffer buffer(&memory[0], memory.size(), _compress, _crypt ? _ctx.pubkey.c_str() : "");
+    AutoBuffer out;
+
+    char line[16 * 1024];
+    XLoggerInfo info;
+    __FillInfo(info, kLevelInfo);
+    PtrBuffer log(line, 0, sizeof(line));
+    log_formater(&info, kLogBody, log);
+
+    size_t iterations = __Iterations(_ctx, 500000);
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        buffer.Write(line, log.Length(), kLevelInfo, 0, "bench");
+        if (buffer.GetData().Length() >= kSegmentSize / 3) {
+            out.Reset();
+            buffer.Flush(out);
+        }
+    }
+    uint64_t elapsed = __NowNs() - begin;
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("compress", _compress ? "true" : "false"));
+    result.params.push_back(std::make_pair("crypt", _crypt ? "true" : "false"));
+    __AddThroughput(result, iterations, (uint64_t)iterations * log.Length(), elapsed);
+    _ctx.results.push_back(result);
+}
+
+void __BenchTea(BenchContext& _ctx) {
+    const size_t kChunk = 4096;
+    std::vector<char> input(kChunk);
+    for (size_t i = 0; i < kChunk; ++i) input[i] = (char)('a' + i % 26);
+    size_t iterations = __Iterations(_ctx, 100000);
+
+    if (__Selected(_ctx, "tea/encrypt")) {
+        LogCrypt crypt(_ctx.pubkey.c_str());
+        AutoBuffer out;
+        uint64_t begin = __NowNs();
+        for (size_t i = 0; i < iterations; ++i) {
+            size_t remain = 0;
+            out.Reset();
+            crypt.CryptAsyncLog(&input[0], kChunk, out, remain);
+        }
+        uint64_t elapsed = __NowNs() - begin;
+
+        BenchResult result;
+        result.name = "tea/encrypt";
+        result.params.push_back(std::make_pair("chunk_bytes", "4096"));
+        __AddThroughput(result, iterations, (uint64_t)iterations * kChunk, elapsed);
+        _ctx.results.push_back(result);
+    }
+
+    if (__Selected(_ctx, "tea/decrypt")) {
+        // 解密速度和密钥无关
+        const uint32_t kTeaKey[4] = {0x01234567, 0x89abcdef, 0xfedcba98, 0x76543210};
+        std::vector<char> data(input);
+        uint64_t begin = __NowNs();
+        for (size_t i = 0; i < iterations; ++i) {
+            LogCrypt::DecryptAsyncLog(&data[0], kChunk, kTeaKey);
+        }
+        uint64_t elapsed = __NowNs() - begin;
+
+        BenchResult result;
+        result.name = "tea/decrypt";
+        result.params.push_back(std::make_pair("chunk_bytes", "4096"));
+        __AddThroughput(result, iterations, (uint64_t)iterations * kChunk, elapsed);
+        _ctx.results.push_back(result);
+    }
+}
+
+// 总条数固定, 平均分给各线程; 计时到全部写完并落盘
+void __BenchAppender(BenchContext& _ctx, int _threads) {
+    char name[64];
+    snprintf(name, sizeof(name), "appender/threads:%d", _threads);
+    if (!__Selected(_ctx, name)) return;
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "appender_%d", _threads);
+    XloggerAppender* appender = __NewAppender(_ctx, dir, kAppednerAsync);
+
+    size_t total = __Iterations(_ctx, 400000);
+    size_t per_thread = total / _threads;
+    uint64_t begin = __NowNs();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < _threads; ++t) {
+        threads.push_back(std::thread([appender, per_thread, t]() {
+            XLoggerInfo info;
+            for (size_t i = 0; i < per_thread; ++i) {
+                __FillInfo(info, kLevelInfo);
+                info.tid = t + 1;
+                appender->Write(&info, kLogBody);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    uint64_t written = __NowNs() - begin;
+    appender->FlushSync();
+    uint64_t elapsed = __NowNs() - begin;
+
+    uint64_t file_bytes = 0;
+    std::vector<XloggerAppender::LogFileInfo> infos;
+    appender->GetLogFileInfos(infos);
+    for (size_t i = 0; i < infos.size(); ++i) file_bytes += infos[i].size;
+    LogMetricsSnapshot stats;
+    appender->GetMetrics(stats);
+    XloggerAppender::__Release(appender);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("threads", std::to_string(_threads)));
+    __AddThroughput(result, per_thread * _threads, 0, elapsed);
+    result.metrics.push_back(std::make_pair("write_ms", (double)written / 1e6));
+    result.metrics.push_back(std::make_pair("file_bytes", (double)file_bytes));
+    // appender 自己的统计: 丢弃数和写入时等锁的分布
+    result.metrics.push_back(std::make_pair("drops", (double)stats.Drops()));
+    result.metrics.push_back(std::make_pair("lock_contended", (double)stats.lock_contended));
+    result.metrics.push_back(std::make_pair("lock_wait_p99_us", (double)stats.lock_wait_us.Percentile(99)));
+    result.metrics.push_back(std::make_pair("flush_p99_us", (double)stats.flush_latency_us.Percentile(99)));
+    _ctx.results.push_back(result);
+}
+
+// 流水线压缩: 8 个线程持续写, 段数相同, 比较在写入线程上压缩和交给 _compress_threads 个压缩线程
+void __BenchPipeline(BenchContext& _ctx, unsigned int _compress_threads) {
+    char name[64];
+    snprintf(name, sizeof(name), "pipeline/compress_threads:%u", _compress_threads);
+    if (!__Selected(_ctx, name)) return;
+
+    const int kThreads = 8;
+    const unsigned int kSegments = 9;
+    char dir[64];
+    snprintf(dir, sizeof(dir), "pipeline_%u", _compress_threads);
+    XloggerAppender* appender = __NewAppender(_ctx, dir, kAppednerAsync, kSegments, _compress_threads);
+
+    size_t per_thread = __Iterations(_ctx, 800000) / kThreads;
+    uint64_t begin = __NowNs();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.push_back(std::thread([appender, per_thread, t]() {
+            XLoggerInfo info;
+            for (size_t i = 0; i < per_thread; ++i) {
+                __FillInfo(info, kLevelInfo);
+                info.tid = t + 1;
+                appender->Write(&info, kLogBody);
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+    appender->FlushSync();
+    uint64_t elapsed = __NowNs() - begin;
+
+    uint64_t file_bytes = 0;
+    std::vector<XloggerAppender::LogFileInfo> infos;
+    appender->GetLogFileInfos(infos);
+    for (size_t i = 0; i < infos.size(); ++i) file_bytes += infos[i].size;
+    LogMetricsSnapshot stats;
+    appender->GetMetrics(stats);
+    XloggerAppender::__Release(appender);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("threads", std::to_string(kThreads)));
+    result.params.push_back(std::make_pair("segments", std::to_string(kSegments)));
+    __AddThroughput(result, per_thread * kThreads, stats.bytes_in, elapsed);
+    result.metrics.push_back(std::make_pair("file_bytes", (double)file_bytes));
+    result.metrics.push_back(std::make_pair("drops", (double)stats.Drops()));
+    result.metrics.push_back(std::make_pair("lock_wait_p99_us", (double)stats.lock_wait_us.Percentile(99)));
+    _ctx.results.push_back(result);
+}
+
+// 超长日志分片写入: 一条比一段缓冲区还长的日志写完并落盘的吞吐
+void __BenchLargeRecord(BenchContext& _ctx, size_t _record_bytes) {
+    char name[64];
+    snprintf(name, sizeof(name), "appender/large_record:%zu", _record_bytes);
+    if (!__Selected(_ctx, name)) return;
+
+    // 多行, 和堆栈、格式化过的 JSON 一样每行都要缩进
+    std::string body;
+    while (body.size() < _record_bytes) {
+        body += kLogBody;
+        body += '\n';
+    }
+    body.resize(_record_bytes);
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "large_%zu", _record_bytes);
+    XloggerAppender* appender = __NewAppender(_ctx, dir, kAppednerAsync);
+
+    size_t iterations = __Iterations(_ctx, std::max<size_t>(64 * 1024 * 1024 / _record_bytes, 20));
+    XLoggerInfo info;
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        __FillInfo(info, kLevelInfo);
+        appender->Write(&info, body.c_str());
+    }
+    appender->FlushSync();
+    uint64_t elapsed = __NowNs() - begin;
+
+    LogMetricsSnapshot stats;
+    appender->GetMetrics(stats);
+    XloggerAppender::__Release(appender);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("record_bytes", std::to_string(_record_bytes)));
+    __AddThroughput(result, iterations, (uint64_t)iterations * _record_bytes, elapsed);
+    result.metrics.push_back(std::make_pair("drops", (double)stats.Drops()));
+    _ctx.results.push_back(result);
+}
+
+// 调用方只复制数据排队, 统计 Attach 的耗时分布和按批落盘的总吞吐
+void __BenchAttach(BenchContext& _ctx, size_t _blob_bytes) {
+    char name[64];
+    snprintf(name, sizeof(name), "appender/attach:%zu", _blob_bytes);
+    if (!__Selected(_ctx, name)) return;
+
+    std::string blob(_blob_bytes, '\0');
+    for (size_t i = 0; i < blob.size(); ++i) blob[i] = kLogBody[i % strlen(kLogBody)] ^ (char)i;
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "attach_%zu", _blob_bytes);
+    XloggerAppender* appender = __NewAppender(_ctx, dir, kAppednerAsync);
+
+    size_t iterations = __Iterations(_ctx, std::max<size_t>(64 * 1024 * 1024 / _blob_bytes, 20));
+    std::vector<uint64_t> samples;
+    samples.reserve(iterations);
+    size_t rejected = 0;
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        uint64_t call_begin = __NowNs();
+        if (0 == appender->Attach("bench", blob.data(), blob.size())) ++rejected;
+        samples.push_back(__NowNs() - call_begin);
+        // 每 4MB 一批, 不超过排队上限
+        if (0 == (i + 1) % (4 * 1024 * 1024 / _blob_bytes)) appender->FlushSync();
+    }
+    appender->FlushSync();
+    uint64_t elapsed = __NowNs() - begin;
+    XloggerAppender::__Release(appender);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("blob_bytes", std::to_string(_blob_bytes)));
+    __AddThroughput(result, iterations, (uint64_t)iterations * _blob_bytes, elapsed);
+    __AddPercentiles(result, samples);
+    result.metrics.push_back(std::make_pair("rejected", (double)rejected));
+    _ctx.results.push_back(result);
+}
+
+// 多进程模式下每次落盘多出 flock、stat 和 lseek, 和独占的写法对比单次 write 的开销.
+// 同时校验系统调用计数: 打开一次, 每次落盘一次 write; 独占模式落盘期间不 stat, 共享模式每次加锁 stat 一次
+void __BenchFileWriter(BenchContext& _ctx, bool _shared) {
+    std::string name = _shared ? "file_writer/shared" : "file_writer/exclusive";
+    if (!__Selected(_ctx, name)) return;
+
+    std::string path = _ctx.workdir + "/" + (_shared ? "shared.xlog" : "exclusive.xlog");
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+
+    LogFileWriter writer;
+    writer.SetShared(_shared);
+    if (!writer.Open(path.c_str())) {
+        fprintf(stderr, "%s: open %s fail:%s\n", name.c_str(), path.c_str(), strerror(errno));
+        return;
+    }
+
+    // Open 里的 fstat 不算在落盘里
+    const uint64_t open_stat = writer.Syscalls().stat;
+
+    const size_t kBlockBytes = 4096;
+    std::string block(kBlockBytes, 'x');
+    size_t iterations = __Iterations(_ctx, 20000);
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        writer.IsValid(time(NULL));
+        writer.Write(block.data(), block.size());
+    }
+    uint64_t elapsed = __NowNs() - begin;
+    LogFileWriter::SyscallCount syscalls = writer.Syscalls();
+    writer.Close();
+
+    uint64_t stat = syscalls.stat - open_stat;
+    uint64_t expect_stat = _shared ? iterations : 0;
+    if (1 != syscalls.open || iterations != syscalls.write || expect_stat != stat) {
+        fprintf(stderr, "%s: syscalls open:%llu write:%llu stat:%llu, expect open:1 write:%zu stat:%llu\n", name.c_str(),
+                (unsigned long long)syscalls.open, (unsigned long long)syscalls.write, (unsigned long long)stat,
+                iterations, (unsigned long long)expect_stat);
+        ++_ctx.failures;
+    }
+    boost::filesystem::remove(path, ec);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("block_bytes", std::to_string(kBlockBytes)));
+    __AddThroughput(result, iterations, (uint64_t)iterations * kBlockBytes, elapsed);
+    result.metrics.push_back(std::make_pair("open", (double)syscalls.open));
+    result.metrics.push_back(std::make_pair("write", (double)syscalls.write));
+    result.metrics.push_back(std::make_pair("stat", (double)stat));
+    _ctx.results.push_back(result);
+}
+
+// 同一份数据分别用 write(2) 和 io_uring 追加, 统计持续写入的吞吐(含关闭前等在途请求完成)和落盘线程自己的 CPU 时间
+void __BenchFileWriterUring(BenchContext& _ctx, bool _uring) {
+    std::string name = _uring ? "file_writer/io_uring" : "file_writer/write";
+    if (!__Selected(_ctx, name)) return;
+
+    std::string path = _ctx.workdir + "/" + (_uring ? "uring.xlog" : "write.xlog");
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+
+    LogFileWriter writer;
+    if (_uring && !writer.EnableIoUring()) {
+        fprintf(stderr, "%s: io_uring not supported, skipped\n", name.c_str());
+        return;
+    }
+    if (!writer.Open(path.c_str())) {
+        fprintf(stderr, "%s: open %s fail:%s\n", name.c_str(), path.c_str(), strerror(errno));
+        return;
+    }
+
+    // 一次落盘一段缓冲区, 间隔 20ms fdatasync, 和线上配置的同步策略一样
+    writer.SetSyncPolicy(kFileSyncInterval, 20);
+    std::string block(kSegmentSize, 'x');
+    size_t iterations = __Iterations(_ctx, 2000);
+    uint64_t begin = __NowNs();
+    uint64_t cpu_begin = __ThreadCpuNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        memcpy(&block[0], &i, sizeof(i));    // 读回时校验顺序
+        writer.Write(block.data(), block.size());
+    }
+    writer.Close();
+    uint64_t cpu = __ThreadCpuNs() - cpu_begin;
+    uint64_t elapsed = __NowNs() - begin;
+
+    size_t blocks = 0;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (NULL != file) {
+        std::string read(block.size(), '\0');
+        size_t index = 0;
+        while (1 == fread(&read[0], read.size(), 1, file) && (memcpy(&index, read.data(), sizeof(index)), index == blocks)) ++blocks;
+        fclose(file);
+    }
+    boost::filesystem::remove(path, ec);
+
+    if (iterations != blocks || 0 != writer.AsyncErrors()) {
+        fprintf(stderr, "%s: %zu of %zu blocks in order, async errors %llu\n", name.c_str(), blocks, iterations,
+                (unsigned long long)writer.AsyncErrors());
+        ++_ctx.failures;
+    }
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("block_bytes", std::to_string(block.size())));
+    __AddThroughput(result, iterations, (uint64_t)iterations * block.size(), elapsed);
+    result.metrics.push_back(std::make_pair("cpu_ms", (double)cpu / 1e6));
+    result.metrics.push_back(std::make_pair("cpu_ns_per_byte", (double)cpu / ((double)iterations * block.size())));
+    _ctx.results.push_back(result);
+}
+
+// 每轮写满一段的 1/3 左右再同步落盘, 统计 FlushSync 的耗时分布
+void __BenchFlushLatency(BenchContext& _ctx) {
+    const std::string name = "flush_latency";
+    if (!__Selected(_ctx, name)) return;
+
+    XloggerAppender* appender = __NewAppender(_ctx, "flush", kAppednerAsync);
+    size_t rounds = __Iterations(_ctx, 400);
+    const size_t kRecordsPerRound = 500;
+
+    std::vector<uint64_t> samples;
+    XLoggerInfo info;
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < kRecordsPerRound; ++i) {
+            __FillInfo(info, kLevelInfo);
+            appender->Write(&info, kLogBody);
+        }
+        uint64_t begin = __NowNs();
+        appender->FlushSync();
+        samples.push_back(__NowNs() - begin);
+    }
+    XloggerAppender::__Release(appender);
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("records_per_flush", std::to_string(kRecordsPerRound)));
+    __AddPercentiles(result, samples);
+    _ctx.results.push_back(result);
+}
+
+// 同步模式每条日志一个 block, 造出 block 很多的文件, 再按小时和毫秒范围定位
+void __BenchPeriodLogs(BenchContext& _ctx) {
+    if (!__Selected(_ctx, "get_period_logs")) return;
+
+    XloggerAppender* appender = __NewAppender(_ctx, "period", kAppednerSync);
+    size_t blocks = __Iterations(_ctx, 20000);
+    XLoggerInfo info;
+    int64_t first_ms = 0;
+    int64_t last_ms = 0;
+    for (size_t i = 0; i < blocks; ++i) {
+        __FillInfo(info, kLevelInfo);
+        int64_t now_ms = (int64_t)info.timeval.tv_sec * 1000 + info.timeval.tv_usec / 1000;
+        if (0 == i) first_ms = now_ms;
+        last_ms = now_ms;
+        appender->Write(&info, kLogBody);
+    }
+    std::vector<std::string> paths;
+    appender->GetLogFilePaths(paths);
+    XloggerAppender::__Release(appender);
+    if (paths.empty()) {
+        fprintf(stderr, "get_period_logs: no log file written\n");
+        return;
+    }
+
+    size_t iterations = __Iterations(_ctx, 50);
+    std::string err_msg;
+    unsigned long begin_pos = 0;
+    unsigned long end_pos = 0;
+
+    BenchResult by_hour;
+    by_hour.name = "get_period_logs/hour";
+    by_hour.params.push_back(std::make_pair("blocks", std::to_string(blocks)));
+    uint64_t begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        LogBuffer::GetPeriodLogs(paths[0].c_str(), 0, 24, begin_pos, end_pos, err_msg);
+    }
+    __AddThroughput(by_hour, iterations, (uint64_t)iterations * end_pos, __NowNs() - begin);
+    _ctx.results.push_back(by_hour);
+
+    // 取中间一半的时间
+    int64_t quarter = (last_ms - first_ms) / 4;
+    BenchResult by_ms;
+    by_ms.name = "get_period_logs/ms";
+    by_ms.params.push_back(std::make_pair("blocks", std::to_string(blocks)));
+    begin = __NowNs();
+    for (size_t i = 0; i < iterations; ++i) {
+        LogBuffer::GetPeriodLogsMs(paths[0].c_str(), first_ms + quarter, last_ms - quarter, begin_pos, end_pos, err_msg);
+    }
+    __AddThroughput(by_ms, iterations, 0, __NowNs() - begin);
+    by_ms.metrics.push_back(std::make_pair("range_bytes", (double)(end_pos - begin_pos)));
+    _ctx.results.push_back(by_ms);
+}
+
+// 时间轮压测的状态, 除了开始和结束只在驱动线程上访问
+struct TimerWheelState {
+    TimerWheel* wheel;
+    std::atomic<bool> stop;
+    uint64_t seed;
+    uint64_t fires;
+    uint64_t cpu_begin_ns;
+    uint64_t cpu_end_ns;
+    std::vector<uint64_t> late_ns;  // 预先填满, 运行中不再分配, 免得算进内存增长
+};
+
+int64_t __NextTimerDelay(TimerWheelState* _state) {
+    _state->seed = _state->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return 1 + (int64_t)((_state->seed >> 33) % 1000);
+}
+
+uint64_t __RssBytes() {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages = 0;
+    uint64_t resident = 0;
+    statm >> pages >> resident;
+    return resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// 到期后按新的随机延时重新排一个, 待执行的定时器数量保持不变
+void __TimerWheelFire(TimerWheelState* _state, uint64_t _due_ns) {
+    uint64_t now = __NowNs();
+    uint64_t cpu = __ThreadCpuNs();
+    if (0 == _state->fires) _state->cpu_begin_ns = cpu;
+    _state->cpu_end_ns = cpu;
+    if (_state->fires < _state->late_ns.size()) _state->late_ns[_state->fires] = now > _due_ns ? now - _due_ns : 0;
+    ++_state->fires;
+    if (_state->stop.load(std::memory_order_relaxed)) return;
+
+    int64_t delay = __NextTimerDelay(_state);
+    uint64_t due = now + (uint64_t)delay * 1000000;
+    _state->wheel->Schedule(delay, [_state, due]() { __TimerWheelFire(_state, due); });
+}
+
+// 时间轮常驻 _pending 个 1ms~1s 的定时器, 到期的立即重新排. 统计每个 tick 驱动线程的 CPU、触发延迟,
+// 以及稳定运行期间常驻内存的增长(应当接近 0, 占用只和待执行的定时器数量有关)
+void __BenchTimerWheel(BenchContext& _ctx, size_t _pending) {
+    const std::string name = "timer_wheel/pending:" + std::to_string(_pending);
+    if (!__Selected(_ctx, name)) return;
+
+    const size_t kPending = _pending;
+    const unsigned int kTickMs = 10;
+    size_t duration_ms = std::max<size_t>(__Iterations(_ctx, 6000), 2000);
+
+    TimerWheelState state;
+    state.stop = false;
+    state.seed = 42;
+    state.fires = 0;
+    state.cpu_begin_ns = 0;
+    state.cpu_end_ns = 0;
+    state.late_ns.assign(kPending * (duration_ms / 250 + 2), 0);
+
+    uint64_t rss_begin = __RssBytes();
+    TimerWheel* wheel = new TimerWheel(kTickMs, "bench_timer");
+    state.wheel = wheel;
+    for (size_t i = 0; i < kPending; ++i) {
+        int64_t delay = __NextTimerDelay(&state);
+        uint64_t due = __NowNs() + (uint64_t)delay * 1000000;
+        TimerWheelState* st = &state;
+        wheel->Schedule(delay, [st, due]() { __TimerWheelFire(st, due); });
+    }
+    uint64_t rss_scheduled = __RssBytes();
+
+    // 先跑满一轮让每个定时器都至少重排过一次, 再开始看内存
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    uint64_t rss_steady = __RssBytes();
+    uint64_t allocs = sg_allocs.load(std::memory_order_relaxed);
+    uint64_t fires = state.fires;
+    std::this_thread::sleep_for(std::chrono::milliseconds(duration_ms - 1000));
+    size_t pending = wheel->Size();
+    uint64_t rss_end = __RssBytes();
+    allocs = sg_allocs.load(std::memory_order_relaxed) - allocs;
+
+    state.stop = true;
+    delete wheel;   // 停止驱动线程, 之后 state 只有本线程访问
+    fires = state.fires - fires;
+    state.late_ns.resize(std::min<size_t>(state.fires, state.late_ns.size()));
+
+    BenchResult result;
+    result.name = name;
+    result.params.push_back(std::make_pair("tick_ms", std::to_string(kTickMs)));
+    uint64_t cpu = state.cpu_end_ns - state.cpu_begin_ns;
+    uint64_t ticks = std::max<uint64_t>(duration_ms / kTickMs, 1);
+    result.metrics.push_back(std::make_pair("fires", (double)state.fires));
+    result.metrics.push_back(std::make_pair("tick_cpu_us", (double)cpu / ticks / 1e3));
+    result.metrics.push_back(std::make_pair("fire_cpu_ns", 0 == state.fires ? 0 : (double)cpu / state.fires));
+    result.metrics.push_back(std::make_pair("allocs_per_fire", 0 == fires ? 0 : (double)allocs / fires));
+    result.metrics.push_back(std::make_pair("pending_end", (double)pending));
+    result.metrics.push_back(std::make_pair("bytes_per_timer", (double)((int64_t)rss_scheduled - (int64_t)rss_begin) / kPending));
+    result.metrics.push_back(std::make_pair("rss_growth_kb", (double)((int64_t)rss_end - (int64_t)rss_steady) / 1024));
+    __AddPercentiles(result, state.late_ns);
+    _ctx.results.push_back(result);
+}
+
+bool __MakePubKey(std::string& _hex) {
+    uint8_t pubkey[64] = {0};
+    uint8_t prikey[32] = {0};
+    if (0 == uECC_make_key(pubkey, prikey, uECC_secp256k1())) return false;
+
+    static const char kHex[] = "0123456789abcdef";
+    _hex.clear();
+    for (size_t i = 0; i < sizeof(pubkey); ++i) {
+        _hex += kHex[pubkey[i] >> 4];
+        _hex += kHex[pubkey[i] & 0x0f];
+    }
+    return true;
+}
+
+std::string __JsonEscape(const std::string& _str) {
+    std::string out;
+    for (size_t i = 0; i < _str.size(); ++i) {
+        char c = _str[i];
+        if ('"' == c || '\\' == c) {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char)c < 0x20) {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)c);
+            out += esc;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+void __WriteJson(const BenchContext& _ctx, FILE* _out) {
+    fprintf(_out, "{\n  \"schema\": \"xlogbench/1\",\n");
+    fprintf(_out, "  \"revision\": \"%s\",\n", __JsonEscape(AETHER_REVISION).c_str());
+    fprintf(_out, "  \"build_time\": \"%s\",\n", __JsonEscape(AETHER_BUILD_TIME).c_str());
+    fprintf(_out, "  \"timestamp\": %lld,\n", (long long)time(NULL));
+    fprintf(_out, "  \"cpus\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(_out, "  \"quick\": %s,\n", _ctx.quick ? "true" : "false");
+    fprintf(_out, "  \"results\": [");
+    for (size_t i = 0; i < _ctx.results.size(); ++i) {
+        const BenchResult& result = _ctx.results[i];
+        fprintf(_out, "%s\n    {\"name\": \"%s\"", 0 == i ? "" : ",", __JsonEscape(result.name).c_str());
+        for (size_t j = 0; j < result.params.size(); ++j) {
+            fprintf(_out, ", \"%s\": \"%s\"", result.params[j].first.c_str(), __JsonEscape(result.params[j].second).c_str());
+        }
+        for (size_t j = 0; j < result.metrics.size(); ++j) {
+            // 计数类的值输出成整数
+            double value = result.metrics[j].second;
+            int precision = (value == (double)(long long)value) ? 0 : 3;
+            fprintf(_out, ", \"%s\": %.*f", result.metrics[j].first.c_str(), precision, value);
+        }
+        fprintf(_out, "}");
+    }
+    fprintf(_out, "\n  ]\n}\n");
+}
+
+void __Usage(const char* _name) {
+    fprintf(stderr,
+            "usage: %s [-d workdir] [-o output] [-f filter] [-q]\n"
+            "  -d  directory for log files, removed afterwards; default: /tmp/xlogbench.<pid>\n"
+            "  -o  JSON output file; default: stdout\n"
+            "  -f  only run benchmarks whose name contains filter\n"
+            "  -q  quick run with 1/20 of the iterations, for smoke tests\n",
+            _name);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    BenchContext ctx;
+    std::string output;
+    int opt = 0;
+    while (-1 != (opt = getopt(argc, argv, "d:o:f:qh"))) {
+        switch (opt) {
+            case 'd': ctx.workdir = optarg; break;
+            case 'o': output = optarg; break;
+            case 'f': ctx.filter = optarg; break;
+            case 'q': ctx.quick = true; break;
+            default:
+                __Usage(argv[0]);
+                return 'h' == opt ? 0 : 1;
+        }
+    }
+
+    if (ctx.workdir.empty()) {
+        char dir[64];
+        snprintf(dir, sizeof(dir), "/tmp/xlogbench.%d", (int)getpid());
+        ctx.workdir = dir;
+    }
+    boost::filesystem::create_directories(ctx.workdir);
+
+    if (!__MakePubKey(ctx.pubkey)) {
+        fprintf(stderr, "make ecc key fail\n");
+        return 1;
+    }
+    // 控制台输出会淹没计时
+    appender_set_console_log(false);
+
+    __BenchFrontend(ctx);
+    __BenchNumFormat(ctx);
+    __BenchFormater(ctx);
+    for (int compress = 0; compress < 2; ++compress) {
+        for (int crypt = 0; crypt < 2; ++crypt) __BenchBufferWrite(ctx, 0 != compress, 0 != crypt);
+    }
+    __BenchTea(ctx);
+    for (int threads = 1; threads <= 16; threads *= 2) __BenchAppender(ctx, threads);
+    for (unsigned int threads = 0; threads <= 8; threads = 0 == threads ? 2 : threads * 2) __BenchPipeline(ctx, threads);
+    __BenchLargeRecord(ctx, 64 * 1024);
+    __BenchLargeRecord(ctx, 1024 * 1024);
+    __BenchAttach(ctx, 64 * 1024);
+    __BenchFileWriter(ctx, false);
+    __BenchFileWriter(ctx, true);
+    __BenchFileWriterUring(ctx, false);
+    __BenchFileWriterUring(ctx, true);
+    __BenchFlushLatency(ctx);
+    __BenchPeriodLogs(ctx);
+    __BenchTimerWheel(ctx, 10000);
+    __BenchTimerWheel(ctx, 50000);
+
+    boost::filesystem::remove_all(ctx.workdir);
+
+    FILE* out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (NULL == out) {
+        fprintf(stderr, "open %s fail: %s\n", output.c_str(), strerror(errno));
+        return 1;
+    }
+    __WriteJson(ctx, out);
+    if (stdout != out) fclose(out);
+    return 0 == ctx.failures ? 0 : 1;
+}
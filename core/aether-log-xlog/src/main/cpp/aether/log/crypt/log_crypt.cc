@@ -20,11 +20,13 @@
 #include "log_crypt.h"
 
 #include <errno.h>
+#include <inttypes.h>
 #include <string.h>
 #include <sys/time.h>
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #ifdef WIN32
 #include <algorithm>
 #endif // WIN32
@@ -38,10 +40,20 @@ static const char kMagicSyncNoCryptStart ='\x08';
 static const char kMagicAsyncStart ='\x07';
 static const char kMagicAsyncNoCryptStart ='\x09';
 
+// 第二版 header: 毫秒时间范围和条数、写入进程的 pid、级别位图和 tag 的 bloom filter, 查询时只读 header 就能跳过 block.
+// 不加密的 block 不再带 64 字节的公钥
+static const char kMagicSyncStartV2 = '\x10';
+static const char kMagicSyncNoCryptStartV2 = '\x11';
+static const char kMagicAsyncStartV2 = '\x12';
+static const char kMagicAsyncNoCryptStartV2 = '\x13';
+
 static const char kMagicEnd  = '\0';
 
 const static int TEA_BLOCK_LEN = 8;
 
+const uint32_t LogCrypt::kTagBloomBytes;
+const uint32_t LogCrypt::kTagBloomHashes;
+
 static void __TeaEncrypt (uint32_t* v, uint32_t* k) {
     uint32_t v0=v[0], v1=v[1], sum=0, i;
     const static uint32_t delta=0x9e3779b9;
@@ -54,6 +66,19 @@ static void __TeaEncrypt (uint32_t* v, uint32_t* k) {
     v[0]=v0; v[1]=v1;
 }
 
+static void __TeaDecrypt (uint32_t* v, const uint32_t* k) {
+    uint32_t v0=v[0], v1=v[1], i;
+    const static uint32_t delta=0x9e3779b9;
+    uint32_t sum=delta << 4;
+    uint32_t k0=k[0], k1=k[1], k2=k[2], k3=k[3];
+    for (i=0; i < 16; i++) {
+        v1 -= ((v0<<4) + k2) ^ (v0 + sum) ^ ((v0>>5) + k3);
+        v0 -= ((v1<<4) + k0) ^ (v1 + sum) ^ ((v1>>5) + k1);
+        sum -= delta;
+    }
+    v[0]=v0; v[1]=v1;
+}
+
 static uint16_t __GetSeq(bool _is_async) {
     
     if (!_is_async) {
@@ -97,7 +122,7 @@ static bool Hex2Buffer(const char* _str, size_t _len, unsigned char* _buffer) {
 }
 #endif
 
-LogCrypt::LogCrypt(const char* _pubkey): seq_(0), is_crypt_(false) {
+LogCrypt::LogCrypt(const char* _pubkey): seq_(0), is_crypt_(false), header_v2_(false) {
     
 #ifndef XLOG_NO_CRYPT
     const static size_t PUB_KEY_LEN = 64;
@@ -131,11 +156,114 @@ LogCrypt::LogCrypt(const char* _pubkey): seq_(0), is_crypt_(false) {
 }
 
 /*
- * |magic start(char)|seq(uint16_t)|begin hour(char)|end hour(char)|length(uint32_t)|crypt key(char*64)|
+ * v1: |magic start(char)|seq(uint16_t)|begin hour(char)|end hour(char)|length(uint32_t)|crypt key(char*64)|
+ * v2: |magic start(char)|seq(uint16_t)|begin hour(char)|end hour(char)|length(uint32_t)|begin time ms(int64_t)
+ *     |end time ms - begin time ms(uint32_t)|count(uint32_t)|pid(uint32_t)|level mask(uint8_t)|flags(uint8_t)
+ *     |tag bloom(char*32)|crypt key(char*64), 只有加密的 magic 有|
  */
 
-uint32_t LogCrypt::GetHeaderLen() {
-    return sizeof(char) * 3 + sizeof(uint16_t) + sizeof(uint32_t) + sizeof(char) * 64;
+static const uint32_t kHourOffset = sizeof(char) + sizeof(uint16_t);
+static const uint32_t kLenOffset = kHourOffset + sizeof(char) * 2;
+// 两个版本共有的部分, 读到这里就能知道整个 header 的长度
+static const uint32_t kHeaderPrefixLen = kLenOffset + sizeof(uint32_t);
+static const uint32_t kCryptKeyLen = 64;
+static const uint32_t kHeaderLenV1 = kHeaderPrefixLen + kCryptKeyLen;
+
+static const uint32_t kTimeOffset = kHeaderPrefixLen;
+static const uint32_t kCountOffset = kTimeOffset + sizeof(int64_t) + sizeof(uint32_t);
+static const uint32_t kPidOffset = kCountOffset + sizeof(uint32_t);
+static const uint32_t kLevelOffset = kPidOffset + sizeof(uint32_t);
+static const uint32_t kFlagsOffset = kLevelOffset + sizeof(uint8_t);
+static const uint32_t kTagBloomOffset = kFlagsOffset + sizeof(uint8_t);
+
+// 内容经过 CryptAsyncLog 加密. 不压缩的异步 block 和同步 block 的 magic 相同, v1 里分不出来
+static const uint8_t kFlagEncrypted = 0x01;
+static const uint32_t kHeaderLenV2 = kTagBloomOffset + LogCrypt::kTagBloomBytes;
+static const uint32_t kHeaderLenV2Crypt = kHeaderLenV2 + kCryptKeyLen;
+static const uint32_t kMaxHeaderLen = kHeaderLenV2Crypt;
+
+static int __MagicVersion(char _magic) {
+    switch (_magic) {
+        case kMagicSyncStart:
+        case kMagicSyncNoCryptStart:
+        case kMagicAsyncStart:
+        case kMagicAsyncNoCryptStart:
+            return 1;
+        case kMagicSyncStartV2:
+        case kMagicSyncNoCryptStartV2:
+        case kMagicAsyncStartV2:
+        case kMagicAsyncNoCryptStartV2:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+static bool __IsAsyncMagic(char _magic) {
+    return kMagicAsyncStart == _magic || kMagicAsyncNoCryptStart == _magic
+        || kMagicAsyncStartV2 == _magic || kMagicAsyncNoCryptStartV2 == _magic;
+}
+
+static bool __IsCryptMagic(char _magic) {
+    return kMagicSyncStart == _magic || kMagicAsyncStart == _magic
+        || kMagicSyncStartV2 == _magic || kMagicAsyncStartV2 == _magic;
+}
+
+// 公钥的位置, 没有公钥(v2 不加密)返回 0
+static uint32_t __CryptKeyOffset(char _magic) {
+    switch (__MagicVersion(_magic)) {
+        case 1: return kHeaderPrefixLen;
+        case 2: return __IsCryptMagic(_magic) ? kHeaderLenV2 : 0;
+        default: return 0;
+    }
+}
+
+// [_begin_hour, _end_hour] 在 24 小时的环上占的位, 跨零点的 block 结束小时比开始小
+static uint32_t __HourMask(int _begin_hour, int _end_hour) {
+    if (_begin_hour < 0 || _begin_hour > 23 || _end_hour < 0 || _end_hour > 23) return 0xFFFFFF;
+
+    uint32_t mask = 0;
+    for (int hour = _begin_hour; ; hour = (hour + 1) % 24) {
+        mask |= 1u << hour;
+        if (hour == _end_hour) break;
+    }
+    return mask;
+}
+
+// FNV-1a, 高低 32 位做双重哈希
+static uint64_t __TagHash(const char* _tag) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const char* p = _tag ? _tag : ""; '\0' != *p; ++p) {
+        hash ^= (uint8_t)*p;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int __LocalHour(int64_t _ms) {
+    time_t sec = (time_t)(_ms / 1000);
+    struct tm tm_tmp;
+    localtime_r(&sec, &tm_tmp);
+    return tm_tmp.tm_hour;
+}
+
+uint32_t LogCrypt::GetHeaderLen() const {
+    if (!header_v2_) return kHeaderLenV1;
+    return is_crypt_ ? kHeaderLenV2Crypt : kHeaderLenV2;
+}
+
+uint32_t LogCrypt::GetHeaderLen(const char* const _data, size_t _len) {
+    if (_len < sizeof(char)) return 0;
+
+    switch (__MagicVersion(_data[0])) {
+        case 1: return kHeaderLenV1;
+        case 2: return __IsCryptMagic(_data[0]) ? kHeaderLenV2Crypt : kHeaderLenV2;
+        default: return 0;
+    }
+}
+
+uint32_t LogCrypt::GetMaxHeaderLen() {
+    return kMaxHeaderLen;
 }
 
 uint32_t LogCrypt::GetTailerLen() {
@@ -144,13 +272,11 @@ uint32_t LogCrypt::GetTailerLen() {
 
 bool LogCrypt::GetLogHour(const char* const _data, size_t _len, int& _begin_hour, int& _end_hour) {
     
-    if (_len < GetHeaderLen()) return false;
-    
-    char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start) return false;
+    uint32_t header_len = GetHeaderLen(_data, _len);
+    if (0 == header_len || _len < header_len) return false;
     
-    char begin_hour = _data[sizeof(char)+sizeof(uint16_t)];
-    char end_hour = _data[sizeof(char)+sizeof(uint16_t)+sizeof(char)];
+    char begin_hour = _data[kHourOffset];
+    char end_hour = _data[kHourOffset + sizeof(char)];
     
     _begin_hour = (int)begin_hour;
     _end_hour = (int)end_hour;
@@ -161,164 +287,381 @@ void LogCrypt::UpdateLogHour(char* _data) {
     
     struct timeval tv;
     gettimeofday(&tv, 0);
-    time_t sec = tv.tv_sec;
-    struct tm tm_tmp = *localtime((const time_t*)&sec);
     
-    char hour = (char)tm_tmp.tm_hour;
-    memcpy(_data + GetHeaderLen() - sizeof(uint32_t) - sizeof(char) * 64 - sizeof(char), &hour, sizeof(hour));
+    char hour = (char)__LocalHour((int64_t)tv.tv_sec * 1000);
+    memcpy(_data + kHourOffset + sizeof(char), &hour, sizeof(hour));
 }
 
-uint32_t LogCrypt::GetLogLen(const char*  const _data, size_t _len) {
-    if (_len < GetHeaderLen()) return 0;
-    
-    char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start
-        && kMagicAsyncNoCryptStart != start && kMagicSyncNoCryptStart != start) {
-        return 0;
+bool LogCrypt::GetLogTime(const char* const _data, size_t _len, int64_t& _begin_ms, int64_t& _end_ms, uint32_t& _count) {
+    if (_len < kHeaderLenV2 || 2 != __MagicVersion(_data[0])) return false;
+
+    uint32_t span_ms = 0;
+    memcpy(&_begin_ms, _data + kTimeOffset, sizeof(_begin_ms));
+    memcpy(&span_ms, _data + kTimeOffset + sizeof(int64_t), sizeof(span_ms));
+    memcpy(&_count, _data + kCountOffset, sizeof(_count));
+    _end_ms = _begin_ms + span_ms;
+    return true;
+}
+
+void LogCrypt::UpdateLogTime(char* _data, int64_t _begin_ms, int64_t _end_ms, uint32_t _count) {
+    // 从旧版本 mmap 里恢复出来的 block 没有这几个字段
+    if (2 != __MagicVersion(_data[0])) return;
+
+    // 结束时间存成差值, 超过 49 天的按 49 天算
+    int64_t span = _end_ms > _begin_ms ? _end_ms - _begin_ms : 0;
+    uint32_t span_ms = span > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)span;
+    memcpy(_data + kTimeOffset, &_begin_ms, sizeof(_begin_ms));
+    memcpy(_data + kTimeOffset + sizeof(int64_t), &span_ms, sizeof(span_ms));
+    memcpy(_data + kCountOffset, &_count, sizeof(_count));
+}
+
+bool LogCrypt::GetLogSummary(const char* const _data, size_t _len, uint8_t& _level_mask, uint8_t _tag_bloom[kTagBloomBytes]) {
+    if (_len < kHeaderLenV2 || 2 != __MagicVersion(_data[0])) return false;
+
+    _level_mask = (uint8_t)_data[kLevelOffset];
+    memcpy(_tag_bloom, _data + kTagBloomOffset, kTagBloomBytes);
+    return true;
+}
+
+void LogCrypt::UpdateLogSummary(char* _data, uint8_t _level_mask, const uint8_t _tag_bloom[kTagBloomBytes]) {
+    if (2 != __MagicVersion(_data[0])) return;
+
+    _data[kLevelOffset] = (char)_level_mask;
+    memcpy(_data + kTagBloomOffset, _tag_bloom, kTagBloomBytes);
+}
+
+bool LogCrypt::GetPayloadEncrypted(const char* const _data, size_t _len, bool& _encrypted) {
+    if (_len < kHeaderLenV2 || 2 != __MagicVersion(_data[0])) return false;
+
+    _encrypted = __IsCryptMagic(_data[0]) && 0 != (_data[kFlagsOffset] & kFlagEncrypted);
+    return true;
+}
+
+bool LogCrypt::GetPid(const char* const _data, size_t _len, uint32_t& _pid) {
+    if (_len < kHeaderLenV2 || 2 != __MagicVersion(_data[0])) return false;
+
+    memcpy(&_pid, _data + kPidOffset, sizeof(_pid));
+    return true;
+}
+
+void LogCrypt::AddTagBloom(uint8_t _tag_bloom[kTagBloomBytes], const char* _tag) {
+    uint64_t hash = __TagHash(_tag);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    for (uint32_t i = 0; i < kTagBloomHashes; ++i) {
+        uint32_t bit = (h1 + i * h2) % (kTagBloomBytes * 8);
+        _tag_bloom[bit / 8] |= (uint8_t)(1 << (bit % 8));
+    }
+}
+
+bool LogCrypt::MayContainTag(const uint8_t _tag_bloom[kTagBloomBytes], const char* _tag) {
+    uint64_t hash = __TagHash(_tag);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    for (uint32_t i = 0; i < kTagBloomHashes; ++i) {
+        uint32_t bit = (h1 + i * h2) % (kTagBloomBytes * 8);
+        if (0 == (_tag_bloom[bit / 8] & (1 << (bit % 8)))) return false;
     }
+    return true;
+}
+
+uint32_t LogCrypt::GetLogLen(const char*  const _data, size_t _len) {
+    uint32_t header_len = GetHeaderLen(_data, _len);
+    if (0 == header_len || _len < header_len) return 0;
     
     uint32_t len = 0;
-    memcpy(&len, _data + GetHeaderLen() - sizeof(uint32_t) - sizeof(char)*64, sizeof(len));
+    memcpy(&len, _data + kLenOffset, sizeof(len));
     return len;
 }
 
+uint16_t LogCrypt::GetSeq(const char* const _data, size_t _len) {
+    uint32_t header_len = GetHeaderLen(_data, _len);
+    if (0 == header_len || _len < header_len) return 0;
+
+    uint16_t seq = 0;
+    memcpy(&seq, _data + sizeof(char), sizeof(seq));
+    return seq;
+}
+
 void LogCrypt::UpdateLogLen(char* _data, uint32_t _add_len) {
     
-    uint32_t currentlen = (uint32_t)(GetLogLen(_data, GetHeaderLen()) + _add_len);
-    memcpy(_data + GetHeaderLen() - sizeof(uint32_t) - sizeof(char) * 64, &currentlen, sizeof(currentlen));
+    uint32_t currentlen = 0;
+    memcpy(&currentlen, _data + kLenOffset, sizeof(currentlen));
+    currentlen += _add_len;
+    memcpy(_data + kLenOffset, &currentlen, sizeof(currentlen));
+}
+
+void LogCrypt::SetLogLen(char* _data, uint32_t _len) {
+    memcpy(_data + kLenOffset, &_len, sizeof(_len));
+}
+
+bool LogCrypt::GetBlockFormat(const char* const _data, size_t _len, bool& _is_async, bool& _is_crypt) {
+    if (0 == GetHeaderLen(_data, _len)) return false;
+
+    char start = _data[0];
+    _is_async = __IsAsyncMagic(start);
+    _is_crypt = __IsCryptMagic(start);
+    return true;
+}
+
+bool LogCrypt::SetBlockFormat(char* _data, size_t _len, bool _is_async) {
+    if (0 == GetHeaderLen(_data, _len)) return false;
+
+    static const char kMagics[2][4] = {
+        // sync, sync no crypt, async, async no crypt
+        {kMagicSyncStart, kMagicSyncNoCryptStart, kMagicAsyncStart, kMagicAsyncNoCryptStart},
+        {kMagicSyncStartV2, kMagicSyncNoCryptStartV2, kMagicAsyncStartV2, kMagicAsyncNoCryptStartV2},
+    };
+    int version = __MagicVersion(_data[0]);
+    _data[0] = kMagics[version - 1][(_is_async ? 2 : 0) + (__IsCryptMagic(_data[0]) ? 0 : 1)];
+    return true;
+}
+
+bool LogCrypt::GetClientPubKey(const char* const _data, size_t _len, char _pubkey[64]) {
+    uint32_t header_len = GetHeaderLen(_data, _len);
+    if (0 == header_len || _len < header_len) return false;
+
+    uint32_t offset = __CryptKeyOffset(_data[0]);
+    if (0 == offset) return false;
+    memcpy(_pubkey, _data + offset, kCryptKeyLen);
+    return true;
+}
+
+bool LogCrypt::MakeDecryptKey(const char* _svr_prikey, const char _client_pubkey[64], uint32_t _tea_key[4]) {
+#ifndef XLOG_NO_CRYPT
+    const static size_t PRI_KEY_LEN = 32;
+
+    if (NULL == _svr_prikey || PRI_KEY_LEN * 2 != strnlen(_svr_prikey, 256)) {
+        return false;
+    }
+
+    unsigned char svr_prikey[PRI_KEY_LEN] = {0};
+    if (!Hex2Buffer(_svr_prikey, PRI_KEY_LEN * 2, svr_prikey)) {
+        return false;
+    }
+
+    uint8_t ecdh_key[32] = {0};
+    if (0 == uECC_shared_secret((const uint8_t*)_client_pubkey, svr_prikey, ecdh_key, uECC_secp256k1())) {
+        return false;
+    }
+
+    memcpy(_tea_key, ecdh_key, sizeof(uint32_t) * 4);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void LogCrypt::DecryptAsyncLog(char* _data, size_t _len, const uint32_t _tea_key[4]) {
+    uint32_t tmp[2] = {0};
+    size_t cnt = _len / TEA_BLOCK_LEN;
+
+    for (size_t i = 0; i < cnt; ++i) {
+        memcpy(tmp, _data + i * TEA_BLOCK_LEN, TEA_BLOCK_LEN);
+        __TeaDecrypt(tmp, _tea_key);
+        memcpy(_data + i * TEA_BLOCK_LEN, tmp, TEA_BLOCK_LEN);
+    }
+}
+
+void LogCrypt::DecryptAsyncLog(char* _data, size_t _len) const {
+#ifndef XLOG_NO_CRYPT
+    if (is_crypt_) DecryptAsyncLog(_data, _len, tea_key_);
+#endif
+}
+
+bool LogCrypt::IsOwnBlock(const char* const _data, size_t _len) const {
+    bool is_async = false;
+    bool is_crypt = false;
+    if (!GetBlockFormat(_data, _len, is_async, is_crypt)) return false;
+    if (!is_crypt) return true;
+
+    char pubkey[64];
+    return is_crypt_ && GetClientPubKey(_data, _len, pubkey) && 0 == memcmp(pubkey, client_pubkey_, sizeof(pubkey));
 }
 
 void LogCrypt::SetHeaderInfo(char* _data, bool _is_async) {
+    __SetHeaderInfo(_data, _is_async, _is_async, _is_async);
+}
+
+void LogCrypt::SetHeaderInfo(char* _data, bool _is_async, bool _take_seq) {
+    __SetHeaderInfo(_data, _is_async, _take_seq, true);
+}
+
+void LogCrypt::__SetHeaderInfo(char* _data, bool _is_async, bool _take_seq, bool _encrypted) {
     if (_is_async) {
         if (is_crypt_) {
-            memcpy(_data, &kMagicAsyncStart, sizeof(kMagicAsyncStart));
+            _data[0] = header_v2_ ? kMagicAsyncStartV2 : kMagicAsyncStart;
         } else {
-            memcpy(_data, &kMagicAsyncNoCryptStart, sizeof(kMagicAsyncNoCryptStart));
+            _data[0] = header_v2_ ? kMagicAsyncNoCryptStartV2 : kMagicAsyncNoCryptStart;
         }
     } else {
         if (is_crypt_) {
-            memcpy(_data, &kMagicSyncStart, sizeof(kMagicSyncStart));
+            _data[0] = header_v2_ ? kMagicSyncStartV2 : kMagicSyncStart;
         } else {
-            memcpy(_data, &kMagicSyncNoCryptStart, sizeof(kMagicSyncNoCryptStart));
+            _data[0] = header_v2_ ? kMagicSyncNoCryptStartV2 : kMagicSyncNoCryptStart;
         }
     }
     
-    seq_ = __GetSeq(_is_async);
+    seq_ = __GetSeq(_take_seq);
     memcpy(_data + sizeof(kMagicAsyncStart), &seq_, sizeof(seq_));
 
     
     struct timeval tv;
     gettimeofday(&tv, 0);
-    time_t sec = tv.tv_sec;
-    tm tm_tmp = *localtime((const time_t*)&sec);
+    int64_t now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
     
-    char hour = (char)tm_tmp.tm_hour;
-    memcpy(_data + sizeof(kMagicAsyncStart) + sizeof(seq_), &hour, sizeof(hour));
-    memcpy(_data + sizeof(kMagicAsyncStart) + sizeof(seq_) + sizeof(hour), &hour, sizeof(hour));
+    char hour = (char)__LocalHour(now_ms);
+    memcpy(_data + kHourOffset, &hour, sizeof(hour));
+    memcpy(_data + kHourOffset + sizeof(hour), &hour, sizeof(hour));
 
     
     uint32_t len = 0;
-    memcpy(_data + sizeof(kMagicAsyncStart) + sizeof(seq_) + sizeof(hour) * 2, &len, sizeof(len));
-    memcpy(_data + sizeof(kMagicAsyncStart) + sizeof(seq_) + sizeof(hour) * 2 + sizeof(len), client_pubkey_, sizeof(client_pubkey_));
+    memcpy(_data + kLenOffset, &len, sizeof(len));
+
+    if (!header_v2_) {
+        // v1 总有公钥的位置, 不加密时填 0
+        if (is_crypt_) {
+            memcpy(_data + kHeaderPrefixLen, client_pubkey_, sizeof(client_pubkey_));
+        } else {
+            memset(_data + kHeaderPrefixLen, 0, kCryptKeyLen);
+        }
+        return;
+    }
+
+    if (is_crypt_) memcpy(_data + kHeaderLenV2, client_pubkey_, sizeof(client_pubkey_));
+    
+    // 没有日志时时间范围是 header 生成的时刻, 条数为 0
+    UpdateLogTime(_data, now_ms, now_ms, 0);
+    uint8_t tag_bloom[kTagBloomBytes] = {0};
+    UpdateLogSummary(_data, 0, tag_bloom);
+
+    // fork 出来的子进程沿用父进程的 buffer, 每个 block 现取
+    uint32_t pid = (uint32_t)getpid();
+    memcpy(_data + kPidOffset, &pid, sizeof(pid));
+    _data[kFlagsOffset] = (char)(is_crypt_ && _encrypted ? kFlagEncrypted : 0);
 }
 
 void LogCrypt::SetTailerInfo(char* _data) {
     memcpy(_data, &kMagicEnd, sizeof(kMagicEnd));
 }
 
-bool LogCrypt::GetPeriodLogs(const char* const _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg) {
-    
-    char msg[1024] = {0};
-    
-    
-    if (NULL == _log_path || _end_hour <= _begin_hour) {
-        snprintf(msg, sizeof(msg), "NULL == _logPath || _endHour <= _beginHour, %d, %d", _begin_hour, _end_hour);
-        return false;
+// 逐个读 block 头, 损坏的地方逐字节往后找下一个合法的 block.
+// 返回 1 时 _header 是一个完整 block 的头, 文件位置在它的结尾; 0 表示读完; -1 表示出错
+static int __NextBlock(FILE* _file, long _file_size, char* _header, long& _block_pos, char* _msg, size_t _msg_len) {
+    while (!feof(_file) && !ferror(_file)) {
+        
+        if ((long)(ftell(_file) + kHeaderPrefixLen + LogCrypt::GetTailerLen()) > _file_size) {
+            snprintf(_msg, _msg_len, "ftell(file) + __GetHeaderLen() + sizeof(kMagicEnd)) > file_size error");
+            return 0;
+        }
+        
+        // 先读两个版本共有的部分, 按 magic 得到 header 长度再读剩下的
+        long before_len = ftell(_file);
+        if (kHeaderPrefixLen != fread(_header, 1, kHeaderPrefixLen, _file)) {
+            snprintf(_msg, _msg_len, "fread(buff.Ptr(), 1, __GetHeaderLen(), file) error:%s, before_len:%ld.", strerror(ferror(_file)), before_len);
+            return -1;
+        }
+        
+        bool fix = false;
+        
+        uint32_t header_len = LogCrypt::GetHeaderLen(_header, kHeaderPrefixLen);
+        if (0 == header_len) {
+            fix = true;
+        } else if ((long)(before_len + header_len + LogCrypt::GetTailerLen()) > _file_size) {
+            fix = true;
+        } else if (header_len - kHeaderPrefixLen != fread(_header + kHeaderPrefixLen, 1, header_len - kHeaderPrefixLen, _file)) {
+            snprintf(_msg, _msg_len, "fread(header, 1, %u, file) error:%s, before_len:%ld.", header_len - kHeaderPrefixLen, strerror(ferror(_file)), before_len);
+            return -1;
+        } else {
+            uint32_t len = LogCrypt::GetLogLen(_header, header_len);
+            if ((long)(ftell(_file) + len + LogCrypt::GetTailerLen()) > _file_size) {
+                fix = true;
+            } else {
+                if (0 != fseek(_file, len, SEEK_CUR)) {
+                    snprintf(_msg, _msg_len, "fseek(file, len, SEEK_CUR):%s, before_len:%ld, len:%u.", strerror(ferror(_file)), before_len, len);
+                    return -1;
+                }
+                char end;
+                if (1 != fread(&end, 1, 1, _file)) {
+                    snprintf(_msg, _msg_len, "fread(&end, 1, 1, file) err:%s, before_len:%ld, len:%u.", strerror(ferror(_file)), before_len, len);
+                    return -1;
+                }
+                if (end != kMagicEnd) {
+                    fix = true;
+                }
+            }
+        }
+        
+        if (fix) {
+            if (0 != fseek(_file, before_len+1, SEEK_SET)) {
+                snprintf(_msg, _msg_len, "fseek(file, before_len+1, SEEK_SET) err:%s, before_len:%ld.", strerror(ferror(_file)), before_len);
+                return -1;
+            }
+            continue;
+        }
+        
+        _block_pos = before_len;
+        return 1;
     }
+    return 0;
+}
+
+static FILE* __OpenLogFile(const char* const _log_path, long& _file_size, std::string& _err_msg) {
+    char msg[1024] = {0};
     
     FILE* file = fopen(_log_path, "rb");
     if (NULL == file) {
         snprintf(msg, sizeof(msg), "open file fail:%s", strerror(errno));
         _err_msg += msg;
-        return false;
+        return NULL;
     }
     
     if (0 != fseek(file, 0, SEEK_END)) {
         snprintf(msg, sizeof(msg), "fseek(file, 0, SEEK_END):%s", strerror(ferror(file)));
         _err_msg += msg;
         fclose(file);
-        return false;
+        return NULL;
     }
     
-    long file_size = ftell(file);
+    _file_size = ftell(file);
     
     if (0 != fseek(file, 0, SEEK_SET)) {
         snprintf(msg, sizeof(msg), "fseek(file, 0, SEEK_SET) error:%s", strerror(ferror(file)));
         _err_msg += msg;
         fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+bool LogCrypt::GetPeriodLogs(const char* const _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg) {
+    
+    char msg[1024] = {0};
+    
+    
+    if (NULL == _log_path || _end_hour <= _begin_hour) {
+        snprintf(msg, sizeof(msg), "NULL == _logPath || _endHour <= _beginHour, %d, %d", _begin_hour, _end_hour);
         return false;
     }
     
+    long file_size = 0;
+    FILE* file = __OpenLogFile(_log_path, file_size, _err_msg);
+    if (NULL == file) return false;
+    
     _begin_pos = _end_pos = 0;
     
     bool find_begin_pos = false;
     int last_end_hour = -1;
     unsigned long last_end_pos = 0;
     
-    char* header_buff = new char[GetHeaderLen()];
+    char* header_buff = new char[kMaxHeaderLen];
+    long before_len = 0;
     
-    while (!feof(file) && !ferror(file)) {
-        
-        if ((long)(ftell(file) + GetHeaderLen() + GetTailerLen()) > file_size) {
-            snprintf(msg, sizeof(msg), "ftell(file) + __GetHeaderLen() + sizeof(kMagicEnd)) > file_size error");
-            break;
-        }
-        
-        long before_len = ftell(file);
-        if (GetHeaderLen() != fread(header_buff, 1, GetHeaderLen(), file)) {
-            snprintf(msg, sizeof(msg), "fread(buff.Ptr(), 1, __GetHeaderLen(), file) error:%s, before_len:%ld.", strerror(ferror(file)), before_len);
-            break;
-        }
-        
-        
-        bool fix = false;
-        
-        char start = *header_buff;
-        if (start != kMagicSyncStart && start != kMagicSyncNoCryptStart
-                && start != kMagicAsyncStart && start != kMagicAsyncNoCryptStart) {
-            fix = true;
-        } else {
-            uint32_t len = GetLogLen(header_buff, GetHeaderLen());
-            if ((long)(ftell(file) + len + sizeof(kMagicEnd)) > file_size) {
-                fix = true;
-            } else {
-                if (0 != fseek(file, len, SEEK_CUR)) {
-                    snprintf(msg, sizeof(msg), "fseek(file, len, SEEK_CUR):%s, before_len:%ld, len:%u.", strerror(ferror(file)), before_len, len);
-                    break;
-                }
-                char end;
-                if (1 != fread(&end, 1, 1, file)) {
-                    snprintf(msg, sizeof(msg), "fread(&end, 1, 1, file) err:%s, before_len:%ld, len:%u.", strerror(ferror(file)), before_len, len);
-                    break;
-                }
-                if (end != kMagicEnd) {
-                    fix = true;
-                }
-            }
-        }
-        
-        if (fix) {
-            if (0 !=fseek(file, before_len+1, SEEK_SET)) {
-                snprintf(msg, sizeof(msg), "fseek(file, before_len+1, SEEK_SET) err:%s, before_len:%ld.", strerror(ferror(file)), before_len);
-                break;
-            }
-            continue;
-        }
-        
+    while (1 == __NextBlock(file, file_size, header_buff, before_len, msg, sizeof(msg))) {
         
         int begin_hour = 0;
         int end_hour = 0;
-        if (!GetLogHour(header_buff, GetHeaderLen(), begin_hour, end_hour)) {
+        if (!GetLogHour(header_buff, kMaxHeaderLen, begin_hour, end_hour)) {
             snprintf(msg, sizeof(msg), "__GetLogHour(buff.Ptr(), buff.Length(), beginHour, endHour) err, before_len:%ld.", before_len);
             break;
         }
@@ -372,6 +715,69 @@ bool LogCrypt::GetPeriodLogs(const char* const _log_path, int _begin_hour, int _
     return ret;
 }
 
+bool LogCrypt::GetPeriodLogsMs(const char* const _log_path, int64_t _begin_ms, int64_t _end_ms, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg) {
+    
+    char msg[1024] = {0};
+    
+    if (NULL == _log_path || _end_ms < _begin_ms) {
+        snprintf(msg, sizeof(msg), "NULL == _logPath || _end_ms < _begin_ms, %" PRId64 ", %" PRId64, _begin_ms, _end_ms);
+        _err_msg += msg;
+        return false;
+    }
+    
+    long file_size = 0;
+    FILE* file = __OpenLogFile(_log_path, file_size, _err_msg);
+    if (NULL == file) return false;
+    
+    _begin_pos = _end_pos = 0;
+    
+    // 旧格式的 block 只有小时, 按本地时间的小时在 24 小时环上比较, 超过一天的范围总是命中
+    uint32_t query_hours = (_end_ms - _begin_ms >= 24 * 60 * 60 * 1000LL) ? 0xFFFFFF
+                         : __HourMask(__LocalHour(_begin_ms), __LocalHour(_end_ms));
+    
+    bool find_begin_pos = false;
+    char header_buff[kMaxHeaderLen];
+    long before_len = 0;
+    
+    while (1 == __NextBlock(file, file_size, header_buff, before_len, msg, sizeof(msg))) {
+        
+        bool hit = false;
+        int64_t begin_ms = 0;
+        int64_t end_ms = 0;
+        uint32_t count = 0;
+        int begin_hour = 0;
+        int end_hour = 0;
+        
+        if (GetLogTime(header_buff, kMaxHeaderLen, begin_ms, end_ms, count)) {
+            // 条数为 0 的 block 是崩溃后恢复出来的, 时间不可信
+            hit = 0 == count || (begin_ms <= _end_ms && end_ms >= _begin_ms);
+        } else if (GetLogHour(header_buff, kMaxHeaderLen, begin_hour, end_hour)) {
+            hit = 0 != (query_hours & __HourMask(begin_hour, end_hour));
+        }
+        
+        if (!hit) continue;
+        
+        if (!find_begin_pos) {
+            _begin_pos = before_len;
+            find_begin_pos = true;
+        }
+        _end_pos = ftell(file);
+    }
+    
+    fclose(file);
+    
+    bool ret = _end_pos > _begin_pos;
+    
+    if (!ret) {
+        _err_msg += msg;
+        memset(msg, 0, sizeof(msg));
+        snprintf(msg, sizeof(msg), "begintpos:%lu, endpos:%lu, filesize:%ld.", _begin_pos, _end_pos, file_size);
+        _err_msg += msg;
+    }
+    
+    return ret;
+}
+
 
 void LogCrypt::CryptSyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff) {
 	_out_buff.AllocWrite(GetHeaderLen() + GetTailerLen() + _input_len);
@@ -430,21 +836,12 @@ void LogCrypt::CryptAsyncLog(const char* const _log_data, size_t _input_len, Aut
 }
 
 bool LogCrypt::Fix(char* _data, size_t _data_len, bool& _is_async, uint32_t& _raw_log_len) {
-    if (_data_len < GetHeaderLen()) {
+    uint32_t header_len = GetHeaderLen(_data, _data_len);
+    if (0 == header_len || _data_len < header_len) {
         return false;
     }
     
-    char start = _data[0];
-    if (kMagicAsyncStart != start && kMagicSyncStart != start
-        && kMagicAsyncNoCryptStart != start && kMagicSyncNoCryptStart != start) {
-        return false;
-    }
-    
-    if (kMagicSyncStart == start || kMagicSyncNoCryptStart == start) {
-        _is_async = false;
-    } else {
-        _is_async = true;
-    }
+    _is_async = __IsAsyncMagic(_data[0]);
     
     _raw_log_len = GetLogLen(_data, _data_len);
     
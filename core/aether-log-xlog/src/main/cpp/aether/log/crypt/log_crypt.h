@@ -25,6 +25,12 @@
 
 #include "autobuffer.h"
 
+// block header 有两个版本:
+//   v1 magic 0x06-0x09, 上游 Mars 的格式, 73 字节
+//   v2 magic 0x10-0x13, 多了毫秒时间、条数、pid、级别位图、标志位和 tag bloom, 不加密 63 字节, 加密 127 字节
+// 旧的解码器(上游 Mars 的 decode_mars_*_log_file.py)只认 0x06-0x09, 遇到 v2 magic 当成坏数据
+// 往后逐字节找下一个 v1 magic, v2 block 里的日志全部丢失. 所以默认只写 v1, SetHeaderV2 打开后才写 v2,
+// 要等读日志的一方都换成本仓库的 xlogdecode / LogDecoder. 本仓库的读取端两种都认.
 
 class LogCrypt {
 public:
@@ -36,31 +42,82 @@ private:
     LogCrypt& operator=(const LogCrypt&);
     
 public:
-    static uint32_t GetHeaderLen();
+    static const uint32_t kTagBloomBytes = 32;
+    static const uint32_t kTagBloomHashes = 3;
+
+    // 从下一个 block 开始写 v2 header; 默认写 v1
+    void SetHeaderV2(bool _v2) { header_v2_ = _v2; }
+    bool IsHeaderV2() const { return header_v2_; }
+    // 本端新写入的 block 的 header 长度, v2 不加密时没有公钥, 短 64 字节
+    uint32_t GetHeaderLen() const;
+    // 按 magic 区分新旧 header, 不认识的 magic 返回 0
+    static uint32_t GetHeaderLen(const char* const _data, size_t _len);
+    static uint32_t GetMaxHeaderLen();
     static uint32_t GetTailerLen();
     
     static bool GetLogHour(const char* const _data, size_t _len, int& _begin_hour, int& _end_hour);
     static void UpdateLogHour(char* _data);
     
+    // 毫秒时间范围和条数, 旧格式的 header 返回 false
+    static bool GetLogTime(const char* const _data, size_t _len, int64_t& _begin_ms, int64_t& _end_ms, uint32_t& _count);
+    static void UpdateLogTime(char* _data, int64_t _begin_ms, int64_t _end_ms, uint32_t _count);
+    
+    // 级别位图(bit n 为 level n)和 tag 的 bloom filter, 旧格式的 header 返回 false
+    static bool GetLogSummary(const char* const _data, size_t _len, uint8_t& _level_mask, uint8_t _tag_bloom[kTagBloomBytes]);
+    static void UpdateLogSummary(char* _data, uint8_t _level_mask, const uint8_t _tag_bloom[kTagBloomBytes]);
+    static void AddTagBloom(uint8_t _tag_bloom[kTagBloomBytes], const char* _tag);
+    static bool MayContainTag(const uint8_t _tag_bloom[kTagBloomBytes], const char* _tag);
+    // 加密的 magic 下内容是否真的加密了(同步写的不加密, 异步写的不压缩也加密), 旧格式的 header 返回 false
+    static bool GetPayloadEncrypted(const char* const _data, size_t _len, bool& _encrypted);
+    // 写入 block 的进程, 旧格式的 header 返回 false
+    static bool GetPid(const char* const _data, size_t _len, uint32_t& _pid);
+    
     static uint32_t GetLogLen(const char* const _data, size_t _len);
+    static uint16_t GetSeq(const char* const _data, size_t _len);
     static void UpdateLogLen(char* _data, uint32_t _add_len);
+    static void SetLogLen(char* _data, uint32_t _len);
     static bool GetPeriodLogs(const char* const _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
+    // 解码端用: magic 对应的格式, async 的 block 是压缩过的
+    static bool GetBlockFormat(const char* const _data, size_t _len, bool& _is_async, bool& _is_crypt);
+    // 换成同一版本、同样加密与否的 async(压缩)或 sync 的 magic
+    static bool SetBlockFormat(char* _data, size_t _len, bool _is_async);
+    // 不加密的新格式 header 没有公钥, 返回 false
+    static bool GetClientPubKey(const char* const _data, size_t _len, char _pubkey[64]);
+    // 服务端私钥(十六进制)和 header 里的客户端公钥算出 tea key
+    static bool MakeDecryptKey(const char* _svr_prikey, const char _client_pubkey[64], uint32_t _tea_key[4]);
+    // 和 CryptAsyncLog 对应: 只有整 8 字节的部分是加密的
+    static void DecryptAsyncLog(char* _data, size_t _len, const uint32_t _tea_key[4]);
+    
+    // [_begin_ms, _end_ms] 内的日志所在的 [_begin_pos, _end_pos); 旧格式的 block 按小时判断
+    static bool GetPeriodLogsMs(const char* const _log_path, int64_t _begin_ms, int64_t _end_ms, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
 
 public:
     
     void SetHeaderInfo(char* _data, bool _is_async);
+    // 异步写入的 block, 内容都经过 CryptAsyncLog.
+    // _take_seq 时不压缩的 block 也占一个压缩 block 的序号, 留给压缩线程压缩后按序号顺序落盘
+    void SetHeaderInfo(char* _data, bool _is_async, bool _take_seq);
     void SetTailerInfo(char* _data);
 
     void CryptSyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff);
     void CryptAsyncLog(const char* const _log_data, size_t _input_len, AutoBuffer& _out_buff, size_t& _remain_nocrypt_len);
+    // 用本端的 key 解开 CryptAsyncLog 的输出, 多个线程可以同时调用
+    void DecryptAsyncLog(char* _data, size_t _len) const;
+    // 不加密的 block, 或者 header 里是本端的公钥; 别的 LogCrypt(比如崩溃前的进程)加密的解不开
+    bool IsOwnBlock(const char* const _data, size_t _len) const;
+    bool IsCrypt() const { return is_crypt_; }
     
     bool Fix(char* _data, size_t _data_len, bool& _is_async, uint32_t& _raw_log_len);
     
+private:
+    void __SetHeaderInfo(char* _data, bool _is_async, bool _take_seq, bool _encrypted);
+
 private:
     uint16_t seq_;
     uint32_t tea_key_[4];
     char client_pubkey_[64];
     bool is_crypt_;
+    bool header_v2_;
 
 };
 
@@ -0,0 +1,184 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_attachment_extract.cc
+ */
+
+#include "log_attachment_extract.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "../log_attachment.h"
+#include "../../common/xlogger/xlogger_trace.h"
+
+using aether::comm::XloggerTrace;
+
+// _data 以 _magic 的帧开始时返回整帧在 _len 以内的长度, 否则返回 0
+static size_t __FrameLen(const char* _data, size_t _len, const char* _magic) {
+    uint32_t id = 0;
+    uint16_t index = 0;
+    uint8_t flags = 0;
+    uint32_t text_len = 0;
+    if (!LogRecordChunk::GetHeader(_data, _len, id, index, flags, text_len, _magic)) return 0;
+    return LogRecordChunk::kHeaderLen + std::min((size_t)text_len, _len - LogRecordChunk::kHeaderLen);
+}
+
+uint64_t LogAttachmentExtract(std::string& _text, size_t _from, std::string* _frames) {
+    // 没有附件帧时不动文本
+    if (_from >= _text.size() || std::string::npos == _text.find(LogAttachment::Magic(), _from, LogRecordChunk::kMagicLen)) {
+        return 0;
+    }
+
+    char* data = &_text[0];
+    size_t len = _text.size();
+    size_t read = _from;
+    size_t write = _from;
+    uint64_t count = 0;
+
+    while (read < len) {
+        const char* nul = (const char*)memchr(data + read, '\0', len - read);
+        size_t pos = NULL == nul ? len : (size_t)(nul - data);
+        if (write != read) memmove(data + write, data + read, pos - read);
+        write += pos - read;
+        read = pos;
+        if (read >= len) break;
+
+        size_t frame_len = __FrameLen(data + read, len - read, LogAttachment::Magic());
+        if (0 < frame_len) {
+            if (NULL != _frames) _frames->append(data + read, frame_len);
+            if (0 != ((uint8_t)data[read + LogRecordChunk::kMagicLen + 6] & LogRecordChunk::kFlagLast)) ++count;
+            read += frame_len;
+            continue;
+        }
+
+        // 分片帧和 trace 帧整帧原样保留, 其他的 '\0' 也保留
+        size_t keep = __FrameLen(data + read, len - read, LogRecordChunk::Magic());
+        if (0 == keep && len - read >= XloggerTrace::kFrameMagicLen + 4
+            && 0 == memcmp(data + read, XloggerTrace::kFrameMagic, XloggerTrace::kFrameMagicLen)) {
+            uint32_t trace_len = 0;
+            for (size_t i = 0; i < 4; ++i) trace_len |= (uint32_t)(uint8_t)data[read + XloggerTrace::kFrameMagicLen + i] << (8 * i);
+            keep = XloggerTrace::kFrameMagicLen + 4 + std::min((size_t)trace_len, len - read - XloggerTrace::kFrameMagicLen - 4);
+        }
+        if (0 == keep) keep = 1;
+        if (write != read) memmove(data + write, data + read, keep);
+        write += keep;
+        read += keep;
+    }
+
+    _text.resize(write);
+    return count;
+}
+
+LogAttachmentWriter::LogAttachmentWriter(const std::string& _dir)
+: dir_(_dir), written_(0), broken_(0) {}
+
+LogAttachmentWriter::~LogAttachmentWriter() {
+    Finish();
+}
+
+bool LogAttachmentWriter::__Close(Pending& _pending) {
+    bool ok = true;
+    if (NULL != _pending.file) {
+        ok = 0 == fclose(_pending.file);
+        _pending.file = NULL;
+        if (_pending.lost) ok = 0 == rename(_pending.path.c_str(), (_pending.path + ".partial").c_str()) && ok;
+    }
+    if (_pending.lost) {
+        ++broken_;
+    } else {
+        ++written_;
+    }
+    return ok;
+}
+
+bool LogAttachmentWriter::Append(const std::string& _frames) {
+    bool ok = true;
+    size_t pos = 0;
+    while (pos < _frames.size()) {
+        uint32_t id = 0;
+        uint16_t index = 0;
+        uint8_t flags = 0;
+        uint32_t text_len = 0;
+        if (!LogRecordChunk::GetHeader(_frames.data() + pos, _frames.size() - pos, id, index, flags, text_len,
+                                       LogAttachment::Magic())) {
+            break;
+        }
+        size_t begin = pos + LogRecordChunk::kHeaderLen;
+        size_t len = std::min((size_t)text_len, _frames.size() - begin);
+        pos = begin + len;
+
+        std::map<uint32_t, Pending>::iterator iter = pending_.find(id);
+        if (0 == index && pending_.end() != iter) {
+            // 同一个 id 的上一个没等到结尾(比如进程崩溃后重启撞了 id)
+            iter->second.lost = true;
+            ok = __Close(iter->second) && ok;
+            pending_.erase(iter);
+            iter = pending_.end();
+        }
+
+        const char* data = _frames.data() + begin;
+        size_t data_len = len;
+        std::string name;
+        if (0 == index && 0 < data_len) {
+            size_t name_len = std::min((size_t)(uint8_t)data[0], data_len - 1);
+            name.assign(data + 1, name_len);
+            data += 1 + name_len;
+            data_len -= 1 + name_len;
+        }
+
+        if (pending_.end() == iter) {
+            char id_str[16];
+            snprintf(id_str, sizeof(id_str), "%08x", id);
+            Pending pending;
+            pending.path = dir_ + "/" + id_str;
+            if (name.empty()) {
+                pending.path += ".bin";
+            } else {
+                // 名字来自日志, 只留文件名里安全的字符
+                pending.path += '_';
+                for (size_t i = 0; i < name.size(); ++i) {
+                    char c = name[i];
+                    pending.path += (isalnum((unsigned char)c) || '.' == c || '-' == c || '_' == c) ? c : '_';
+                }
+            }
+            pending.file = fopen(pending.path.c_str(), "wb");
+            if (NULL == pending.file) ok = false;
+            pending.next_index = 0;
+            pending.lost = false;
+            iter = pending_.insert(std::make_pair(id, pending)).first;
+        }
+
+        Pending& pending = iter->second;
+        if (pending.next_index != index || len < text_len) pending.lost = true;
+        pending.next_index = (uint16_t)(index + 1);
+        if (NULL != pending.file && 0 < data_len && data_len != fwrite(data, 1, data_len, pending.file)) ok = false;
+
+        if (0 != (flags & LogRecordChunk::kFlagLast)) {
+            ok = __Close(pending) && ok;
+            pending_.erase(iter);
+        }
+    }
+    return ok;
+}
+
+bool LogAttachmentWriter::Finish() {
+    bool ok = true;
+    for (std::map<uint32_t, Pending>::iterator iter = pending_.begin(); iter != pending_.end(); ++iter) {
+        iter->second.lost = true;
+        ok = __Close(iter->second) && ok;
+    }
+    pending_.clear();
+    return ok;
+}
@@ -0,0 +1,68 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_attachment_extract.h
+ *
+ * 解码后的文本里摘出附件帧(格式见 ../log_attachment.h). 附件是任意字节, 可能碰巧含有 trace 帧或分片帧的 magic,
+ * 所以要在摘 trace 帧、拼分片之前摘; 反过来遇到 trace 帧和分片帧时按长度整帧跳过, 不在里面找附件.
+ * 一个附件的帧可能跨 block、跨解码分段, 摘出的帧按文件顺序交给同一个 LogAttachmentWriter 拼成文件.
+ */
+
+#ifndef LOG_ATTACHMENT_EXTRACT_H_
+#define LOG_ATTACHMENT_EXTRACT_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <map>
+#include <string>
+
+// 从 _text 的 _from 处开始摘掉附件帧, 文本原地拼回; _frames 不为 NULL 时整帧追加进去. 返回摘到的附件数(按最后一片计)
+uint64_t LogAttachmentExtract(std::string& _text, size_t _from, std::string* _frames);
+
+// 附件写到 _dir 下, 文件名是 8 位十六进制的 id, 有名字时接在 '_' 后面; 缺片的附件加 .partial 后缀
+class LogAttachmentWriter {
+  public:
+    explicit LogAttachmentWriter(const std::string& _dir);
+    ~LogAttachmentWriter();
+
+    // _frames 是 LogAttachmentExtract 摘出的帧
+    bool Append(const std::string& _frames);
+    // 输入结束, 没等到最后一片的附件按缺片处理
+    bool Finish();
+
+    // 完整写出的附件数
+    uint64_t Written() const { return written_; }
+    // 缺片或者没有结尾的附件数
+    uint64_t Broken() const { return broken_; }
+
+  private:
+    LogAttachmentWriter(const LogAttachmentWriter&);
+    LogAttachmentWriter& operator=(const LogAttachmentWriter&);
+
+    struct Pending {
+        FILE* file;
+        std::string path;
+        uint16_t next_index;
+        bool lost;
+    };
+
+    bool __Close(Pending& _pending);
+
+  private:
+    std::string dir_;
+    std::map<uint32_t, Pending> pending_;
+    uint64_t written_;
+    uint64_t broken_;
+};
+
+#endif  // LOG_ATTACHMENT_EXTRACT_H_
@@ -0,0 +1,552 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_decoder.cc
+ */
+
+#include "log_decoder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <zlib.h>
+
+#include "../crypt/log_crypt.h"
+#include "../log_record_chunk.h"
+#include "../../common/xlogger/xlogger_trace.h"
+#include "log_trace.h"
+#include "log_record_join.h"
+#include "log_attachment_extract.h"
+#include "../log_attachment.h"
+#include "../../common/thread/condition.h"
+#include "../../common/thread/lock.h"
+#include "../../common/thread/thread.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+struct LogDecodeContext {
+    const LogDecodeConfig* config;
+    LogDecodeStat stat;
+    // 同一个 LogCrypt 写的 block 公钥相同, 按公钥缓存 tea key, 避免每个 block 都做 ECDH;
+    // 一个文件里通常只有几个公钥(每次启动、每个 LogBuffer 一个)
+    struct TeaKey {
+        uint32_t key[4];
+        bool valid;
+    };
+    std::map<std::string, TeaKey> keys;
+    uint16_t first_seq;
+    uint16_t last_seq;
+    std::vector<char> buffer;
+    std::string* trace;     // 摘出的 trace 事件, 为 NULL 时丢弃
+    LogRecordJoiner* records;   // 为 NULL 时分片帧留在文本里, 由调用方按文件顺序拼
+    std::string* attachments;   // 摘出的附件帧, 为 NULL 时丢弃
+
+    explicit LogDecodeContext(const LogDecodeConfig* _config)
+    : config(_config), first_seq(0), last_seq(0), trace(NULL), records(NULL), attachments(NULL) {}
+};
+
+namespace {
+
+struct Chunk {
+    size_t begin;
+    size_t end;
+    size_t first_pos;       // 这一段里第一个 block 的位置
+    size_t next_pos;        // 解完这一段后停在的位置, 下一段应该从这里开始
+    std::string text;
+    std::string trace;
+    std::string attachments;
+    LogDecodeStat stat;
+    uint16_t first_seq;
+    uint16_t last_seq;
+    bool done;
+};
+
+}  // namespace
+
+// 合法 block 的总长度, 不合法返回 0
+static size_t __BlockLen(const char* _data, size_t _len, size_t _pos) {
+    uint32_t header_len = LogCrypt::GetHeaderLen(_data + _pos, _len - _pos);
+    if (0 == header_len || _pos + header_len + LogCrypt::GetTailerLen() > _len) return 0;
+
+    size_t total = (size_t)header_len + LogCrypt::GetLogLen(_data + _pos, header_len) + LogCrypt::GetTailerLen();
+    if (_pos + total > _len || '\0' != _data[_pos + total - 1]) return 0;
+    return total;
+}
+
+// 紧接着的 _count 个 block 都合法(或者到文件尾)才算找到了边界, 减少压缩数据里偶然出现 magic 的误判
+static bool __IsGoodBlock(const char* _data, size_t _len, size_t _pos, int _count) {
+    for (int i = 0; i < _count && _pos < _len; ++i) {
+        size_t block_len = __BlockLen(_data, _len, _pos);
+        if (0 == block_len) return false;
+        _pos += block_len;
+    }
+    return true;
+}
+
+static size_t __FindBlock(const char* _data, size_t _len, size_t _pos) {
+    for (; _pos < _len; ++_pos) {
+        if (0 == LogCrypt::GetHeaderLen(_data + _pos, _len - _pos)) continue;
+        if (__IsGoodBlock(_data, _len, _pos, 2)) return _pos;
+    }
+    return _len;
+}
+
+static void __AppendNote(std::string& _out, const char* _fmt, size_t _pos) {
+    char note[256] = {0};
+    snprintf(note, sizeof(note), _fmt, _pos);
+    _out += note;
+}
+
+// 同步写的 block 没有加密, 但不压缩的异步 block 也用同样的 magic 且内容加密了. v2 header 里有标志位,
+// v1 只能看内容像不像文本
+static bool __LooksLikeText(const char* _data, size_t _len) {
+    // 同步写的 trace 帧、附件和超长日志的分片
+    if (_len >= aether::comm::XloggerTrace::kFrameMagicLen
+        && 0 == memcmp(_data, aether::comm::XloggerTrace::kFrameMagic, aether::comm::XloggerTrace::kFrameMagicLen)) {
+        return true;
+    }
+    if (_len >= LogRecordChunk::kHeaderLen && 0 == memcmp(_data, LogAttachment::Magic(), LogRecordChunk::kMagicLen)) {
+        return true;
+    }
+    if (_len >= LogRecordChunk::kHeaderLen && 0 == memcmp(_data, LogRecordChunk::Magic(), LogRecordChunk::kMagicLen)) {
+        _data += LogRecordChunk::kHeaderLen;
+        _len -= LogRecordChunk::kHeaderLen;
+    }
+    size_t check_len = _len < 256 ? _len : 256;
+    for (size_t i = 0; i < check_len; ++i) {
+        unsigned char c = (unsigned char)_data[i];
+        // ESC: 终端颜色码
+        if (c < 0x20 && '\n' != c && '\r' != c && '\t' != c && 0x1b != c) return false;
+    }
+    return true;
+}
+
+static bool __Inflate(const char* _data, size_t _len, std::string& _out) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != inflateInit2(&stream, -MAX_WBITS)) return false;
+
+    char buffer[64 * 1024];
+    stream.next_in = (Bytef*)_data;
+    stream.avail_in = (uInt)_len;
+
+    // 写入端每条日志 Z_SYNC_FLUSH, 落盘时没有 Z_FINISH, 输入用完就算结束
+    int ret = Z_OK;
+    while (true) {
+        stream.next_out = (Bytef*)buffer;
+        stream.avail_out = sizeof(buffer);
+        ret = inflate(&stream, Z_SYNC_FLUSH);
+        _out.append(buffer, sizeof(buffer) - stream.avail_out);
+
+        if (Z_OK != ret) break;
+        if (0 == stream.avail_in && 0 != stream.avail_out) break;
+    }
+
+    inflateEnd(&stream);
+    // Z_BUF_ERROR: 输入用完了, 不是错误
+    return Z_OK == ret || Z_STREAM_END == ret || (Z_BUF_ERROR == ret && 0 == stream.avail_in);
+}
+
+static const uint32_t* __GetKey(LogDecodeContext& _ctx, const char* _header, size_t _header_len) {
+    char pubkey[64] = {0};
+    if (_ctx.config->private_key_.empty() || !LogCrypt::GetClientPubKey(_header, _header_len, pubkey)) return NULL;
+
+    std::string id(pubkey, sizeof(pubkey));
+    std::map<std::string, LogDecodeContext::TeaKey>::iterator iter = _ctx.keys.find(id);
+    if (_ctx.keys.end() == iter) {
+        if (256 <= _ctx.keys.size()) _ctx.keys.clear();
+
+        LogDecodeContext::TeaKey key;
+        key.valid = LogCrypt::MakeDecryptKey(_ctx.config->private_key_.c_str(), pubkey, key.key);
+        iter = _ctx.keys.insert(std::make_pair(id, key)).first;
+    }
+    return iter->second.valid ? iter->second.key : NULL;
+}
+
+static void __DecodeBlockText(LogDecodeContext& _ctx, const char* _block, size_t _block_len, size_t _pos, std::string& _out) {
+    uint32_t header_len = LogCrypt::GetHeaderLen(_block, _block_len);
+    const char* payload = _block + header_len;
+    size_t payload_len = _block_len - header_len - LogCrypt::GetTailerLen();
+
+    bool is_async = false;
+    bool is_crypt = false;
+    LogCrypt::GetBlockFormat(_block, _block_len, is_async, is_crypt);
+    ++_ctx.stat.blocks;
+
+    if (_ctx.config->check_seq_) {
+        uint16_t seq = LogCrypt::GetSeq(_block, header_len);
+        if (0 != seq) {
+            if (0 != _ctx.last_seq && seq != (uint16_t)(_ctx.last_seq + 1) && !(1 == seq && 0xFFFF == _ctx.last_seq)) {
+                char note[128] = {0};
+                snprintf(note, sizeof(note), "[F]xlog decoder: lost log, seq %u to %u\n", _ctx.last_seq + 1, seq - 1);
+                _out += note;
+            }
+            if (0 == _ctx.first_seq) _ctx.first_seq = seq;
+            _ctx.last_seq = seq;
+        }
+    }
+
+    if (0 == payload_len) return;
+
+    bool encrypted = is_async;
+    if (is_crypt && !is_async && !LogCrypt::GetPayloadEncrypted(_block, header_len, encrypted)) {
+        encrypted = !__LooksLikeText(payload, payload_len);
+    }
+
+    if (is_crypt && encrypted) {
+        const uint32_t* tea_key = __GetKey(_ctx, _block, header_len);
+        if (NULL == tea_key) {
+            ++_ctx.stat.failed_blocks;
+            __AppendNote(_out, "[F]xlog decoder: encrypted block at %zu, private key missing or wrong\n", _pos);
+            return;
+        }
+        _ctx.buffer.assign(payload, payload + payload_len);
+        LogCrypt::DecryptAsyncLog(&_ctx.buffer[0], payload_len, tea_key);
+        payload = &_ctx.buffer[0];
+    }
+
+    if (!is_async) {
+        _out.append(payload, payload_len);
+        return;
+    }
+
+    if (!__Inflate(payload, payload_len, _out)) {
+        ++_ctx.stat.failed_blocks;
+        __AppendNote(_out, "\n[F]xlog decoder: inflate error in block at %zu\n", _pos);
+    }
+}
+
+// 拼到的超长日志计入 _stat
+static void __JoinRecords(LogRecordJoiner& _records, std::string& _text, size_t _from, LogDecodeStat& _stat) {
+    uint64_t joined = _records.Joined();
+    uint64_t broken = _records.Broken();
+    _records.Join(_text, _from);
+    _stat.long_records += _records.Joined() - joined;
+    _stat.broken_records += _records.Broken() - broken;
+}
+
+static void __FinishRecords(LogRecordJoiner& _records, std::string& _out, LogDecodeStat& _stat) {
+    uint64_t broken = _records.Broken();
+    _records.Finish(_out);
+    _stat.broken_records += _records.Broken() - broken;
+}
+
+// 一条记录不会跨 block, trace 帧、附件和超长日志的每一片总是完整地落在一个 block 里.
+// 附件数据里可能有别的帧的 magic, 最先摘
+static void __DecodeBlock(LogDecodeContext& _ctx, const char* _block, size_t _block_len, size_t _pos, std::string& _out) {
+    size_t begin = _out.size();
+    __DecodeBlockText(_ctx, _block, _block_len, _pos, _out);
+    _ctx.stat.attachments += LogAttachmentExtract(_out, begin, _ctx.attachments);
+    _ctx.stat.trace_events += LogTraceExtract(_out, begin, _ctx.trace);
+    if (NULL != _ctx.records) __JoinRecords(*_ctx.records, _out, begin, _ctx.stat);
+}
+
+// 从 _pos 开始解码, 直到第一个起点不小于 _end 的 block; 返回停下的位置
+static size_t __DecodeRange(LogDecodeContext& _ctx, const char* _data, size_t _len, size_t _pos, size_t _end, std::string& _out) {
+    while (_pos < _end && _pos < _len) {
+        size_t block_len = __BlockLen(_data, _len, _pos);
+        if (0 == block_len) {
+            size_t next = __FindBlock(_data, _len, _pos + 1);
+            _ctx.stat.skipped_bytes += next - _pos;
+            __AppendNote(_out, "[F]xlog decoder: corrupted data at %zu, skipped\n", _pos);
+            _pos = next;
+            continue;
+        }
+
+        __DecodeBlock(_ctx, _data + _pos, block_len, _pos, _out);
+        _pos += block_len;
+    }
+    return _pos;
+}
+
+static void __MergeStat(LogDecodeStat& _to, const LogDecodeStat& _from) {
+    _to.blocks += _from.blocks;
+    _to.skipped_bytes += _from.skipped_bytes;
+    _to.failed_blocks += _from.failed_blocks;
+    _to.trace_events += _from.trace_events;
+    _to.attachments += _from.attachments;
+    _to.long_records += _from.long_records;
+    _to.broken_records += _from.broken_records;
+}
+
+LogDecoder::LogDecoder(const LogDecodeConfig& _config)
+: config_(_config), block_ctx_(NULL) {
+    if (0 == config_.chunk_size_) config_.chunk_size_ = 16 * 1024 * 1024;
+}
+
+LogDecoder::~LogDecoder() {
+    if (NULL != block_ctx_) delete block_ctx_->records;
+    delete block_ctx_;
+}
+
+size_t LogDecoder::NextBlock(const char* _data, size_t _len, size_t _pos, size_t& _block_len) {
+    _block_len = __BlockLen(_data, _len, _pos);
+    if (0 != _block_len) return _pos;
+
+    _pos = __FindBlock(_data, _len, _pos + 1);
+    _block_len = _pos < _len ? __BlockLen(_data, _len, _pos) : 0;
+    return _pos;
+}
+
+void LogDecoder::DecodeBlock(const char* _block, size_t _block_len, std::string& _out, LogDecodeStat* _stat) {
+    if (NULL == block_ctx_) {
+        block_ctx_ = new LogDecodeContext(&config_);
+        block_ctx_->records = new LogRecordJoiner();
+    }
+
+    block_ctx_->stat = LogDecodeStat();
+    __DecodeBlock(*block_ctx_, _block, _block_len, 0, _out);
+    if (_stat) __MergeStat(*_stat, block_ctx_->stat);
+}
+
+void LogDecoder::Decode(const char* _data, size_t _len, std::string& _out, LogDecodeStat* _stat) {
+    LogDecodeContext ctx(&config_);
+    LogRecordJoiner records;
+    ctx.records = &records;
+    __DecodeRange(ctx, _data, _len, 0, _len, _out);
+    __FinishRecords(records, _out, ctx.stat);
+    if (_stat) __MergeStat(*_stat, ctx.stat);
+}
+
+namespace {
+
+class ParallelDecode {
+  public:
+    ParallelDecode(const LogDecodeConfig* _config, const char* _data, size_t _len, unsigned int _threads, LogTraceWriter* _trace,
+                   LogAttachmentWriter* _attachments)
+    : config_(_config), data_(_data), len_(_len), threads_(_threads), trace_(_trace), attachments_(_attachments)
+    , next_chunk_(0), next_output_(0) {
+        for (size_t begin = 0; begin < _len; begin += _config->chunk_size_) {
+            Chunk chunk;
+            chunk.begin = begin;
+            chunk.end = std::min(_len, begin + _config->chunk_size_);
+            chunk.first_pos = chunk.next_pos = chunk.end;
+            chunk.first_seq = chunk.last_seq = 0;
+            chunk.done = false;
+            chunks_.push_back(chunk);
+        }
+        // 解完还没输出的段最多这么多, 限制内存
+        window_ = threads_ * 2;
+    }
+
+    bool Run(FILE* _out, LogDecodeStat& _stat) {
+        std::vector<Thread*> workers;
+        for (unsigned int i = 0; i < threads_; ++i) {
+            Thread* thread = new Thread(std::bind(&ParallelDecode::__Worker, this), "xlog_decode");
+            thread->start();
+            workers.push_back(thread);
+        }
+
+        bool ok = true;
+        size_t expected = 0;
+        uint16_t last_seq = 0;
+        LogDecodeContext serial(config_);
+        LogRecordJoiner records;
+        for (size_t i = 0; i < chunks_.size(); ++i) {
+            ScopedLock lock(mutex_);
+            while (!chunks_[i].done) cond_.wait(lock);
+            Chunk& chunk = chunks_[i];
+            lock.unlock();
+
+            // 前一段最后一个 block 跨过了段边界, 这一段找到的起点和它对不上时从衔接处重新解
+            if (chunk.first_pos != expected && expected < chunk.end) {
+                chunk.text.clear();
+                chunk.trace.clear();
+                chunk.attachments.clear();
+                chunk.stat = LogDecodeStat();
+                serial.stat = LogDecodeStat();
+                serial.first_seq = serial.last_seq = 0;
+                serial.trace = NULL == trace_ ? NULL : &chunk.trace;
+                serial.attachments = NULL == attachments_ ? NULL : &chunk.attachments;
+                chunk.next_pos = __DecodeRange(serial, data_, len_, expected, chunk.end, chunk.text);
+                chunk.stat = serial.stat;
+                chunk.first_seq = serial.first_seq;
+                chunk.last_seq = serial.last_seq;
+            } else if (expected >= chunk.end) {
+                // 整段都在上一个 block 里
+                chunk.text.clear();
+                chunk.trace.clear();
+                chunk.attachments.clear();
+                chunk.stat = LogDecodeStat();
+                chunk.next_pos = expected;
+                chunk.first_seq = chunk.last_seq = 0;
+            }
+
+            if (config_->check_seq_ && 0 != last_seq && 0 != chunk.first_seq && chunk.first_seq != (uint16_t)(last_seq + 1)) {
+                fprintf(_out, "[F]xlog decoder: lost log, seq %u to %u\n", last_seq + 1, chunk.first_seq - 1);
+            }
+            if (0 != chunk.last_seq) last_seq = chunk.last_seq;
+
+            // 分片可能跨段, 只能在这里按顺序拼
+            __JoinRecords(records, chunk.text, 0, chunk.stat);
+            if (!chunk.text.empty() && chunk.text.size() != fwrite(chunk.text.data(), 1, chunk.text.size(), _out)) {
+                ok = false;
+            }
+            if (NULL != trace_ && !chunk.trace.empty() && !trace_->Append(chunk.trace)) ok = false;
+            std::string().swap(chunk.trace);
+            if (NULL != attachments_ && !chunk.attachments.empty() && !attachments_->Append(chunk.attachments)) ok = false;
+            std::string().swap(chunk.attachments);
+            __MergeStat(_stat, chunk.stat);
+            expected = chunk.next_pos;
+            std::string().swap(chunk.text);
+
+            lock.lock();
+            next_output_ = i + 1;
+            cond_.notifyAll(lock, true);
+        }
+
+        std::string rest;
+        __FinishRecords(records, rest, _stat);
+        if (!rest.empty() && rest.size() != fwrite(rest.data(), 1, rest.size(), _out)) ok = false;
+
+        for (std::vector<Thread*>::iterator iter = workers.begin(); iter != workers.end(); ++iter) {
+            (*iter)->join();
+            delete *iter;
+        }
+        return ok;
+    }
+
+  private:
+    void __Worker() {
+        LogDecodeContext ctx(config_);
+        while (true) {
+            ScopedLock lock(mutex_);
+            while (next_chunk_ < chunks_.size() && next_chunk_ >= next_output_ + window_) cond_.wait(lock);
+            if (next_chunk_ >= chunks_.size()) return;
+            size_t index = next_chunk_++;
+            Chunk& chunk = chunks_[index];
+            lock.unlock();
+
+            ctx.stat = LogDecodeStat();
+            ctx.first_seq = ctx.last_seq = 0;
+            ctx.trace = NULL == trace_ ? NULL : &chunk.trace;
+            ctx.attachments = NULL == attachments_ ? NULL : &chunk.attachments;
+            chunk.first_pos = (0 == chunk.begin) ? 0 : __FindBlock(data_, len_, chunk.begin);
+            chunk.next_pos = __DecodeRange(ctx, data_, len_, chunk.first_pos, chunk.end, chunk.text);
+            chunk.stat = ctx.stat;
+            chunk.first_seq = ctx.first_seq;
+            chunk.last_seq = ctx.last_seq;
+
+            lock.lock();
+            chunk.done = true;
+            cond_.notifyAll(lock, true);
+        }
+    }
+
+  private:
+    const LogDecodeConfig* config_;
+    const char* data_;
+    size_t len_;
+    unsigned int threads_;
+    LogTraceWriter* trace_;
+    LogAttachmentWriter* attachments_;
+    size_t window_;
+
+    Mutex mutex_;
+    Condition cond_;
+    std::vector<Chunk> chunks_;
+    size_t next_chunk_;
+    size_t next_output_;
+};
+
+}  // namespace
+
+bool LogDecoder::DecodeFile(const std::string& _path, FILE* _out, std::string& _err_msg, LogDecodeStat* _stat,
+                            LogTraceWriter* _trace, LogAttachmentWriter* _attachments) {
+    char msg[1024] = {0};
+
+    int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        snprintf(msg, sizeof(msg), "open %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        return false;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st)) {
+        snprintf(msg, sizeof(msg), "fstat %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        ::close(fd);
+        return false;
+    }
+    if (0 == st.st_size) {
+        ::close(fd);
+        return true;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void* data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == data) {
+        snprintf(msg, sizeof(msg), "mmap %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        return false;
+    }
+    madvise(data, len, MADV_SEQUENTIAL);
+
+    unsigned int threads = config_.threads_;
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int)cpus : 1;
+    }
+    size_t chunks = (len + config_.chunk_size_ - 1) / config_.chunk_size_;
+    if (threads > chunks) threads = (unsigned int)chunks;
+
+    LogDecodeStat stat;
+    bool ok = true;
+    if (1 >= threads) {
+        LogDecodeContext ctx(&config_);
+        LogRecordJoiner records;
+        std::string text;
+        std::string trace;
+        std::string attachments;
+        ctx.trace = NULL == _trace ? NULL : &trace;
+        ctx.records = &records;
+        ctx.attachments = NULL == _attachments ? NULL : &attachments;
+        size_t pos = 0;
+        while (pos < len && ok) {
+            text.clear();
+            trace.clear();
+            attachments.clear();
+            pos = __DecodeRange(ctx, (const char*)data, len, pos, std::min(len, pos + config_.chunk_size_), text);
+            ok = text.size() == fwrite(text.data(), 1, text.size(), _out);
+            if (ok && NULL != _trace && !trace.empty()) ok = _trace->Append(trace);
+            if (ok && NULL != _attachments && !attachments.empty()) ok = _attachments->Append(attachments);
+        }
+        text.clear();
+        __FinishRecords(records, text, ctx.stat);
+        if (ok) ok = text.size() == fwrite(text.data(), 1, text.size(), _out);
+        stat = ctx.stat;
+    } else {
+        ParallelDecode decode(&config_, (const char*)data, len, threads, _trace, _attachments);
+        ok = decode.Run(_out, stat);
+    }
+
+    munmap(data, len);
+    if (_stat) __MergeStat(*_stat, stat);
+
+    if (!ok) {
+        snprintf(msg, sizeof(msg), "write output fail:%s", strerror(errno));
+        _err_msg += msg;
+    }
+    return ok;
+}
@@ -0,0 +1,77 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_decoder.h
+ *
+ * .xlog 解码: 按 block 解析, 损坏的地方跳到下一个合法的 block; 压缩的 block 做 raw inflate,
+ * 加密的 block 用服务端私钥解 tea. 大文件切成若干段由多个线程同时解码, 输出仍按文件顺序.
+ * 超长日志的分片按文件顺序拼回整条, 附件从文本里摘掉, 可以另存成文件.
+ */
+
+#ifndef LOG_DECODER_H_
+#define LOG_DECODER_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+
+struct LogDecodeConfig {
+    std::string private_key_;       // 十六进制的服务端私钥, 为空时加密的 block 只输出提示
+    unsigned int threads_ = 0;      // 0 表示按 CPU 核数
+    size_t chunk_size_ = 16 * 1024 * 1024;
+    bool check_seq_ = false;        // 多个实例共用 seq, 只有单实例的文件才适合检查丢失
+};
+
+struct LogDecodeStat {
+    uint64_t blocks = 0;
+    uint64_t skipped_bytes = 0;     // 损坏后跳过的字节
+    uint64_t failed_blocks = 0;     // 解压失败或者没有私钥
+    uint64_t trace_events = 0;      // 从文本里摘出的 trace 事件
+    uint64_t long_records = 0;      // 分片写入、拼回整条的超长日志
+    uint64_t broken_records = 0;    // 缺片或者没有结尾的超长日志
+    uint64_t attachments = 0;       // 从文本里摘掉的附件, 按最后一片计
+};
+
+struct LogDecodeContext;
+class LogTraceWriter;
+class LogAttachmentWriter;
+
+class LogDecoder {
+  public:
+    explicit LogDecoder(const LogDecodeConfig& _config);
+    ~LogDecoder();
+
+    // 从 _pos 开始找第一个合法 block, 返回它的位置并通过 _block_len 带回长度; 找不到时返回 _len.
+    // 返回值大于 _pos 说明中间的数据损坏了
+    static size_t NextBlock(const char* _data, size_t _len, size_t _pos, size_t& _block_len);
+
+    // 解码一段内存里的 xlog 数据, 单线程
+    void Decode(const char* _data, size_t _len, std::string& _out, LogDecodeStat* _stat = NULL);
+    // mmap 整个文件, 分段并行解码, 按顺序写到 _out; trace 帧和附件总是从文本里摘掉,
+    // _trace 不为 NULL 时导出 trace 事件, _attachments 不为 NULL 时写出附件
+    bool DecodeFile(const std::string& _path, FILE* _out, std::string& _err_msg, LogDecodeStat* _stat = NULL,
+                    LogTraceWriter* _trace = NULL, LogAttachmentWriter* _attachments = NULL);
+    // 解码一个完整的 block(NextBlock 找到的), 追加到 _out; 按公钥缓存的 tea key 在多次调用间复用, 不能多线程同时调用.
+    // 超长日志在最后一片所在的 block 输出整条
+    void DecodeBlock(const char* _block, size_t _block_len, std::string& _out, LogDecodeStat* _stat = NULL);
+
+  private:
+    LogDecoder(const LogDecoder&);
+    LogDecoder& operator=(const LogDecoder&);
+
+  private:
+    LogDecodeConfig config_;
+    LogDecodeContext* block_ctx_;
+};
+
+#endif  // LOG_DECODER_H_
@@ -0,0 +1,488 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_query.cc
+ */
+
+#include "log_query.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../crypt/log_crypt.h"
+#include "../log_index.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+namespace {
+
+// log_formater 写的记录头: "2025-12-22 18:56:27.897 [25449:25449* main] D/Account LogActivity.kt:212 - ..."
+// 没有时间时以 " [" 开头
+struct RecordHead {
+    bool has_time;
+    int64_t pid;
+    int64_t tid;
+    int level;
+    const char* tag;
+    size_t tag_len;
+};
+
+}  // namespace
+
+// 归并时一个进程的记录流: 它的 block 按文件顺序排好, 用到时才解码
+struct LogMergeStream {
+    std::vector<std::pair<const char*, size_t> > blocks;
+    size_t next_block = 0;
+    std::string text;
+    size_t pos = 0;             // 当前记录在 text 里的位置
+    size_t len = 0;             // 当前记录的长度, 0 表示流已经结束
+    int64_t ms = 0;             // 当前记录的时间
+};
+
+static const char kTimePattern[] = "0000-00-00 00:00:00.000";
+static const size_t kTimeLen = sizeof(kTimePattern) - 1;
+
+static bool __IsTime(const char* _data, size_t _len) {
+    if (_len < kTimeLen) return false;
+    for (size_t i = 0; i < kTimeLen; ++i) {
+        bool is_digit = '0' <= _data[i] && _data[i] <= '9';
+        if ('0' == kTimePattern[i] ? !is_digit : kTimePattern[i] != _data[i]) return false;
+    }
+    return true;
+}
+
+static bool __ParseInt(const char*& _pos, const char* _end, int64_t& _value) {
+    const char* begin = _pos;
+    _value = 0;
+    while (_pos < _end && '0' <= *_pos && *_pos <= '9') {
+        _value = _value * 10 + (*_pos - '0');
+        ++_pos;
+    }
+    return _pos != begin;
+}
+
+static int __LevelFromChar(char _c) {
+    static const char kLevels[] = "VDIWEF";
+    const char* found = strchr(kLevels, _c);
+    return ('\0' != _c && NULL != found) ? (int)(found - kLevels) : -1;
+}
+
+static bool __ParseHead(const char* _record, size_t _len, RecordHead& _head) {
+    const char* pos = _record;
+    const char* end = _record + _len;
+
+    _head.has_time = __IsTime(_record, _len);
+    if (_head.has_time) pos += kTimeLen;
+
+    if (end - pos < 2 || ' ' != pos[0] || '[' != pos[1]) return false;
+    pos += 2;
+
+    if (!__ParseInt(pos, end, _head.pid) || pos == end || ':' != *pos) return false;
+    ++pos;
+    if (!__ParseInt(pos, end, _head.tid)) return false;
+
+    // 主线程标记和线程名
+    pos = (const char*)memchr(pos, ']', end - pos);
+    if (NULL == pos || end - pos < 4 || ' ' != pos[1] || '/' != pos[3]) return false;
+
+    _head.level = __LevelFromChar(pos[2]);
+    _head.tag = pos + 4;
+    const char* tag_end = _head.tag;
+    while (tag_end < end && ' ' != *tag_end && '\n' != *tag_end) ++tag_end;
+    _head.tag_len = tag_end - _head.tag;
+    return true;
+}
+
+// 空行和缩进 4 个空格的行是上一条记录的续行
+static bool __IsContinuation(const char* _line, size_t _len) {
+    if (0 == _len || '\n' == _line[0]) return true;
+    return 4 <= _len && 0 == memcmp(_line, "    ", 4);
+}
+
+// 从 _begin 开始的一条记录的结尾, 包含续行
+static size_t __RecordEnd(const char* _data, size_t _len, size_t _begin) {
+    const char* line_end = (const char*)memchr(_data + _begin, '\n', _len - _begin);
+    size_t end = NULL == line_end ? _len : (size_t)(line_end - _data) + 1;
+
+    while (end < _len && __IsContinuation(_data + end, _len - end)) {
+        line_end = (const char*)memchr(_data + end, '\n', _len - end);
+        end = NULL == line_end ? _len : (size_t)(line_end - _data) + 1;
+    }
+    return end;
+}
+
+static bool __TagEquals(const std::string& _tag, const char* _record_tag, size_t _len) {
+    // 没有 tag 的记录写成 "-"
+    if (1 == _len && '-' == _record_tag[0] && _tag.empty()) return true;
+    return _tag.size() == _len && 0 == memcmp(_tag.data(), _record_tag, _len);
+}
+
+static void __MergeStat(LogQueryStat& _to, const LogQueryStat& _from) {
+    _to.blocks += _from.blocks;
+    _to.skipped_blocks += _from.skipped_blocks;
+    _to.records += _from.records;
+    _to.matched += _from.matched;
+    _to.processes += _from.processes;
+    _to.decode.blocks += _from.decode.blocks;
+    _to.decode.skipped_bytes += _from.decode.skipped_bytes;
+    _to.decode.failed_blocks += _from.decode.failed_blocks;
+}
+
+LogQueryEngine::LogQueryEngine(const LogQuery& _query, const LogDecodeConfig& _config)
+: query_(_query), decoder_(_config), use_regex_(false), valid_(true), last_second_ms_(0) {
+    memset(last_second_, 0, sizeof(last_second_));
+
+    if (!query_.regex_.empty()) {
+        try {
+            regex_.assign(query_.regex_, std::regex::ECMAScript | std::regex::optimize);
+            use_regex_ = true;
+        } catch (const std::regex_error& e) {
+            valid_ = false;
+            err_msg_ = std::string("bad regex: ") + e.what();
+        }
+    }
+}
+
+bool LogQueryEngine::__MatchBlock(const char* _block, size_t _block_len) const {
+    int64_t begin_ms = 0;
+    int64_t end_ms = 0;
+    uint32_t count = 0;
+    // 旧格式的 block 和 count 为 0 的 block 时间未知, 只能解开看
+    if (LogCrypt::GetLogTime(_block, _block_len, begin_ms, end_ms, count) && 0 < count) {
+        if (0 != query_.begin_ms_ && end_ms < query_.begin_ms_) return false;
+        if (0 != query_.end_ms_ && begin_ms > query_.end_ms_) return false;
+    }
+
+    // 记录头里的 pid 就是写 block 的进程
+    uint32_t pid = 0;
+    if (0 <= query_.pid_ && LogCrypt::GetPid(_block, _block_len, pid) && (int64_t)pid != query_.pid_) return false;
+
+    // 摘要只记录了有 XLoggerInfo 的记录; 没有的记录(kLevelMaskNoInfo)本来也过不了级别和 tag 条件
+    uint8_t level_mask = 0;
+    uint8_t tag_bloom[LogCrypt::kTagBloomBytes];
+    if (!LogCrypt::GetLogSummary(_block, _block_len, level_mask, tag_bloom)) return true;
+
+    if (0 != query_.level_mask_ && 0 == (level_mask & query_.level_mask_)) return false;
+
+    if (!query_.tags_.empty()) {
+        bool may_contain = false;
+        for (std::vector<std::string>::const_iterator iter = query_.tags_.begin(); iter != query_.tags_.end() && !may_contain; ++iter) {
+            may_contain = LogCrypt::MayContainTag(tag_bloom, iter->c_str()) || ("-" == *iter && LogCrypt::MayContainTag(tag_bloom, ""));
+        }
+        if (!may_contain) return false;
+    }
+    return true;
+}
+
+int64_t LogQueryEngine::__RecordTimeMs(const char* _record) {
+    // "YYYY-MM-DD HH:mm:ss" 部分相同时复用上一次的结果
+    if (0 != memcmp(last_second_, _record, sizeof(last_second_) - 1)) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = atoi(_record) - 1900;
+        tm.tm_mon = atoi(_record + 5) - 1;
+        tm.tm_mday = atoi(_record + 8);
+        tm.tm_hour = atoi(_record + 11);
+        tm.tm_min = atoi(_record + 14);
+        tm.tm_sec = atoi(_record + 17);
+        tm.tm_isdst = -1;
+
+        memcpy(last_second_, _record, sizeof(last_second_) - 1);
+        last_second_ms_ = (int64_t)mktime(&tm) * 1000;
+    }
+    return last_second_ms_ + atoi(_record + 20);
+}
+
+bool LogQueryEngine::__MatchRecord(const char* _record, size_t _len) {
+    RecordHead head;
+    bool structured = __ParseHead(_record, _len, head);
+
+    if (0 != query_.begin_ms_ || 0 != query_.end_ms_) {
+        if (!structured || !head.has_time) return false;
+        int64_t ms = __RecordTimeMs(_record);
+        if (0 != query_.begin_ms_ && ms < query_.begin_ms_) return false;
+        if (0 != query_.end_ms_ && ms > query_.end_ms_) return false;
+    }
+
+    if (0 != query_.level_mask_) {
+        if (!structured || 0 > head.level || 0 == (query_.level_mask_ & (1 << head.level))) return false;
+    }
+
+    if (!query_.tags_.empty()) {
+        if (!structured) return false;
+        bool found = false;
+        for (std::vector<std::string>::const_iterator iter = query_.tags_.begin(); iter != query_.tags_.end() && !found; ++iter) {
+            found = __TagEquals(*iter, head.tag, head.tag_len);
+        }
+        if (!found) return false;
+    }
+
+    if (0 <= query_.pid_ && (!structured || head.pid != query_.pid_)) return false;
+    if (0 <= query_.tid_ && (!structured || head.tid != query_.tid_)) return false;
+
+    if (!query_.substring_.empty() && _record + _len == std::search(_record, _record + _len, query_.substring_.begin(), query_.substring_.end())) {
+        return false;
+    }
+
+    // 结尾的换行不参与匹配, "$" 对应记录末尾
+    size_t body_len = (0 < _len && '\n' == _record[_len - 1]) ? _len - 1 : _len;
+    if (use_regex_ && !std::regex_search(_record, _record + body_len, regex_)) return false;
+
+    return true;
+}
+
+bool LogQueryEngine::__FilterText(const std::string& _text, const LogQueryCallback& _callback, LogQueryStat& _stat) {
+    const char* data = _text.data();
+    size_t len = _text.size();
+    size_t begin = 0;
+
+    while (begin < len) {
+        size_t end = __RecordEnd(data, len, begin);
+
+        ++_stat.records;
+        if (__MatchRecord(data + begin, end - begin)) {
+            ++_stat.matched;
+            if (!_callback(data + begin, end - begin)) return false;
+        }
+        begin = end;
+    }
+    return true;
+}
+
+bool LogQueryEngine::Query(const char* _data, size_t _len, const LogQueryCallback& _callback, LogQueryStat* _stat) {
+    if (!valid_) return true;
+
+    LogQueryStat stat;
+    bool go_on = true;
+    size_t pos = 0;
+    while (pos < _len && go_on) {
+        size_t block_len = 0;
+        size_t next = LogDecoder::NextBlock(_data, _len, pos, block_len);
+        stat.decode.skipped_bytes += next - pos;
+        if (next >= _len) break;
+
+        ++stat.blocks;
+        pos = next + block_len;
+        if (!__MatchBlock(_data + next, block_len)) {
+            ++stat.skipped_blocks;
+            continue;
+        }
+
+        text_.clear();
+        decoder_.DecodeBlock(_data + next, block_len, text_, &stat.decode);
+        go_on = __FilterText(text_, _callback, stat);
+    }
+
+    // 一个 block 解出来可能很大, 不留着
+    if (text_.capacity() > 1024 * 1024) std::string().swap(text_);
+    if (_stat) __MergeStat(*_stat, stat);
+    return go_on;
+}
+
+static bool __MapFile(const std::string& _path, const char*& _data, size_t& _len, std::string& _err_msg) {
+    char msg[1024] = {0};
+    _data = NULL;
+    _len = 0;
+
+    int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        snprintf(msg, sizeof(msg), "open %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        return false;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st)) {
+        snprintf(msg, sizeof(msg), "fstat %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        ::close(fd);
+        return false;
+    }
+    if (0 == st.st_size) {
+        ::close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == data) {
+        snprintf(msg, sizeof(msg), "mmap %s fail:%s", _path.c_str(), strerror(errno));
+        _err_msg += msg;
+        return false;
+    }
+
+    _data = (const char*)data;
+    _len = (size_t)st.st_size;
+    return true;
+}
+
+bool LogQueryEngine::QueryFile(const std::string& _path, const LogQueryCallback& _callback, std::string& _err_msg, LogQueryStat* _stat) {
+    if (!valid_) {
+        _err_msg += err_msg_;
+        return false;
+    }
+
+    const char* data = NULL;
+    size_t len = 0;
+    if (!__MapFile(_path, data, len, _err_msg)) return false;
+    if (0 == len) return true;
+
+    std::vector<LogIndexRange> ranges;
+    bool has_time = 0 != query_.begin_ms_ || 0 != query_.end_ms_;
+    int64_t end_ms = 0 != query_.end_ms_ ? query_.end_ms_ : INT64_MAX;
+    if (has_time && LogIndex::FindRanges(_path, query_.begin_ms_, end_ms, ranges)) {
+        for (std::vector<LogIndexRange>::iterator iter = ranges.begin(); iter != ranges.end(); ++iter) {
+            if (iter->offset >= len) break;
+            size_t range_len = (size_t)std::min<uint64_t>(iter->length, len - iter->offset);
+            if (!Query(data + iter->offset, range_len, _callback, _stat)) break;
+        }
+    } else {
+        Query(data, len, _callback, _stat);
+    }
+
+    munmap((void*)data, len);
+    return true;
+}
+
+bool LogQueryEngine::QueryRange(const std::string& _path, uint64_t _offset, uint64_t _length, const LogQueryCallback& _callback,
+                                std::string& _err_msg, LogQueryStat* _stat) {
+    if (!valid_) {
+        _err_msg += err_msg_;
+        return false;
+    }
+
+    const char* data = NULL;
+    size_t len = 0;
+    if (!__MapFile(_path, data, len, _err_msg)) return false;
+    if (0 == len) return true;
+
+    if (_offset < len) {
+        Query(data + _offset, (size_t)std::min<uint64_t>(_length, len - _offset), _callback, _stat);
+    }
+
+    munmap((void*)data, len);
+    return true;
+}
+
+bool LogQueryEngine::__NextRecord(LogMergeStream& _stream, LogQueryStat& _stat) {
+    _stream.pos += _stream.len;
+    _stream.len = 0;
+
+    while (_stream.pos >= _stream.text.size()) {
+        if (_stream.next_block >= _stream.blocks.size()) {
+            std::string().swap(_stream.text);
+            return false;
+        }
+
+        const std::pair<const char*, size_t>& block = _stream.blocks[_stream.next_block++];
+        ++_stat.blocks;
+        if (!__MatchBlock(block.first, block.second)) {
+            ++_stat.skipped_blocks;
+            continue;
+        }
+
+        // 开头没有时间的记录(头部信息之类)先按 block 的开始时间算
+        int64_t begin_ms = 0;
+        int64_t end_ms = 0;
+        uint32_t count = 0;
+        if (LogCrypt::GetLogTime(block.first, block.second, begin_ms, end_ms, count) && begin_ms > _stream.ms) {
+            _stream.ms = begin_ms;
+        }
+
+        _stream.text.clear();
+        _stream.pos = 0;
+        decoder_.DecodeBlock(block.first, block.second, _stream.text, &_stat.decode);
+    }
+
+    const char* data = _stream.text.data();
+    _stream.len = __RecordEnd(data, _stream.text.size(), _stream.pos) - _stream.pos;
+    if (__IsTime(data + _stream.pos, _stream.len)) _stream.ms = __RecordTimeMs(data + _stream.pos);
+    return true;
+}
+
+bool LogQueryEngine::QueryMerged(const std::vector<std::string>& _paths, const LogQueryCallback& _callback, std::string& _err_msg,
+                                 LogQueryStat* _stat) {
+    if (!valid_) {
+        _err_msg += err_msg_;
+        return false;
+    }
+
+    std::vector<std::pair<const char*, size_t> > maps;
+    std::vector<LogMergeStream> streams;
+    std::map<int64_t, size_t> stream_of;
+    LogQueryStat stat;
+    bool ok = true;
+
+    for (size_t i = 0; i < _paths.size() && ok; ++i) {
+        const char* data = NULL;
+        size_t len = 0;
+        ok = __MapFile(_paths[i], data, len, _err_msg);
+        if (!ok || 0 == len) continue;
+        maps.push_back(std::make_pair(data, len));
+
+        size_t pos = 0;
+        while (pos < len) {
+            size_t block_len = 0;
+            size_t next = LogDecoder::NextBlock(data, len, pos, block_len);
+            stat.decode.skipped_bytes += next - pos;
+            if (next >= len) break;
+            pos = next + block_len;
+
+            // 没有 pid 的旧格式 block 按文件区分, 用负数和 pid 错开
+            uint32_t pid = 0;
+            int64_t key = LogCrypt::GetPid(data + next, block_len, pid) ? (int64_t)pid : -1 - (int64_t)i;
+            std::map<int64_t, size_t>::iterator iter = stream_of.find(key);
+            if (stream_of.end() == iter) {
+                iter = stream_of.insert(std::make_pair(key, streams.size())).first;
+                streams.push_back(LogMergeStream());
+            }
+            streams[iter->second].blocks.push_back(std::make_pair(data + next, block_len));
+        }
+    }
+    stat.processes = streams.size();
+
+    if (ok) {
+        for (size_t i = 0; i < streams.size(); ++i) __NextRecord(streams[i], stat);
+
+        // 进程数一般只有几个, 每次线性找时间最早的; 时间相同时先出现的进程在前
+        while (true) {
+            LogMergeStream* earliest = NULL;
+            for (size_t i = 0; i < streams.size(); ++i) {
+                if (0 < streams[i].len && (NULL == earliest || streams[i].ms < earliest->ms)) earliest = &streams[i];
+            }
+            if (NULL == earliest) break;
+
+            const char* record = earliest->text.data() + earliest->pos;
+            ++stat.records;
+            if (__MatchRecord(record, earliest->len)) {
+                ++stat.matched;
+                if (!_callback(record, earliest->len)) break;
+            }
+            __NextRecord(*earliest, stat);
+        }
+    }
+
+    for (size_t i = 0; i < maps.size(); ++i) munmap((void*)maps[i].first, maps[i].second);
+    if (_stat) __MergeStat(*_stat, stat);
+    return ok;
+}
@@ -0,0 +1,103 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_query.h
+ *
+ * 按时间、级别、tag、pid/tid 和正文(子串或正则)过滤 .xlog.
+ * 先只看 block header: 时间范围、级别掩码和 tag 布隆过滤器都对不上的 block 不解压;
+ * 剩下的 block 逐个解码, 按记录过滤后回调, 内存占用只和单个 block 有关.
+ * 多个进程写的日志(header 里带 pid)可以按进程拆开, 再按记录时间归并成一个流.
+ */
+
+#ifndef LOG_QUERY_H_
+#define LOG_QUERY_H_
+
+#include <stdint.h>
+#include <functional>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "log_decoder.h"
+
+struct LogQuery {
+    int64_t begin_ms_ = 0;              // [begin_ms_, end_ms_], 0 表示不限
+    int64_t end_ms_ = 0;
+    uint8_t level_mask_ = 0;            // bit n 对应 level n, 0 表示不限
+    std::vector<std::string> tags_;     // 匹配其中任意一个, 空表示不限
+    int64_t pid_ = -1;                  // -1 表示不限
+    int64_t tid_ = -1;
+    std::string substring_;             // 正文(整条记录)包含的子串
+    std::string regex_;                 // ECMAScript 正则, 在整条记录里搜索
+};
+
+struct LogQueryStat {
+    uint64_t blocks = 0;
+    uint64_t skipped_blocks = 0;        // 只看 header 就跳过的 block
+    uint64_t records = 0;
+    uint64_t matched = 0;
+    uint64_t processes = 0;             // 归并时的进程数; 没有 pid 的旧 block 每个文件算一个
+    LogDecodeStat decode;
+};
+
+struct LogMergeStream;
+
+// 每条匹配的记录回调一次, 多行记录包含续行和结尾的换行; 返回 false 停止查询
+typedef std::function<bool (const char* _record, size_t _len)> LogQueryCallback;
+
+class LogQueryEngine {
+  public:
+    // 加密的日志需要 _config.private_key_
+    LogQueryEngine(const LogQuery& _query, const LogDecodeConfig& _config);
+
+    // 正则不合法时为 false, 查询不会有结果
+    bool IsValid() const { return valid_; }
+    const std::string& ErrMsg() const { return err_msg_; }
+
+    // 查询整个文件, 有索引时只读和时间范围相交的区间; 回调要求停止时也返回 true
+    bool QueryFile(const std::string& _path, const LogQueryCallback& _callback, std::string& _err_msg, LogQueryStat* _stat = NULL);
+    // 查询文件中 block 对齐的一段, 比如 XloggerAppender::GetLogRangesByTimeRange 的结果
+    bool QueryRange(const std::string& _path, uint64_t _offset, uint64_t _length, const LogQueryCallback& _callback,
+                    std::string& _err_msg, LogQueryStat* _stat = NULL);
+    // 查询一段内存里的 xlog 数据; 回调要求停止时返回 false
+    bool Query(const char* _data, size_t _len, const LogQueryCallback& _callback, LogQueryStat* _stat = NULL);
+    // 多个文件按 header 里的 pid 拆成各进程的记录流, 每个流内保持文件顺序, 流之间按记录时间归并后过滤、回调.
+    // 没有时间的记录跟着前一条; 每个进程同时只解开一个 block
+    bool QueryMerged(const std::vector<std::string>& _paths, const LogQueryCallback& _callback, std::string& _err_msg,
+                     LogQueryStat* _stat = NULL);
+
+  private:
+    LogQueryEngine(const LogQueryEngine&);
+    LogQueryEngine& operator=(const LogQueryEngine&);
+
+    bool __MatchBlock(const char* _block, size_t _block_len) const;
+    bool __MatchRecord(const char* _record, size_t _len);
+    bool __FilterText(const std::string& _text, const LogQueryCallback& _callback, LogQueryStat& _stat);
+    bool __NextRecord(LogMergeStream& _stream, LogQueryStat& _stat);
+    int64_t __RecordTimeMs(const char* _record);
+
+  private:
+    LogQuery query_;
+    LogDecoder decoder_;
+    std::regex regex_;
+    bool use_regex_;
+    bool valid_;
+    std::string err_msg_;
+    std::string text_;
+
+    // 同一秒内的记录不重复 mktime
+    char last_second_[20];
+    int64_t last_second_ms_;
+};
+
+#endif  // LOG_QUERY_H_
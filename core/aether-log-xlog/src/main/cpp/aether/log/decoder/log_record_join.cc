@@ -0,0 +1,105 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_record_join.cc
+ */
+
+#include "log_record_join.h"
+
+#include <algorithm>
+
+#include "../log_record_chunk.h"
+
+static void __AppendNote(std::string& _out, const char* _note) {
+    if (!_out.empty() && '\n' != _out[_out.size() - 1]) _out += '\n';
+    _out += _note;
+}
+
+void LogRecordJoiner::__Lost(Pending& _pending) {
+    __AppendNote(_pending.text, "[F]xlog decoder: part of a long log lost\n");
+    _pending.lost = true;
+}
+
+void LogRecordJoiner::Join(std::string& _text, size_t _from) {
+    if (_from >= _text.size()) return;
+
+    // 没有分片帧时不复制
+    size_t pos = _text.find(LogRecordChunk::Magic(), _from, LogRecordChunk::kMagicLen);
+    if (std::string::npos == pos) return;
+
+    std::string out(_text, 0, pos);
+    out.reserve(_text.size());
+    while (pos < _text.size()) {
+        size_t frame = _text.find(LogRecordChunk::Magic(), pos, LogRecordChunk::kMagicLen);
+        if (std::string::npos == frame) {
+            out.append(_text, pos, std::string::npos);
+            break;
+        }
+        out.append(_text, pos, frame - pos);
+
+        uint32_t id = 0;
+        uint16_t index = 0;
+        uint8_t flags = 0;
+        uint32_t text_len = 0;
+        if (!LogRecordChunk::GetHeader(_text.data() + frame, _text.size() - frame, id, index, flags, text_len)) {
+            // 截断在帧头里, 后面没有可用的内容
+            break;
+        }
+        size_t begin = frame + LogRecordChunk::kHeaderLen;
+        size_t len = std::min((size_t)text_len, _text.size() - begin);
+
+        std::map<uint32_t, Pending>::iterator iter = pending_.find(id);
+        if (0 == index && pending_.end() != iter) {
+            // 同一个 id 的上一条没等到结尾(比如进程崩溃后重启撞了 id), 先原样输出
+            __Lost(iter->second);
+            out += iter->second.text;
+            ++broken_;
+            pending_.erase(iter);
+            iter = pending_.end();
+        }
+        if (pending_.end() == iter) {
+            Pending pending;
+            pending.next_index = 0;
+            pending.lost = false;
+            iter = pending_.insert(std::make_pair(id, pending)).first;
+        }
+
+        Pending& pending = iter->second;
+        if (pending.next_index != index) __Lost(pending);
+        pending.text.append(_text, begin, len);
+        pending.next_index = (uint16_t)(index + 1);
+        if (len < text_len) __Lost(pending);
+
+        if (0 != (flags & LogRecordChunk::kFlagLast)) {
+            out += pending.text;
+            if (pending.lost) {
+                ++broken_;
+            } else {
+                ++joined_;
+            }
+            pending_.erase(iter);
+        }
+        pos = begin + len;
+    }
+
+    _text.swap(out);
+}
+
+void LogRecordJoiner::Finish(std::string& _out) {
+    for (std::map<uint32_t, Pending>::iterator iter = pending_.begin(); iter != pending_.end(); ++iter) {
+        __AppendNote(iter->second.text, "[F]xlog decoder: long log incomplete\n");
+        _out += iter->second.text;
+        ++broken_;
+    }
+    pending_.clear();
+}
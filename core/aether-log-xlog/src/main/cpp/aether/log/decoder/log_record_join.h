@@ -0,0 +1,56 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_record_join.h
+ *
+ * 解码后的文本里把超长日志的分片帧(格式见 ../log_record_chunk.h)拼回整条.
+ * 一条日志的片可能跨 block、跨解码分段, 所以按文件顺序喂给同一个 LogRecordJoiner.
+ */
+
+#ifndef LOG_RECORD_JOIN_H_
+#define LOG_RECORD_JOIN_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+class LogRecordJoiner {
+  public:
+    LogRecordJoiner() : joined_(0), broken_(0) {}
+
+    // 从 _text 的 _from 处开始摘掉分片帧, 拼完整的日志放在最后一片的位置; 没拼完的留到之后的调用
+    void Join(std::string& _text, size_t _from);
+    // 输入结束, 没等到最后一片的日志按 id 顺序追加到 _out, 并注明不完整
+    void Finish(std::string& _out);
+
+    // 拼回的整条日志数
+    uint64_t Joined() const { return joined_; }
+    // 缺片或者没有结尾的日志数
+    uint64_t Broken() const { return broken_; }
+
+  private:
+    struct Pending {
+        std::string text;
+        uint16_t next_index;
+        bool lost;
+    };
+
+    void __Lost(Pending& _pending);
+
+  private:
+    std::map<uint32_t, Pending> pending_;
+    uint64_t joined_;
+    uint64_t broken_;
+};
+
+#endif  // LOG_RECORD_JOIN_H_
@@ -0,0 +1,225 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_trace.cc
+ */
+
+#include "log_trace.h"
+
+#include <cstring>
+
+#include "../../common/xlogger/xlogger_trace.h"
+
+using aether::comm::XloggerTrace;
+
+namespace {
+
+class FrameReader {
+  public:
+    FrameReader(const char* _data, size_t _len)
+    : data_(_data), len_(_len), pos_(0) {}
+
+    bool Fixed(uint64_t& _value, size_t _bytes) {
+        if (len_ - pos_ < _bytes) return false;
+        _value = 0;
+        for (size_t i = 0; i < _bytes; ++i) _value |= (uint64_t)(uint8_t)data_[pos_ + i] << (8 * i);
+        pos_ += _bytes;
+        return true;
+    }
+
+    bool Varint(uint64_t& _value) {
+        _value = 0;
+        for (int shift = 0; shift < 64 && pos_ < len_; shift += 7) {
+            uint8_t byte = (uint8_t)data_[pos_++];
+            _value |= (uint64_t)(byte & 0x7f) << shift;
+            if (0 == (byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool String(const char*& _str, size_t& _len) {
+        uint64_t len = 0;
+        if (!Varint(len) || len > len_ - pos_) return false;
+        _str = data_ + pos_;
+        _len = (size_t)len;
+        pos_ += (size_t)len;
+        return true;
+    }
+
+    bool Byte(char& _value) {
+        if (pos_ >= len_) return false;
+        _value = data_[pos_++];
+        return true;
+    }
+
+  private:
+    const char* data_;
+    size_t len_;
+    size_t pos_;
+};
+
+}  // namespace
+
+static void __AppendJsonString(std::string& _out, const char* _str, size_t _len) {
+    _out += '"';
+    for (size_t i = 0; i < _len; ++i) {
+        unsigned char c = (unsigned char)_str[i];
+        if ('"' == c || '\\' == c) {
+            _out += '\\';
+            _out += (char)c;
+        } else if (c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            _out += escaped;
+        } else {
+            _out += (char)c;
+        }
+    }
+    _out += '"';
+}
+
+// 帧头之后的部分: pid | tid | 墙上时间 | 单调时钟 | 第一个事件的时间 | 事件...
+static uint64_t __ConvertFrame(const char* _data, size_t _len, std::string* _events) {
+    FrameReader reader(_data, _len);
+    uint64_t pid = 0, tid = 0, wall_us = 0, mono_ns = 0, ts_ns = 0;
+    if (!reader.Fixed(pid, 4) || !reader.Fixed(tid, 8) || !reader.Fixed(wall_us, 8) || !reader.Fixed(mono_ns, 8)
+        || !reader.Fixed(ts_ns, 8)) {
+        return 0;
+    }
+
+    uint64_t count = 0;
+    char type = 0;
+    while (reader.Byte(type)) {
+        uint64_t delta = 0;
+        const char* name = NULL;
+        size_t name_len = 0;
+        const char* msg = NULL;
+        size_t msg_len = 0;
+        uint64_t value = 0;
+        if (!reader.Varint(delta)) break;
+        bool ok = false;
+        switch (type) {
+            case XloggerTrace::kEventBegin:
+            case XloggerTrace::kEventInstant:
+                ok = reader.String(name, name_len) && reader.String(msg, msg_len);
+                break;
+            case XloggerTrace::kEventEnd:
+                ok = reader.String(msg, msg_len);
+                break;
+            case XloggerTrace::kEventCounter:
+                ok = reader.String(name, name_len) && reader.Varint(value);
+                break;
+            default:
+                break;
+        }
+        if (!ok) break;
+
+        ts_ns += delta;
+        ++count;
+        if (NULL == _events) continue;
+
+        // 按取帧时两个时钟的差换算成墙上时间
+        int64_t wall_ns = (int64_t)wall_us * 1000 - (int64_t)(mono_ns - ts_ns);
+        char buf[160];
+        std::string& out = *_events;
+        out += "{";
+        if (NULL != name) {
+            out += "\"name\":";
+            __AppendJsonString(out, name, name_len);
+            out += ",";
+        }
+        const char* phase = "B";
+        if (XloggerTrace::kEventEnd == type) phase = "E";
+        if (XloggerTrace::kEventCounter == type) phase = "C";
+        if (XloggerTrace::kEventInstant == type) phase = "i\",\"s\":\"t";     // 瞬时事件限定在线程内
+        snprintf(buf, sizeof(buf), "\"ph\":\"%s\",\"ts\":%lld.%03lld,\"pid\":%llu,\"tid\":%llu",
+                 phase, (long long)(wall_ns / 1000), (long long)(wall_ns % 1000), (unsigned long long)pid, (unsigned long long)tid);
+        out += buf;
+        if (XloggerTrace::kEventCounter == type) {
+            int64_t counter = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+            snprintf(buf, sizeof(buf), ",\"args\":{\"value\":%lld}", (long long)counter);
+            out += buf;
+        } else if (0 < msg_len) {
+            out += ",\"args\":{\"msg\":";
+            __AppendJsonString(out, msg, msg_len);
+            out += "}";
+        }
+        out += "}\n";
+    }
+    return count;
+}
+
+uint64_t LogTraceExtract(std::string& _text, size_t _from, std::string* _events) {
+    if (_from >= _text.size()) return 0;
+
+    char* data = &_text[0];
+    size_t len = _text.size();
+    size_t read = _from;
+    size_t write = _from;
+    uint64_t count = 0;
+
+    while (read < len) {
+        const char* nul = (const char*)memchr(data + read, '\0', len - read);
+        size_t pos = NULL == nul ? len : (size_t)(nul - data);
+        if (write != read) memmove(data + write, data + read, pos - read);
+        write += pos - read;
+        read = pos;
+        if (read >= len) break;
+
+        if (len - read < XloggerTrace::kFrameMagicLen + 4
+            || 0 != memcmp(data + read, XloggerTrace::kFrameMagic, XloggerTrace::kFrameMagicLen)) {
+            // 不是帧头的 '\0' 原样保留
+            data[write++] = data[read++];
+            continue;
+        }
+
+        size_t body = read + XloggerTrace::kFrameMagicLen + 4;
+        uint32_t frame_len = 0;
+        for (size_t i = 0; i < 4; ++i) frame_len |= (uint32_t)(uint8_t)data[body - 4 + i] << (8 * i);
+        size_t end = frame_len > len - body ? len : body + frame_len;
+        count += __ConvertFrame(data + body, end - body, _events);
+        read = end;
+    }
+
+    _text.resize(write);
+    return count;
+}
+
+LogTraceWriter::LogTraceWriter(FILE* _out)
+: out_(_out), started_(false), events_(0) {}
+
+bool LogTraceWriter::Append(const std::string& _events) {
+    bool ok = true;
+    if (!started_) {
+        started_ = true;
+        ok = 0 <= fputs("{\"traceEvents\":[\n", out_);
+    }
+
+    size_t begin = 0;
+    while (ok && begin < _events.size()) {
+        size_t end = _events.find('\n', begin);
+        if (std::string::npos == end) end = _events.size();
+        if (end > begin) {
+            if (0 < events_) ok = 0 <= fputs(",\n", out_);
+            ok = ok && end - begin == fwrite(_events.data() + begin, 1, end - begin, out_);
+            ++events_;
+        }
+        begin = end + 1;
+    }
+    return ok;
+}
+
+bool LogTraceWriter::Finish() {
+    if (!started_ && !Append(std::string())) return false;
+    return 0 <= fputs("\n],\"displayTimeUnit\":\"ns\"}\n", out_) && 0 == fflush(out_);
+}
@@ -0,0 +1,52 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_trace.h
+ *
+ * 解码后的文本里摘出 trace 帧(格式见 xlogger_trace.h), 转成 Chrome/Perfetto 的 trace event JSON.
+ * 时间换算成墙上时间的微秒(带三位小数到纳秒), 和文本日志的时间对得上.
+ */
+
+#ifndef LOG_TRACE_H_
+#define LOG_TRACE_H_
+
+#include <stdint.h>
+#include <cstdio>
+#include <string>
+
+// 从 _text 的 _from 处开始摘掉所有 trace 帧, 文本原地拼回; _events 不为 NULL 时每个事件追加一行 JSON 对象.
+// 截断或损坏的帧也摘掉, 只转换完整的事件. 返回转换出的事件数
+uint64_t LogTraceExtract(std::string& _text, size_t _from, std::string* _events);
+
+// {"traceEvents":[...]} 格式的输出, 多个文件可以写进同一个
+class LogTraceWriter {
+  public:
+    explicit LogTraceWriter(FILE* _out);
+
+    // _events 是 LogTraceExtract 输出的若干行
+    bool Append(const std::string& _events);
+    bool Finish();
+
+    uint64_t Events() const { return events_; }
+
+  private:
+    LogTraceWriter(const LogTraceWriter&);
+    LogTraceWriter& operator=(const LogTraceWriter&);
+
+  private:
+    FILE* out_;
+    bool started_;
+    uint64_t events_;
+};
+
+#endif  // LOG_TRACE_H_
@@ -0,0 +1,362 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * xlog_decode.cc
+ *
+ * xlogdecode [-k private_key] [-j threads] [-o output] [-s] [-x trace.json] [-a dir] [-m] [query options] path...
+ * path 可以是 .xlog 文件或目录(解码目录下所有 .xlog); 不指定 -o 时输出到 path.log, "-o -" 输出到标准输出.
+ * 带查询条件(-b -e -l -t -p -T -g -r)时只输出匹配的记录, 时间和级别/tag 对不上的 block 不解压.
+ * -x 把所有输入里的 trace 事件导出到一个 Chrome/Perfetto 可以打开的 JSON 文件.
+ * -a 把附件(appender_attach/xdump 写入的二进制数据)按 id 写成文件; 不指定时附件只从文本里摘掉.
+ * -m 把所有输入按进程(v2 header 里的 pid)拆开再按时间归并成一个输出, 用于多进程模式写的日志; 没有 pid 的 v1 block 按文件区分. 可以带查询条件.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "log_decoder.h"
+#include "log_query.h"
+#include "log_trace.h"
+#include "log_attachment_extract.h"
+
+static void __Usage(const char* _name) {
+    fprintf(stderr,
+            "usage: %s [-k private_key] [-j threads] [-o output] [-s] [-x trace.json] [-a dir] [-m] [query options] path...\n"
+            "  -k  hex private key for encrypted logs\n"
+            "  -j  decode threads, default: number of cpus\n"
+            "  -o  output file, '-' for stdout; default: <path>.log for each input\n"
+            "  -s  report lost blocks by seq (single appender files only)\n"
+            "  -x  export trace events as chrome trace json\n"
+            "  -a  extract attachments into dir\n"
+            "  -m  merge all inputs by process and time into one output, default: stdout\n"
+            "query options, only matching records are written:\n"
+            "  -b  begin time, unix ms\n"
+            "  -e  end time, unix ms\n"
+            "  -l  levels, e.g. WEF\n"
+            "  -t  tag, may be repeated\n"
+            "  -p  pid\n"
+            "  -T  tid\n"
+            "  -g  substring\n"
+            "  -r  ECMAScript regex\n",
+            _name);
+}
+
+static bool __ParseLevels(const char* _levels, uint8_t& _mask) {
+    static const char kLevels[] = "VDIWEF";
+    for (const char* p = _levels; '\0' != *p; ++p) {
+        const char* found = strchr(kLevels, *p);
+        if (NULL == found) return false;
+        _mask |= (uint8_t)(1 << (found - kLevels));
+    }
+    return true;
+}
+
+static bool __Query(LogQueryEngine& _engine, const std::string& _path, FILE* _out, std::string& _err_msg) {
+    bool write_ok = true;
+    LogQueryStat stat;
+    bool ok = _engine.QueryFile(_path, [&](const char* _record, size_t _len) {
+        write_ok = _len == fwrite(_record, 1, _len, _out);
+        return write_ok;
+    }, _err_msg, &stat);
+
+    if (ok && !write_ok) {
+        _err_msg += std::string("write output fail:") + strerror(errno);
+        return false;
+    }
+    if (ok) {
+        fprintf(stderr, "%s: %llu/%llu records matched, %llu/%llu blocks skipped by header\n", _path.c_str(),
+                (unsigned long long)stat.matched, (unsigned long long)stat.records,
+                (unsigned long long)stat.skipped_blocks, (unsigned long long)stat.blocks);
+    }
+    return ok;
+}
+
+static bool __Merge(LogQueryEngine& _engine, const std::vector<std::string>& _files, FILE* _out, std::string& _err_msg) {
+    bool write_ok = true;
+    LogQueryStat stat;
+    bool ok = _engine.QueryMerged(_files, [&](const char* _record, size_t _len) {
+        write_ok = _len == fwrite(_record, 1, _len, _out);
+        return write_ok;
+    }, _err_msg, &stat);
+
+    if (ok && !write_ok) {
+        _err_msg += std::string("write output fail:") + strerror(errno);
+        return false;
+    }
+    if (ok) {
+        fprintf(stderr, "%llu/%llu records from %llu processes merged, %llu/%llu blocks skipped by header\n",
+                (unsigned long long)stat.matched, (unsigned long long)stat.records, (unsigned long long)stat.processes,
+                (unsigned long long)stat.skipped_blocks, (unsigned long long)stat.blocks);
+    }
+    return ok;
+}
+
+static bool __EndsWith(const std::string& _str, const std::string& _suffix) {
+    return _str.size() >= _suffix.size() && 0 == _str.compare(_str.size() - _suffix.size(), _suffix.size(), _suffix);
+}
+
+// 数字部分按数值比较: 按大小切分的 prefix_YYYYMMDD_10.xlog 排在 _9 后面
+static bool __NaturalLess(const std::string& _lhs, const std::string& _rhs) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < _lhs.size() && j < _rhs.size()) {
+        if (isdigit((unsigned char)_lhs[i]) && isdigit((unsigned char)_rhs[j])) {
+            size_t i_end = _lhs.find_first_not_of("0123456789", i);
+            size_t j_end = _rhs.find_first_not_of("0123456789", j);
+            if (std::string::npos == i_end) i_end = _lhs.size();
+            if (std::string::npos == j_end) j_end = _rhs.size();
+            unsigned long long lhs_num = strtoull(_lhs.c_str() + i, NULL, 10);
+            unsigned long long rhs_num = strtoull(_rhs.c_str() + j, NULL, 10);
+            if (lhs_num != rhs_num) return lhs_num < rhs_num;
+            i = i_end;
+            j = j_end;
+            continue;
+        }
+        if (_lhs[i] != _rhs[j]) return _lhs[i] < _rhs[j];
+        ++i;
+        ++j;
+    }
+    return _lhs.size() - i < _rhs.size() - j;
+}
+
+static void __CollectFiles(const std::string& _path, std::vector<std::string>& _files) {
+    struct stat st;
+    if (0 != stat(_path.c_str(), &st)) {
+        fprintf(stderr, "stat %s fail:%s\n", _path.c_str(), strerror(errno));
+        return;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        _files.push_back(_path);
+        return;
+    }
+
+    DIR* dir = opendir(_path.c_str());
+    if (NULL == dir) {
+        fprintf(stderr, "opendir %s fail:%s\n", _path.c_str(), strerror(errno));
+        return;
+    }
+
+    std::vector<std::string> found;
+    struct dirent* entry = NULL;
+    while (NULL != (entry = readdir(dir))) {
+        std::string name = entry->d_name;
+        if (__EndsWith(name, ".xlog")) found.push_back(_path + "/" + name);
+    }
+    closedir(dir);
+
+    std::sort(found.begin(), found.end());
+    _files.insert(_files.end(), found.begin(), found.end());
+}
+
+int main(int argc, char* argv[]) {
+    LogDecodeConfig config;
+    LogQuery query;
+    bool is_query = false;
+    std::string output;
+    std::string trace_output;
+    std::string attachment_dir;
+    bool merge = false;
+
+    int opt = 0;
+    while (-1 != (opt = getopt(argc, argv, "k:j:o:sx:a:mb:e:l:t:p:T:g:r:h"))) {
+        switch (opt) {
+            case 'k':
+                config.private_key_ = optarg;
+                break;
+            case 'j':
+                config.threads_ = (unsigned int)strtoul(optarg, NULL, 10);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 's':
+                config.check_seq_ = true;
+                break;
+            case 'x':
+                trace_output = optarg;
+                break;
+            case 'a':
+                attachment_dir = optarg;
+                break;
+            case 'm':
+                merge = true;
+                break;
+            case 'b':
+                query.begin_ms_ = strtoll(optarg, NULL, 10);
+                is_query = true;
+                break;
+            case 'e':
+                query.end_ms_ = strtoll(optarg, NULL, 10);
+                is_query = true;
+                break;
+            case 'l':
+                if (!__ParseLevels(optarg, query.level_mask_)) {
+                    __Usage(argv[0]);
+                    return 2;
+                }
+                is_query = true;
+                break;
+            case 't':
+                query.tags_.push_back(optarg);
+                is_query = true;
+                break;
+            case 'p':
+                query.pid_ = strtoll(optarg, NULL, 10);
+                is_query = true;
+                break;
+            case 'T':
+                query.tid_ = strtoll(optarg, NULL, 10);
+                is_query = true;
+                break;
+            case 'g':
+                query.substring_ = optarg;
+                is_query = true;
+                break;
+            case 'r':
+                query.regex_ = optarg;
+                is_query = true;
+                break;
+            default:
+                __Usage(argv[0]);
+                return 'h' == opt ? 0 : 2;
+        }
+    }
+
+    std::vector<std::string> files;
+    for (int i = optind; i < argc; ++i) {
+        __CollectFiles(argv[i], files);
+    }
+    if (files.empty() || ((is_query || merge) && (!trace_output.empty() || !attachment_dir.empty()))) {
+        __Usage(argv[0]);
+        return 2;
+    }
+
+    LogDecoder decoder(config);
+    LogQueryEngine engine(query, config);
+    if (is_query && !engine.IsValid()) {
+        fprintf(stderr, "%s\n", engine.ErrMsg().c_str());
+        return 2;
+    }
+
+    if (merge && output.empty()) output = "-";
+
+    FILE* shared_out = NULL;
+    if (!output.empty()) {
+        shared_out = ("-" == output) ? stdout : fopen(output.c_str(), "wb");
+        if (NULL == shared_out) {
+            fprintf(stderr, "open %s fail:%s\n", output.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    FILE* trace_out = NULL;
+    LogTraceWriter* trace = NULL;
+    if (!trace_output.empty()) {
+        trace_out = fopen(trace_output.c_str(), "wb");
+        if (NULL == trace_out) {
+            fprintf(stderr, "open %s fail:%s\n", trace_output.c_str(), strerror(errno));
+            return 1;
+        }
+        trace = new LogTraceWriter(trace_out);
+    }
+
+    LogAttachmentWriter* attachments = NULL;
+    if (!attachment_dir.empty()) {
+        if (0 != mkdir(attachment_dir.c_str(), 0755) && EEXIST != errno) {
+            fprintf(stderr, "mkdir %s fail:%s\n", attachment_dir.c_str(), strerror(errno));
+            return 1;
+        }
+        attachments = new LogAttachmentWriter(attachment_dir);
+    }
+
+    int ret = 0;
+    if (merge) {
+        // 同一个进程的记录按文件顺序接起来, 切分出的文件要按序号排
+        std::stable_sort(files.begin(), files.end(), __NaturalLess);
+        std::string err_msg;
+        if (!__Merge(engine, files, shared_out, err_msg)) {
+            fprintf(stderr, "%s\n", err_msg.c_str());
+            ret = 1;
+        }
+        // 归并已经输出了全部输入
+        files.clear();
+    }
+
+    for (std::vector<std::string>::iterator iter = files.begin(); iter != files.end(); ++iter) {
+        FILE* out = shared_out;
+        if (NULL == out) {
+            std::string out_path = *iter + ".log";
+            out = fopen(out_path.c_str(), "wb");
+            if (NULL == out) {
+                fprintf(stderr, "open %s fail:%s\n", out_path.c_str(), strerror(errno));
+                ret = 1;
+                continue;
+            }
+        }
+
+        std::string err_msg;
+        LogDecodeStat stat;
+        if (is_query) {
+            if (!__Query(engine, *iter, out, err_msg)) {
+                fprintf(stderr, "%s: %s\n", iter->c_str(), err_msg.c_str());
+                ret = 1;
+            }
+        } else if (!decoder.DecodeFile(*iter, out, err_msg, &stat, trace, attachments)) {
+            fprintf(stderr, "%s: %s\n", iter->c_str(), err_msg.c_str());
+            ret = 1;
+        } else if (0 < stat.skipped_bytes || 0 < stat.failed_blocks) {
+            fprintf(stderr, "%s: %llu blocks, %llu corrupted bytes skipped, %llu blocks failed\n", iter->c_str(),
+                    (unsigned long long)stat.blocks, (unsigned long long)stat.skipped_bytes, (unsigned long long)stat.failed_blocks);
+        }
+        if (0 < stat.broken_records) {
+            fprintf(stderr, "%s: %llu long logs joined, %llu incomplete\n", iter->c_str(),
+                    (unsigned long long)stat.long_records, (unsigned long long)stat.broken_records);
+        }
+        if (0 < stat.attachments && NULL == attachments) {
+            fprintf(stderr, "%s: %llu attachments, extract with -a\n", iter->c_str(), (unsigned long long)stat.attachments);
+        }
+
+        if (out != shared_out) fclose(out);
+    }
+
+    if (NULL != shared_out && stdout != shared_out) fclose(shared_out);
+    if (NULL != trace) {
+        if (!trace->Finish()) {
+            fprintf(stderr, "write %s fail:%s\n", trace_output.c_str(), strerror(errno));
+            ret = 1;
+        }
+        fprintf(stderr, "%llu trace events written to %s\n", (unsigned long long)trace->Events(), trace_output.c_str());
+        delete trace;
+        fclose(trace_out);
+    }
+    if (NULL != attachments) {
+        if (!attachments->Finish()) {
+            fprintf(stderr, "write attachments to %s fail:%s\n", attachment_dir.c_str(), strerror(errno));
+            ret = 1;
+        }
+        fprintf(stderr, "%llu attachments written to %s, %llu incomplete\n", (unsigned long long)attachments->Written(),
+                attachment_dir.c_str(), (unsigned long long)attachments->Broken());
+        delete attachments;
+    }
+    return ret;
+}
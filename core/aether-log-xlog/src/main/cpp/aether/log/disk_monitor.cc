@@ -0,0 +1,178 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * disk_monitor.cc
+ */
+
+#include "disk_monitor.h"
+
+#include <sys/statvfs.h>
+
+#include "../common/thread/lock.h"
+
+const uint64_t DiskMonitor::kUnknownAvailable;
+
+// 回到低一级要求可用空间比阈值多出 1/8, 避免在阈值附近来回切换
+static uint64_t __LeaveThreshold(uint64_t _threshold) {
+    return _threshold + _threshold / 8;
+}
+
+DiskMonitor::DiskMonitor()
+: timer_id_(TimerWheel::kInvalidTimerId), running_(false)
+, tier_(kDiskPressureNone), min_level_(kLevelAll), min_available_(kUnknownAvailable), bytes_since_refresh_(0) {
+}
+
+DiskMonitor::~DiskMonitor() {
+    Stop();
+}
+
+void DiskMonitor::Start(const std::vector<std::string>& _dirs, const DiskPressureConfig& _config,
+                        const TransitionCallback& _callback) {
+    ScopedLock lock(mutex_);
+    if (running_) return;
+
+    dirs_ = _dirs;
+    available_.assign(dirs_.size(), kUnknownAvailable);
+    config_ = _config;
+    callback_ = _callback;
+    running_ = true;
+
+    TDiskPressureTier from, to;
+    uint64_t available;
+    bool changed = __Refresh(from, to, available);
+
+    if (config_.enable_ && 0 < config_.refresh_interval_ms_) {
+        timer_id_ = TimerWheel::Singleton()->Schedule(config_.refresh_interval_ms_, std::bind(&DiskMonitor::__OnTimer, this));
+    }
+    lock.unlock();
+
+    if (changed) __Notify(from, to, available);
+}
+
+void DiskMonitor::Stop() {
+    ScopedLock lock(mutex_);
+    if (!running_) return;
+
+    running_ = false;
+    TimerWheel::TimerId timer_id = timer_id_;
+    timer_id_ = TimerWheel::kInvalidTimerId;
+    lock.unlock();
+
+    // 定时回调要拿 mutex_, 放锁后再取消; 已经在执行的会等它结束, 之后不会再访问 this
+    TimerWheel::Singleton()->Cancel(timer_id);
+}
+
+void DiskMonitor::OnBytesWritten(size_t _len) {
+    if (0 == config_.refresh_bytes_) return;
+
+    uint64_t bytes = __atomic_add_fetch(&bytes_since_refresh_, (uint64_t)_len, __ATOMIC_RELAXED);
+    if (bytes < config_.refresh_bytes_ || bytes - _len >= config_.refresh_bytes_) return;
+
+    // 只有跨过阈值的那一次去拨定时器, 刷新后计数清零
+    ScopedLock lock(mutex_);
+    if (running_ && TimerWheel::kInvalidTimerId != timer_id_) {
+        TimerWheel::Singleton()->Reschedule(timer_id_, 0);
+    }
+}
+
+uint64_t DiskMonitor::Available(const std::string& _dir) const {
+    ScopedLock lock(mutex_);
+    for (size_t i = 0; i < dirs_.size(); ++i) {
+        if (dirs_[i] == _dir) return available_[i];
+    }
+    return kUnknownAvailable;
+}
+
+void DiskMonitor::Refresh() {
+    ScopedLock lock(mutex_);
+    TDiskPressureTier from, to;
+    uint64_t available;
+    bool changed = __Refresh(from, to, available);
+    lock.unlock();
+
+    if (changed) __Notify(from, to, available);
+}
+
+void DiskMonitor::__OnTimer() {
+    ScopedLock lock(mutex_);
+    if (!running_) return;
+
+    TDiskPressureTier from, to;
+    uint64_t available;
+    bool changed = __Refresh(from, to, available);
+    lock.unlock();
+
+    // 回调会写日志, 落盘路径持有文件锁时还会来拿 mutex_, 所以放锁后再回调.
+    // 下一次定时在回调之后才排, 期间 timer_id_ 还是本次的, Stop 取消它时会等回调结束
+    if (changed) __Notify(from, to, available);
+
+    lock.lock();
+    if (!running_) return;
+    timer_id_ = TimerWheel::Singleton()->Schedule(config_.refresh_interval_ms_, std::bind(&DiskMonitor::__OnTimer, this));
+}
+
+void DiskMonitor::__Notify(TDiskPressureTier _from, TDiskPressureTier _to, uint64_t _available) {
+    if (callback_) callback_(_from, _to, _available);
+}
+
+bool DiskMonitor::__Refresh(TDiskPressureTier& _from, TDiskPressureTier& _to, uint64_t& _available) {
+    __atomic_store_n(&bytes_since_refresh_, 0, __ATOMIC_RELAXED);
+
+    uint64_t min_available = kUnknownAvailable;
+    for (size_t i = 0; i < dirs_.size(); ++i) {
+        struct statvfs st;
+        if (0 != statvfs(dirs_[i].c_str(), &st)) continue;
+
+        available_[i] = (uint64_t)st.f_bavail * (uint64_t)st.f_frsize;
+        if (available_[i] < min_available) min_available = available_[i];
+    }
+    min_available_ = min_available;
+
+    if (!config_.enable_) return false;
+
+    TDiskPressureTier from = (TDiskPressureTier)tier_;
+    TDiskPressureTier to = __CalcTier(min_available, from);
+    if (from == to) return false;
+
+    TLogLevel min_level = kLevelAll;
+    if (kDiskPressureErrorOnly <= to) {
+        min_level = kLevelError;
+    } else if (kDiskPressureRaiseLevel <= to) {
+        min_level = config_.raise_level_;
+    }
+    min_level_ = min_level;
+    tier_ = to;
+
+    _from = from;
+    _to = to;
+    _available = min_available;
+    return true;
+}
+
+TDiskPressureTier DiskMonitor::__CalcTier(uint64_t _available, TDiskPressureTier _current) const {
+    if (kUnknownAvailable == _available) return _current;
+
+    int tier = kDiskPressureNone;
+    for (int i = kDiskPressureTierCount - 1; i > kDiskPressureNone; --i) {
+        uint64_t threshold = config_.thresholds_[i - 1];
+        if (0 == threshold) continue;
+
+        // 已经处在这一级及以上时按离开阈值判断
+        if (_available < threshold || (_current >= i && _available < __LeaveThreshold(threshold))) {
+            tier = i;
+            break;
+        }
+    }
+
+    return (TDiskPressureTier)tier;
+}
@@ -0,0 +1,112 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * disk_monitor.h
+ *
+ * 磁盘空间监控. statvfs 的结果缓存起来, 由时间轮定时刷新, 或者写入量超过阈值时提前刷新;
+ * 写路径只读缓存的级别, 不做任何空间检查.
+ * 空间越少级别越高, 各级效果叠加: 提高最低日志级别 -> 打开压缩 -> 缩短保留时间 -> 只写错误日志.
+ */
+
+#ifndef DISK_MONITOR_H_
+#define DISK_MONITOR_H_
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../common/thread/mutex.h"
+#include "../common/thread/timer_wheel.h"
+#include "../common/xlogger/xloggerbase.h"
+
+enum TDiskPressureTier {
+    kDiskPressureNone = 0,
+    kDiskPressureRaiseLevel,        // 丢弃低于 raise_level_ 的日志
+    kDiskPressureCompress,          // 未压缩的实例从下一个 block 开始压缩
+    kDiskPressureShrinkRetention,   // 保留时间缩短到 shrink_alive_time_
+    kDiskPressureErrorOnly,         // 只写 kLevelError 及以上
+    kDiskPressureTierCount,
+};
+
+struct DiskPressureConfig {
+    bool enable_ = true;
+    // 可用空间低于阈值时进入对应级别, 下标为 级别 - 1; 0 表示不启用该级
+    uint64_t thresholds_[kDiskPressureTierCount - 1] = {
+        (uint64_t)500 * 1024 * 1024,
+        (uint64_t)300 * 1024 * 1024,
+        (uint64_t)200 * 1024 * 1024,
+        (uint64_t)100 * 1024 * 1024,
+    };
+    TLogLevel raise_level_ = kLevelInfo;
+    long shrink_alive_time_ = 24 * 60 * 60;         // second
+    unsigned int refresh_interval_ms_ = 60 * 1000;
+    uint64_t refresh_bytes_ = 8 * 1024 * 1024;      // 写入这么多字节后提前刷新
+};
+
+class DiskMonitor {
+  public:
+    // 一般在时间轮线程上回调(Start/Refresh 时在调用线程). 回调时不持有内部锁, 可以写日志;
+    // Stop 会等正在执行的定时回调结束, 回调里不要再调用 Start/Stop
+    typedef std::function<void (TDiskPressureTier _from, TDiskPressureTier _to, uint64_t _available)> TransitionCallback;
+
+    static const uint64_t kUnknownAvailable = (uint64_t)-1;
+
+  public:
+    DiskMonitor();
+    ~DiskMonitor();
+
+    // 先同步刷新一次, 之后由时间轮驱动
+    void Start(const std::vector<std::string>& _dirs, const DiskPressureConfig& _config,
+               const TransitionCallback& _callback);
+    void Stop();
+
+    // 落盘线程调用, 只累加计数; 超过 refresh_bytes_ 时让定时器提前触发
+    void OnBytesWritten(size_t _len);
+
+    TDiskPressureTier Tier() const { return (TDiskPressureTier)tier_; }
+    // 当前级别下允许写入的最低日志级别
+    TLogLevel MinLevel() const { return (TLogLevel)min_level_; }
+    // 上次刷新时 _dir 所在分区的可用字节数, 不在监控列表里时返回 kUnknownAvailable
+    uint64_t Available(const std::string& _dir) const;
+    uint64_t MinAvailable() const { return min_available_; }
+
+    void Refresh();
+
+  private:
+    DiskMonitor(const DiskMonitor&);
+    DiskMonitor& operator=(const DiskMonitor&);
+
+    void __OnTimer();
+    // 持锁刷新; 级别变化时返回 true 并带出回调参数, 由调用方放锁后回调
+    bool __Refresh(TDiskPressureTier& _from, TDiskPressureTier& _to, uint64_t& _available);
+    void __Notify(TDiskPressureTier _from, TDiskPressureTier _to, uint64_t _available);
+    TDiskPressureTier __CalcTier(uint64_t _available, TDiskPressureTier _current) const;
+
+  private:
+    mutable Mutex mutex_;
+    std::vector<std::string> dirs_;
+    std::vector<uint64_t> available_;
+    DiskPressureConfig config_;
+    TransitionCallback callback_;
+
+    TimerWheel::TimerId timer_id_;
+    bool running_;
+
+    volatile int tier_;
+    volatile int min_level_;
+    volatile uint64_t min_available_;
+    volatile uint64_t bytes_since_refresh_;
+};
+
+#endif  // DISK_MONITOR_H_
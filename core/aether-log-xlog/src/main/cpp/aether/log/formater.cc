@@ -19,7 +19,9 @@
 
 #include "xloggerbase.h"
 #include "loginfo_extract.h"
+#include "xlogger_threadcontext.h"
 #include "ptrbuffer.h"
+#include "num_format.h"
 
 #ifdef _WIN32
 #define PRIdMAX "lld"
@@ -29,16 +31,133 @@
 #include <cinttypes>
 #endif
 
-void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log) {
-    static const char* levelStrings[] = {
-        "V",
-        "D",  // debug
-        "I",  // info
-        "W",  // warn
-        "E",  // error
-        "F"  // fatal
-    };
+// 追加到 _end 为止, 超出的截掉
+static char* __Append(char* _pos, const char* _end, const char* _str, size_t _len) {
+    size_t len = std::min(_len, (size_t)(_end - _pos));
+    memcpy(_pos, _str, len);
+    return _pos + len;
+}
+
+static char* __Append(char* _pos, const char* _end, const char* _str) {
+    return __Append(_pos, _end, _str, strlen(_str));
+}
+
+static char* __AppendInt(char* _pos, const char* _end, intmax_t _value) {
+    char num[numfmt::kIntBufferSize];
+    return __Append(_pos, _end, num, numfmt::Int64ToA((int64_t)_value, num));
+}
+
+static const char* levelStrings[] = {
+    "V",
+    "D",  // debug
+    "I",  // info
+    "W",  // warn
+    "E",  // error
+    "F"  // fatal
+};
+
+static void __FormatHeader(const XLoggerInfo* _info, bool _has_body, PtrBuffer& _log) {
+    const char* filename = ExtractFileName(_info->filename);
+    char strFuncName [128] = {0};
+    ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
+
+    // 优化日志格式：参考 Logback/Log4j2 和 Android Logcat 的清晰格式
+    // 格式：时间 [PID:TID*] LEVEL/TAG 文件名:行号 - 消息
+    // 示例：2025-12-22 18:56:27.897 [25449:25449*] D/Account LogActivity.kt:212 - 用户登录请求
+    
+    const char* tag = _info->tag && strlen(_info->tag) > 0 ? _info->tag : "-";
+    const char* file = filename && strlen(filename) > 0 ? filename : "-";
+    const char* func = strFuncName[0] != '\0' ? strFuncName : "-";
+    int line = _info->line > 0 ? _info->line : 0;
+    const char* mainThreadMark = _info->tid == _info->maintid ? "*" : "";
+
+    aether::comm::XloggerThreadContext* context = aether::comm::XloggerThreadContext::Current();
+
+    // 位置信息：文件名:行号 或 函数名:行号
+    const char* location = file[0] != '-' ? file : (func[0] != '-' ? func : "");
+
+    // 逐段拼接, 最多 1023 字节; 时间格式 YYYY-MM-DD HH:mm:ss.SSS（去掉时区偏移）
+    char* begin = (char*)_log.PosPtr();
+    const char* end = begin + 1023;
+    char* pos = begin;
+    if (0 != _info->timeval.tv_sec) {
+        pos = numfmt::WriteDateTime(pos, context->LocalTime(_info->timeval.tv_sec), (int)(_info->timeval.tv_usec / 1000));
+    }
+    pos = __Append(pos, end, " [", 2);
+    pos = __AppendInt(pos, end, _info->pid);
+    pos = __Append(pos, end, ":", 1);
+    pos = __AppendInt(pos, end, _info->tid);
+    pos = __Append(pos, end, mainThreadMark);
+    pos = __Append(pos, end, "] ", 2);
+    pos = __Append(pos, end, _has_body ? levelStrings[_info->level] : levelStrings[kLevelFatal], 1);
+    pos = __Append(pos, end, "/", 1);
+    pos = __Append(pos, end, tag);
+    pos = __Append(pos, end, " ", 1);
+    pos = __Append(pos, end, location);
+    if (line > 0) {
+        pos = __Append(pos, end, ":", 1);
+        pos = __AppendInt(pos, end, line);
+    }
+    pos = __Append(pos, end, " - ", 3);
+    *pos = '\0';
+
+    int ret = (int)(pos - begin);
+    _log.Length(_log.Pos() + ret, _log.Length() + ret);
+
+    assert((unsigned int)_log.Pos() == _log.Length());
+}
+
+// 线程名不放进日志头, 免得改了每一行的格式; 每个线程的第一条日志前单独记一行, 格式和普通日志一样:
+// 2025-12-22 18:56:27.897 [25449:25449*] I/xlog  - thread name: main
+// 只有在写日志的线程上格式化时才知道线程名
+static void __FormatThreadName(const XLoggerInfo* _info, PtrBuffer& _log) {
+    aether::comm::XloggerThreadContext* context = aether::comm::XloggerThreadContext::Current();
+    if (_info->tid != context->Tid() || !context->TakeNameReport()) return;
+
+    XLoggerInfo info = *_info;
+    info.level = kLevelInfo;
+    info.tag = "xlog";
+    info.filename = NULL;
+    info.func_name = NULL;
+    info.line = 0;
+    __FormatHeader(&info, true, _log);
+    _log.Write("thread name: ");
+    _log.Write(context->Name());
+    _log.Write("\n", 1);
+}
+
+// 正文 [_pos, _end) 追加到 _log, 处理多行日志（异常堆栈）：第一个非空行之后的行缩进 4 格, _lead 是开头空行的长度.
+// 最多追加 _room 字节, 返回写到的位置; 一行没写完时下次从行中间接着写, 不再缩进
+static size_t __AppendBody(PtrBuffer& _log, const char* _body, size_t _pos, size_t _end, size_t _lead, size_t _room) {
+    while (_pos < _end && 0 < _room) {
+        const char* lineEnd = (const char*)memchr(_body + _pos, '\n', _end - _pos);
+        size_t lineLen = lineEnd ? (size_t)(lineEnd - _body) - _pos : _end - _pos;
+
+        if (lineLen > 0) {
+            if (_pos > _lead && '\n' == _body[_pos - 1]) {
+                // 缩进和至少一个字符
+                if (_room < 5) break;
+                _log.Write("    ", 4);
+                _room -= 4;
+            }
+            size_t len = std::min(lineLen, _room);
+            _log.Write(_body + _pos, len);
+            _pos += len;
+            _room -= len;
+            if (len < lineLen) break;
+        }
+
+        if (lineEnd) {
+            if (0 == _room) break;
+            _log.Write("\n", 1);
+            ++_pos;
+            --_room;
+        }
+    }
+    return _pos;
+}
 
+void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _log) {
     assert((unsigned int)_log.Pos() == _log.Length());
 
     static int error_count = 0;
@@ -62,62 +181,8 @@ void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _lo
     }
 
     if (NULL != _info) {
-        const char* filename = ExtractFileName(_info->filename);
-        char strFuncName [128] = {0};
-        ExtractFunctionName(_info->func_name, strFuncName, sizeof(strFuncName));
-
-        // 优化时间格式：使用标准格式 YYYY-MM-DD HH:mm:ss.SSS（去掉时区偏移）
-        char temp_time[32] = {0};
-        if (0 != _info->timeval.tv_sec) {
-            time_t sec = _info->timeval.tv_sec;
-            tm tm = *localtime((const time_t*)&sec);
-            snprintf(temp_time, sizeof(temp_time), "%04d-%02d-%02d %02d:%02d:%02d.%03ld",
-                     1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday,
-                     tm.tm_hour, tm.tm_min, tm.tm_sec, _info->timeval.tv_usec / 1000);
-        }
-
-        // 优化日志格式：参考 Logback/Log4j2 和 Android Logcat 的清晰格式
-        // 格式：时间 [PID:TID*] LEVEL/TAG 文件名:行号 - 消息
-        // 示例：2025-12-22 18:56:27.897 [25449:25449*] D/Account LogActivity.kt:212 - 用户登录请求
-        
-        const char* tag = _info->tag && strlen(_info->tag) > 0 ? _info->tag : "-";
-        const char* file = filename && strlen(filename) > 0 ? filename : "-";
-        const char* func = strFuncName[0] != '\0' ? strFuncName : "-";
-        int line = _info->line > 0 ? _info->line : 0;
-        const char* mainThreadMark = _info->tid == _info->maintid ? "*" : "";
-        
-        // 构建位置信息（文件名:行号 或 函数名:行号）
-        char location[256] = {0};
-        if (line > 0) {
-            if (file[0] != '-' && strlen(file) > 0) {
-                snprintf(location, sizeof(location), "%s:%d", file, line);
-            } else if (func[0] != '-' && strlen(func) > 0) {
-                snprintf(location, sizeof(location), "%s:%d", func, line);
-            } else {
-                snprintf(location, sizeof(location), ":%d", line);
-            }
-        } else {
-            if (file[0] != '-' && strlen(file) > 0) {
-                snprintf(location, sizeof(location), "%s", file);
-            } else if (func[0] != '-' && strlen(func) > 0) {
-                snprintf(location, sizeof(location), "%s", func);
-            } else {
-                location[0] = '\0';
-            }
-        }
-
-        int ret = snprintf((char*)_log.PosPtr(), 1024, 
-                           "%s [%" PRIdMAX ":%" PRIdMAX "%s] %s/%s %s - ",  // **CPPLINT SKIP**
-                           temp_time,
-                           _info->pid, _info->tid, mainThreadMark,
-                           _logbody ? levelStrings[_info->level] : levelStrings[kLevelFatal],
-                           tag,
-                           location[0] != '\0' ? location : "");
-
-        assert(0 <= ret);
-        _log.Length(_log.Pos() + ret, _log.Length() + ret);
-
-        assert((unsigned int)_log.Pos() == _log.Length());
+        if (NULL != _logbody) __FormatThreadName(_info, _log);
+        __FormatHeader(_info, NULL != _logbody, _log);
     }
 
     if (NULL != _logbody) {
@@ -128,33 +193,8 @@ void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _lo
         bodylen = strnlen(_logbody, bodylen);
         bodylen = bodylen > 0xFFFFU ? 0xFFFFU : bodylen;
         
-        // 处理多行日志（异常堆栈）：为后续行添加缩进，提高可读性
-        const char* body = _logbody;
-        size_t remaining = bodylen;
-        bool isFirstLine = true;
-        
-        while (remaining > 0) {
-            const char* lineStart = body;
-            const char* lineEnd = (const char*)memchr(body, '\n', remaining);
-            size_t lineLen = lineEnd ? (lineEnd - body) : remaining;
-            
-            if (lineLen > 0) {
-                if (!isFirstLine && lineLen > 0) {
-                    // 为多行日志的后续行添加缩进（4个空格），提高可读性
-                    _log.Write("    ", 4);
-                }
-                _log.Write(lineStart, lineLen);
-                isFirstLine = false;
-            }
-            
-            if (lineEnd) {
-                _log.Write("\n", 1);
-                body = lineEnd + 1;
-                remaining -= (lineLen + 1);
-            } else {
-                remaining = 0;
-            }
-        }
+        // 结尾留一个字节给换行
+        __AppendBody(_log, _logbody, 0, bodylen, strspn(_logbody, "\n"), _log.MaxLength() - _log.Length() - 1);
     } else {
         _log.Write("error!! NULL==_logbody");
     }
@@ -164,3 +204,20 @@ void log_formater(const XLoggerInfo* _info, const char* _logbody, PtrBuffer& _lo
     if (*((char*)_log.PosPtr() - 1) != nextline) _log.Write(&nextline, 1);
 }
 
+// 超长日志的一片: _offset 为 0 时先写日志头, 再从正文的 _offset 处最多写 _room 字节并更新 _offset;
+// _lead 是正文开头空行的长度. 正文写完时补上结尾的换行
+void log_formater_chunk(const XLoggerInfo* _info, const char* _logbody, size_t _bodylen, size_t _lead, size_t& _offset,
+                        size_t _room, PtrBuffer& _log) {
+    assert((unsigned int)_log.Pos() == _log.Length());
+    assert(_log.MaxLength() >= _log.Length() + 1024 + _room + 1);
+
+    if (0 == _offset && NULL != _info) {
+        __FormatHeader(_info, true, _log);
+    }
+
+    _offset = __AppendBody(_log, _logbody, _offset, _bodylen, _lead, _room);
+
+    if (_offset >= _bodylen && (0 == _log.Length() || '\n' != *((char*)_log.PosPtr() - 1))) {
+        _log.Write("\n", 1);
+    }
+}
@@ -0,0 +1,361 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * io_uring_writer.cc
+ *
+ * 不依赖 liburing, 直接用 io_uring_setup/io_uring_enter/io_uring_register 三个系统调用.
+ */
+
+#include "io_uring_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define XLOG_HAS_IO_URING 1
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+#ifdef XLOG_HAS_IO_URING
+
+static const uint64_t kSyncUserData = UINT64_MAX;
+
+static int __io_uring_setup(unsigned int _entries, struct io_uring_params* _params) {
+    return (int)syscall(__NR_io_uring_setup, _entries, _params);
+}
+
+static int __io_uring_enter(int _fd, unsigned int _to_submit, unsigned int _min_complete, unsigned int _flags) {
+    return (int)syscall(__NR_io_uring_enter, _fd, _to_submit, _min_complete, _flags, NULL, 0);
+}
+
+static int __io_uring_register(int _fd, unsigned int _opcode, const void* _arg, unsigned int _nr_args) {
+    return (int)syscall(__NR_io_uring_register, _fd, _opcode, _arg, _nr_args);
+}
+
+#endif
+
+IoUringWriter::IoUringWriter()
+: ring_fd_(-1), sq_entries_(0)
+, sq_ring_(NULL), sq_ring_size_(0), cq_ring_(NULL), cq_ring_size_(0), sqes_(NULL), sqes_size_(0)
+, sq_head_(NULL), sq_tail_(NULL), sq_mask_(NULL), sq_array_(NULL)
+, cq_head_(NULL), cq_tail_(NULL), cq_mask_(NULL), cqes_(NULL)
+, slots_(NULL), slot_size_(0)
+, inflight_(0), errors_(0), last_error_(0) {
+}
+
+IoUringWriter::~IoUringWriter() {
+    Drain();
+    __Release();
+}
+
+bool IoUringWriter::IsSupported() {
+#ifdef XLOG_HAS_IO_URING
+    static int s_supported = -1;
+    if (-1 == s_supported) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = __io_uring_setup(1, &params);
+        s_supported = (0 <= fd && (params.features & IORING_FEAT_RW_CUR_POS)) ? 1 : 0;
+        if (0 <= fd) close(fd);
+    }
+    return 1 == s_supported;
+#else
+    return false;
+#endif
+}
+
+bool IoUringWriter::Init(unsigned int _slot_count, size_t _slot_size) {
+#ifdef XLOG_HAS_IO_URING
+    if (IsInited()) return true;
+    if (0 == _slot_count || 0 == _slot_size) return false;
+
+    unsigned int entries = 4;
+    while (entries < _slot_count * 2) entries <<= 1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd_ = __io_uring_setup(entries, &params);
+    if (0 > ring_fd_) {
+        ring_fd_ = -1;
+        return false;
+    }
+
+    // RW_CUR_POS 是 5.6 加的, 用它限定内核版本
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        __Release();
+        return false;
+    }
+
+    sq_entries_ = params.sq_entries;
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size_ > sq_ring_size_) sq_ring_size_ = cq_ring_size_;
+        cq_ring_size_ = sq_ring_size_;
+    }
+
+    sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == sq_ring_) {
+        sq_ring_ = NULL;
+        __Release();
+        return false;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == cq_ring_) {
+            cq_ring_ = NULL;
+            __Release();
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (MAP_FAILED == sqes_) {
+        sqes_ = NULL;
+        __Release();
+        return false;
+    }
+
+    sq_head_ = (unsigned*)((char*)sq_ring_ + params.sq_off.head);
+    sq_tail_ = (unsigned*)((char*)sq_ring_ + params.sq_off.tail);
+    sq_mask_ = (unsigned*)((char*)sq_ring_ + params.sq_off.ring_mask);
+    sq_array_ = (unsigned*)((char*)sq_ring_ + params.sq_off.array);
+    cq_head_ = (unsigned*)((char*)cq_ring_ + params.cq_off.head);
+    cq_tail_ = (unsigned*)((char*)cq_ring_ + params.cq_off.tail);
+    cq_mask_ = (unsigned*)((char*)cq_ring_ + params.cq_off.ring_mask);
+    cqes_ = (char*)cq_ring_ + params.cq_off.cqes;
+
+    slot_size_ = _slot_size;
+    slot_len_.assign(_slot_count, 0);
+    void* slots = mmap(NULL, _slot_count * _slot_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (MAP_FAILED == slots) {
+        __Release();
+        return false;
+    }
+    slots_ = (char*)slots;
+
+    std::vector<struct iovec> iovs(_slot_count);
+    for (unsigned int i = 0; i < _slot_count; ++i) {
+        iovs[i].iov_base = slots_ + i * _slot_size;
+        iovs[i].iov_len = _slot_size;
+    }
+
+    // 注册失败一般是 RLIMIT_MEMLOCK 太小
+    if (0 != __io_uring_register(ring_fd_, IORING_REGISTER_BUFFERS, &iovs[0], _slot_count)) {
+        __Release();
+        return false;
+    }
+
+    free_slots_.clear();
+    for (int i = (int)_slot_count - 1; i >= 0; --i) {
+        free_slots_.push_back(i);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IoUringWriter::Write(int _fd, const void* _data, size_t _len, uint64_t _offset) {
+#ifdef XLOG_HAS_IO_URING
+    if (!IsInited() || NULL == _data) return false;
+
+    const char* data = (const char*)_data;
+    while (0 < _len) {
+        int slot = __AcquireSlot();
+        if (0 > slot) return false;
+
+        size_t chunk = _len < slot_size_ ? _len : slot_size_;
+        memcpy(slots_ + slot * slot_size_, data, chunk);
+        slot_len_[slot] = chunk;
+
+        if (!__Submit(IORING_OP_WRITE_FIXED, _fd, slot, chunk, _offset, 0)) {
+            slot_len_[slot] = 0;
+            free_slots_.push_back(slot);
+            return false;
+        }
+
+        data += chunk;
+        _len -= chunk;
+        _offset += chunk;
+    }
+
+    __Reap();
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool IoUringWriter::Fdatasync(int _fd) {
+#ifdef XLOG_HAS_IO_URING
+    if (!IsInited()) return false;
+    // 只在同步点排空: 等前面所有写入完成后才开始, 后面的写入也等它完成
+    return __Submit(IORING_OP_FSYNC, _fd, -1, 0, 0, IOSQE_IO_DRAIN);
+#else
+    return false;
+#endif
+}
+
+void IoUringWriter::Drain() {
+    while (0 < inflight_) {
+        if (!__WaitOne()) break;
+    }
+}
+
+void IoUringWriter::__Release() {
+#ifdef XLOG_HAS_IO_URING
+    if (NULL != slots_) munmap(slots_, slot_len_.size() * slot_size_);
+    if (NULL != sqes_) munmap(sqes_, sqes_size_);
+    if (NULL != cq_ring_ && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+    if (NULL != sq_ring_) munmap(sq_ring_, sq_ring_size_);
+    if (-1 != ring_fd_) close(ring_fd_);
+#endif
+    ring_fd_ = -1;
+    slots_ = NULL;
+    sqes_ = NULL;
+    cq_ring_ = NULL;
+    sq_ring_ = NULL;
+    slot_len_.clear();
+    free_slots_.clear();
+    inflight_ = 0;
+}
+
+bool IoUringWriter::__Submit(uint8_t _opcode, int _fd, int _slot, size_t _len, uint64_t _offset, uint32_t _flags) {
+#ifdef XLOG_HAS_IO_URING
+    unsigned tail = *sq_tail_;
+    while (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_) {
+        if (!__WaitOne()) return false;
+    }
+
+    unsigned idx = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = (struct io_uring_sqe*)sqes_ + idx;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = _opcode;
+    sqe->flags = (uint8_t)_flags;
+    sqe->fd = _fd;
+
+    if (IORING_OP_FSYNC == _opcode) {
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = kSyncUserData;
+    } else {
+        sqe->off = _offset;
+        sqe->addr = (uint64_t)(uintptr_t)(slots_ + _slot * slot_size_);
+        sqe->len = (uint32_t)_len;
+        sqe->buf_index = (uint16_t)_slot;
+        sqe->user_data = (uint64_t)_slot;
+    }
+
+    sq_array_[idx] = idx;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    int ret = -1;
+    for (int retry = 0; retry < 3; ++retry) {
+        ret = __io_uring_enter(ring_fd_, 1, 0, 0);
+        if (1 == ret) break;
+        if (0 > ret && EINTR != errno && EAGAIN != errno && EBUSY != errno) break;
+        __Reap();
+    }
+
+    if (1 != ret) {
+        // 没提交出去的 sqe 留在队列里会被下一次 enter 带走, 这里只能把尾指针退回来
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+        ++errors_;
+        last_error_ = 0 > ret ? errno : EAGAIN;
+        return false;
+    }
+
+    ++inflight_;
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned int IoUringWriter::__Reap() {
+#ifdef XLOG_HAS_IO_URING
+    unsigned int count = 0;
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const struct io_uring_cqe* cqe = (const struct io_uring_cqe*)cqes_ + (head & *cq_mask_);
+
+        if (kSyncUserData == cqe->user_data) {
+            if (0 > cqe->res) {
+                ++errors_;
+                last_error_ = -cqe->res;
+            }
+        } else {
+            int slot = (int)cqe->user_data;
+            if (cqe->res != (int)slot_len_[slot]) {
+                ++errors_;
+                last_error_ = 0 > cqe->res ? -cqe->res : ENOSPC;
+            }
+            slot_len_[slot] = 0;
+            free_slots_.push_back(slot);
+        }
+
+        --inflight_;
+        ++count;
+        ++head;
+    }
+
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return count;
+#else
+    return 0;
+#endif
+}
+
+bool IoUringWriter::__WaitOne() {
+#ifdef XLOG_HAS_IO_URING
+    if (0 == inflight_) return false;
+    if (0 < __Reap()) return true;
+
+    int ret = __io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+    if (0 > ret && EINTR != errno) {
+        ++errors_;
+        last_error_ = errno;
+        return false;
+    }
+
+    __Reap();
+    return true;
+#else
+    return false;
+#endif
+}
+
+int IoUringWriter::__AcquireSlot() {
+    while (free_slots_.empty()) {
+        __Reap();
+        if (!free_slots_.empty()) break;
+        if (!__WaitOne()) return -1;
+    }
+
+    int slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
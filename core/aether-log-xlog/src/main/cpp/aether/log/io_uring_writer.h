@@ -0,0 +1,89 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * io_uring_writer.h
+ *
+ * 基于 io_uring 的异步写. 数据拷进注册过的固定缓冲区后用 WRITE_FIXED 提交, 落盘线程不阻塞在 write 上.
+ * 每个请求带调用方给定的偏移, 完成顺序不影响 block 在文件里的位置, 所以写请求之间不排空队列;
+ * 只有 fdatasync 带 IOSQE_IO_DRAIN, 等它之前的写入全部完成. 换文件前由调用方 Drain.
+ * 内核不支持或被 seccomp 拦截(部分 Android 版本)时 Init 返回 false, 调用方继续走同步 write.
+ */
+
+#ifndef IO_URING_WRITER_H_
+#define IO_URING_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class IoUringWriter {
+  public:
+    IoUringWriter();
+    ~IoUringWriter();
+
+    static bool IsSupported();
+
+    bool Init(unsigned int _slot_count, size_t _slot_size);
+    bool IsInited() const { return -1 != ring_fd_; }
+
+    // 拷贝后立即返回; 固定缓冲区全部在途时等待最早的一个完成. _fd 不能带 O_APPEND, 否则偏移被忽略
+    bool Write(int _fd, const void* _data, size_t _len, uint64_t _offset);
+    bool Fdatasync(int _fd);
+    // 等待所有在途请求完成, 关闭文件前必须调用
+    void Drain();
+
+    unsigned int Inflight() const { return inflight_; }
+    uint64_t Errors() const { return errors_; }
+    int LastError() const { return last_error_; }
+
+  private:
+    IoUringWriter(const IoUringWriter&);
+    IoUringWriter& operator=(const IoUringWriter&);
+
+    void __Release();
+    bool __Submit(uint8_t _opcode, int _fd, int _slot, size_t _len, uint64_t _offset, uint32_t _flags);
+    unsigned int __Reap();
+    bool __WaitOne();
+    int __AcquireSlot();
+
+  private:
+    int ring_fd_;
+    unsigned int sq_entries_;
+
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    void* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    void* cqes_;
+
+    char* slots_;
+    size_t slot_size_;
+    std::vector<size_t> slot_len_;     // 0 表示空闲
+    std::vector<int> free_slots_;
+
+    unsigned int inflight_;
+    uint64_t errors_;
+    int last_error_;
+};
+
+#endif  // IO_URING_WRITER_H_
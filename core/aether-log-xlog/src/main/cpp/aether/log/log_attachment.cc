@@ -0,0 +1,69 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_attachment.cc
+ */
+
+#include "log_attachment.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+LogAttachment::LogAttachment(const char* _name, const void* _data, size_t _len)
+: id_(LogRecordChunk::NextId()), name_(NULL == _name ? "" : _name, NULL == _name ? 0 : strnlen(_name, kMaxNameLen))
+, data_((const char*)_data, _len), offset_(0), index_(0), done_(false) {}
+
+size_t LogAttachment::Next(char* _buffer, size_t _len) {
+    if (done_ || _len < kBufferLength) return 0;
+
+    char* out = _buffer + LogRecordChunk::kHeaderLen;
+    if (0 == index_) {
+        *out++ = (char)name_.size();
+        memcpy(out, name_.data(), name_.size());
+        out += name_.size();
+    }
+    size_t len = std::min((size_t)kDataLength, data_.size() - offset_);
+    memcpy(out, data_.data() + offset_, len);
+    out += len;
+    offset_ += len;
+
+    done_ = offset_ >= data_.size();
+    size_t frame_len = (size_t)(out - _buffer);
+    LogRecordChunk::PutHeader(_buffer, id_, index_++, done_ ? LogRecordChunk::kFlagLast : 0,
+                              (uint32_t)(frame_len - LogRecordChunk::kHeaderLen), Magic());
+    return frame_len;
+}
+
+bool LogAttachmentQueue::Push(LogAttachment& _attachment) {
+    if (bytes_ + _attachment.Length() > kMaxPendingBytes) return false;
+    bytes_ += _attachment.Length();
+    items_.push_back(LogAttachment());
+    std::swap(items_.back(), _attachment);
+    return true;
+}
+
+bool LogAttachmentQueue::Pop(LogAttachment& _attachment) {
+    if (items_.empty()) return false;
+    std::swap(_attachment, items_.front());
+    items_.pop_front();
+    bytes_ -= _attachment.Length();
+    return true;
+}
+
+size_t LogAttachmentQueue::Clear() {
+    size_t count = items_.size();
+    items_.clear();
+    bytes_ = 0;
+    return count;
+}
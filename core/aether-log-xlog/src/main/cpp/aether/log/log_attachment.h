@@ -0,0 +1,81 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_attachment.h
+ *
+ * 日志流里的二进制附件. 调用方复制一份数据排进队列后立即拿到 id, 由异步线程切成附件帧写进 LogBuffer,
+ * 和文本日志一样压缩、加密、落盘, 随日志文件一起清理和上传; 同步模式在调用线程直接写.
+ *
+ * 附件帧(帧头和 log_record_chunk.h 的分片帧相同, 只是 magic 不同):
+ *   "\0xat1" | u32 附件 id | u16 片序号 | u8 标志 | u32 之后的字节数 | 数据
+ * 第一片的数据以 u8 名字长度 | 名字 开始. 解码器按 id 拼回, 写成单独的文件(xlogdecode -a).
+ */
+
+#ifndef LOG_ATTACHMENT_H_
+#define LOG_ATTACHMENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+#include "log_record_chunk.h"
+
+class LogAttachment {
+  public:
+    static const size_t kDataLength = 8 * 1024;                 // 每片最多的数据
+    static const size_t kMaxLength = 4 * 1024 * 1024;           // 更大的附件直接拒绝
+    static const size_t kMaxNameLen = 64;
+    // 缓冲区至少这么长: 帧头 + 名字 + 一片数据
+    static const size_t kBufferLength = LogRecordChunk::kHeaderLen + 1 + kMaxNameLen + kDataLength;
+
+    static const char* Magic() { return "\0xat1"; }
+
+    LogAttachment() : id_(0), offset_(0), index_(0), done_(true) {}
+    // 复制一份数据并分配 id, 名字超长时截断
+    LogAttachment(const char* _name, const void* _data, size_t _len);
+
+    uint32_t Id() const { return id_; }
+    size_t Length() const { return data_.size(); }
+
+    // 下一片写到 _buffer, 返回整帧的长度; 已经取完或 _len 不够时返回 0
+    size_t Next(char* _buffer, size_t _len);
+
+  private:
+    uint32_t id_;
+    std::string name_;
+    std::string data_;
+    size_t offset_;
+    uint16_t index_;
+    bool done_;
+};
+
+// 等异步线程写的附件, 由调用方持有的缓冲区锁保护
+class LogAttachmentQueue {
+  public:
+    static const size_t kMaxPendingBytes = 8 * 1024 * 1024;     // 异步线程跟不上时拒绝新的附件
+
+    LogAttachmentQueue() : bytes_(0) {}
+
+    // 接管 _attachment 的数据; 排队的字节数超过上限时返回 false
+    bool Push(LogAttachment& _attachment);
+    bool Pop(LogAttachment& _attachment);
+    // 丢掉还没写的, 返回个数
+    size_t Clear();
+
+  private:
+    std::deque<LogAttachment> items_;
+    size_t bytes_;
+};
+
+#endif  // LOG_ATTACHMENT_H_
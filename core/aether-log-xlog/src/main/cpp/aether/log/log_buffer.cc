@@ -12,6 +12,7 @@
 
 #include "log_buffer.h"
 
+#include <cctype>
 #include <cstdio>
 #include <ctime>
 #include <algorithm>
@@ -19,30 +20,166 @@
 #include <cstring>
 #include <cerrno>
 #include <cassert>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include <boost/filesystem.hpp>
 
 #include "crypt/log_crypt.h"
+#include "log_compress_pool.h"
+#include "log_metrics.h"
+#include "../common/mmap_util.h"
 
 
 #ifdef WIN32
 #define snprintf _snprintf
 #endif
 
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+const uint8_t LogBlockStat::kLevelMaskNoInfo;
 
 bool LogBuffer::GetPeriodLogs(const char* _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg) {
     return LogCrypt::GetPeriodLogs(_log_path, _begin_hour, _end_hour, _begin_pos, _end_pos, _err_msg);
 }
 
-LogBuffer::LogBuffer(void* _pbuffer, size_t _len, bool _isCompress, const char* _pubkey)
-: is_compress_(_isCompress), log_crypt_(new LogCrypt(_pubkey)), remain_nocrypt_len_(0) {
-    buff_.Attach(_pbuffer, _len);
-    __Fix();
+bool LogBuffer::GetPeriodLogsMs(const char* _log_path, int64_t _begin_ms, int64_t _end_ms, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg) {
+    return LogCrypt::GetPeriodLogsMs(_log_path, _begin_ms, _end_ms, _begin_pos, _end_pos, _err_msg);
+}
 
-    if (is_compress_) {
-        memset(&cstream_, 0, sizeof(cstream_));
+static const char* const kMmapExt = ".mmap3";
+static const size_t kWriteMargin = 64;
+
+// 流水线模式写的 block: 不压缩的 magic, 却占了压缩 block 的序号
+static bool __IsDeferred(const char* _data, size_t _len) {
+    bool is_async = false;
+    bool is_crypt = false;
+    return LogCrypt::GetBlockFormat(_data, _len, is_async, is_crypt) && !is_async && 0 != LogCrypt::GetSeq(_data, _len);
+}
+
+std::string LogBuffer::MmapPath(const std::string& _dir, const std::string& _nameprefix, size_t _segments) {
+    std::string path = _dir + "/" + _nameprefix;
+    if (1 < _segments) {
+        char temp[24] = {0};
+        snprintf(temp, sizeof(temp), ".%u", (unsigned int)_segments);
+        path += temp;
+    }
+    return path + kMmapExt;
+}
+
+std::string LogBuffer::MmapPrefix(const std::string& _nameprefix, const std::string& _process_name) {
+    if (_process_name.empty()) return _nameprefix;
+
+    // Android 的进程名形如 com.example:push
+    std::string prefix = _nameprefix + "@";
+    for (size_t i = 0; i < _process_name.size(); ++i) {
+        char c = _process_name[i];
+        prefix += (isalnum((unsigned char)c) || '.' == c || '-' == c || '_' == c) ? c : '_';
+    }
+    return prefix;
+}
+
+bool LogBuffer::LockMmap(const std::string& _dir, const std::string& _nameprefix, int& _fd) {
+    _fd = -1;
+    std::string path = _dir + "/" + _nameprefix + ".lock";
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (-1 == fd) return true;
+
+    int ret = -1;
+    do {
+        ret = flock(fd, LOCK_EX | LOCK_NB);
+    } while (-1 == ret && EINTR == errno);
+
+    if (-1 == ret) {
+        bool busy = EWOULDBLOCK == errno;
+        ::close(fd);
+        return !busy;
+    }
+    _fd = fd;
+    return true;
+}
+
+void LogBuffer::UnlockMmap(int& _fd) {
+    if (-1 == _fd) return;
+    ::close(_fd);
+    _fd = -1;
+}
+
+void LogBuffer::RecoverStaleMmap(const std::string& _dir, const std::string& _nameprefix, const std::string& _keep_path,
+                                 size_t _keep_len, AutoBuffer& _out, LogBlockStat* _stat) {
+    std::vector<std::pair<std::string, size_t> > stale;
+
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator end_iter;
+    for (boost::filesystem::directory_iterator iter(_dir, ec); !ec && iter != end_iter; iter.increment(ec)) {
+        std::string filename = iter->path().filename().string();
+        size_t ext_len = strlen(kMmapExt);
+        if (filename.size() < _nameprefix.size() + ext_len || 0 != filename.compare(0, _nameprefix.size(), _nameprefix)
+            || 0 != filename.compare(filename.size() - ext_len, ext_len, kMmapExt)) {
+            continue;
+        }
+
+        // 中间是空的(单段)或者 .<段数>
+        std::string middle = filename.substr(_nameprefix.size(), filename.size() - _nameprefix.size() - ext_len);
+        size_t segments = 1;
+        if (!middle.empty()) {
+            if ('.' != middle[0] || 2 > middle.size() || std::string::npos != middle.find_first_not_of("0123456789", 1)) continue;
+            segments = (size_t)atoi(middle.c_str() + 1);
+        }
+
+        std::string path = iter->path().string();
+        boost::system::error_code size_ec;
+        uint64_t size = boost::filesystem::file_size(path, size_ec);
+        if (size_ec || (path == _keep_path && size == _keep_len)) continue;
+        stale.push_back(std::make_pair(path, segments));
+    }
+
+    for (size_t i = 0; i < stale.size(); ++i) {
+        boost::iostreams::mapped_file mmap_file;
+        boost::system::error_code size_ec;
+        uint64_t size = boost::filesystem::file_size(stale[i].first, size_ec);
+        if (!size_ec && 0 < size && OpenMmapFile(stale[i].first.c_str(), (unsigned int)size, mmap_file)) {
+            LogBuffer buffer(mmap_file.data(), (size_t)size, false, "", stale[i].second);
+            AutoBuffer out;
+            LogBlockStat stat;
+            buffer.Flush(out, &stat);
+            if (out.Ptr()) {
+                if (_stat && 0 == _out.Length()) {
+                    *_stat = stat;
+                } else if (_stat) {
+                    _stat->Merge(stat);
+                }
+                _out.Write(out.Ptr(), out.Length());
+            }
+            CloseMmapFile(mmap_file);
+        }
+        boost::filesystem::remove(stale[i].first, size_ec);
+    }
+}
+
+LogBuffer::LogBuffer(void* _pbuffer, size_t _len, bool _isCompress, const char* _pubkey, size_t _segments)
+: base_((char*)_pbuffer), segment_len_(_len), segment_count_(1), active_(0)
+, is_compress_(_isCompress), pending_compress_(_isCompress), log_crypt_(new LogCrypt(_pubkey)), remain_nocrypt_len_(0), metrics_(NULL)
+, pipeline_(false), defer_(false), packing_(0) {
+    if (1 < _segments) {
+        segment_count_ = _segments;
+        segment_len_ = _len / _segments;
     }
+    __Fix();
+
+    memset(&cstream_, 0, sizeof(cstream_));
 }
 
 LogBuffer::~LogBuffer() {
+    // 压缩线程还在读段里的数据、用 log_crypt_
+    ScopedLock lock(mutex_pack_);
+    while (0 < packing_) cond_pack_.wait(lock);
+    lock.unlock();
+
     if (is_compress_ && Z_NULL != cstream_.state) {
         deflateEnd(&cstream_);
     }
@@ -55,7 +192,26 @@ PtrBuffer& LogBuffer::GetData() {
 }
 
 
-void LogBuffer::Flush(AutoBuffer& _buff) {
+void LogBuffer::Flush(AutoBuffer& _buff, LogBlockStat* _stat) {
+    bool has_stat = false;
+    while (!sealed_.empty()) {
+        Sealed& sealed = sealed_.front();
+        char* data = base_ + sealed.index * segment_len_;
+        const AutoBuffer* packed = sealed.job ? __WaitPacked(*sealed.job) : NULL;
+        if (NULL != packed) {
+            _buff.Write(*packed);
+        } else {
+            _buff.Write(data, sealed.length);
+        }
+        if (_stat && has_stat) {
+            _stat->Merge(sealed.stat);
+        } else if (_stat) {
+            *_stat = sealed.stat;
+        }
+        has_stat = true;
+        memset(data, 0, sealed.length);
+        sealed_.pop_front();
+    }
 
     if (is_compress_ && Z_NULL != cstream_.state) {
         deflateEnd(&cstream_);
@@ -67,26 +223,226 @@ void LogBuffer::Flush(AutoBuffer& _buff) {
     }
 
     __Flush();
-    _buff.Write(buff_.Ptr(), buff_.Length());
+    AutoBuffer packed;
+    if (defer_ && __PackBlock((char*)buff_.Ptr(), buff_.Length(), packed)) {
+        _buff.Write(packed);
+    } else {
+        _buff.Write(buff_.Ptr(), buff_.Length());
+    }
+    if (_stat) {
+        LogBlockStat stat = block_stat_;
+        stat.seq = LogCrypt::GetSeq((char*)buff_.Ptr(), buff_.Length());
+        if (has_stat) {
+            _stat->Merge(stat);
+        } else {
+            *_stat = stat;
+        }
+    }
     __Clear();
 }
 
-bool LogBuffer::Write(const void* _data, size_t _inputlen, AutoBuffer& _out_buff) {
+bool LogBuffer::Seal() {
+    if (1 >= segment_count_ || sealed_.size() + 1 >= segment_count_) return false;
+    if (0 == buff_.Length() || 0 == log_crypt_->GetLogLen((char*)buff_.Ptr(), buff_.Length())) return false;
+
+    if (is_compress_ && Z_NULL != cstream_.state) {
+        deflateEnd(&cstream_);
+    }
+    __Flush();
+
+    Sealed sealed;
+    sealed.index = active_;
+    sealed.length = buff_.Length();
+    sealed.stat = block_stat_;
+    sealed.stat.seq = LogCrypt::GetSeq((char*)buff_.Ptr(), buff_.Length());
+    // 写入方接着写下一段, 这一段同时在压缩线程上压缩
+    __MakeJob(sealed);
+    if (sealed.job) __Submit(sealed.job);
+    sealed_.push_back(sealed);
+
+    size_t next = active_;
+    do {
+        next = (next + 1) % segment_count_;
+    } while (__IsSealed(next));
+    __Attach(next, 0);
+    return true;
+}
+
+void LogBuffer::FlushSegments(ScopedLock& _lock, const FlushSink& _sink) {
+    // 先放开 _lock 再排队, 否则和正在交出数据、等着重新加锁的线程互相等待
+    _lock.unlock();
+    ScopedLock lock_flush(mutex_flush_);
+    _lock.lock();
+
+    Seal();
+    // 之前排不进压缩线程的段再交一次, 下面按封口顺序等
+    for (std::deque<Sealed>::iterator iter = sealed_.begin(); iter != sealed_.end(); ++iter) {
+        if (iter->job) __Submit(iter->job);
+    }
+    while (!sealed_.empty()) {
+        // 封口的段不会再被写入, 交出期间不用持锁
+        Sealed sealed = sealed_.front();
+        _lock.unlock();
+        const AutoBuffer* packed = sealed.job ? __WaitPacked(*sealed.job) : NULL;
+        if (NULL != packed) {
+            _sink(packed->Ptr(), packed->Length(), sealed.stat);
+        } else {
+            _sink(base_ + sealed.index * segment_len_, sealed.length, sealed.stat);
+        }
+        _lock.lock();
+
+        memset(base_ + sealed.index * segment_len_, 0, sealed.length);
+        sealed_.pop_front();
+    }
+
+    // 单段, 或者交出期间写入方又写了一些. 流水线模式下当前段拷出来以后在锁外压缩
+    AutoBuffer tmp;
+    LogBlockStat stat;
+    bool defer = defer_;
+    defer_ = false;
+    Flush(tmp, &stat);
+    if (tmp.Ptr()) {
+        _lock.unlock();
+        AutoBuffer packed;
+        if (defer && __PackBlock((char*)tmp.Ptr(), tmp.Length(), packed)) {
+            _sink(packed.Ptr(), packed.Length(), stat);
+        } else {
+            _sink(tmp.Ptr(), tmp.Length(), stat);
+        }
+        _lock.lock();
+    }
+}
+
+void LogBuffer::__MakeJob(Sealed& _sealed) {
+    const char* data = base_ + _sealed.index * segment_len_;
+    if (!__IsDeferred(data, _sealed.length) || !log_crypt_->IsOwnBlock(data, _sealed.length)) return;
+
+    _sealed.job.reset(new PackJob());
+    _sealed.job->data = data;
+    _sealed.job->length = _sealed.length;
+    _sealed.job->submitted = false;
+    _sealed.job->done = false;
+    _sealed.job->ok = false;
+}
+
+void LogBuffer::__Submit(const std::shared_ptr<PackJob>& _job) {
+    ScopedLock lock(mutex_pack_);
+    if (_job->submitted) return;
+
+    std::shared_ptr<PackJob> job = _job;
+    _job->submitted = LogCompressPool::Singleton()->TrySubmit([this, job]() {
+        job->ok = __PackBlock(job->data, job->length, job->out);
+        ScopedLock lock_done(mutex_pack_);
+        job->done = true;
+        --packing_;
+        cond_pack_.notifyAll(lock_done);
+    });
+    if (_job->submitted) ++packing_;
+}
+
+// 等压缩线程做完, 排不进去的在当前线程压缩; 返回 NULL 时落盘原来的 block
+const AutoBuffer* LogBuffer::__WaitPacked(PackJob& _job) {
+    ScopedLock lock(mutex_pack_);
+    if (!_job.submitted) {
+        _job.submitted = true;
+        lock.unlock();
+        _job.ok = __PackBlock(_job.data, _job.length, _job.out);
+        _job.done = true;
+    } else {
+        while (!_job.done) cond_pack_.wait(lock);
+    }
+    return _job.ok ? &_job.out : NULL;
+}
+
+// 整个 block 用一个独立的 deflate 流压缩再加密, header 照搬, 换成压缩的 magic 和新的长度.
+// 多个压缩线程同时调用, 只读 log_crypt_ 的 key
+bool LogBuffer::__PackBlock(const char* _block, size_t _len, AutoBuffer& _out) {
+    // 崩溃前的进程用它自己的 key 加密的 block 解不开, 原样落盘
+    if (!__IsDeferred(_block, _len) || !log_crypt_->IsOwnBlock(_block, _len)) return false;
+
+    uint32_t header_len = LogCrypt::GetHeaderLen(_block, _len);
+    uint32_t tailer_len = LogCrypt::GetTailerLen();
+    uint32_t log_len = LogCrypt::GetLogLen(_block, _len);
+    if ((size_t)header_len + log_len + tailer_len > _len) return false;
+
+    AutoBuffer plain;
+    plain.Write(_block + header_len, log_len);
+    log_crypt_->DecryptAsyncLog((char*)plain.Ptr(), log_len);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY)) {
+        return false;
+    }
+    AutoBuffer zipped;
+    uLong bound = deflateBound(&stream, log_len);
+    zipped.AllocWrite(bound);
+    stream.next_in = (Bytef*)plain.Ptr();
+    stream.avail_in = (uInt)log_len;
+    stream.next_out = (Bytef*)zipped.Ptr();
+    stream.avail_out = (uInt)bound;
+    int ret = deflate(&stream, Z_FINISH);
+    size_t zipped_len = bound - stream.avail_out;
+    deflateEnd(&stream);
+    if (Z_STREAM_END != ret) return false;
+
+    AutoBuffer crypted;
+    size_t remain_nocrypt_len = 0;
+    log_crypt_->CryptAsyncLog((const char*)zipped.Ptr(), zipped_len, crypted, remain_nocrypt_len);
+
+    _out.AllocWrite(header_len + crypted.Length() + tailer_len);
+    char* out = (char*)_out.Ptr();
+    memcpy(out, _block, header_len);
+    LogCrypt::SetBlockFormat(out, header_len, true);
+    LogCrypt::SetLogLen(out, (uint32_t)crypted.Length());
+    memcpy(out + header_len, crypted.Ptr(), crypted.Length());
+    memcpy(out + header_len + crypted.Length(), _block + header_len + log_len, tailer_len);
+
+    if (NULL != metrics_) {
+        metrics_->OnEncoded(zipped_len, log_crypt_->IsCrypt() ? zipped_len - remain_nocrypt_len : 0);
+    }
+    return true;
+}
+
+bool LogBuffer::Write(const void* _data, size_t _inputlen, AutoBuffer& _out_buff, int _level, int64_t _timestamp_ms, const char* _tag) {
     if (NULL == _data || 0 == _inputlen) {
         return false;
     }
 
     log_crypt_->CryptSyncLog((char*)_data, _inputlen, _out_buff);
+    // 同步模式不压缩也不加密
+    if (NULL != metrics_) metrics_->OnEncoded(_inputlen, 0);
+
+    if (0 == _timestamp_ms) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        _timestamp_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+    LogCrypt::UpdateLogTime((char*)_out_buff.Ptr(), _timestamp_ms, _timestamp_ms, 1);
+
+    LogBlockStat stat;
+    stat.Add(_level, _timestamp_ms, _tag);
+    LogCrypt::UpdateLogSummary((char*)_out_buff.Ptr(), stat.level_mask, stat.tag_bloom);
 
     return true;
 }
 
 
-bool LogBuffer::Write(const void* _data, size_t _length) {
+bool LogBuffer::Write(const void* _data, size_t _length, int _level, int64_t _timestamp_ms, const char* _tag) {
     if (NULL == _data || 0 == _length) {
         return false;
     }
 
+    // 多段时剩余空间可能放不下(按压缩最坏情况估)就先换段, 不把一条日志截断在段尾
+    if (0 < buff_.Length() && buff_.MaxLength() - buff_.Length() < _length + _length / 1000 + kWriteMargin) {
+        Seal();
+    }
+    // 没有空闲段可换又放不下时丢掉这条, 不截断; 压缩时也按最坏情况估, 否则 deflate 写不下的部分会丢
+    size_t need = is_compress_ && !defer_ ? _length + _length / 1000 + kWriteMargin : _length + kWriteMargin;
+    if (buff_.MaxLength() - buff_.Length() < need) {
+        return false;
+    }
+
     if (buff_.Length() == 0) {
         if (!__Reset()) return false;
     }
@@ -94,7 +450,7 @@ bool LogBuffer::Write(const void* _data, size_t _length) {
     size_t before_len = buff_.Length();
     size_t write_len = _length;
 
-    if (is_compress_) {
+    if (is_compress_ && !defer_) {
         cstream_.avail_in = (uInt)_length;
         cstream_.next_in = (Bytef*)_data;
 
@@ -124,14 +480,53 @@ bool LogBuffer::Write(const void* _data, size_t _length) {
 
     log_crypt_->UpdateLogLen((char*)buff_.Ptr(), (uint32_t)(out_buffer.Length() - last_remain_len));
 
+    // 上次留下的不足 8 字节的尾巴这次一起加密了, 这次新留下的下次再算; 流水线模式在压缩线程上统计
+    if (NULL != metrics_ && !defer_) {
+        metrics_->OnEncoded(write_len, log_crypt_->IsCrypt() ? out_buffer.Length() - remain_nocrypt_len_ : 0);
+    }
+
+    if (0 == _timestamp_ms) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        _timestamp_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    }
+    block_stat_.Add(_level, _timestamp_ms, _tag);
+    // 随每条日志更新 header, 崩溃后从 mmap 恢复的 block 也带着时间范围和级别/tag 摘要
+    if (block_stat_.time_known) {
+        LogCrypt::UpdateLogTime((char*)buff_.Ptr(), block_stat_.begin_ms, block_stat_.end_ms, block_stat_.count);
+        LogCrypt::UpdateLogSummary((char*)buff_.Ptr(), block_stat_.level_mask, block_stat_.tag_bloom);
+    }
+
     return true;
 }
 
+void LogBuffer::SetCompress(bool _is_compress) {
+    pending_compress_ = _is_compress;
+}
+
+void LogBuffer::SetPipeline(bool _pipeline) {
+    pipeline_ = _pipeline;
+}
+
+void LogBuffer::SetHeaderV2(bool _v2) {
+    log_crypt_->SetHeaderV2(_v2);
+}
+
 bool LogBuffer::__Reset() {
 
     __Clear();
 
-    if (is_compress_) {
+    // 只在 block 边界切换, 每个 block 的 magic 记录了自己是否压缩
+    if (pending_compress_ != is_compress_) {
+        if (is_compress_ && Z_NULL != cstream_.state) {
+            deflateEnd(&cstream_);
+        }
+        memset(&cstream_, 0, sizeof(cstream_));
+        is_compress_ = pending_compress_;
+    }
+
+    defer_ = is_compress_ && pipeline_;
+    if (is_compress_ && !defer_) {
         cstream_.zalloc = Z_NULL;
         cstream_.zfree = Z_NULL;
         cstream_.opaque = Z_NULL;
@@ -142,14 +537,14 @@ bool LogBuffer::__Reset() {
 
     }
 
-    log_crypt_->SetHeaderInfo((char*)buff_.Ptr(), is_compress_);
+    log_crypt_->SetHeaderInfo((char*)buff_.Ptr(), is_compress_ && !defer_, is_compress_);
     buff_.Length(log_crypt_->GetHeaderLen(), log_crypt_->GetHeaderLen());
 
     return true;
 }
 
 void LogBuffer::__Flush() {
-    assert(buff_.Length() >= log_crypt_->GetHeaderLen());
+    assert(buff_.Length() >= LogCrypt::GetHeaderLen((char*)buff_.Ptr(), buff_.Length()));
 
     log_crypt_->UpdateLogHour((char*)buff_.Ptr());
     log_crypt_->SetTailerInfo((char*)buff_.Ptr() + buff_.Length());
@@ -161,17 +556,112 @@ void LogBuffer::__Clear() {
     memset(buff_.Ptr(), 0, buff_.Length());
     buff_.Length(0, 0);
     remain_nocrypt_len_ = 0;
+    block_stat_.Reset();
+}
+
+
+// 每段末尾留出结尾 magic 的位置
+void LogBuffer::__Attach(size_t _index, size_t _length) {
+    active_ = _index;
+    buff_.Attach(base_ + _index * segment_len_, _length, segment_len_ - LogCrypt::GetTailerLen());
+    buff_.Length(_length, _length);
+    remain_nocrypt_len_ = 0;
+    block_stat_.Reset();
 }
 
+bool LogBuffer::__IsSealed(size_t _index) const {
+    for (std::deque<Sealed>::const_iterator iter = sealed_.begin(); iter != sealed_.end(); ++iter) {
+        if (iter->index == _index) return true;
+    }
+    return false;
+}
 
+// 每段单独恢复. 有日志的段按开始时间排队等落盘, 最后一段没有空闲段可换时留作当前段接着写;
+// 单段时和以前一样, 恢复出来的 block 就是当前段
 void LogBuffer::__Fix() {
+    std::vector<Sealed> found;
+    for (size_t i = 0; i < segment_count_; ++i) {
+        if (!__FixSegment(i) || 0 == log_crypt_->GetLogLen((char*)buff_.Ptr(), buff_.Length())) {
+            // 坏的或者只有 header 的段清空, 当作空闲
+            if (1 < segment_count_) memset(base_ + i * segment_len_, 0, segment_len_);
+            continue;
+        }
+        Sealed sealed;
+        sealed.index = i;
+        sealed.length = buff_.Length();
+        sealed.stat = block_stat_;
+        sealed.stat.seq = LogCrypt::GetSeq((char*)buff_.Ptr(), buff_.Length());
+        found.push_back(sealed);
+    }
+
+    // 时间未知的旧 block 排在最前
+    std::stable_sort(found.begin(), found.end(), [](const Sealed& _a, const Sealed& _b) {
+        int64_t a = _a.stat.time_known ? _a.stat.begin_ms : 0;
+        int64_t b = _b.stat.time_known ? _b.stat.begin_ms : 0;
+        return a < b;
+    });
+
+    // 没有空闲段时最新的一段不封口, 留作当前段
+    size_t active = segment_count_;
+    if (found.size() == segment_count_) {
+        active = found.back().index;
+        found.pop_back();
+    }
+    for (std::vector<Sealed>::iterator iter = found.begin(); iter != found.end(); ++iter) {
+        __Attach(iter->index, iter->length);
+        __Flush();
+        iter->length = buff_.Length();
+        __MakeJob(*iter);
+        sealed_.push_back(*iter);
+    }
+
+    if (active < segment_count_) {
+        // 重新恢复一次, seq 接到这个 block 上
+        __FixSegment(active);
+        return;
+    }
+
+    if (!sealed_.empty()) {
+        bool is_async = false;
+        uint32_t raw_log_len = 0;
+        log_crypt_->Fix(base_ + sealed_.back().index * segment_len_, sealed_.back().length, is_async, raw_log_len);
+    }
+    for (active = 0; __IsSealed(active); ++active) {}
+    __Attach(active, 0);
+}
+
+bool LogBuffer::__FixSegment(size_t _index) {
+    __Attach(_index, segment_len_ - LogCrypt::GetTailerLen());
     uint32_t raw_log_len = 0;
     bool is_compress = false;
+    uint32_t header_len = 0;
     if (log_crypt_->Fix((char*)buff_.Ptr(), buff_.Length(), is_compress, raw_log_len)) {
-        buff_.Length(raw_log_len + log_crypt_->GetHeaderLen(), raw_log_len + log_crypt_->GetHeaderLen());
-    } else {
+        // 旧版本留下的 block 按它自己的 header 长度继续写
+        header_len = LogCrypt::GetHeaderLen((char*)buff_.Ptr(), buff_.Length());
+    }
+    // 长度超出本段的是坏数据
+    if (0 == header_len || (size_t)raw_log_len + header_len > buff_.MaxLength()) {
         buff_.Length(0, 0);
+        return false;
     }
-
+    buff_.Length(raw_log_len + header_len, raw_log_len + header_len);
+    // 流水线模式写了一半的 block 接着不压缩地写
+    defer_ = __IsDeferred((char*)buff_.Ptr(), buff_.Length());
+
+    // 新格式的 header 里有时间范围、条数、级别和 tag 摘要; 旧格式的 block 时间未知
+    int64_t begin_ms = 0;
+    int64_t end_ms = 0;
+    uint32_t count = 0;
+    if (LogCrypt::GetLogTime((char*)buff_.Ptr(), buff_.Length(), begin_ms, end_ms, count) && 0 < count) {
+        block_stat_.begin_ms = begin_ms;
+        block_stat_.end_ms = end_ms;
+        block_stat_.count = count;
+        if (!LogCrypt::GetLogSummary((char*)buff_.Ptr(), buff_.Length(), block_stat_.level_mask, block_stat_.tag_bloom)) {
+            block_stat_.level_mask = 0xFF;
+        }
+    } else {
+        block_stat_.time_known = false;
+    }
+    return true;
 }
 
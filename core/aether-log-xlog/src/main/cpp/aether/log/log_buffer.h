@@ -16,25 +16,117 @@
 #include <zlib.h>
 #include <string>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include "ptrbuffer.h"
 #include "autobuffer.h"
+#include "../common/thread/condition.h"
+#include "../common/thread/lock.h"
 
-class LogCrypt;
+#include "crypt/log_crypt.h"
 
+// 一个 block 的摘要, 写进 header 和 .xlog 旁边的索引
+struct LogBlockStat {
+    int64_t begin_ms;
+    int64_t end_ms;
+    uint32_t count;
+    uint16_t seq;
+    uint8_t level_mask;     // bit n 表示有 level n 的日志, kLevelMaskNoInfo 表示有不知道级别和 tag 的记录
+    bool time_known;        // mmap 里恢复出来的 block 不知道时间范围
+    uint8_t tag_bloom[LogCrypt::kTagBloomBytes];
+
+    static const uint8_t kLevelMaskNoInfo = 0x80;
+
+    LogBlockStat() { Reset(); }
+    void Reset() {
+        begin_ms = 0;
+        end_ms = 0;
+        count = 0;
+        seq = 0;
+        level_mask = 0;
+        time_known = true;
+        memset(tag_bloom, 0, sizeof(tag_bloom));
+    }
+    // _level < 0 表示没有 XLoggerInfo
+    void Add(int _level, int64_t _timestamp_ms, const char* _tag) {
+        if (0 == count || _timestamp_ms < begin_ms) begin_ms = _timestamp_ms;
+        if (0 == count || _timestamp_ms > end_ms) end_ms = _timestamp_ms;
+        if (0 <= _level && _level < 7) {
+            level_mask |= (uint8_t)(1 << _level);
+            LogCrypt::AddTagBloom(tag_bloom, _tag);
+        } else {
+            level_mask |= kLevelMaskNoInfo;
+        }
+        ++count;
+    }
+    // 多个相邻 block 一起落盘时合并摘要, seq 取第一个
+    void Merge(const LogBlockStat& _other) {
+        if (0 < _other.count) {
+            if (0 == count || _other.begin_ms < begin_ms) begin_ms = _other.begin_ms;
+            if (0 == count || _other.end_ms > end_ms) end_ms = _other.end_ms;
+        }
+        count += _other.count;
+        level_mask |= _other.level_mask;
+        time_known = time_known && _other.time_known;
+        for (size_t i = 0; i < sizeof(tag_bloom); ++i) tag_bloom[i] |= _other.tag_bloom[i];
+    }
+};
+
+// _len 平分成 _segments 段, 每段放一个 block. 多段时写满一段就封口(补上结尾), 写入方换到下一个空闲段,
+// 封口的段在锁外落盘; 单段时和以前一样拷出来再落盘.
+// 流水线模式下写入方不压缩, 只拷贝(和加密); 封口的段立即交给 LogCompressPool 的线程用独立的 deflate 流
+// 整块压缩、加密, FlushSegments 按封口顺序等结果落盘. 崩溃时 mmap 里留下的是不压缩的 block, 照样能恢复;
+// 恢复时只压缩不加密的, 加密的 block 用的是崩溃前那个进程的 key, 原样落盘.
 class LogBuffer {
 public:
-    LogBuffer(void* _pbuffer, size_t _len, bool _is_compress, const char* _pubkey);
+    typedef std::function<void(const void* _data, size_t _len, const LogBlockStat& _stat)> FlushSink;
+
+    LogBuffer(void* _pbuffer, size_t _len, bool _is_compress, const char* _pubkey, size_t _segments = 1);
     ~LogBuffer();
     
 public:
+    // 单段时沿用 <nameprefix>.mmap3, 多段时是 <nameprefix>.<段数>.mmap3
+    static std::string MmapPath(const std::string& _dir, const std::string& _nameprefix, size_t _segments);
+    // _dir 里本前缀的 mmap 文件中, 路径不是 _keep_path 或长度不是 _keep_len 的(缓冲区大小或段数改过),
+    // 按各自的布局取出日志追加到 _out, 然后删除
+    static void RecoverStaleMmap(const std::string& _dir, const std::string& _nameprefix, const std::string& _keep_path,
+                                 size_t _keep_len, AutoBuffer& _out, LogBlockStat* _stat);
+    // 多进程共用目录时 mmap 按进程区分: <nameprefix>@<进程名>, 进程名里不能进文件名的字符换成 '_'; 进程名为空时不变
+    static std::string MmapPrefix(const std::string& _nameprefix, const std::string& _process_name);
+    // 锁住 _dir/<_nameprefix>.lock, 一个前缀的 mmap 文件同时只归一个进程. 锁被别的进程拿着时返回 false,
+    // 这时不能映射也不能恢复它的 mmap 文件; 锁文件打不开时 _fd 为 -1, 照常使用. _fd 要保持打开到关闭 mmap 之后
+    static bool LockMmap(const std::string& _dir, const std::string& _nameprefix, int& _fd);
+    static void UnlockMmap(int& _fd);
+
     static bool GetPeriodLogs(const char* _log_path, int _begin_hour, int _end_hour, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
+    static bool GetPeriodLogsMs(const char* _log_path, int64_t _begin_ms, int64_t _end_ms, unsigned long& _begin_pos, unsigned long& _end_pos, std::string& _err_msg);
 
 public:
+    // 当前在写的段
     PtrBuffer& GetData();
+    size_t SegmentLength() const { return segment_len_; }
     
-    void Flush(AutoBuffer& _buff);
-    bool Write(const void* _data, size_t _inputlen, AutoBuffer& _out_buff);
-    bool Write(const void* _data, size_t _length);
+    // 已封口的段和当前段按顺序拷到 _buff; 调用方保证没有并发的 FlushSegments
+    void Flush(AutoBuffer& _buff, LogBlockStat* _stat = NULL);
+    // 当前段有日志且还有空闲段时封口并换段, 在写入方的锁里调用
+    bool Seal();
+    // 调用方持有保护本对象的 _lock; 依次把已封口的段和当前段交给 _sink, 交出期间释放 _lock, 写入方继续写别的段.
+    // 多个线程同时调用时排队
+    void FlushSegments(ScopedLock& _lock, const FlushSink& _sink);
+    // _level/_timestamp_ms/_tag 用于 block 摘要和 header 里的时间范围、级别、tag;
+    // _level < 0 表示没有 XLoggerInfo, _timestamp_ms 为 0 时取当前时间
+    bool Write(const void* _data, size_t _inputlen, AutoBuffer& _out_buff, int _level = -1, int64_t _timestamp_ms = 0, const char* _tag = NULL);
+    bool Write(const void* _data, size_t _length, int _level = -1, int64_t _timestamp_ms = 0, const char* _tag = NULL);
+    // 从下一个 block 开始生效, 已经写了一半的 block 保持原来的格式
+    void SetCompress(bool _is_compress);
+    // 流水线模式, 同样从下一个 block 开始生效; 压缩线程数由 LogCompressPool 决定, 没有线程时在落盘线程上压缩
+    void SetPipeline(bool _pipeline);
+    bool IsPipeline() const { return pipeline_; }
+    // 新的 block 写 v2 header(LogCrypt::SetHeaderV2), 默认 v1; 同样从下一个 block 开始生效
+    void SetHeaderV2(bool _v2);
+    // 压缩、加密后的字节数报到 _metrics, 为 NULL 时不统计
+    void SetMetrics(class LogMetrics* _metrics) { metrics_ = _metrics; }
 
 private:
     
@@ -43,14 +135,57 @@ private:
     void __Clear();
     
     void __Fix();
+    bool __FixSegment(size_t _index);
+    void __Attach(size_t _index, size_t _length);
+    bool __IsSealed(size_t _index) const;
 
 private:
+    // 一个封口段的压缩任务, out 只由执行它的线程写, done 之后才读
+    struct PackJob {
+        const char* data;
+        size_t length;
+        AutoBuffer out;
+        bool submitted;
+        bool done;
+        bool ok;
+    };
+
+    struct Sealed {
+        size_t index;
+        size_t length;
+        LogBlockStat stat;
+        std::shared_ptr<PackJob> job;   // 流水线模式写的 block 才有
+    };
+
+    void __MakeJob(Sealed& _sealed);
+    void __Submit(const std::shared_ptr<PackJob>& _job);
+    const AutoBuffer* __WaitPacked(PackJob& _job);
+    bool __PackBlock(const char* _block, size_t _len, AutoBuffer& _out);
+
+private:
+
+    char* base_;
+    size_t segment_len_;
+    size_t segment_count_;
+    size_t active_;
+    std::deque<Sealed> sealed_;     // 等待落盘, 按写入顺序
+    Mutex mutex_flush_;
+
     PtrBuffer buff_;
     bool is_compress_;
+    bool pending_compress_;
+    LogBlockStat block_stat_;
     z_stream cstream_;
     
     class LogCrypt* log_crypt_;
     size_t remain_nocrypt_len_;
+    class LogMetrics* metrics_;
+
+    bool pipeline_;
+    bool defer_;                    // 当前 block 留给压缩线程压缩
+    Mutex mutex_pack_;
+    Condition cond_pack_;
+    size_t packing_;                // 交给压缩线程还没做完的
 
 };
 
@@ -0,0 +1,108 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_bundle.cc
+ */
+
+#include "log_bundle.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "log_file_mover.h"
+
+static const size_t kTarBlock = 512;
+
+static void __Octal(char* _field, size_t _size, uint64_t _value) {
+    // 末尾留一个 '\0'
+    snprintf(_field, _size, "%0*llo", (int)(_size - 1), (unsigned long long)_value);
+}
+
+LogBundleWriter::LogBundleWriter(int _out_fd)
+: out_fd_(_out_fd), written_(0) {}
+
+bool LogBundleWriter::__Write(const void* _data, size_t _len) {
+    const char* data = (const char*)_data;
+    size_t done = 0;
+    while (done < _len) {
+        ssize_t ret = write(out_fd_, data + done, _len - done);
+        if (0 > ret && EINTR == errno) continue;
+        if (0 >= ret) return false;
+        done += ret;
+    }
+    written_ += _len;
+    return true;
+}
+
+bool LogBundleWriter::__WriteZero(uint64_t _len) {
+    static const char kZero[kTarBlock] = {0};
+    while (0 < _len) {
+        size_t len = _len < sizeof(kZero) ? (size_t)_len : sizeof(kZero);
+        if (!__Write(kZero, len)) return false;
+        _len -= len;
+    }
+    return true;
+}
+
+bool LogBundleWriter::__WriteHeader(const std::string& _name, uint64_t _size, time_t _mtime) {
+    char header[kTarBlock];
+    memset(header, 0, sizeof(header));
+
+    // 日志文件名远短于 100 字节, 超长时保留结尾
+    std::string name = _name.size() < 100 ? _name : _name.substr(_name.size() - 99);
+    memcpy(header, name.data(), name.size());
+    __Octal(header + 100, 8, 0644);
+    __Octal(header + 108, 8, 0);
+    __Octal(header + 116, 8, 0);
+    __Octal(header + 124, 12, _size);
+    __Octal(header + 136, 12, (uint64_t)_mtime);
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    // 校验和按校验和字段为空格计算
+    memset(header + 148, ' ', 8);
+    unsigned int sum = 0;
+    for (size_t i = 0; i < sizeof(header); ++i) sum += (unsigned char)header[i];
+    snprintf(header + 148, 8, "%06o", sum);
+    header[155] = ' ';
+
+    return __Write(header, sizeof(header));
+}
+
+bool LogBundleWriter::AddBuffer(const std::string& _name, const std::string& _data, time_t _mtime) {
+    if (!__WriteHeader(_name, _data.size(), _mtime)) return false;
+    if (!__Write(_data.data(), _data.size())) return false;
+    return __WriteZero((kTarBlock - _data.size() % kTarBlock) % kTarBlock);
+}
+
+bool LogBundleWriter::AddFileRanges(const std::string& _name, int _src_fd, const std::vector<LogIndexRange>& _ranges, time_t _mtime) {
+    uint64_t size = 0;
+    for (std::vector<LogIndexRange>::const_iterator iter = _ranges.begin(); iter != _ranges.end(); ++iter) {
+        size += iter->length;
+    }
+    if (!__WriteHeader(_name, size, _mtime)) return false;
+
+    for (std::vector<LogIndexRange>::const_iterator iter = _ranges.begin(); iter != _ranges.end(); ++iter) {
+        if (!SendLogRange(_src_fd, iter->offset, iter->length, out_fd_)) return false;
+        written_ += iter->length;
+    }
+
+    return __WriteZero((kTarBlock - size % kTarBlock) % kTarBlock);
+}
+
+bool LogBundleWriter::Finish() {
+    return __WriteZero(2 * kTarBlock);
+}
@@ -0,0 +1,56 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_bundle.h
+ *
+ * 上传用的日志包, ustar 格式: 第一项是 manifest.json, 后面每个 .xlog 一项, 内容是命中的 block 区间首尾相接.
+ * 数据从日志文件直接拷到输出 fd, 不经过中间文件和 Java 堆.
+ */
+
+#ifndef LOG_BUNDLE_H_
+#define LOG_BUNDLE_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "log_index.h"
+
+class LogBundleWriter {
+  public:
+    // 只写不关闭 _out_fd
+    explicit LogBundleWriter(int _out_fd);
+
+    bool AddBuffer(const std::string& _name, const std::string& _data, time_t _mtime);
+    // _ranges 依次拷进同一项, 调用方保证区间不超出文件长度(日志文件只追加, 打开后不会变短)
+    bool AddFileRanges(const std::string& _name, int _src_fd, const std::vector<LogIndexRange>& _ranges, time_t _mtime);
+    // 写结尾的两个空块; 任何一步失败后包都不完整, 调用方丢弃输出
+    bool Finish();
+
+    uint64_t Written() const { return written_; }
+
+  private:
+    LogBundleWriter(const LogBundleWriter&);
+    LogBundleWriter& operator=(const LogBundleWriter&);
+
+    bool __WriteHeader(const std::string& _name, uint64_t _size, time_t _mtime);
+    bool __WriteZero(uint64_t _len);
+    bool __Write(const void* _data, size_t _len);
+
+  private:
+    int out_fd_;
+    uint64_t written_;
+};
+
+#endif  // LOG_BUNDLE_H_
@@ -0,0 +1,70 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_compress_pool.cc
+ */
+
+#include "log_compress_pool.h"
+
+#include <algorithm>
+
+const size_t LogCompressPool::kMaxThreads;
+const size_t LogCompressPool::kMaxPending;
+
+LogCompressPool* LogCompressPool::Singleton() {
+    static LogCompressPool* s_instance = new LogCompressPool();
+    return s_instance;
+}
+
+LogCompressPool::LogCompressPool() {}
+
+void LogCompressPool::Reserve(size_t _threads) {
+    ScopedLock lock(mutex_);
+    _threads = std::min(_threads, kMaxThreads);
+    while (threads_.size() < _threads) {
+        Thread* thread = new Thread(std::bind(&LogCompressPool::__Run, this), "log_compress");
+        thread->start();
+        threads_.push_back(thread);
+    }
+}
+
+size_t LogCompressPool::Threads() {
+    ScopedLock lock(mutex_);
+    return threads_.size();
+}
+
+bool LogCompressPool::TrySubmit(const std::function<void()>& _task) {
+    ScopedLock lock(mutex_);
+    if (threads_.empty() || kMaxPending <= tasks_.size()) return false;
+
+    tasks_.push_back(_task);
+    cond_.notifyOne(lock);
+    return true;
+}
+
+void LogCompressPool::__Run() {
+    ScopedLock lock(mutex_);
+    while (true) {
+        if (tasks_.empty()) {
+            cond_.wait(lock);
+            continue;
+        }
+
+        std::function<void()> task;
+        task.swap(tasks_.front());
+        tasks_.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
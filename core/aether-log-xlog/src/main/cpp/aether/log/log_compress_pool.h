@@ -0,0 +1,62 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_compress_pool.h
+ *
+ * 所有实例共用的压缩线程. 流水线模式下写入方只把日志拷进缓冲区, 封口的段交给这里的线程
+ * 各自用独立的 deflate 流压缩、加密, 落盘线程再按封口顺序写出(见 log_buffer.h).
+ * 队列有上限, 满了由调用方自己做, 不会无限堆积.
+ */
+
+#ifndef LOG_COMPRESS_POOL_H_
+#define LOG_COMPRESS_POOL_H_
+
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "../common/thread/condition.h"
+#include "../common/thread/lock.h"
+#include "../common/thread/thread.h"
+
+class LogCompressPool {
+  public:
+    static const size_t kMaxThreads = 8;
+    static const size_t kMaxPending = 64;
+
+    // 进程级共享实例, 不会析构
+    static LogCompressPool* Singleton();
+
+    // 线程数只增不减, 最多 kMaxThreads; 空闲的线程等在条件变量上
+    void Reserve(size_t _threads);
+    size_t Threads();
+
+    // 没有线程或者排队的任务满了返回 false, 调用方自己执行
+    bool TrySubmit(const std::function<void()>& _task);
+
+  private:
+    LogCompressPool();
+    LogCompressPool(const LogCompressPool&);
+    LogCompressPool& operator=(const LogCompressPool&);
+
+    void __Run();
+
+  private:
+    Mutex mutex_;
+    Condition cond_;
+    std::vector<Thread*> threads_;
+    std::deque<std::function<void()> > tasks_;
+};
+
+#endif  // LOG_COMPRESS_POOL_H_
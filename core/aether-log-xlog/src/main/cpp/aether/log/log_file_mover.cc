@@ -0,0 +1,317 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_file_mover.cc
+ */
+
+#include "log_file_mover.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#if defined(__linux__) || defined(__ANDROID__)
+#include <sys/sendfile.h>
+#define XLOG_HAS_SENDFILE 1
+#endif
+
+#include "log_index.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+static const size_t kCopyChunk = 16 * 1024 * 1024;
+
+// 这些错误说明当前方式不可用(老内核、跨分区、文件系统不支持), 换下一种方式
+static bool __IsUnsupported(int _err) {
+    return ENOSYS == _err || EXDEV == _err || EINVAL == _err || EOPNOTSUPP == _err || EBADF == _err || ESPIPE == _err;
+}
+
+static int __CopyFileRange(int _src_fd, off_t* _src_off, int _dst_fd, off_t* _dst_off, size_t _len) {
+#ifdef __NR_copy_file_range
+    loff_t src_off = *_src_off;
+    loff_t dst_off = *_dst_off;
+    ssize_t ret = syscall(__NR_copy_file_range, _src_fd, &src_off, _dst_fd, &dst_off, _len, 0);
+    if (0 < ret) {
+        *_src_off = (off_t)src_off;
+        *_dst_off = (off_t)dst_off;
+    }
+    return (int)(0 < ret ? 1 : (0 == ret ? 0 : -1));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int __Sendfile(int _src_fd, off_t* _src_off, int _dst_fd, off_t* _dst_off, size_t _len) {
+#ifdef XLOG_HAS_SENDFILE
+    // sendfile 写在目标的当前位置上
+    if (*_dst_off != lseek(_dst_fd, *_dst_off, SEEK_SET)) return -1;
+    ssize_t ret = sendfile(_dst_fd, _src_fd, _src_off, _len);
+    if (0 < ret) *_dst_off += ret;
+    return (int)(0 < ret ? 1 : (0 == ret ? 0 : -1));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int __ReadWrite(int _src_fd, off_t* _src_off, int _dst_fd, off_t* _dst_off, size_t _len) {
+    char buffer[64 * 1024];
+    ssize_t read_ret = pread(_src_fd, buffer, _len < sizeof(buffer) ? _len : sizeof(buffer), *_src_off);
+    if (0 >= read_ret) return (int)read_ret;
+
+    ssize_t written = 0;
+    while (written < read_ret) {
+        ssize_t ret = pwrite(_dst_fd, buffer + written, read_ret - written, *_dst_off + written);
+        if (0 > ret && EINTR == errno) continue;
+        if (0 >= ret) {
+            if (0 == ret) errno = ENOSPC;
+            return -1;
+        }
+        written += ret;
+    }
+
+    *_src_off += read_ret;
+    *_dst_off += read_ret;
+    return 1;
+}
+
+typedef int (*CopyFunc)(int, off_t*, int, off_t*, size_t);
+
+static bool __Flock(int _fd, int _op) {
+    int ret = -1;
+    do {
+        ret = flock(_fd, _op);
+    } while (-1 == ret && EINTR == errno);
+    return 0 == ret;
+}
+
+// 多进程共享模式下别的进程在 flock(目标) 里追加同一个日期文件(LogFileWriter::__WriteShared),
+// 整个拷贝和失败截断都拿着目标的锁, 长度也在锁里取, 不会覆盖或截掉别人的 block.
+// 加锁后路径换了文件(被别的进程移走)时重新打开
+static int __OpenLockedDst(const std::string& _dst, off_t& _dst_len) {
+    for (int retry = 0; retry < 2; ++retry) {
+        // 不用 O_APPEND: copy_file_range 不接受 O_APPEND 的目标, 偏移自己维护
+        int fd = ::open(_dst.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+        if (-1 == fd) return -1;
+
+        struct stat fd_st, path_st;
+        if (!__Flock(fd, LOCK_EX) || 0 != fstat(fd, &fd_st)) {
+            ::close(fd);
+            return -1;
+        }
+        if (0 == stat(_dst.c_str(), &path_st) && path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino) {
+            _dst_len = fd_st.st_size;
+            return fd;
+        }
+        ::close(fd);
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// _dst_len 带出追加前目标的长度, 即 _src 内容在目标里的起始偏移
+static bool __AppendLogFile(const std::string& _src, const std::string& _dst, TFileMoveMethod* _method, uint64_t* _dst_len) {
+    if (_method) *_method = kFileMoveNone;
+    if (_src == _dst) return false;
+
+    int src_fd = ::open(_src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == src_fd) return false;
+
+    struct stat src_st;
+    if (0 != fstat(src_fd, &src_st)) {
+        ::close(src_fd);
+        return false;
+    }
+    if (0 == src_st.st_size) {
+        ::close(src_fd);
+        return true;
+    }
+
+    off_t dst_len = 0;
+    int dst_fd = __OpenLockedDst(_dst, dst_len);
+    if (-1 == dst_fd) {
+        int err = errno;
+        ::close(src_fd);
+        errno = err;
+        return false;
+    }
+
+    static const CopyFunc kCopyFuncs[] = {&__CopyFileRange, &__Sendfile, &__ReadWrite};
+    static const TFileMoveMethod kMethods[] = {kFileMoveCopyFileRange, kFileMoveSendfile, kFileMoveReadWrite};
+
+    const off_t src_len = src_st.st_size;
+    off_t src_off = 0;
+    off_t dst_off = dst_len;
+    size_t func = 0;
+    bool ok = true;
+
+    while (src_off < src_len) {
+        int ret = kCopyFuncs[func](src_fd, &src_off, dst_fd, &dst_off, (size_t)(src_len - src_off) < kCopyChunk ? (size_t)(src_len - src_off) : kCopyChunk);
+        if (0 < ret) continue;
+        if (0 > ret && EINTR == errno) continue;
+
+        // 已经拷了一部分时从当前偏移继续, 换方式不影响结果
+        if (0 > ret && __IsUnsupported(errno) && func + 1 < sizeof(kCopyFuncs) / sizeof(kCopyFuncs[0])) {
+            ++func;
+            continue;
+        }
+
+        // 源文件变短(0)或者真正的写错误
+        ok = false;
+        break;
+    }
+
+    if (!ok || dst_off != dst_len + src_len) {
+        int err = errno;
+        if (0 != ftruncate(dst_fd, dst_len)) {
+            // 截断也失败时目标里会留下半个文件, 只能交给解码端按 magic 跳过
+        }
+        ::close(src_fd);
+        ::close(dst_fd);    // 关闭时释放锁
+        errno = err;
+        return false;
+    }
+
+    ::close(src_fd);
+    ::close(dst_fd);
+    if (_method) *_method = kMethods[func];
+    if (_dst_len) *_dst_len = (uint64_t)dst_len;
+    return true;
+}
+
+bool AppendLogFile(const std::string& _src, const std::string& _dst, TFileMoveMethod* _method) {
+    return __AppendLogFile(_src, _dst, _method, NULL);
+}
+
+// 目标已存在时失败(EEXIST), 不会覆盖别的进程刚建的同名文件. 老内核或文件系统不支持 renameat2 时用 link + unlink
+static bool __RenameNoReplace(const std::string& _src, const std::string& _dst) {
+#ifdef __NR_renameat2
+    if (0 == syscall(__NR_renameat2, AT_FDCWD, _src.c_str(), AT_FDCWD, _dst.c_str(), RENAME_NOREPLACE)) return true;
+    if (ENOSYS != errno && EINVAL != errno) return false;
+#endif
+    if (0 != link(_src.c_str(), _dst.c_str())) return false;
+    unlink(_src.c_str());
+    return true;
+}
+
+bool MoveLogFile(const std::string& _src, const std::string& _dst, TFileMoveMethod* _method) {
+    if (_method) *_method = kFileMoveNone;
+    if (_src == _dst) return false;
+
+    // 目标不存在时整体改名, 不覆盖(先 lstat 再 rename 之间别的进程可能建了同名文件);
+    // 目标已存在(EEXIST)、跨分区(EXDEV)或文件系统不支持硬链接时走拷贝
+    if (__RenameNoReplace(_src, _dst)) {
+        LogIndex::OnFileMoved(_src, _dst, 0, true);
+        if (_method) *_method = kFileMoveRename;
+        return true;
+    }
+
+    // 别的进程可能还在以共享模式追加 _src(LogFileWriter::SetShared), 拷贝到删除期间拿着它的锁,
+    // 它们拿到锁后发现文件已经不在, 会重新打开同名文件. 先锁源再锁目标, 追加方只锁一个文件
+    int lock_fd = ::open(_src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 != lock_fd) __Flock(lock_fd, LOCK_EX);
+
+    uint64_t dst_len = 0;
+    bool ok = __AppendLogFile(_src, _dst, _method, &dst_len);
+    if (ok) {
+        // 目标原来是空的, 它名下的索引是残留
+        if (0 == dst_len) unlink(LogIndex::SidecarPath(_dst).c_str());
+        LogIndex::OnFileMoved(_src, _dst, dst_len, false);
+        unlink(_src.c_str());
+    }
+
+    if (-1 != lock_fd) ::close(lock_fd);
+    return ok;
+}
+
+// 输出端不指定偏移, 写在 _out_fd 的当前位置; 管道和 socket 只能这样写
+static int __StreamCopyFileRange(int _src_fd, off_t* _src_off, int _out_fd, size_t _len) {
+#ifdef __NR_copy_file_range
+    loff_t src_off = *_src_off;
+    ssize_t ret = syscall(__NR_copy_file_range, _src_fd, &src_off, _out_fd, NULL, _len, 0);
+    if (0 < ret) *_src_off = (off_t)src_off;
+    return (int)(0 < ret ? 1 : (0 == ret ? 0 : -1));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int __StreamSendfile(int _src_fd, off_t* _src_off, int _out_fd, size_t _len) {
+#ifdef XLOG_HAS_SENDFILE
+    ssize_t ret = sendfile(_out_fd, _src_fd, _src_off, _len);
+    return (int)(0 < ret ? 1 : (0 == ret ? 0 : -1));
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int __StreamReadWrite(int _src_fd, off_t* _src_off, int _out_fd, size_t _len) {
+    char buffer[64 * 1024];
+    ssize_t read_ret = pread(_src_fd, buffer, _len < sizeof(buffer) ? _len : sizeof(buffer), *_src_off);
+    if (0 >= read_ret) return (int)read_ret;
+
+    ssize_t written = 0;
+    while (written < read_ret) {
+        ssize_t ret = write(_out_fd, buffer + written, read_ret - written);
+        if (0 > ret && EINTR == errno) continue;
+        if (0 >= ret) {
+            if (0 == ret) errno = ENOSPC;
+            return -1;
+        }
+        written += ret;
+    }
+
+    *_src_off += read_ret;
+    return 1;
+}
+
+typedef int (*StreamFunc)(int, off_t*, int, size_t);
+
+bool SendLogRange(int _src_fd, uint64_t _offset, uint64_t _length, int _out_fd, TFileMoveMethod* _method) {
+    if (_method) *_method = kFileMoveNone;
+
+    static const StreamFunc kStreamFuncs[] = {&__StreamCopyFileRange, &__StreamSendfile, &__StreamReadWrite};
+    static const TFileMoveMethod kMethods[] = {kFileMoveCopyFileRange, kFileMoveSendfile, kFileMoveReadWrite};
+
+    off_t src_off = (off_t)_offset;
+    const off_t src_end = (off_t)(_offset + _length);
+    size_t func = 0;
+
+    while (src_off < src_end) {
+        size_t len = (size_t)(src_end - src_off) < kCopyChunk ? (size_t)(src_end - src_off) : kCopyChunk;
+        int ret = kStreamFuncs[func](_src_fd, &src_off, _out_fd, len);
+        if (0 < ret) continue;
+        if (0 > ret && EINTR == errno) continue;
+
+        if (0 > ret && __IsUnsupported(errno) && func + 1 < sizeof(kStreamFuncs) / sizeof(kStreamFuncs[0])) {
+            ++func;
+            continue;
+        }
+        return false;
+    }
+
+    if (_method) *_method = kMethods[func];
+    return true;
+}
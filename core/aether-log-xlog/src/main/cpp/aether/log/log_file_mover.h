@@ -0,0 +1,46 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_file_mover.h
+ *
+ * 缓存目录的日志文件并入日志目录. 目标不存在时直接 rename(不覆盖); 跨分区或目标已存在时在内核里拷贝
+ * (copy_file_range, 其次 sendfile), 都不支持时才退回 read/write 循环. 拷贝期间持有目标的 flock,
+ * 和多进程共享模式的追加互斥; 拷贝失败截断回原长度.
+ * 导出日志包时用同样的方式把文件的一段直接写到输出 fd.
+ */
+
+#ifndef LOG_FILE_MOVER_H_
+#define LOG_FILE_MOVER_H_
+
+#include <stdint.h>
+#include <string>
+
+enum TFileMoveMethod {
+    kFileMoveNone = 0,
+    kFileMoveRename,
+    kFileMoveCopyFileRange,
+    kFileMoveSendfile,
+    kFileMoveReadWrite,
+};
+
+// 把 _src 的内容追加到 _dst 末尾, _src 保持不变
+bool AppendLogFile(const std::string& _src, const std::string& _dst, TFileMoveMethod* _method = NULL);
+
+// 追加成功后删除 _src; 能 rename 时不拷贝数据
+bool MoveLogFile(const std::string& _src, const std::string& _dst, TFileMoveMethod* _method = NULL);
+
+// 把 _src_fd 的 [_offset, _offset + _length) 写到 _out_fd 的当前位置, _out_fd 可以是文件、管道或 socket.
+// _src_fd 变短时返回 false, 已经写出的部分不回退
+bool SendLogRange(int _src_fd, uint64_t _offset, uint64_t _length, int _out_fd, TFileMoveMethod* _method = NULL);
+
+#endif  // LOG_FILE_MOVER_H_
@@ -0,0 +1,324 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_file_writer.cc
+ */
+
+#include "log_file_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "time_utils.h"
+#include "io_uring_writer.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+static const uint64_t kStatCheckInterval = 5 * 1000;   // ms
+
+LogFileWriter::LogFileWriter()
+: fd_(-1), size_(0), last_offset_(0), shared_(false), day_key_(0), day_begin_(0), day_end_(0), dev_(0), ino_(0), last_stat_tick_(0)
+, sync_policy_(kFileSyncNone), sync_interval_ms_(0), last_sync_tick_(0), dirty_(false)
+, uring_(NULL) {
+    memset(&syscalls_, 0, sizeof(syscalls_));
+}
+
+LogFileWriter::~LogFileWriter() {
+    Close();
+    delete uring_;
+}
+
+bool LogFileWriter::Open(const char* _path) {
+    Close();
+
+    int fd = -1;
+    do {
+        fd = ::open(_path, O_WRONLY | O_CREAT | O_CLOEXEC | (NULL == uring_ ? O_APPEND : 0), 0666);
+    } while (-1 == fd && EINTR == errno);
+    ++syscalls_.open;
+
+    if (-1 == fd) return false;
+
+    struct stat st;
+    ++syscalls_.stat;
+    if (0 != fstat(fd, &st)) {
+        ::close(fd);
+        return false;
+    }
+
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+
+    struct tm tm_day = tm_now;
+    tm_day.tm_hour = 0;
+    tm_day.tm_min = 0;
+    tm_day.tm_sec = 0;
+    tm_day.tm_isdst = -1;
+    day_begin_ = mktime(&tm_day);
+    tm_day = tm_now;
+    tm_day.tm_mday += 1;
+    tm_day.tm_hour = 0;
+    tm_day.tm_min = 0;
+    tm_day.tm_sec = 0;
+    tm_day.tm_isdst = -1;
+    day_end_ = mktime(&tm_day);
+    day_key_ = (1900 + tm_now.tm_year) * 10000 + (1 + tm_now.tm_mon) * 100 + tm_now.tm_mday;
+
+    fd_ = fd;
+    path_ = _path;
+    size_ = (uint64_t)st.st_size;
+    dev_ = st.st_dev;
+    ino_ = st.st_ino;
+    last_stat_tick_ = gettickcount();
+    last_sync_tick_ = last_stat_tick_;
+    dirty_ = false;
+    return true;
+}
+
+void LogFileWriter::Close() {
+    if (-1 == fd_) return;
+
+    if (dirty_ && kFileSyncNone != sync_policy_) __Sync();
+    if (NULL != uring_) uring_->Drain();
+
+    ::close(fd_);
+    fd_ = -1;
+    path_.clear();
+    size_ = 0;
+    last_offset_ = 0;
+    day_key_ = 0;
+    day_begin_ = 0;
+    day_end_ = 0;
+    dirty_ = false;
+}
+
+bool LogFileWriter::IsValid(time_t _now) {
+    if (-1 == fd_) return false;
+    if (_now < day_begin_ || _now >= day_end_) return false;
+
+    uint64_t now_tick = gettickcount();
+    if (now_tick - last_stat_tick_ < kStatCheckInterval) return true;
+    last_stat_tick_ = now_tick;
+
+    struct stat st;
+    ++syscalls_.stat;
+    if (0 != fstat(fd_, &st)) return false;
+
+    // 文件被删除(清理工具、用户清缓存)后继续写只会写进一个看不见的 inode
+    if (0 == st.st_nlink || st.st_dev != dev_ || st.st_ino != ino_) return false;
+
+    if (NULL == uring_ || 0 == uring_->Inflight()) size_ = (uint64_t)st.st_size;
+    return true;
+}
+
+bool LogFileWriter::Write(const void* _data, size_t _len) {
+    if (-1 == fd_ || NULL == _data) return false;
+    if (0 == _len) return true;
+    if (shared_ || NULL != uring_) {
+        struct iovec iov = {(void*)_data, _len};
+        return shared_ ? __WriteShared(&iov, 1, _len) : __SubmitAsync(&iov, 1);
+    }
+
+    last_offset_ = size_;
+    ssize_t ret = -1;
+    do {
+        ret = ::write(fd_, _data, _len);
+        ++syscalls_.write;
+    } while (-1 == ret && EINTR == errno);
+
+    return __Commit(ret, _len);
+}
+
+bool LogFileWriter::Writev(const struct iovec* _iov, int _iovcnt) {
+    if (-1 == fd_ || NULL == _iov || 0 >= _iovcnt) return false;
+
+    size_t total = 0;
+    for (int i = 0; i < _iovcnt; ++i) {
+        total += _iov[i].iov_len;
+    }
+    if (0 == total) return true;
+    if (shared_) return __WriteShared(_iov, _iovcnt, total);
+
+    if (NULL != uring_) return __SubmitAsync(_iov, _iovcnt);
+
+    last_offset_ = size_;
+    ssize_t ret = -1;
+    do {
+        ret = ::writev(fd_, _iov, _iovcnt);
+        ++syscalls_.write;
+    } while (-1 == ret && EINTR == errno);
+
+    return __Commit(ret, total);
+}
+
+// 加锁后路径还指向当前描述符的文件才算拿到锁; 文件被别的进程移走(改名或拷走后删除)时重新打开同名文件再加锁
+bool LogFileWriter::__LockShared() {
+    for (int retry = 0; retry < 2; ++retry) {
+        int ret = -1;
+        do {
+            ret = flock(fd_, LOCK_EX);
+        } while (-1 == ret && EINTR == errno);
+        if (-1 == ret) return false;
+
+        struct stat st;
+        ++syscalls_.stat;
+        if (0 == stat(path_.c_str(), &st) && st.st_dev == dev_ && st.st_ino == ino_) return true;
+
+        flock(fd_, LOCK_UN);
+        std::string path = path_;
+        if (!Open(path.c_str())) return false;
+    }
+    return false;
+}
+
+// 锁内文件末尾就是这次写入的位置, 写了一半时 __Commit 按 fstat 的长度截回也不会截到别的进程的数据
+bool LogFileWriter::__WriteShared(const struct iovec* _iov, int _iovcnt, size_t _total) {
+    if (!__LockShared()) return false;
+
+    off_t end = lseek(fd_, 0, SEEK_END);
+    ssize_t ret = -1;
+    if (0 <= end) {
+        size_ = (uint64_t)end;
+        last_offset_ = size_;
+        do {
+            ret = ::writev(fd_, _iov, _iovcnt);
+            ++syscalls_.write;
+        } while (-1 == ret && EINTR == errno);
+    }
+
+    bool ok = __Commit(ret, _total);
+    int err = errno;
+    flock(fd_, LOCK_UN);
+    errno = err;
+    return ok;
+}
+
+void LogFileWriter::SetSyncPolicy(TFileSyncPolicy _policy, unsigned int _interval_ms) {
+    sync_policy_ = _policy;
+    sync_interval_ms_ = _interval_ms;
+}
+
+bool LogFileWriter::EnableIoUring(unsigned int _slot_count, size_t _slot_size) {
+    if (NULL != uring_) return true;
+    if (!IoUringWriter::IsSupported()) return false;
+
+    IoUringWriter* uring = new IoUringWriter();
+    if (!uring->Init(_slot_count, _slot_size)) {
+        delete uring;
+        return false;
+    }
+
+    // 已经打开的文件去掉 O_APPEND, 否则内核忽略提交的偏移
+    if (-1 != fd_) {
+        int flags = fcntl(fd_, F_GETFL);
+        if (-1 == flags || -1 == fcntl(fd_, F_SETFL, flags & ~O_APPEND)) {
+            delete uring;
+            return false;
+        }
+    }
+
+    uring_ = uring;
+    return true;
+}
+
+uint64_t LogFileWriter::AsyncErrors() const {
+    return NULL == uring_ ? 0 : uring_->Errors();
+}
+
+// 一次写入拆成多个固定缓冲区提交, 中途失败时前面的片段已经在途.
+// 等它们完成后截回这次写入之前的长度, 不留半个 block, 下一次写入也不会和在途的片段重叠
+bool LogFileWriter::__SubmitAsync(const struct iovec* _iov, int _iovcnt) {
+    uint64_t begin = size_;
+    for (int i = 0; i < _iovcnt; ++i) {
+        ++syscalls_.write;
+        if (uring_->Write(fd_, _iov[i].iov_base, _iov[i].iov_len, size_)) {
+            size_ += _iov[i].iov_len;
+            continue;
+        }
+
+        int err = uring_->LastError();
+        uring_->Drain();
+        if (0 == ftruncate(fd_, begin)) {
+            size_ = begin;
+        } else {
+            // 截不回去就从文件末尾接着写, 半个 block 留给解码端跳过
+            struct stat st;
+            ++syscalls_.stat;
+            if (0 == fstat(fd_, &st) && (uint64_t)st.st_size > size_) size_ = (uint64_t)st.st_size;
+        }
+        errno = err;
+        return false;
+    }
+
+    last_offset_ = begin;
+    dirty_ = true;
+
+    if (kFileSyncEveryWrite == sync_policy_
+        || (kFileSyncInterval == sync_policy_ && gettickcount() - last_sync_tick_ >= sync_interval_ms_)) {
+        __Sync();
+    }
+    return true;
+}
+
+bool LogFileWriter::__Commit(ssize_t _written, size_t _expected) {
+    if (_written == (ssize_t)_expected) {
+        size_ += _expected;
+        dirty_ = true;
+
+        if (kFileSyncEveryWrite == sync_policy_) {
+            __Sync();
+        } else if (kFileSyncInterval == sync_policy_ && gettickcount() - last_sync_tick_ >= sync_interval_ms_) {
+            __Sync();
+        }
+        return true;
+    }
+
+    // 写了一半(一般是空间不足): 以当前文件长度为准截掉这次写入的部分
+    int err = 0 <= _written ? ENOSPC : errno;
+    if (0 < _written) {
+        struct stat st;
+        ++syscalls_.stat;
+        if (0 == fstat(fd_, &st) && (uint64_t)st.st_size >= (uint64_t)_written) {
+            if (0 == ftruncate(fd_, st.st_size - _written)) {
+                size_ = (uint64_t)(st.st_size - _written);
+            }
+        }
+    }
+
+    errno = err;
+    return false;
+}
+
+void LogFileWriter::__Sync() {
+    ++syscalls_.sync;
+    if (NULL != uring_ && uring_->Fdatasync(fd_)) {
+        last_sync_tick_ = gettickcount();
+        dirty_ = false;
+        return;
+    }
+
+#if defined(__APPLE__)
+    fsync(fd_);
+#else
+    fdatasync(fd_);
+#endif
+    last_sync_tick_ = gettickcount();
+    dirty_ = false;
+}
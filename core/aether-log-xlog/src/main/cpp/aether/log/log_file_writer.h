@@ -0,0 +1,115 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_file_writer.h
+ *
+ * 常驻的 O_APPEND 日志文件描述符. 打开时记录文件大小和所属日期, 之后每次落盘只有一次 write/writev,
+ * 只有跨天、文件被删除或调用方要求(超过大小上限)时才重新打开.
+ * 多个进程追加同一个文件时打开共享模式, 每次写入在 flock 里完成, block 不会被别的进程插进来.
+ * 走 io_uring 时不带 O_APPEND, 按自己记录的文件长度指定偏移.
+ */
+
+#ifndef LOG_FILE_WRITER_H_
+#define LOG_FILE_WRITER_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <ctime>
+#include <string>
+
+class IoUringWriter;
+
+enum TFileSyncPolicy {
+    kFileSyncNone = 0,      // 交给内核回写, 与原来的 fwrite 行为一致
+    kFileSyncEveryWrite,    // 每次落盘后 fdatasync
+    kFileSyncInterval,      // 距上次 fdatasync 超过 interval 才同步
+};
+
+class LogFileWriter {
+  public:
+    // 系统调用计数, 用来观察每次落盘的开销
+    struct SyscallCount {
+        uint64_t open;
+        uint64_t write;
+        uint64_t sync;
+        uint64_t stat;
+    };
+
+  public:
+    LogFileWriter();
+    ~LogFileWriter();
+
+    bool Open(const char* _path);
+    void Close();
+    bool IsOpen() const { return -1 != fd_; }
+
+    // 仍然是同一天且文件没有被删除; 删除检查按间隔做 fstat, 不是每次都查
+    bool IsValid(time_t _now);
+
+    // 失败时截断回写入前的长度, 不留半个 block
+    bool Write(const void* _data, size_t _len);
+    bool Writev(const struct iovec* _iov, int _iovcnt);
+    // 最近一次成功写入的起始位置; 共享模式下前面可能还有别的进程刚写的内容
+    uint64_t LastOffset() const { return last_offset_; }
+
+    // 共享模式: 写入前 flock, 以加锁后的文件末尾为准记录位置和截断; 文件被别的进程移走时重新打开同名文件.
+    // 共享模式下不走 io_uring
+    void SetShared(bool _shared) { shared_ = _shared; }
+    bool IsShared() const { return shared_; }
+
+    void SetSyncPolicy(TFileSyncPolicy _policy, unsigned int _interval_ms = 0);
+    // 改用 io_uring 异步提交; 内核不支持时返回 false, 继续走同步 write.
+    // 异步写失败无法回滚, 只记录在 AsyncErrors 里
+    bool EnableIoUring(unsigned int _slot_count = 4, size_t _slot_size = 256 * 1024);
+    bool IsIoUringEnabled() const { return NULL != uring_; }
+    uint64_t AsyncErrors() const;
+
+    const std::string& Path() const { return path_; }
+    uint64_t Size() const { return size_; }
+    int DayKey() const { return day_key_; }
+    const SyscallCount& Syscalls() const { return syscalls_; }
+
+  private:
+    LogFileWriter(const LogFileWriter&);
+    LogFileWriter& operator=(const LogFileWriter&);
+
+    bool __Commit(ssize_t _written, size_t _expected);
+    bool __WriteShared(const struct iovec* _iov, int _iovcnt, size_t _total);
+    bool __LockShared();
+    bool __SubmitAsync(const struct iovec* _iov, int _iovcnt);
+    void __Sync();
+
+  private:
+    int fd_;
+    std::string path_;
+    uint64_t size_;
+    uint64_t last_offset_;
+    bool shared_;
+    int day_key_;           // yyyymmdd
+    time_t day_begin_;
+    time_t day_end_;
+    dev_t dev_;
+    ino_t ino_;
+    uint64_t last_stat_tick_;
+
+    TFileSyncPolicy sync_policy_;
+    unsigned int sync_interval_ms_;
+    uint64_t last_sync_tick_;
+    bool dirty_;
+
+    IoUringWriter* uring_;
+    SyscallCount syscalls_;
+};
+
+#endif  // LOG_FILE_WRITER_H_
@@ -0,0 +1,323 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_index.cc
+ *
+ * |magic "XLIX"(char*4)|version(uint16_t)|entry size(uint16_t)|reserved(uint64_t)|entry(LogIndexEntry)*N|
+ */
+
+#include "log_index.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+const char* const LogIndex::kSuffix = ".idx";
+
+static const char kIndexMagic[4] = {'X', 'L', 'I', 'X'};
+static const uint16_t kIndexVersion = 1;
+static const size_t kIndexHeaderLen = sizeof(kIndexMagic) + sizeof(uint16_t) * 2 + sizeof(uint64_t);
+// 同步模式一条日志一个 block, 小 block 合并到这么大再写一条索引
+static const uint32_t kCoalesceLength = 16 * 1024;
+
+static bool __WriteAll(int _fd, const void* _data, size_t _len) {
+    const char* data = (const char*)_data;
+    while (0 < _len) {
+        ssize_t ret = ::write(_fd, data, _len);
+        if (0 > ret && EINTR == errno) continue;
+        if (0 >= ret) return false;
+        data += ret;
+        _len -= (size_t)ret;
+    }
+    return true;
+}
+
+// 多进程模式下几个进程追加同一个索引文件: 追加和修复都在 flock 里做, 修复时看到的半条一定是崩溃留下的
+static bool __LockSidecar(int _fd) {
+    int ret = -1;
+    do {
+        ret = flock(_fd, LOCK_EX);
+    } while (-1 == ret && EINTR == errno);
+    return 0 == ret;
+}
+
+static bool __AppendLocked(int _fd, const void* _data, size_t _len) {
+    if (!__LockSidecar(_fd)) return false;
+    bool ok = __WriteAll(_fd, _data, _len);
+    flock(_fd, LOCK_UN);
+    return ok;
+}
+
+// 加锁后检查; 空文件补上文件头, 崩溃留下的半条索引截掉
+static bool __RepairLocked(int _fd) {
+    struct stat st;
+    if (0 != fstat(_fd, &st)) return false;
+
+    if ((size_t)st.st_size < kIndexHeaderLen) {
+        char header[kIndexHeaderLen] = {0};
+        uint16_t version = kIndexVersion;
+        uint16_t entry_size = sizeof(LogIndexEntry);
+        memcpy(header, kIndexMagic, sizeof(kIndexMagic));
+        memcpy(header + sizeof(kIndexMagic), &version, sizeof(version));
+        memcpy(header + sizeof(kIndexMagic) + sizeof(version), &entry_size, sizeof(entry_size));
+
+        return 0 == ftruncate(_fd, 0) && __WriteAll(_fd, header, sizeof(header));
+    }
+
+    size_t extra = ((size_t)st.st_size - kIndexHeaderLen) % sizeof(LogIndexEntry);
+    return 0 == extra || 0 == ftruncate(_fd, st.st_size - extra);
+}
+
+// 打开(必要时创建)索引文件
+static int __OpenSidecar(const std::string& _idx_path) {
+    int fd = ::open(_idx_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (-1 == fd) return -1;
+
+    if (!__LockSidecar(fd)) {
+        ::close(fd);
+        return -1;
+    }
+    bool ok = __RepairLocked(fd);
+    flock(fd, LOCK_UN);
+
+    if (!ok) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool __ReadEntries(const std::string& _idx_path, std::vector<LogIndexEntry>& _entries) {
+    FILE* file = fopen(_idx_path.c_str(), "rb");
+    if (NULL == file) return false;
+
+    char header[kIndexHeaderLen] = {0};
+    uint16_t entry_size = 0;
+    if (kIndexHeaderLen != fread(header, 1, kIndexHeaderLen, file) || 0 != memcmp(header, kIndexMagic, sizeof(kIndexMagic))) {
+        fclose(file);
+        return false;
+    }
+    memcpy(&entry_size, header + sizeof(kIndexMagic) + sizeof(uint16_t), sizeof(entry_size));
+    if (sizeof(LogIndexEntry) != entry_size) {
+        fclose(file);
+        return false;
+    }
+
+    // 读的时候不加锁, 别的进程正在写的半条 fread 不会读出来
+    LogIndexEntry entries[256];
+    size_t count = 0;
+    while (0 < (count = fread(entries, sizeof(LogIndexEntry), sizeof(entries) / sizeof(entries[0]), file))) {
+        _entries.insert(_entries.end(), entries, entries + count);
+    }
+
+    fclose(file);
+    return true;
+}
+
+static bool __OffsetLess(const LogIndexEntry& _lhs, const LogIndexEntry& _rhs) {
+    return _lhs.offset < _rhs.offset;
+}
+
+static bool __RangeLess(const LogIndexRange& _lhs, const LogIndexRange& _rhs) {
+    return _lhs.offset < _rhs.offset;
+}
+
+std::string LogIndex::SidecarPath(const std::string& _xlog_path) {
+    return _xlog_path + kSuffix;
+}
+
+bool LogIndex::Load(const std::string& _xlog_path, std::vector<LogIndexEntry>& _entries, uint64_t* _xlog_size) {
+    _entries.clear();
+
+    struct stat st;
+    if (0 != stat(_xlog_path.c_str(), &st)) return false;
+    if (_xlog_size) *_xlog_size = (uint64_t)st.st_size;
+
+    if (!__ReadEntries(SidecarPath(_xlog_path), _entries)) return false;
+
+    // .xlog 被截断(写失败回滚)时, 超出部分的索引作废
+    std::vector<LogIndexEntry>::iterator end = std::remove_if(_entries.begin(), _entries.end(),
+        [&st](const LogIndexEntry& _entry) { return _entry.offset + _entry.length > (uint64_t)st.st_size; });
+    _entries.erase(end, _entries.end());
+
+    std::stable_sort(_entries.begin(), _entries.end(), &__OffsetLess);
+    return true;
+}
+
+bool LogIndex::FindRanges(const std::string& _xlog_path, int64_t _begin_ms, int64_t _end_ms,
+                          std::vector<LogIndexRange>& _ranges) {
+    _ranges.clear();
+
+    std::vector<LogIndexEntry> entries;
+    uint64_t xlog_size = 0;
+    if (!Load(_xlog_path, entries, &xlog_size)) return false;
+
+    // 时间不一定严格单调(改系统时间、时间未知的 block), 用前缀最大结束时间和后缀最小开始时间做二分
+    size_t count = entries.size();
+    std::vector<int64_t> max_end(count);
+    std::vector<int64_t> min_begin(count);
+    for (size_t i = 0; i < count; ++i) {
+        int64_t end = (entries[i].flags & kLogIndexFlagTimeUnknown) ? INT64_MAX : entries[i].end_ms;
+        max_end[i] = (0 == i) ? end : std::max(max_end[i - 1], end);
+    }
+    for (size_t i = count; i > 0; --i) {
+        int64_t begin = (entries[i - 1].flags & kLogIndexFlagTimeUnknown) ? INT64_MIN : entries[i - 1].begin_ms;
+        min_begin[i - 1] = (count == i) ? begin : std::min(min_begin[i], begin);
+    }
+
+    size_t lo = std::lower_bound(max_end.begin(), max_end.end(), _begin_ms) - max_end.begin();
+    size_t hi = std::upper_bound(min_begin.begin(), min_begin.end(), _end_ms) - min_begin.begin();
+
+    for (size_t i = lo; i < hi; ++i) {
+        const LogIndexEntry& entry = entries[i];
+        if (!(entry.flags & kLogIndexFlagTimeUnknown) && (entry.end_ms < _begin_ms || entry.begin_ms > _end_ms)) continue;
+
+        LogIndexRange range = {entry.offset, entry.length};
+        _ranges.push_back(range);
+    }
+
+    // 没有索引覆盖的区域时间未知, 一律返回
+    uint64_t covered = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (entries[i].offset > covered) {
+            LogIndexRange range = {covered, entries[i].offset - covered};
+            _ranges.push_back(range);
+        }
+        covered = std::max(covered, entries[i].offset + entries[i].length);
+    }
+    if (covered < xlog_size) {
+        LogIndexRange range = {covered, xlog_size - covered};
+        _ranges.push_back(range);
+    }
+
+    std::sort(_ranges.begin(), _ranges.end(), &__RangeLess);
+    std::vector<LogIndexRange> merged;
+    for (std::vector<LogIndexRange>::iterator iter = _ranges.begin(); iter != _ranges.end(); ++iter) {
+        if (!merged.empty() && merged.back().offset + merged.back().length >= iter->offset) {
+            uint64_t end = std::max(merged.back().offset + merged.back().length, iter->offset + iter->length);
+            merged.back().length = end - merged.back().offset;
+        } else {
+            merged.push_back(*iter);
+        }
+    }
+    _ranges.swap(merged);
+    return true;
+}
+
+void LogIndex::OnFileMoved(const std::string& _src, const std::string& _dst, uint64_t _dst_offset, bool _renamed) {
+    std::string src_idx = SidecarPath(_src);
+    std::string dst_idx = SidecarPath(_dst);
+
+    if (_renamed) {
+        // 目标原来不存在, 它名下的旧索引一定是残留
+        if (0 != rename(src_idx.c_str(), dst_idx.c_str())) {
+            unlink(dst_idx.c_str());
+        }
+        return;
+    }
+
+    std::vector<LogIndexEntry> entries;
+    if (!__ReadEntries(src_idx, entries)) return;
+    unlink(src_idx.c_str());
+    if (entries.empty()) return;
+
+    for (std::vector<LogIndexEntry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+        iter->offset += _dst_offset;
+    }
+
+    int fd = __OpenSidecar(dst_idx);
+    if (-1 == fd) return;
+    __AppendLocked(fd, &entries[0], entries.size() * sizeof(LogIndexEntry));
+    ::close(fd);
+}
+
+LogIndexWriter::LogIndexWriter()
+: fd_(-1), has_pending_(false) {
+    memset(&pending_, 0, sizeof(pending_));
+}
+
+LogIndexWriter::~LogIndexWriter() {
+    Close();
+}
+
+void LogIndexWriter::Append(const std::string& _xlog_path, uint64_t _offset, uint32_t _length, const LogBlockStat& _stat) {
+    if (0 == _length) return;
+
+    if (xlog_path_ != _xlog_path) {
+        Close();
+        if (!__Open(_xlog_path)) return;
+    }
+
+    uint8_t flags = _stat.time_known ? 0 : kLogIndexFlagTimeUnknown;
+    if (has_pending_ && pending_.offset + pending_.length == _offset && pending_.length < kCoalesceLength) {
+        if (0 < _stat.count) {
+            if (0 == pending_.count || _stat.begin_ms < pending_.begin_ms) pending_.begin_ms = _stat.begin_ms;
+            if (0 == pending_.count || _stat.end_ms > pending_.end_ms) pending_.end_ms = _stat.end_ms;
+        }
+        pending_.length += _length;
+        pending_.count += _stat.count;
+        pending_.level_mask |= _stat.level_mask;
+        pending_.flags |= flags;
+    } else {
+        __FlushPending();
+        memset(&pending_, 0, sizeof(pending_));
+        pending_.offset = _offset;
+        pending_.length = _length;
+        pending_.count = _stat.count;
+        pending_.begin_ms = _stat.begin_ms;
+        pending_.end_ms = _stat.end_ms;
+        pending_.seq = _stat.seq;
+        pending_.level_mask = _stat.level_mask;
+        pending_.flags = flags;
+        has_pending_ = true;
+    }
+
+    if (pending_.length >= kCoalesceLength) __FlushPending();
+}
+
+void LogIndexWriter::Flush() {
+    __FlushPending();
+}
+
+void LogIndexWriter::Close() {
+    __FlushPending();
+    if (-1 != fd_) ::close(fd_);
+    fd_ = -1;
+    xlog_path_.clear();
+}
+
+bool LogIndexWriter::__Open(const std::string& _xlog_path) {
+    fd_ = __OpenSidecar(LogIndex::SidecarPath(_xlog_path));
+    if (-1 == fd_) return false;
+
+    xlog_path_ = _xlog_path;
+    return true;
+}
+
+void LogIndexWriter::__FlushPending() {
+    if (!has_pending_) return;
+    has_pending_ = false;
+
+    // 写失败只是少一条索引, 查询时这段会当作未覆盖区域返回
+    if (-1 != fd_) __AppendLocked(fd_, &pending_, sizeof(pending_));
+}
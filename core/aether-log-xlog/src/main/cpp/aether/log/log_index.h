@@ -0,0 +1,96 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_index.h
+ *
+ * .xlog 旁边的 block 索引(xxx.xlog.idx), 每次落盘追加一条: 偏移、长度、seq、时间范围、级别和条数.
+ * 按时间取日志时二分查索引得到字节区间, 不用再从头逐个读 block 头.
+ * 索引只增不改; 没覆盖到的区域(旧文件、崩溃丢掉的尾部)查询时原样返回, 结果只会多不会少.
+ */
+
+#ifndef LOG_INDEX_H_
+#define LOG_INDEX_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "log_buffer.h"
+
+#pragma pack(push, 1)
+struct LogIndexEntry {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t count;
+    int64_t begin_ms;
+    int64_t end_ms;
+    uint16_t seq;
+    uint8_t level_mask;
+    uint8_t flags;
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+enum {
+    kLogIndexFlagTimeUnknown = 0x01,    // 时间范围未知, 查询时总是命中
+};
+
+struct LogIndexRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+class LogIndex {
+  public:
+    static const char* const kSuffix;
+
+    static std::string SidecarPath(const std::string& _xlog_path);
+
+    // 读出全部索引项, 丢弃超出 .xlog 当前长度的部分; 没有索引文件返回 false
+    static bool Load(const std::string& _xlog_path, std::vector<LogIndexEntry>& _entries, uint64_t* _xlog_size = NULL);
+
+    // [_begin_ms, _end_ms] 对应的字节区间, 相邻区间合并; 没有索引文件返回 false, 调用方退回整个文件
+    static bool FindRanges(const std::string& _xlog_path, int64_t _begin_ms, int64_t _end_ms,
+                           std::vector<LogIndexRange>& _ranges);
+
+    // .xlog 被整体改名或追加到另一个文件末尾(_dst_offset 为追加前的长度)后, 索引跟着迁移
+    static void OnFileMoved(const std::string& _src, const std::string& _dst, uint64_t _dst_offset, bool _renamed);
+};
+
+class LogIndexWriter {
+  public:
+    LogIndexWriter();
+    ~LogIndexWriter();
+
+    // _offset 是 block 在 _xlog_path 里的起始位置; 文件变了自动切换
+    void Append(const std::string& _xlog_path, uint64_t _offset, uint32_t _length, const LogBlockStat& _stat);
+    // 写出合并中的索引项, 查询前调用
+    void Flush();
+    // 写出合并中的索引项并关闭; .xlog 关闭或移动前调用
+    void Close();
+
+  private:
+    LogIndexWriter(const LogIndexWriter&);
+    LogIndexWriter& operator=(const LogIndexWriter&);
+
+    bool __Open(const std::string& _xlog_path);
+    void __FlushPending();
+
+  private:
+    int fd_;
+    std::string xlog_path_;
+    LogIndexEntry pending_;
+    bool has_pending_;
+};
+
+#endif  // LOG_INDEX_H_
@@ -0,0 +1,320 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_inventory.cc
+ */
+
+#include "log_inventory.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef __APPLE__
+#define XLOG_MTIME_NSEC(st) ((st).st_mtimespec.tv_nsec)
+#else
+#define XLOG_MTIME_NSEC(st) ((st).st_mtim.tv_nsec)
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+static const char* const kLogExt = ".xlog";
+static const char* const kPersistMagic = "xloginv1";
+
+// 目录不存在时记为 0, 和之后创建出来的目录区分开
+static void __DirMtime(const std::string& _dir, long long& _sec, long& _nsec) {
+    struct stat st;
+    _sec = 0;
+    _nsec = 0;
+    if (_dir.empty() || 0 != stat(_dir.c_str(), &st)) return;
+    _sec = (long long)st.st_mtime;
+    _nsec = (long)XLOG_MTIME_NSEC(st);
+}
+
+static bool __AllDigits(const std::string& _str, size_t _pos, size_t _len) {
+    if (0 == _len || _pos + _len > _str.size()) return false;
+    for (size_t i = _pos; i < _pos + _len; ++i) {
+        if (_str[i] < '0' || _str[i] > '9') return false;
+    }
+    return true;
+}
+
+LogInventory::LogInventory()
+: loaded_(false), shared_(false) {}
+
+void LogInventory::Init(const std::string& _logdir, const std::string& _cachedir, const std::string& _nameprefix,
+                        const std::string& _persist_path, bool _shared) {
+    ScopedLock lock(mutex_);
+    logdir_ = _logdir;
+    cachedir_ = (_cachedir == _logdir) ? std::string() : _cachedir;
+    nameprefix_ = _nameprefix;
+    persist_path_ = _persist_path;
+    shared_ = _shared;
+    loaded_ = false;
+    entries_.clear();
+}
+
+int LogInventory::DayOf(time_t _time) {
+    struct tm tm;
+    localtime_r(&_time, &tm);
+    return (1900 + tm.tm_year) * 10000 + (1 + tm.tm_mon) * 100 + tm.tm_mday;
+}
+
+// 只认 prefix_YYYYMMDD.xlog 和 prefix_YYYYMMDD_N.xlog; 前缀更长的其他模块(prefix_xxx_...)不会误认
+bool LogInventory::__Parse(const std::string& _dir, const std::string& _filename, Entry& _entry) const {
+    size_t prefix_len = nameprefix_.size() + 1;
+    size_t ext_len = strlen(kLogExt);
+    if (_filename.size() < prefix_len + 8 + ext_len) return false;
+    if (0 != _filename.compare(0, nameprefix_.size(), nameprefix_) || '_' != _filename[nameprefix_.size()]) return false;
+    if (0 != _filename.compare(_filename.size() - ext_len, ext_len, kLogExt)) return false;
+    if (!__AllDigits(_filename, prefix_len, 8)) return false;
+
+    size_t rest = prefix_len + 8;
+    size_t rest_len = _filename.size() - ext_len - rest;
+    long index = 0;
+    if (0 < rest_len) {
+        if ('_' != _filename[rest] || !__AllDigits(_filename, rest + 1, rest_len - 1)) return false;
+        index = atol(_filename.c_str() + rest + 1);
+    }
+
+    _entry.path = _dir + "/" + _filename;
+    _entry.day = atoi(_filename.substr(prefix_len, 8).c_str());
+    _entry.index = index;
+    _entry.is_cache = !cachedir_.empty() && _dir == cachedir_;
+    _entry.size = 0;
+    _entry.mtime = 0;
+    return true;
+}
+
+bool LogInventory::__ParsePath(const std::string& _path, Entry& _entry) const {
+    size_t slash = _path.rfind('/');
+    if (std::string::npos == slash) return false;
+
+    std::string dir = _path.substr(0, slash);
+    if (dir != logdir_ && (cachedir_.empty() || dir != cachedir_)) return false;
+    return __Parse(dir, _path.substr(slash + 1), _entry);
+}
+
+void LogInventory::__ScanDir(const std::string& _dir) {
+    if (_dir.empty()) return;
+
+    DIR* dir = opendir(_dir.c_str());
+    if (NULL == dir) return;
+
+    struct dirent* item = NULL;
+    while (NULL != (item = readdir(dir))) {
+        Entry entry;
+        // 先按文件名过滤, 只 stat 本实例的日志文件
+        if (!__Parse(_dir, item->d_name, entry)) continue;
+
+        struct stat st;
+        if (0 != stat(entry.path.c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+        entry.size = (uint64_t)st.st_size;
+        entry.mtime = st.st_mtime;
+        entries_[entry.path] = entry;
+    }
+    closedir(dir);
+}
+
+void LogInventory::__EnsureLoaded() {
+    if (loaded_) return;
+    loaded_ = true;
+
+    entries_.clear();
+    if (__Load()) return;
+
+    __ScanDir(logdir_);
+    __ScanDir(cachedir_);
+    __Save();
+}
+
+// 格式: 首行 magic, 两个目录的 mtime 和条数; 每行一个文件 "size mtime is_cache filename"; 末行 "end".
+// 目录里增删文件都会改变目录 mtime, 对不上就重新列目录
+bool LogInventory::__Load() {
+    if (persist_path_.empty()) return false;
+
+    FILE* file = fopen(persist_path_.c_str(), "rb");
+    if (NULL == file) return false;
+
+    char magic[16] = {0};
+    long long log_sec = 0;
+    long log_nsec = 0;
+    long long cache_sec = 0;
+    long cache_nsec = 0;
+    unsigned long count = 0;
+    bool ok = 6 == fscanf(file, "%15s %lld %ld %lld %ld %lu\n", magic, &log_sec, &log_nsec, &cache_sec, &cache_nsec, &count)
+              && 0 == strcmp(magic, kPersistMagic);
+
+    long long sec = 0;
+    long nsec = 0;
+    __DirMtime(logdir_, sec, nsec);
+    ok = ok && sec == log_sec && nsec == log_nsec;
+    __DirMtime(cachedir_, sec, nsec);
+    ok = ok && sec == cache_sec && nsec == cache_nsec;
+
+    std::map<std::string, Entry> entries;
+    char line[1024];
+    for (unsigned long i = 0; ok && i < count; ++i) {
+        unsigned long long size = 0;
+        long long mtime = 0;
+        int is_cache = 0;
+        char filename[512] = {0};
+        Entry entry;
+        ok = NULL != fgets(line, sizeof(line), file)
+             && 4 == sscanf(line, "%llu %lld %d %511s", &size, &mtime, &is_cache, filename)
+             && __Parse(is_cache ? cachedir_ : logdir_, filename, entry);
+        if (!ok) break;
+
+        entry.size = (uint64_t)size;
+        entry.mtime = (time_t)mtime;
+        entries[entry.path] = entry;
+    }
+    // 写了一半的文件没有结尾
+    ok = ok && NULL != fgets(line, sizeof(line), file) && 0 == strcmp(line, "end\n");
+    fclose(file);
+    if (!ok) return false;
+
+    // 追加写不改变目录 mtime, 最近一天的文件可能在上次保存后又写过, 重新取大小
+    int last_day = 0;
+    for (std::map<std::string, Entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+        if (iter->second.day > last_day) last_day = iter->second.day;
+    }
+    for (std::map<std::string, Entry>::iterator iter = entries.begin(); iter != entries.end();) {
+        struct stat st;
+        if (iter->second.day != last_day) {
+            ++iter;
+        } else if (0 == stat(iter->first.c_str(), &st)) {
+            iter->second.size = (uint64_t)st.st_size;
+            iter->second.mtime = st.st_mtime;
+            ++iter;
+        } else {
+            entries.erase(iter++);
+        }
+    }
+
+    entries_.swap(entries);
+    return true;
+}
+
+// 原地覆盖而不是写临时文件再改名: 持久化文件可能就在日志目录里, 改名会改变目录 mtime
+void LogInventory::__Save() {
+    if (persist_path_.empty()) return;
+
+    int fd = ::open(persist_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (-1 == fd) return;
+
+    long long log_sec = 0;
+    long log_nsec = 0;
+    long long cache_sec = 0;
+    long cache_nsec = 0;
+    __DirMtime(logdir_, log_sec, log_nsec);
+    __DirMtime(cachedir_, cache_sec, cache_nsec);
+
+    std::string content;
+    char line[1024];
+    snprintf(line, sizeof(line), "%s %lld %ld %lld %ld %lu\n", kPersistMagic, log_sec, log_nsec, cache_sec, cache_nsec,
+             (unsigned long)entries_.size());
+    content += line;
+    for (std::map<std::string, Entry>::iterator iter = entries_.begin(); iter != entries_.end(); ++iter) {
+        const Entry& entry = iter->second;
+        snprintf(line, sizeof(line), "%llu %lld %d %s\n", (unsigned long long)entry.size, (long long)entry.mtime,
+                 entry.is_cache ? 1 : 0, entry.path.c_str() + entry.path.rfind('/') + 1);
+        content += line;
+    }
+    content += "end\n";
+
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t ret = write(fd, content.data() + written, content.size() - written);
+        if (0 > ret && EINTR == errno) continue;
+        if (0 >= ret) break;
+        written += ret;
+    }
+    ::close(fd);
+}
+
+void LogInventory::List(int _day_begin, int _day_end, std::vector<Entry>& _entries) {
+    ScopedLock lock(mutex_);
+    if (shared_) {
+        loaded_ = false;
+        entries_.clear();
+    }
+    __EnsureLoaded();
+
+    for (std::map<std::string, Entry>::iterator iter = entries_.begin(); iter != entries_.end(); ++iter) {
+        if (iter->second.day >= _day_begin && iter->second.day <= _day_end) _entries.push_back(iter->second);
+    }
+}
+
+void LogInventory::OnWritten(const std::string& _path, uint64_t _size) {
+    ScopedLock lock(mutex_);
+    __EnsureLoaded();
+
+    std::map<std::string, Entry>::iterator iter = entries_.find(_path);
+    if (entries_.end() == iter) {
+        Entry entry;
+        if (!__ParsePath(_path, entry)) return;
+        iter = entries_.insert(std::make_pair(_path, entry)).first;
+    }
+    iter->second.size = _size;
+    iter->second.mtime = time(NULL);
+}
+
+void LogInventory::OnMoved(const std::string& _src, const std::string& _dst) {
+    ScopedLock lock(mutex_);
+    __EnsureLoaded();
+
+    uint64_t moved_size = 0;
+    time_t moved_mtime = 0;
+    std::map<std::string, Entry>::iterator src = entries_.find(_src);
+    if (entries_.end() != src) {
+        moved_size = src->second.size;
+        moved_mtime = src->second.mtime;
+        entries_.erase(src);
+    }
+
+    // 目标已存在时是追加
+    std::map<std::string, Entry>::iterator dst = entries_.find(_dst);
+    if (entries_.end() == dst) {
+        Entry entry;
+        if (!__ParsePath(_dst, entry)) return;
+        dst = entries_.insert(std::make_pair(_dst, entry)).first;
+    }
+    dst->second.size += moved_size;
+    if (moved_mtime > dst->second.mtime) dst->second.mtime = moved_mtime;
+}
+
+void LogInventory::OnRemoved(const std::string& _path) {
+    ScopedLock lock(mutex_);
+    entries_.erase(_path);
+}
+
+void LogInventory::Invalidate() {
+    ScopedLock lock(mutex_);
+    loaded_ = false;
+    entries_.clear();
+    // 持久化的清单同样不可信
+    if (!persist_path_.empty()) unlink(persist_path_.c_str());
+}
+
+void LogInventory::Save() {
+    ScopedLock lock(mutex_);
+    if (loaded_) __Save();
+}
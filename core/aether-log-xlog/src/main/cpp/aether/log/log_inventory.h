@@ -0,0 +1,87 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_inventory.h
+ *
+ * 一个实例的日志文件清单. 第一次用到时日志目录和缓存目录各列一次, 文件名解析成(日期, 序号, 所在目录);
+ * 之后由 appender 报告创建/写入/移动、由清理线程报告删除, 查询时不再列目录和 stat.
+ * 可以存到磁盘, 重启时两个目录的 mtime 都没变就直接加载.
+ */
+
+#ifndef LOG_INVENTORY_H_
+#define LOG_INVENTORY_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../common/thread/lock.h"
+
+class LogInventory {
+  public:
+    struct Entry {
+        std::string path;
+        int day;            // 文件名里的日期, YYYYMMDD
+        long index;         // prefix_YYYYMMDD.xlog 是 0 号, prefix_YYYYMMDD_N.xlog 是 N 号
+        bool is_cache;
+        uint64_t size;
+        time_t mtime;
+    };
+
+    LogInventory();
+
+    // _persist_path 为空时不持久化; _shared 表示别的进程也在这些目录里写同一个前缀的文件, 每次查询都重新列目录
+    void Init(const std::string& _logdir, const std::string& _cachedir, const std::string& _nameprefix,
+              const std::string& _persist_path, bool _shared = false);
+
+    // 文件名日期在 [_day_begin, _day_end] 内的文件, 按路径排序
+    void List(int _day_begin, int _day_end, std::vector<Entry>& _entries);
+
+    // 不是本实例日志文件的路径忽略
+    void OnWritten(const std::string& _path, uint64_t _size);
+    void OnMoved(const std::string& _src, const std::string& _dst);
+    void OnRemoved(const std::string& _path);
+
+    // 目录被外部改动过, 下次查询重新列目录
+    void Invalidate();
+    // 关闭实例时调用
+    void Save();
+
+    // 本地时间的 YYYYMMDD, 和文件名里的日期一致
+    static int DayOf(time_t _time);
+
+  private:
+    LogInventory(const LogInventory&);
+    LogInventory& operator=(const LogInventory&);
+
+    bool __Parse(const std::string& _dir, const std::string& _filename, Entry& _entry) const;
+    bool __ParsePath(const std::string& _path, Entry& _entry) const;
+    void __EnsureLoaded();
+    void __ScanDir(const std::string& _dir);
+    bool __Load();
+    void __Save();
+
+  private:
+    Mutex mutex_;
+    std::string logdir_;
+    std::string cachedir_;
+    std::string nameprefix_;
+    std::string persist_path_;
+    bool loaded_;
+    bool shared_;
+    std::map<std::string, Entry> entries_;
+};
+
+#endif  // LOG_INVENTORY_H_
@@ -0,0 +1,202 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_metrics.cc
+ */
+
+#include "log_metrics.h"
+
+#include <cstdio>
+#include <ctime>
+
+static const char* const kDropReasonNames[kLogDropReasonCount] = {"closed", "level", "buffer_full", "no_memory"};
+static const char* const kLevelNames[LogMetricsSnapshot::kLevelCount] = {"verbose", "debug", "info", "warn", "error", "fatal", "none"};
+
+static int __HighestBit(uint64_t _value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(_value);
+#else
+    int bit = 0;
+    while (_value >>= 1) ++bit;
+    return bit;
+#endif
+}
+
+LatencyHistogram::LatencyHistogram()
+: sum_(0), max_(0) {
+    for (int i = 0; i < kBucketCount; ++i) buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+// 小于 kSubBuckets 的值一个值一个桶; 之后最高位为 n 的区间 [2^n, 2^(n+1)) 均分成 kSubBuckets 个桶
+int LatencyHistogram::BucketOf(uint64_t _value) {
+    if (_value < (uint64_t)kSubBuckets) return (int)_value;
+
+    int bit = __HighestBit(_value);
+    if (bit >= kMaxBits) return kBucketCount - 1;
+
+    int shift = bit - kSubBucketBits;
+    return (shift + 1) * kSubBuckets + (int)((_value >> shift) & (kSubBuckets - 1));
+}
+
+uint64_t LatencyHistogram::BucketUpper(int _index) {
+    if (_index < kSubBuckets) return (uint64_t)_index;
+
+    int shift = _index / kSubBuckets - 1;
+    uint64_t lower = (uint64_t)(kSubBuckets + _index % kSubBuckets) << shift;
+    return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t _value) {
+    buckets_[BucketOf(_value)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(_value, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (_value > max && !max_.compare_exchange_weak(max, _value, std::memory_order_relaxed)) {}
+}
+
+void LatencyHistogram::GetSnapshot(Snapshot& _snapshot) const {
+    _snapshot.count = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        _snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        _snapshot.count += _snapshot.buckets[i];
+    }
+    // count 按桶累加, 和桶对得上, 分位数不会越界
+    _snapshot.sum = sum_.load(std::memory_order_relaxed);
+    _snapshot.max = max_.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::Snapshot::Percentile(double _percent) const {
+    if (0 == count) return 0;
+
+    uint64_t rank = (uint64_t)(_percent / 100.0 * count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = BucketUpper(i);
+            return upper < max ? upper : max;
+        }
+    }
+    return max;
+}
+
+LogMetrics::LogMetrics()
+: records_in_(0), bytes_in_(0), bytes_compressed_(0), bytes_encrypted_(0)
+, flush_count_(0), flush_bytes_(0), lock_contended_(0), buffer_fill_(0), buffer_capacity_(0) {
+    for (int i = 0; i < kLogDropReasonCount; ++i) drops_by_reason_[i].store(0, std::memory_order_relaxed);
+    for (int i = 0; i < LogMetricsSnapshot::kLevelCount; ++i) drops_by_level_[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t LogMetrics::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void LogMetrics::OnDrop(TLogDropReason _reason, int _level) {
+    if (0 > _level || _level >= LogMetricsSnapshot::kLevelCount) _level = LogMetricsSnapshot::kLevelCount - 1;
+    drops_by_reason_[_reason].fetch_add(1, std::memory_order_relaxed);
+    drops_by_level_[_level].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LogMetrics::OnFlush(size_t _bytes, uint64_t _latency_us) {
+    flush_count_.fetch_add(1, std::memory_order_relaxed);
+    flush_bytes_.fetch_add(_bytes, std::memory_order_relaxed);
+    flush_latency_us_.Record(_latency_us);
+}
+
+void LogMetrics::OnLockWait(bool _contended, uint64_t _wait_us) {
+    if (_contended) lock_contended_.fetch_add(1, std::memory_order_relaxed);
+    lock_wait_us_.Record(_wait_us);
+}
+
+void LogMetrics::GetSnapshot(LogMetricsSnapshot& _snapshot) const {
+    _snapshot.records_in = records_in_.load(std::memory_order_relaxed);
+    _snapshot.bytes_in = bytes_in_.load(std::memory_order_relaxed);
+    _snapshot.bytes_compressed = bytes_compressed_.load(std::memory_order_relaxed);
+    _snapshot.bytes_encrypted = bytes_encrypted_.load(std::memory_order_relaxed);
+    for (int i = 0; i < kLogDropReasonCount; ++i) _snapshot.drops_by_reason[i] = drops_by_reason_[i].load(std::memory_order_relaxed);
+    for (int i = 0; i < LogMetricsSnapshot::kLevelCount; ++i) _snapshot.drops_by_level[i] = drops_by_level_[i].load(std::memory_order_relaxed);
+    _snapshot.flush_count = flush_count_.load(std::memory_order_relaxed);
+    _snapshot.flush_bytes = flush_bytes_.load(std::memory_order_relaxed);
+    _snapshot.lock_contended = lock_contended_.load(std::memory_order_relaxed);
+    _snapshot.buffer_fill = buffer_fill_.load(std::memory_order_relaxed);
+    _snapshot.buffer_capacity = buffer_capacity_.load(std::memory_order_relaxed);
+    flush_latency_us_.GetSnapshot(_snapshot.flush_latency_us);
+    lock_wait_us_.GetSnapshot(_snapshot.lock_wait_us);
+}
+
+uint64_t LogMetricsSnapshot::Drops() const {
+    uint64_t drops = 0;
+    for (int i = 0; i < kLogDropReasonCount; ++i) drops += drops_by_reason[i];
+    return drops;
+}
+
+static void __AppendHistogram(std::string& _json, const char* _name, const LatencyHistogram::Snapshot& _histogram) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "\"%s\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}",
+             _name, (unsigned long long)_histogram.count, (unsigned long long)_histogram.sum,
+             (unsigned long long)_histogram.Percentile(50), (unsigned long long)_histogram.Percentile(90),
+             (unsigned long long)_histogram.Percentile(99), (unsigned long long)_histogram.max);
+    _json += buf;
+}
+
+std::string LogMetricsSnapshot::ToJson() const {
+    std::string json;
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"records_in\":%llu,\"bytes_in\":%llu,\"bytes_compressed\":%llu,\"bytes_encrypted\":%llu,"
+             "\"flush_count\":%llu,\"flush_bytes\":%llu,\"lock_contended\":%llu,\"buffer_fill\":%llu,\"buffer_capacity\":%llu,",
+             (unsigned long long)records_in, (unsigned long long)bytes_in, (unsigned long long)bytes_compressed,
+             (unsigned long long)bytes_encrypted, (unsigned long long)flush_count, (unsigned long long)flush_bytes,
+             (unsigned long long)lock_contended, (unsigned long long)buffer_fill, (unsigned long long)buffer_capacity);
+    json += buf;
+
+    json += "\"drops_by_reason\":{";
+    for (int i = 0; i < kLogDropReasonCount; ++i) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%llu", 0 == i ? "" : ",", kDropReasonNames[i], (unsigned long long)drops_by_reason[i]);
+        json += buf;
+    }
+    json += "},\"drops_by_level\":{";
+    for (int i = 0; i < kLevelCount; ++i) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%llu", 0 == i ? "" : ",", kLevelNames[i], (unsigned long long)drops_by_level[i]);
+        json += buf;
+    }
+    json += "},";
+
+    __AppendHistogram(json, "flush_latency_us", flush_latency_us);
+    json += ",";
+    __AppendHistogram(json, "lock_wait_us", lock_wait_us);
+    json += "}";
+    return json;
+}
+
+std::string LogMetricsSnapshot::Summary() const {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "xlog metrics: records:%llu, bytes in/compressed/encrypted:%llu/%llu/%llu, drops:%llu"
+             " (closed:%llu, level:%llu, buffer_full:%llu, no_memory:%llu), flush:%llu p99:%lluus max:%lluus,"
+             " lock contended:%llu p99:%lluus, buffer:%llu/%llu",
+             (unsigned long long)records_in, (unsigned long long)bytes_in, (unsigned long long)bytes_compressed,
+             (unsigned long long)bytes_encrypted, (unsigned long long)Drops(),
+             (unsigned long long)drops_by_reason[kLogDropClosed], (unsigned long long)drops_by_reason[kLogDropLevel],
+             (unsigned long long)drops_by_reason[kLogDropBufferFull], (unsigned long long)drops_by_reason[kLogDropNoMemory],
+             (unsigned long long)flush_count, (unsigned long long)flush_latency_us.Percentile(99),
+             (unsigned long long)flush_latency_us.max, (unsigned long long)lock_contended,
+             (unsigned long long)lock_wait_us.Percentile(99), (unsigned long long)buffer_fill,
+             (unsigned long long)buffer_capacity);
+    return buf;
+}
@@ -0,0 +1,141 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_metrics.h
+ *
+ * appender 的运行指标. 计数都是 relaxed 原子量, 写路径上只多几次原子加, 不加锁;
+ * 延迟用对数分桶的直方图, 每个 2 的幂区间再均分 8 个子桶, 分位数的相对误差在 1/8 以内.
+ * 快照是各计数各自的近似值, 彼此之间不保证一致.
+ */
+
+#ifndef LOG_METRICS_H_
+#define LOG_METRICS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+
+enum TLogDropReason {
+    kLogDropClosed = 0,     // 已关闭或还没打开
+    kLogDropLevel,          // 磁盘空间紧张, 按级别丢弃
+    kLogDropBufferFull,     // 缓冲区放不下, 或压缩失败
+    kLogDropNoMemory,       // 取不到格式化用的临时缓冲区
+    kLogDropReasonCount,
+};
+
+class LatencyHistogram {
+  public:
+    static const int kSubBucketBits = 3;
+    static const int kSubBuckets = 1 << kSubBucketBits;
+    static const int kMaxBits = 40;     // 2^40 微秒以上都记到最后一个桶
+    static const int kBucketCount = (kMaxBits - kSubBucketBits + 1) * kSubBuckets;
+
+    struct Snapshot {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t buckets[kBucketCount];
+
+        // _percent 取 0~100, 返回所在桶的上界(不超过 max); 没有数据时返回 0
+        uint64_t Percentile(double _percent) const;
+    };
+
+    LatencyHistogram();
+
+    void Record(uint64_t _value);
+    void GetSnapshot(Snapshot& _snapshot) const;
+
+    static int BucketOf(uint64_t _value);
+    static uint64_t BucketUpper(int _index);
+
+  private:
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+
+  private:
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+    std::atomic<uint64_t> buckets_[kBucketCount];
+};
+
+struct LogMetricsSnapshot {
+    static const int kLevelCount = 7;   // kLevelVerbose~kLevelNone, 没有 XLoggerInfo 的记在 kLevelNone
+
+    uint64_t records_in;                // 进入缓冲区的条数
+    uint64_t bytes_in;                  // 格式化后的字节数
+    uint64_t bytes_compressed;          // 压缩后的字节数, 不压缩时等于 bytes_in
+    uint64_t bytes_encrypted;           // 经过 TEA 的字节数, 不加密时为 0
+    uint64_t drops_by_reason[kLogDropReasonCount];
+    uint64_t drops_by_level[kLevelCount];
+    uint64_t flush_count;
+    uint64_t flush_bytes;               // 交给文件的字节数
+    uint64_t lock_contended;            // 写入时缓冲区锁被占用的次数
+    uint64_t buffer_fill;               // 当前段已用字节数
+    uint64_t buffer_capacity;           // 每段大小
+    LatencyHistogram::Snapshot flush_latency_us;
+    LatencyHistogram::Snapshot lock_wait_us;
+
+    uint64_t Drops() const;
+    std::string ToJson() const;
+    // 一行的摘要, 定期写进日志用
+    std::string Summary() const;
+};
+
+class LogMetrics {
+  public:
+    LogMetrics();
+
+    static uint64_t NowUs();
+
+    void OnRecord(size_t _bytes) {
+        records_in_.fetch_add(1, std::memory_order_relaxed);
+        bytes_in_.fetch_add(_bytes, std::memory_order_relaxed);
+    }
+    void OnEncoded(size_t _compressed, size_t _encrypted) {
+        bytes_compressed_.fetch_add(_compressed, std::memory_order_relaxed);
+        if (0 < _encrypted) bytes_encrypted_.fetch_add(_encrypted, std::memory_order_relaxed);
+    }
+    // _level 超出范围(没有 XLoggerInfo)的记在 kLevelNone
+    void OnDrop(TLogDropReason _reason, int _level);
+    void OnFlush(size_t _bytes, uint64_t _latency_us);
+    // 每次取缓冲区锁调用一次, 没有等锁时 _contended 为 false
+    void OnLockWait(bool _contended, uint64_t _wait_us);
+    void SetBufferFill(size_t _fill, size_t _capacity) {
+        buffer_fill_.store(_fill, std::memory_order_relaxed);
+        buffer_capacity_.store(_capacity, std::memory_order_relaxed);
+    }
+
+    void GetSnapshot(LogMetricsSnapshot& _snapshot) const;
+
+  private:
+    LogMetrics(const LogMetrics&);
+    LogMetrics& operator=(const LogMetrics&);
+
+  private:
+    std::atomic<uint64_t> records_in_;
+    std::atomic<uint64_t> bytes_in_;
+    std::atomic<uint64_t> bytes_compressed_;
+    std::atomic<uint64_t> bytes_encrypted_;
+    std::atomic<uint64_t> drops_by_reason_[kLogDropReasonCount];
+    std::atomic<uint64_t> drops_by_level_[LogMetricsSnapshot::kLevelCount];
+    std::atomic<uint64_t> flush_count_;
+    std::atomic<uint64_t> flush_bytes_;
+    std::atomic<uint64_t> lock_contended_;
+    std::atomic<uint64_t> buffer_fill_;
+    std::atomic<uint64_t> buffer_capacity_;
+    LatencyHistogram flush_latency_us_;
+    LatencyHistogram lock_wait_us_;
+};
+
+#endif  // LOG_METRICS_H_
@@ -0,0 +1,50 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_record_chunk.cc
+ */
+
+#include "log_record_chunk.h"
+
+#include <atomic>
+#include <ctime>
+#include <unistd.h>
+
+#include "../common/ptrbuffer.h"
+
+extern void log_formater_chunk(const XLoggerInfo* _info, const char* _logbody, size_t _bodylen, size_t _lead, size_t& _offset,
+                               size_t _room, PtrBuffer& _log);
+
+// 进程内递增; 起点按 pid 和时间打散, 减少重启后和上次没写完的日志撞 id
+static std::atomic<uint32_t> sg_next_id(((uint32_t)getpid() << 16) ^ (uint32_t)time(NULL));
+
+uint32_t LogRecordChunk::NextId() {
+    return sg_next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+LogRecordChunker::LogRecordChunker(const XLoggerInfo* _info, const char* _logbody)
+: info_(_info), body_(_logbody), body_len_(strnlen(_logbody, LogRecordChunk::kMaxBodyLength)), lead_(0), offset_(0)
+, id_(LogRecordChunk::NextId()), index_(0), done_(false) {
+    while (lead_ < body_len_ && '\n' == body_[lead_]) ++lead_;
+}
+
+size_t LogRecordChunker::Next(char* _buffer, size_t _len) {
+    if (done_ || _len < kBufferLength) return 0;
+
+    PtrBuffer text(_buffer + LogRecordChunk::kHeaderLen, 0, _len - LogRecordChunk::kHeaderLen);
+    log_formater_chunk(info_, body_, body_len_, lead_, offset_, LogRecordChunk::kTextLength, text);
+
+    done_ = offset_ >= body_len_;
+    LogRecordChunk::PutHeader(_buffer, id_, index_++, done_ ? LogRecordChunk::kFlagLast : 0, (uint32_t)text.Length());
+    return LogRecordChunk::kHeaderLen + text.Length();
+}
@@ -0,0 +1,113 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_record_chunk.h
+ *
+ * 超长日志分片. 正文超过 kSmallBodyLength 的日志逐片格式化到格式化缓冲区, 每片单独作为一条记录
+ * 写进 LogBuffer(压缩、加密照常), 一片总能放进一个 block, 整条日志可以跨多个 block.
+ * 短日志仍是原来的一条文本, 不带帧头.
+ *
+ * 分片帧(小端):
+ *   "\0xrc1" | u32 日志 id | u16 片序号 | u8 标志 | u32 之后的文本字节数 | 文本
+ * 第一片的文本以日志头开始, 最后一片以 '\n' 结束; 同一条日志的片之间可能夹着别的线程的日志.
+ * 解码器按 id 拼回, 在最后一片的位置输出整条.
+ */
+
+#ifndef LOG_RECORD_CHUNK_H_
+#define LOG_RECORD_CHUNK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <cstring>
+
+#include "../common/xlogger/xloggerbase.h"
+
+class LogRecordChunk {
+  public:
+    static const size_t kMagicLen = 5;
+    static const size_t kHeaderLen = kMagicLen + 4 + 2 + 1 + 4;
+    static const uint8_t kFlagLast = 0x01;
+    // 不超过时走原来的一条记录; 续行缩进最多把正文放大到 3 倍, 加上日志头仍放得进 16K 的格式化缓冲区
+    static const size_t kSmallBodyLength = 4 * 1024;
+    static const size_t kTextLength = 8 * 1024;             // 每片最多的文本
+    static const size_t kMaxBodyLength = 4 * 1024 * 1024;   // 超出的部分截掉
+
+    static const char* Magic() { return "\0xrc1"; }
+
+    // 进程内递增的 id, 附件和分片共用
+    static uint32_t NextId();
+
+    // 正文超过 kSmallBodyLength, 需要分片
+    static bool IsLarge(const char* _logbody) {
+        return NULL != _logbody && kSmallBodyLength < strnlen(_logbody, kSmallBodyLength + 1);
+    }
+
+    // 附件帧(log_attachment.h)用同样的帧头, 只是 magic 不同
+    static void PutHeader(char* _out, uint32_t _id, uint16_t _index, uint8_t _flags, uint32_t _text_len,
+                          const char* _magic = Magic()) {
+        memcpy(_out, _magic, kMagicLen);
+        __PutFixed(_out + kMagicLen, _id, 4);
+        __PutFixed(_out + kMagicLen + 4, _index, 2);
+        _out[kMagicLen + 6] = (char)_flags;
+        __PutFixed(_out + kMagicLen + 7, _text_len, 4);
+    }
+
+    // _data 以帧头开始时取出各字段, 文本可能不完整, 由调用方按 _text_len 检查
+    static bool GetHeader(const char* _data, size_t _len, uint32_t& _id, uint16_t& _index, uint8_t& _flags, uint32_t& _text_len,
+                          const char* _magic = Magic()) {
+        if (_len < kHeaderLen || 0 != memcmp(_data, _magic, kMagicLen)) return false;
+        _id = (uint32_t)__GetFixed(_data + kMagicLen, 4);
+        _index = (uint16_t)__GetFixed(_data + kMagicLen + 4, 2);
+        _flags = (uint8_t)_data[kMagicLen + 6];
+        _text_len = (uint32_t)__GetFixed(_data + kMagicLen + 7, 4);
+        return true;
+    }
+
+  private:
+    static void __PutFixed(char* _out, uint32_t _value, size_t _bytes) {
+        for (size_t i = 0; i < _bytes; ++i) _out[i] = (char)(_value >> (8 * i));
+    }
+    static uint32_t __GetFixed(const char* _data, size_t _bytes) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < _bytes; ++i) value |= (uint32_t)(uint8_t)_data[i] << (8 * i);
+        return value;
+    }
+};
+
+// 把一条超长日志切成分片帧, 写入方逐片取出写进 LogBuffer
+class LogRecordChunker {
+  public:
+    // 缓冲区至少这么长: 帧头 + 日志头 + 一片文本(含缩进) + 结尾换行
+    static const size_t kBufferLength = LogRecordChunk::kHeaderLen + 1024 + LogRecordChunk::kTextLength + 8;
+
+    LogRecordChunker(const XLoggerInfo* _info, const char* _logbody);
+
+    // 下一片格式化到 _buffer, 返回整帧的长度; 已经取完或 _len 不够时返回 0
+    size_t Next(char* _buffer, size_t _len);
+
+  private:
+    LogRecordChunker(const LogRecordChunker&);
+    LogRecordChunker& operator=(const LogRecordChunker&);
+
+  private:
+    const XLoggerInfo* info_;
+    const char* body_;
+    size_t body_len_;
+    size_t lead_;
+    size_t offset_;
+    uint32_t id_;
+    uint16_t index_;
+    bool done_;
+};
+
+#endif  // LOG_RECORD_CHUNK_H_
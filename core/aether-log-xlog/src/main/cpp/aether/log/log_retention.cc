@@ -0,0 +1,420 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_retention.cc
+ */
+
+#include "log_retention.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <boost/filesystem.hpp>
+
+#include "../common/time_utils.h"
+#include "log_index.h"
+
+#define LOG_EXT "xlog"
+
+const LogRetention::ModuleId LogRetention::kInvalidModuleId;
+
+static const uint64_t kRescanInterval = 6 * 60 * 60 * 1000;    // ms, 校正外部删除/拷入的文件
+static const uint64_t kSweepInterval = 10 * 60 * 1000;         // ms
+static const uint64_t kBatchInterval = 200;                     // ms, 两批之间让出磁盘
+static const size_t kBatchCount = 16;
+
+static void __LowerPriority() {
+#ifdef __linux__
+    // Linux 上 who 为 0 只作用于当前线程
+    setpriority(PRIO_PROCESS, 0, 10);
+#ifdef __NR_ioprio_set
+    static const int kIoprioWhoProcess = 1;
+    static const int kIoprioClassIdle = 3;
+    static const int kIoprioClassShift = 13;
+    syscall(__NR_ioprio_set, kIoprioWhoProcess, 0, kIoprioClassIdle << kIoprioClassShift);
+#endif
+#endif
+}
+
+static bool __IsDayDir(const std::string& _filename) {
+    return 8 == _filename.size() && std::string::npos == _filename.find_first_not_of("0123456789");
+}
+
+LogRetention* LogRetention::Singleton() {
+    static LogRetention* s_instance = new LogRetention();
+    return s_instance;
+}
+
+LogRetention::LogRetention()
+: thread_(std::bind(&LogRetention::__Run, this), "log_retention")
+, stop_(false), next_id_(kInvalidModuleId), global_quota_(0)
+, next_sweep_tick_(0), next_rescan_tick_(0) {
+}
+
+LogRetention::~LogRetention() {
+    ScopedLock lock(mutex_);
+    stop_ = true;
+    cond_.notifyAll(lock, true);
+    lock.unlock();
+
+    thread_.join();
+}
+
+LogRetention::ModuleId LogRetention::Register(const std::string& _nameprefix, const std::vector<std::string>& _dirs,
+                                              long _max_alive_time, uint64_t _quota_bytes, int64_t _first_sweep_ms) {
+    ScopedLock lock(mutex_);
+
+    ModuleId id = ++next_id_;
+    Module& module = modules_[id];
+    module.nameprefix = _nameprefix;
+    module.dirs = _dirs;
+    module.max_alive_time = _max_alive_time;
+    module.quota = _quota_bytes;
+    module.bytes = 0;
+
+    // 同一目录里其他模块的归属也可能变化, 整个目录重新扫
+    pending_scan_.insert(_dirs.begin(), _dirs.end());
+
+    uint64_t sweep_tick = ::gettickcount() + (uint64_t)(0 < _first_sweep_ms ? _first_sweep_ms : 0);
+    if (0 == next_sweep_tick_ || sweep_tick < next_sweep_tick_) next_sweep_tick_ = sweep_tick;
+    if (0 == next_rescan_tick_) next_rescan_tick_ = ::gettickcount() + kRescanInterval;
+
+    thread_.start();
+    cond_.notifyAll(lock, true);
+    return id;
+}
+
+void LogRetention::Unregister(ModuleId _id) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    if (modules_.end() == iter) return;
+
+    pending_scan_.insert(iter->second.dirs.begin(), iter->second.dirs.end());
+    modules_.erase(iter);
+}
+
+void LogRetention::SetMaxAliveTime(ModuleId _id, long _max_alive_time) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    if (modules_.end() == iter) return;
+
+    iter->second.max_alive_time = _max_alive_time;
+}
+
+void LogRetention::SetQuota(ModuleId _id, uint64_t _quota_bytes) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    if (modules_.end() == iter) return;
+
+    iter->second.quota = _quota_bytes;
+}
+
+void LogRetention::SetGlobalQuota(uint64_t _quota_bytes) {
+    ScopedLock lock(mutex_);
+    global_quota_ = _quota_bytes;
+}
+
+void LogRetention::SetRemovedCallback(ModuleId _id, const RemovedCallback& _callback) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    if (modules_.end() == iter) return;
+    iter->second.on_removed = _callback;
+}
+
+void LogRetention::OnFileWritten(ModuleId _id, const std::string& _path, uint64_t _size) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    if (modules_.end() == iter) return;
+
+    Module& module = iter->second;
+    if (module.active_path != _path) module.active_path = _path;
+
+    std::map<std::string, FileEntry>::iterator file = module.files.find(_path);
+    if (module.files.end() == file) {
+        FileEntry entry = {0, 0, false};
+        file = module.files.insert(std::make_pair(_path, entry)).first;
+    }
+
+    module.bytes = module.bytes - file->second.size + _size;
+    file->second.size = _size;
+    file->second.mtime = time(NULL);
+}
+
+void LogRetention::OnFileMoved(const std::string& _src, const std::string& _dst) {
+    ScopedLock lock(mutex_);
+
+    FileEntry moved = {0, 0, false};
+    for (std::map<ModuleId, Module>::iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+        std::map<std::string, FileEntry>::iterator file = iter->second.files.find(_src);
+        if (iter->second.files.end() == file) continue;
+
+        moved = file->second;
+        __EraseEntry(iter->second, _src);
+        break;
+    }
+
+    boost::filesystem::path dst(_dst);
+    ModuleId owner = __Owner(dst.parent_path().string(), dst.filename().string(), false);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(owner);
+    if (modules_.end() == iter) return;
+
+    Module& module = iter->second;
+    FileEntry& entry = module.files[_dst];
+    entry.size += moved.size;
+    entry.mtime = std::max(entry.mtime, moved.mtime);
+    module.bytes += moved.size;
+}
+
+void LogRetention::RequestSweep(int64_t _after_ms) {
+    ScopedLock lock(mutex_);
+    uint64_t sweep_tick = ::gettickcount() + (uint64_t)(0 < _after_ms ? _after_ms : 0);
+    if (sweep_tick < next_sweep_tick_) next_sweep_tick_ = sweep_tick;
+    cond_.notifyAll(lock, true);
+}
+
+uint64_t LogRetention::ModuleBytes(ModuleId _id) {
+    ScopedLock lock(mutex_);
+    std::map<ModuleId, Module>::iterator iter = modules_.find(_id);
+    return modules_.end() == iter ? 0 : iter->second.bytes;
+}
+
+uint64_t LogRetention::TotalBytes() {
+    ScopedLock lock(mutex_);
+    uint64_t total = 0;
+    for (std::map<ModuleId, Module>::iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+        total += iter->second.bytes;
+    }
+    return total;
+}
+
+void LogRetention::__Run() {
+    __LowerPriority();
+
+    ScopedLock lock(mutex_);
+    while (!stop_) {
+        uint64_t now_tick = ::gettickcount();
+
+        if (now_tick >= next_rescan_tick_) {
+            next_rescan_tick_ = now_tick + kRescanInterval;
+            for (std::map<ModuleId, Module>::iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+                pending_scan_.insert(iter->second.dirs.begin(), iter->second.dirs.end());
+            }
+        }
+
+        if (now_tick < next_sweep_tick_) {
+            uint64_t wake_tick = std::min(next_sweep_tick_, next_rescan_tick_);
+            cond_.wait(lock, (long)(wake_tick - now_tick));
+            continue;
+        }
+
+        // 清单没建好之前不删, 每次只扫一个目录
+        if (!pending_scan_.empty()) {
+            std::string dir = *pending_scan_.begin();
+            pending_scan_.erase(pending_scan_.begin());
+            lock.unlock();
+            __ScanDir(dir);
+            lock.lock();
+            continue;
+        }
+
+        std::vector<Victim> victims;
+        if (0 == __PickVictims(time(NULL), victims)) {
+            next_sweep_tick_ = now_tick + kSweepInterval;
+            continue;
+        }
+
+        lock.unlock();
+        for (std::vector<Victim>::iterator iter = victims.begin(); iter != victims.end(); ++iter) {
+            boost::system::error_code ec;
+            if (iter->is_dir) {
+                boost::filesystem::remove_all(iter->path, ec);
+            } else {
+                boost::filesystem::remove(iter->path, ec);
+                boost::filesystem::remove(LogIndex::SidecarPath(iter->path), ec);
+            }
+        }
+        lock.lock();
+
+        // 删除期间注销了的模块不再回调
+        for (std::vector<Victim>::iterator iter = victims.begin(); iter != victims.end(); ++iter) {
+            if (iter->is_dir) continue;
+            std::map<ModuleId, Module>::iterator module = modules_.find(iter->id);
+            if (modules_.end() != module && module->second.on_removed) module->second.on_removed(iter->path);
+        }
+
+        next_sweep_tick_ = ::gettickcount() + kBatchInterval;
+    }
+}
+
+// 在锁外列目录, 再一次性替换该目录下的清单
+void LogRetention::__ScanDir(const std::string& _dir) {
+    struct Found {
+        std::string filename;
+        FileEntry entry;
+    };
+    std::vector<Found> found;
+    std::vector<std::string> sidecars;
+
+    boost::system::error_code ec;
+    boost::filesystem::directory_iterator end_iter;
+    for (boost::filesystem::directory_iterator iter(_dir, ec); !ec && iter != end_iter; iter.increment(ec)) {
+        boost::system::error_code stat_ec;
+        boost::filesystem::file_status status = iter->status(stat_ec);
+        if (stat_ec) continue;
+
+        Found item;
+        item.filename = iter->path().filename().string();
+        item.entry.is_dir = boost::filesystem::is_directory(status);
+        if (item.entry.is_dir) {
+            if (!__IsDayDir(item.filename)) continue;
+            item.entry.size = 0;
+        } else {
+            if (boost::filesystem::is_regular_file(status) && iter->path().extension() == LogIndex::kSuffix) {
+                sidecars.push_back(iter->path().string());
+                continue;
+            }
+            if (!boost::filesystem::is_regular_file(status) || iter->path().extension() != "." LOG_EXT) continue;
+            item.entry.size = (uint64_t)boost::filesystem::file_size(iter->path(), stat_ec);
+            if (stat_ec) continue;
+        }
+        item.entry.mtime = boost::filesystem::last_write_time(iter->path(), stat_ec);
+        if (stat_ec) continue;
+
+        found.push_back(item);
+    }
+
+    // 对应的 .xlog 已经不在了(外部删除)的索引顺手清掉
+    for (std::vector<std::string>::iterator iter = sidecars.begin(); iter != sidecars.end(); ++iter) {
+        std::string xlog_path = iter->substr(0, iter->size() - strlen(LogIndex::kSuffix));
+        boost::system::error_code exists_ec;
+        if (!boost::filesystem::exists(xlog_path, exists_ec) && !exists_ec) {
+            boost::filesystem::remove(*iter, exists_ec);
+        }
+    }
+
+    ScopedLock lock(mutex_);
+    std::string dir_prefix = _dir + "/";
+    for (std::map<ModuleId, Module>::iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+        Module& module = iter->second;
+        std::map<std::string, FileEntry>::iterator file = module.files.lower_bound(dir_prefix);
+        while (module.files.end() != file && 0 == file->first.compare(0, dir_prefix.size(), dir_prefix)) {
+            // 正在写的文件以写入方报告的为准
+            if (file->first == module.active_path || std::string::npos != file->first.find('/', dir_prefix.size())) {
+                ++file;
+                continue;
+            }
+            module.bytes -= file->second.size;
+            module.files.erase(file++);
+        }
+    }
+
+    for (std::vector<Found>::iterator item = found.begin(); item != found.end(); ++item) {
+        std::map<ModuleId, Module>::iterator owner = modules_.find(__Owner(_dir, item->filename, item->entry.is_dir));
+        if (modules_.end() == owner) continue;
+
+        Module& module = owner->second;
+        std::string path = dir_prefix + item->filename;
+        if (path == module.active_path && module.files.end() != module.files.find(path)) continue;
+
+        module.files[path] = item->entry;
+        module.bytes += item->entry.size;
+    }
+}
+
+// 目录相同的模块里前缀最长的一个; 按天归档的目录只归前缀为空的模块
+LogRetention::ModuleId LogRetention::__Owner(const std::string& _dir, const std::string& _filename, bool _is_dir) const {
+    ModuleId owner = kInvalidModuleId;
+    size_t owner_len = 0;
+
+    for (std::map<ModuleId, Module>::const_iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+        const Module& module = iter->second;
+        if (module.dirs.end() == std::find(module.dirs.begin(), module.dirs.end(), _dir)) continue;
+
+        if (module.nameprefix.empty()) {
+            if (kInvalidModuleId == owner) owner = iter->first;
+            continue;
+        }
+        if (_is_dir) continue;
+
+        std::string prefix = module.nameprefix + "_";
+        if (0 != _filename.compare(0, prefix.size(), prefix)) continue;
+        if (kInvalidModuleId == owner || prefix.size() > owner_len) {
+            owner = iter->first;
+            owner_len = prefix.size();
+        }
+    }
+
+    return owner;
+}
+
+// 依次选出: 超过保留时间的, 超出模块上限的最旧文件, 超出全局上限的最旧文件. 选中的立刻从清单移除
+size_t LogRetention::__PickVictims(time_t _now, std::vector<Victim>& _victims) {
+    std::vector<Victim> remains;
+    uint64_t total = 0;
+
+    for (std::map<ModuleId, Module>::iterator iter = modules_.begin(); iter != modules_.end(); ++iter) {
+        Module& module = iter->second;
+        std::vector<Victim> candidates;
+        uint64_t bytes = module.bytes;
+
+        for (std::map<std::string, FileEntry>::iterator file = module.files.begin(); file != module.files.end(); ++file) {
+            if (file->first == module.active_path) continue;
+
+            Victim victim = {iter->first, file->first, file->second.mtime, file->second.is_dir};
+            if (_now > file->second.mtime && _now - file->second.mtime > module.max_alive_time) {
+                _victims.push_back(victim);
+                bytes -= file->second.size;
+            } else if (!file->second.is_dir) {
+                candidates.push_back(victim);
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+        std::vector<Victim>::iterator candidate = candidates.begin();
+        for (; 0 < module.quota && bytes > module.quota && candidate != candidates.end(); ++candidate) {
+            _victims.push_back(*candidate);
+            bytes -= module.files[candidate->path].size;
+        }
+
+        remains.insert(remains.end(), candidate, candidates.end());
+        total += bytes;
+    }
+
+    if (0 < global_quota_ && total > global_quota_) {
+        std::sort(remains.begin(), remains.end());
+        for (std::vector<Victim>::iterator iter = remains.begin(); total > global_quota_ && iter != remains.end(); ++iter) {
+            _victims.push_back(*iter);
+            total -= modules_[iter->id].files[iter->path].size;
+        }
+    }
+
+    // 每批只删最旧的若干个, 剩下的下一批再选
+    std::sort(_victims.begin(), _victims.end());
+    if (_victims.size() > kBatchCount) _victims.resize(kBatchCount);
+
+    for (std::vector<Victim>::iterator iter = _victims.begin(); iter != _victims.end(); ++iter) {
+        __EraseEntry(modules_[iter->id], iter->path);
+    }
+    return _victims.size();
+}
+
+void LogRetention::__EraseEntry(Module& _module, const std::string& _path) {
+    std::map<std::string, FileEntry>::iterator file = _module.files.find(_path);
+    if (_module.files.end() == file) return;
+
+    _module.bytes -= file->second.size;
+    _module.files.erase(file);
+}
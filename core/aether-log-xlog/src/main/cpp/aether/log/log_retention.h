@@ -0,0 +1,120 @@
+// Tencent is pleased to support the open source community by making Mars available.
+// Copyright (C) 2016 THL A29 Limited, a Tencent company. All rights reserved.
+
+// Licensed under the MIT License (the "License"); you may not use this file except in
+// compliance with the License. You may obtain a copy of the License at
+// http://opensource.org/licenses/MIT
+
+// Unless required by applicable law or agreed to in writing, software distributed under the License is
+// distributed on an "AS IS" basis, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+// either express or implied. See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * log_retention.h
+ *
+ * 所有实例共用的日志清理. 每个模块(一个 nameprefix)有保留时间和总大小上限, 另有一个全局上限;
+ * 超时的文件先删, 超出上限时从最旧的删起. 文件清单放在内存里, 写入方报告打开/写入/移动,
+ * 只在注册和定期校正时列目录. 清理在单独的低优先级线程上分批进行, 每批只删少量文件.
+ */
+
+#ifndef LOG_RETENTION_H_
+#define LOG_RETENTION_H_
+
+#include <stdint.h>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../common/thread/condition.h"
+#include "../common/thread/lock.h"
+#include "../common/thread/thread.h"
+
+class LogRetention {
+  public:
+    typedef uint64_t ModuleId;
+    static const ModuleId kInvalidModuleId = 0;
+    // 删除一个日志文件后在清理线程上回调, 持有清理的锁, 回调里不能再调用 LogRetention
+    typedef std::function<void(const std::string&)> RemovedCallback;
+
+    // 进程级共享实例, 不会析构
+    static LogRetention* Singleton();
+
+    // _nameprefix 为空时认领目录里其他模块不认领的所有日志文件和按天归档的目录;
+    // 同一目录下多个模块按最长前缀归属. _quota_bytes 为 0 表示不限大小.
+    // 首次清理在 _first_sweep_ms 之后, 避开启动阶段
+    ModuleId Register(const std::string& _nameprefix, const std::vector<std::string>& _dirs,
+                      long _max_alive_time, uint64_t _quota_bytes, int64_t _first_sweep_ms = 2 * 60 * 1000);
+    void Unregister(ModuleId _id);
+
+    void SetMaxAliveTime(ModuleId _id, long _max_alive_time);
+    void SetQuota(ModuleId _id, uint64_t _quota_bytes);
+    void SetGlobalQuota(uint64_t _quota_bytes);
+    void SetRemovedCallback(ModuleId _id, const RemovedCallback& _callback);
+
+    // 正在写的文件, 不会被删除; 每次落盘后调用, 只更新内存
+    void OnFileWritten(ModuleId _id, const std::string& _path, uint64_t _size);
+    void OnFileMoved(const std::string& _src, const std::string& _dst);
+
+    void RequestSweep(int64_t _after_ms = 0);
+
+    uint64_t ModuleBytes(ModuleId _id);
+    uint64_t TotalBytes();
+
+  private:
+    struct FileEntry {
+        uint64_t size;
+        time_t mtime;
+        bool is_dir;
+    };
+
+    struct Module {
+        std::string nameprefix;
+        std::vector<std::string> dirs;
+        long max_alive_time;
+        uint64_t quota;
+        std::string active_path;
+        uint64_t bytes;
+        std::map<std::string, FileEntry> files;
+        RemovedCallback on_removed;
+    };
+
+    struct Victim {
+        ModuleId id;
+        std::string path;
+        time_t mtime;
+        bool is_dir;
+        bool operator<(const Victim& _other) const { return mtime < _other.mtime; }
+    };
+
+    LogRetention();
+    ~LogRetention();
+    LogRetention(const LogRetention&);
+    LogRetention& operator=(const LogRetention&);
+
+    void __Run();
+    void __ScanDir(const std::string& _dir);
+    ModuleId __Owner(const std::string& _dir, const std::string& _filename, bool _is_dir) const;
+    size_t __PickVictims(time_t _now, std::vector<Victim>& _victims);
+    void __EraseEntry(Module& _module, const std::string& _path);
+    void __StartThread();
+
+  private:
+    Mutex mutex_;
+    Condition cond_;
+    Thread thread_;
+    bool stop_;
+
+    ModuleId next_id_;
+    std::map<ModuleId, Module> modules_;
+    uint64_t global_quota_;
+
+    std::set<std::string> pending_scan_;
+    uint64_t next_sweep_tick_;
+    uint64_t next_rescan_tick_;
+};
+
+#endif  // LOG_RETENTION_H_
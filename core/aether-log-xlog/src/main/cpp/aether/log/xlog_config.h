@@ -15,6 +15,8 @@
 
 #include <string>
 #include "appender.h"
+#include "log_file_writer.h"
+#include "disk_monitor.h"
 
 namespace aether {
 namespace xlog {
@@ -27,6 +29,19 @@ struct XLogConfig {
     bool is_compress_ = true;
     std::string cachedir_;
     int cache_days_ = 0;
+    uint64_t max_total_size_ = 0;           // 该模块日志文件总大小上限, 0 表示不限
+    TFileSyncPolicy sync_policy_ = kFileSyncNone;
+    unsigned int sync_interval_ms_ = 0;     // kFileSyncInterval 时有效
+    bool use_io_uring_ = false;             // 内核不支持时自动退回同步 write
+    unsigned int buffer_size_ = 150 * 1024; // 每段 mmap 缓冲区大小, 按写入速率调整
+    unsigned int buffer_segments_ = 1;      // 大于 1 时一段落盘, 其他段继续接收写入
+    unsigned int compress_threads_ = 0;     // 大于 0 时流水线压缩: 写入方只拷贝, 封口的段交给共用的压缩线程, 段数至少加到线程数 + 1
+    bool persist_inventory_ = true;         // 文件清单存到 <缓存目录>/<nameprefix>.inventory, 重启后免列目录
+    bool fast_open_ = false;                // 异步模式下只映射缓冲区就返回, 建目录、恢复和头部信息交给异步线程
+    unsigned int metrics_interval_s_ = 0;   // 异步模式下每隔这么多秒往日志里写一行指标摘要, 0 表示不写
+    std::string process_name_;              // 非空时是多进程模式: mmap 按进程区分, 共用的日志文件加锁追加
+    bool block_header_v2_ = false;          // 写 v2 block header(毫秒时间、pid、级别/tag 摘要, 查询时按 header 跳过 block); 上游 Mars 的解码器读不了
+    DiskPressureConfig disk_pressure_;
 };
 
 }  // namespace xlog
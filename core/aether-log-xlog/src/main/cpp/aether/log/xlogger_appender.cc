@@ -12,18 +12,30 @@
 
 #include "xlogger_appender.h"
 #include "appender.h"
+#include "log_file_mover.h"
+#include "log_bundle.h"
+#include "log_record_chunk.h"
+#include "log_attachment.h"
+#include "log_compress_pool.h"
 #include "../common/thread/thread.h"
 #include "../common/thread/lock.h"
+#include "../common/thread/timer_wheel.h"
 #include "../common/autobuffer.h"
 #include "../common/ptrbuffer.h"
 #include "../common/xlogger/xloggerbase.h"
+#include "../common/xlogger/xlogger_threadcontext.h"
 #include "../common/time_utils.h"
 #include "../common/strutil.h"
 #include "../common/mmap_util.h"
 #include "../common/tickcount.h"
+#include <cinttypes>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <memory>
 #include <algorithm>
@@ -37,14 +49,38 @@ extern void ConsoleLog(const XLoggerInfo* _info, const char* _log);
 namespace aether {
 namespace xlog {
 
-static const unsigned int kBufferBlockLength = 150 * 1024;
+// 每段至少放得下几条最长的日志; 段数再多收益不大, 只是多占 mmap
+static const unsigned int kMinBufferSize = 64 * 1024;
+static const unsigned int kMaxBufferSize = 8 * 1024 * 1024;
+static const unsigned int kMaxBufferSegments = 16;
+
+// 写进 block 摘要的时间, 没有 XLoggerInfo 时取当前时间
+static int64_t __TimestampMs(const XLoggerInfo* _info) {
+    struct timeval tv;
+    if (_info) {
+        tv = _info->timeval;
+    } else {
+        gettimeofday(&tv, NULL);
+    }
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static XloggerAppender::LogFileInfo __ToFileInfo(const LogInventory::Entry& _entry) {
+    XloggerAppender::LogFileInfo info;
+    info.path = _entry.path;
+    info.size = (long)_entry.size;
+    info.mtime = _entry.mtime;
+    info.is_cache = _entry.is_cache;
+    return info;
+}
 
 XloggerAppender* XloggerAppender::NewInstance(const XLogConfig& _config, uint64_t _max_byte_size) {
     return new XloggerAppender(_config, _max_byte_size);
 }
 
 void XloggerAppender::DelayRelease(XloggerAppender* _appender) {
-    Thread(std::bind(&XloggerAppender::__Release, _appender)).start_after(5000);
+    // Close 要等异步线程退出并落盘, 不能占着时间轮的驱动线程
+    TimerWheel::Singleton()->ScheduleBlocking(5000, std::bind(&XloggerAppender::__Release, _appender));
 }
 
 void XloggerAppender::__Release(XloggerAppender* _appender) {
@@ -58,42 +94,146 @@ XloggerAppender::XloggerAppender(const XLogConfig& _config, uint64_t _max_byte_s
     : config_(_config)
     , log_close_(true)
     , max_file_size_(_max_byte_size) {
-    // Initialize file cache
-    file_cache_.cache_time = 0;
-    file_cache_.valid = false;
-    
-    // Initialize based on config
-    boost::filesystem::create_directories(config_.logdir_);
-    if (!config_.cachedir_.empty()) {
-        boost::filesystem::create_directories(config_.cachedir_);
-    }
+    tickcount_t tick;
+    tick.gettickcount();
+
+    // 同步模式每条日志都直接落盘, 快速打开没有意义
+    bool fast_open = config_.fast_open_ && config_.mode_ == kAppednerAsync;
+    if (!fast_open) __MakeLogDirs();
     
     // Open mmap file or create buffer
-    char mmap_file_path[512] = {0};
+    config_.buffer_size_ = std::min(std::max(config_.buffer_size_, kMinBufferSize), kMaxBufferSize);
+    config_.buffer_segments_ = std::min(std::max(config_.buffer_segments_, 1u), kMaxBufferSegments);
+    // 流水线压缩时段数至少比压缩线程多一个, 压缩线程各压一段时写入方还有段可写
+    config_.compress_threads_ = std::min(config_.compress_threads_, (unsigned int)LogCompressPool::kMaxThreads);
+    if (0 < config_.compress_threads_) {
+        LogCompressPool::Singleton()->Reserve(config_.compress_threads_);
+        config_.buffer_segments_ = std::max(config_.buffer_segments_, std::min(config_.compress_threads_ + 1, kMaxBufferSegments));
+    }
+    size_t buffer_len = (size_t)config_.buffer_size_ * config_.buffer_segments_;
     std::string cache_dir = config_.cachedir_.empty() ? config_.logdir_ : config_.cachedir_;
-    snprintf(mmap_file_path, sizeof(mmap_file_path), "%s/%s.mmap3", cache_dir.c_str(), config_.nameprefix_.c_str());
+    std::string mmap_prefix = LogBuffer::MmapPrefix(config_.nameprefix_, config_.process_name_);
+    std::string mmap_file_path = LogBuffer::MmapPath(cache_dir, mmap_prefix, config_.buffer_segments_);
+    
+    // 多进程模式下别的进程也在写这些文件, 清单不持久化, 每次查询重新列目录
+    bool shared = !config_.process_name_.empty();
+    std::string inventory_path;
+    if (config_.persist_inventory_ && !shared) inventory_path = cache_dir + "/" + config_.nameprefix_ + ".inventory";
+    inventory_.Init(config_.logdir_, config_.cachedir_, config_.nameprefix_, inventory_path, shared);
+    logfile_.SetShared(shared);
+    
+    // 快速打开只有首次启动、mmap 所在目录还不存在时才同步建目录
+    if (fast_open && !boost::filesystem::exists(cache_dir)) boost::filesystem::create_directories(cache_dir);
+    
+    // 另一个进程用着同一个前缀(或同一个进程名)时不碰它的 mmap, 这次只用堆内存
+    bool own_mmap = LogBuffer::LockMmap(cache_dir, mmap_prefix, mmap_lock_);
+    bool use_mmap = own_mmap && OpenMmapFile(mmap_file_path.c_str(), (unsigned int)buffer_len, mmap_file_);
+    if (use_mmap) {
+        log_buff_ = new LogBuffer(mmap_file_.data(), buffer_len, config_.is_compress_, config_.pub_key_.c_str(), config_.buffer_segments_);
+    } else {
+        char* buffer = new char[buffer_len];
+        log_buff_ = new LogBuffer(buffer, buffer_len, config_.is_compress_, config_.pub_key_.c_str(), config_.buffer_segments_);
+    }
+    log_buff_->SetMetrics(&metrics_);
+    log_buff_->SetPipeline(0 < config_.compress_threads_);
+    log_buff_->SetHeaderV2(config_.block_header_v2_);
+    metrics_.SetBufferFill(log_buff_->GetData().Length(), log_buff_->SegmentLength());
+    metrics_summary_us_ = LogMetrics::NowUs();
+    
+    if (config_.use_io_uring_) {
+        logfile_.EnableIoUring();
+    }
     
-    bool use_mmap = false;
-    if (OpenMmapFile(mmap_file_path, kBufferBlockLength, mmap_file_)) {
-        log_buff_ = new LogBuffer(mmap_file_.data(), kBufferBlockLength, config_.is_compress_, config_.pub_key_.c_str());
-        use_mmap = true;
+    // 缓冲区大小或段数改过时, 按旧布局留下的 mmap 文件先取出日志再删除.
+    // 比当前 mmap 里恢复的日志旧, 在异步线程第一次落盘前写
+    std::function<void()> recover_stale = [this, cache_dir, mmap_prefix, mmap_file_path, buffer_len, own_mmap]() {
+        if (!own_mmap) return;
+        AutoBuffer recovered;
+        LogBlockStat recovered_stat;
+        LogBuffer::RecoverStaleMmap(cache_dir, mmap_prefix, mmap_file_path, buffer_len, recovered, &recovered_stat);
+        if (recovered.Ptr()) {
+            __Log2File(recovered.Ptr(), recovered.Length(), false, &recovered_stat);
+        }
+    };
+    
+    std::vector<std::string> dirs;
+    dirs.push_back(config_.logdir_);
+    if (!config_.cachedir_.empty()) dirs.push_back(config_.cachedir_);
+    std::function<void()> start_disk_monitor = [this, dirs]() {
+        disk_monitor_.Start(dirs, config_.disk_pressure_,
+                            std::bind(&XloggerAppender::__OnDiskPressure, this,
+                                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+    };
+    
+    if (fast_open) {
+        // 建目录、恢复和磁盘探测由异步线程在第一次落盘前做, 这期间的写入照常进缓冲区
+        open_pending_ = true;
+        open_deferred_.push_back([this, recover_stale, start_disk_monitor]() {
+            __MakeLogDirs();
+            recover_stale();
+            start_disk_monitor();
+        });
     } else {
-        char* buffer = new char[kBufferBlockLength];
-        log_buff_ = new LogBuffer(buffer, kBufferBlockLength, config_.is_compress_, config_.pub_key_.c_str());
-        use_mmap = false;
+        recover_stale();
     }
     
+    // 先置为打开, 异步线程一启动就可能写头部信息
+    log_close_ = false;
+    
     // Start async thread if needed
     if (config_.mode_ == kAppednerAsync) {
         thread_async_.reset(new Thread(std::bind(&XloggerAppender::__AsyncLogThread, this)));
         thread_async_->start();
     }
     
-    log_close_ = false;
+    retention_id_ = LogRetention::Singleton()->Register(config_.nameprefix_, dirs, max_alive_time_, config_.max_total_size_);
+    LogRetention::Singleton()->SetRemovedCallback(retention_id_, std::bind(&LogInventory::OnRemoved, &inventory_, std::placeholders::_1));
+    if (!fast_open) start_disk_monitor();
+    
+    open_time_ = tickcount_t().gettickcount() - tick;
+}
+
+void XloggerAppender::RunAfterOpen(const std::function<void()>& _task) {
+    ScopedLock lock(mutex_buffer_async_);
+    if (open_pending_) {
+        open_deferred_.push_back(_task);
+        return;
+    }
+    lock.unlock();
+    _task();
+}
+
+// 只执行一次; 异步线程还没来得及做就关闭时由关闭的线程做, 正在做时关闭要等它做完
+void XloggerAppender::__RunOpenDeferred() {
+    ScopedLock lock_run(mutex_open_deferred_);
+    ScopedLock lock(mutex_buffer_async_);
+    while (!open_deferred_.empty()) {
+        std::vector<std::function<void()> > tasks;
+        tasks.swap(open_deferred_);
+        lock.unlock();
+        for (size_t i = 0; i < tasks.size(); ++i) tasks[i]();
+        lock.lock();
+    }
+    open_pending_ = false;
+}
+
+void XloggerAppender::__MakeLogDirs() {
+    boost::filesystem::create_directories(config_.logdir_);
+    if (!config_.cachedir_.empty()) {
+        boost::filesystem::create_directories(config_.cachedir_);
+    }
 }
 
 void XloggerAppender::Write(const XLoggerInfo* _info, const char* _log) {
-    if (log_close_) return;
+    if (log_close_) {
+        metrics_.OnDrop(kLogDropClosed, _info ? _info->level : -1);
+        return;
+    }
+    // 磁盘空间紧张时按监控给出的级别丢弃, 这里不做空间检查
+    if (_info && _info->level < disk_monitor_.MinLevel()) {
+        metrics_.OnDrop(kLogDropLevel, _info->level);
+        return;
+    }
     
     if (consolelog_open_) {
         ConsoleLog(_info, _log);
@@ -107,62 +247,279 @@ void XloggerAppender::Write(const XLoggerInfo* _info, const char* _log) {
 }
 
 void XloggerAppender::__WriteSync(const XLoggerInfo* _info, const char* _log) {
-    char temp[16 * 1024] = {0};
-    PtrBuffer log_buff(temp, 0, sizeof(temp));
+    if (LogRecordChunk::IsLarge(_log)) {
+        __WriteChunksSync(_info, _log);
+        return;
+    }
+
+    int level = _info ? _info->level : -1;
+    aether::comm::XloggerScratchBuffer temp;
+    if (temp.Ptr() == nullptr) {
+        metrics_.OnDrop(kLogDropNoMemory, level);
+        return;
+    }
+
+    PtrBuffer log_buff(temp.Ptr(), 0, temp.Length());
     log_formater(_info, _log, log_buff);
     
+    const char* tag = _info ? _info->tag : NULL;
+    int64_t timestamp_ms = __TimestampMs(_info);
     AutoBuffer tmp_buff;
-    if (!log_buff_->Write(log_buff.Ptr(), log_buff.Length(), tmp_buff)) {
+    if (!log_buff_->Write(log_buff.Ptr(), log_buff.Length(), tmp_buff, level, timestamp_ms, tag)) {
+        metrics_.OnDrop(kLogDropBufferFull, level);
         return;
     }
+    metrics_.OnRecord(log_buff.Length());
     
-    __Log2File(tmp_buff.Ptr(), tmp_buff.Length(), false);
+    LogBlockStat stat;
+    stat.Add(level, timestamp_ms, tag);
+    __Flush2File(tmp_buff.Ptr(), tmp_buff.Length(), false, &stat);
 }
 
 void XloggerAppender::__WriteAsync(const XLoggerInfo* _info, const char* _log) {
-    ScopedLock lock(mutex_buffer_async_);
-    if (log_buff_ == nullptr) return;
+    int level = _info ? _info->level : -1;
+    // 先试一次, 拿不到时再计时等锁, 不争用时只多一次直方图计数
+    ScopedLock lock(mutex_buffer_async_, false);
+    if (lock.trylock()) {
+        metrics_.OnLockWait(false, 0);
+    } else {
+        uint64_t begin_us = LogMetrics::NowUs();
+        lock.lock();
+        metrics_.OnLockWait(true, LogMetrics::NowUs() - begin_us);
+    }
+    if (log_buff_ == nullptr) {
+        metrics_.OnDrop(kLogDropClosed, level);
+        return;
+    }
+    if (LogRecordChunk::IsLarge(_log)) {
+        __WriteChunksAsync(lock, _info, _log);
+        return;
+    }
     
-    char temp[16 * 1024] = {0};
-    PtrBuffer log_buff(temp, 0, sizeof(temp));
+    aether::comm::XloggerScratchBuffer temp;
+    if (temp.Ptr() == nullptr) {
+        metrics_.OnDrop(kLogDropNoMemory, level);
+        return;
+    }
+
+    PtrBuffer log_buff(temp.Ptr(), 0, temp.Length());
     log_formater(_info, _log, log_buff);
     
-    if (!log_buff_->Write(log_buff.Ptr(), (unsigned int)log_buff.Length())) {
+    int64_t timestamp_ms = __TimestampMs(_info);
+    const char* tag = _info ? _info->tag : NULL;
+    bool written = log_buff_->Write(log_buff.Ptr(), (unsigned int)log_buff.Length(), level, timestamp_ms, tag);
+    // 流水线模式下段都在等压缩、落盘时写入方跟着落盘, 等出空闲段再写, 不丢日志.
+    // 落盘期间放开了锁, 别的写入方可能又把段写满, 那就再来一轮; 空段都写不下时不再重试
+    while (!written && log_buff_ != nullptr && log_buff_->IsPipeline()) {
+        __FlushInline(lock);
+        if (log_buff_ == nullptr) break;
+        bool contended = 0 < log_buff_->GetData().Length();
+        written = log_buff_->Write(log_buff.Ptr(), (unsigned int)log_buff.Length(), level, timestamp_ms, tag);
+        if (!contended) break;
+    }
+    if (!written) {
+        metrics_.OnDrop(log_buff_ == nullptr ? kLogDropClosed : kLogDropBufferFull, level);
         return;
     }
+    metrics_.OnRecord(log_buff.Length());
+    metrics_.SetBufferFill(log_buff_->GetData().Length(), log_buff_->SegmentLength());
     
     // 自动刷新触发条件（性能优化）：
-    // 1. 缓冲区达到 1/3 大小（约 50KB）- 避免频繁刷新影响性能
+    // 1. 当前段达到 1/3 大小（默认约 50KB）- 避免频繁刷新影响性能
     // 2. FATAL 级别日志 - 确保严重错误立即写入
     // 注意：这是自动触发，不会因为少量日志就频繁刷新
-    if (log_buff_->GetData().Length() >= kBufferBlockLength * 1 / 3 || 
+    if (log_buff_->GetData().Length() >= log_buff_->SegmentLength() * 1 / 3 || 
         (_info && _info->level == kLevelFatal)) {
         cond_buffer_async_.notifyAll(lock);
     }
 }
 
+// 写入方就地落盘腾出段, 持有 mutex_buffer_async_, 落盘期间放开
+void XloggerAppender::__FlushInline(ScopedLock& _lock) {
+    // 快速打开时目录可能还没建, 先替异步线程做完
+    if (open_pending_) {
+        _lock.unlock();
+        __RunOpenDeferred();
+        _lock.lock();
+    }
+    if (log_buff_ == nullptr) return;
+    log_buff_->FlushSegments(_lock, [this](const void* _data, size_t _len, const LogBlockStat& _stat) {
+        __Flush2File(_data, _len, true, &_stat);
+    });
+}
+
+// 每帧单独加密成一个 block 直接落盘, 多个线程同时写时帧之间可能夹着别的日志
+bool XloggerAppender::__WriteFramesSync(const FrameSource& _next, int _level, int64_t _timestamp_ms, const char* _tag) {
+    aether::comm::XloggerScratchBuffer temp;
+    if (temp.Ptr() == nullptr) {
+        metrics_.OnDrop(kLogDropNoMemory, _level);
+        return false;
+    }
+    
+    size_t len = 0;
+    while (0 < (len = _next(temp.Ptr(), temp.Length()))) {
+        AutoBuffer tmp_buff;
+        if (!log_buff_->Write(temp.Ptr(), len, tmp_buff, _level, _timestamp_ms, _tag)) {
+            metrics_.OnDrop(kLogDropBufferFull, _level);
+            return false;
+        }
+        metrics_.OnRecord(len);
+        
+        LogBlockStat stat;
+        stat.Add(_level, _timestamp_ms, _tag);
+        __Flush2File(tmp_buff.Ptr(), tmp_buff.Length(), false, &stat);
+    }
+    return true;
+}
+
+// 逐帧压缩进缓冲区, 不在内存里攒整条. 过半时换到空闲段并叫醒异步线程落盘;
+// 没有空闲段可换、写不下时才就地落盘腾出段再写, 落盘期间放开锁, 别的线程的日志可能夹在帧之间
+bool XloggerAppender::__WriteFramesAsync(ScopedLock& _lock, const FrameSource& _next, int _level, int64_t _timestamp_ms,
+                                         const char* _tag) {
+    aether::comm::XloggerScratchBuffer temp;
+    if (temp.Ptr() == nullptr) {
+        metrics_.OnDrop(kLogDropNoMemory, _level);
+        return false;
+    }
+    
+    std::function<void()> flush = [this, &_lock]() { __FlushInline(_lock); };
+    
+    size_t len = 0;
+    while (0 < (len = _next(temp.Ptr(), temp.Length()))) {
+        // 过半就先封口换段, 封口的段交给异步线程落盘, 写入方不等 IO
+        if (log_buff_->GetData().Length() >= log_buff_->SegmentLength() / 2) {
+            log_buff_->Seal();
+            cond_buffer_async_.notifyAll(_lock);
+        }
+        bool written = log_buff_ != nullptr && log_buff_->Write(temp.Ptr(), len, _level, _timestamp_ms, _tag);
+        if (!written && log_buff_ != nullptr) {
+            flush();
+            written = log_buff_ != nullptr && log_buff_->Write(temp.Ptr(), len, _level, _timestamp_ms, _tag);
+        }
+        if (!written) {
+            metrics_.OnDrop(log_buff_ == nullptr ? kLogDropClosed : kLogDropBufferFull, _level);
+            return false;
+        }
+        metrics_.OnRecord(len);
+    }
+    metrics_.SetBufferFill(log_buff_->GetData().Length(), log_buff_->SegmentLength());
+    return true;
+}
+
+void XloggerAppender::__WriteChunksSync(const XLoggerInfo* _info, const char* _log) {
+    LogRecordChunker chunker(_info, _log);
+    __WriteFramesSync([&chunker](char* _buffer, size_t _len) { return chunker.Next(_buffer, _len); },
+                      _info ? _info->level : -1, __TimestampMs(_info), _info ? _info->tag : NULL);
+}
+
+void XloggerAppender::__WriteChunksAsync(ScopedLock& _lock, const XLoggerInfo* _info, const char* _log) {
+    int level = _info ? _info->level : -1;
+    LogRecordChunker chunker(_info, _log);
+    if (!__WriteFramesAsync(_lock, [&chunker](char* _buffer, size_t _len) { return chunker.Next(_buffer, _len); },
+                            level, __TimestampMs(_info), _info ? _info->tag : NULL)) {
+        return;
+    }
+    
+    if (log_buff_->GetData().Length() >= log_buff_->SegmentLength() * 1 / 3 || level == kLevelFatal) {
+        cond_buffer_async_.notifyAll(_lock);
+    }
+}
+
+uint32_t XloggerAppender::Attach(const char* _name, const void* _data, size_t _len) {
+    if (_data == nullptr || 0 == _len || LogAttachment::kMaxLength < _len) return 0;
+    if (log_close_) {
+        metrics_.OnDrop(kLogDropClosed, -1);
+        return 0;
+    }
+    
+    // 在锁外复制
+    LogAttachment attachment(_name, _data, _len);
+    uint32_t id = attachment.Id();
+    
+    if (config_.mode_ == kAppednerSync) {
+        return __WriteFramesSync([&attachment](char* _buffer, size_t _len) { return attachment.Next(_buffer, _len); },
+                                 -1, __TimestampMs(NULL), NULL) ? id : 0;
+    }
+    
+    ScopedLock lock(mutex_buffer_async_);
+    if (log_buff_ == nullptr) {
+        metrics_.OnDrop(kLogDropClosed, -1);
+        return 0;
+    }
+    if (!attachments_.Push(attachment)) {
+        metrics_.OnDrop(kLogDropBufferFull, -1);
+        return 0;
+    }
+    cond_buffer_async_.notifyAll(lock);
+    return id;
+}
+
+// 持有 mutex_buffer_async_; 附件的时间取写入缓冲区的时间
+void XloggerAppender::__WriteAttachments(ScopedLock& _lock) {
+    LogAttachment attachment;
+    while (log_buff_ != nullptr && attachments_.Pop(attachment)) {
+        __WriteFramesAsync(_lock, [&attachment](char* _buffer, size_t _len) { return attachment.Next(_buffer, _len); },
+                           -1, __TimestampMs(NULL), NULL);
+    }
+}
+
 void XloggerAppender::__AsyncLogThread() {
+    __RunOpenDeferred();
+    
+    long wait_ms = 15 * 60 * 1000;
+    if (0 < config_.metrics_interval_s_) wait_ms = std::min(wait_ms, (long)config_.metrics_interval_s_ * 1000);
+    
     while (true) {
+        // 摘要先进缓冲区, 随这一轮一起落盘
+        __WriteMetricsSummary();
+        
+        // 先取关闭标记, 落盘期间放开了锁, 这期间写进来的再落一轮
+        bool closing = log_close_;
         ScopedLock lock_buffer(mutex_buffer_async_);
         
         if (log_buff_ == nullptr) break;
         
-        AutoBuffer tmp;
-        log_buff_->Flush(tmp);
+        __WriteAttachments(lock_buffer);
+        if (log_buff_ == nullptr) break;
+        // 多段时落盘期间写入方在别的段上继续写
+        log_buff_->FlushSegments(lock_buffer, [this](const void* _data, size_t _len, const LogBlockStat& _stat) {
+            __Flush2File(_data, _len, true, &_stat);
+        });
+        metrics_.SetBufferFill(log_buff_->GetData().Length(), log_buff_->SegmentLength());
         lock_buffer.unlock();
         
-        if (tmp.Ptr()) {
-            __Log2File(tmp.Ptr(), tmp.Length(), true);
-        }
-        
-        if (log_close_) break;
+        if (closing) break;
         
+        // Close 在 mutex_buffer_async_ 下置标记后才通知, 持锁再看一次标记就不会错过
         ScopedLock lock_wait(mutex_buffer_async_);
-        cond_buffer_async_.wait(lock_wait, 15 * 60 * 1000);
+        if (!log_close_) cond_buffer_async_.wait(lock_wait, wait_ms);
     }
 }
 
-void XloggerAppender::__Log2File(const void* _data, size_t _len, bool _move_file) {
+// 落盘耗时包括打开/切换文件和写 .idx, 和写入方感受到的一致
+void XloggerAppender::__Flush2File(const void* _data, size_t _len, bool _move_file, const LogBlockStat* _stat) {
+    uint64_t begin_us = LogMetrics::NowUs();
+    __Log2File(_data, _len, _move_file, _stat);
+    metrics_.OnFlush(_len, LogMetrics::NowUs() - begin_us);
+}
+
+void XloggerAppender::__WriteMetricsSummary() {
+    if (0 == config_.metrics_interval_s_ || log_close_) return;
+    
+    uint64_t now_us = LogMetrics::NowUs();
+    if (now_us - metrics_summary_us_ < (uint64_t)config_.metrics_interval_s_ * 1000000) return;
+    metrics_summary_us_ = now_us;
+    
+    LogMetricsSnapshot snapshot;
+    metrics_.GetSnapshot(snapshot);
+    Write(NULL, snapshot.Summary().c_str());
+}
+
+void XloggerAppender::GetMetrics(LogMetricsSnapshot& _snapshot) const {
+    metrics_.GetSnapshot(_snapshot);
+}
+
+void XloggerAppender::__Log2File(const void* _data, size_t _len, bool _move_file, const LogBlockStat* _stat) {
     if (NULL == _data || 0 == _len || config_.logdir_.empty()) {
         return;
     }
@@ -171,62 +528,50 @@ void XloggerAppender::__Log2File(const void* _data, size_t _len, bool _move_file
     
     if (config_.cachedir_.empty()) {
         if (__OpenLogFile(config_.logdir_)) {
-            __WriteFile(_data, _len, logfile_);
-            if (config_.mode_ == kAppednerAsync) {
-                __CloseLogFile();
-            }
+            __WriteFile(_data, _len, _stat);
         }
         return;
     }
     
     struct timeval tv;
     gettimeofday(&tv, NULL);
-    char logcachefilepath[1024] = {0};
     
-    __MakeLogFileName(tv, config_.cachedir_, config_.nameprefix_.c_str(), std::string("xlog"), logcachefilepath, 1024);
+    // 文件还能继续用时沿用上次的选择, 不再每次落盘都 exists/statfs
+    if (!__IsLogFileReusable(current_dir_)) {
+        char logcachefilepath[1024] = {0};
+        __MakeLogFileName(tv, config_.cachedir_, config_.nameprefix_.c_str(), std::string("xlog"), logcachefilepath, 1024);
+        
+        cache_logs_ = __CacheLogs();
+        write_cache_ = cache_logs_ || boost::filesystem::exists(logcachefilepath);
+    }
     
-    bool cache_logs = __CacheLogs();
-    if ((cache_logs || boost::filesystem::exists(logcachefilepath)) && __OpenLogFile(config_.cachedir_)) {
-        __WriteFile(_data, _len, logfile_);
-        if (config_.mode_ == kAppednerAsync) {
-            __CloseLogFile();
-        }
+    if (write_cache_ && __OpenLogFile(config_.cachedir_)) {
+        __WriteFile(_data, _len, _stat);
         
-        if (cache_logs || !_move_file) {
+        if (cache_logs_ || !_move_file) {
             return;
         }
         
         char logfilepath[1024] = {0};
         __MakeLogFileName(tv, config_.logdir_, config_.nameprefix_.c_str(), std::string("xlog"), logfilepath, 1024);
-        // TODO: Implement __AppendFile
-        // if (__AppendFile(logcachefilepath, logfilepath)) {
-        //     if (config_.mode_ == kAppednerSync) {
-        //         __CloseLogFile();
-        //     }
-        //     boost::filesystem::remove(logcachefilepath);
-        // }
+        // 缓存文件要被移走, 先关掉常驻的描述符
+        std::string logcachefilepath = logfile_.Path();
+        __CloseLogFile();
+        if (MoveLogFile(logcachefilepath, logfilepath)) {
+            LogRetention::Singleton()->OnFileMoved(logcachefilepath, logfilepath);
+            inventory_.OnMoved(logcachefilepath, logfilepath);
+        }
         return;
     }
     
     bool write_success = false;
-    bool open_success = __OpenLogFile(config_.logdir_);
-    if (open_success) {
-        write_success = __WriteFile(_data, _len, logfile_);
-        if (config_.mode_ == kAppednerAsync) {
-            __CloseLogFile();
-        }
+    if (__OpenLogFile(config_.logdir_)) {
+        write_success = __WriteFile(_data, _len, _stat);
     }
     
     if (!write_success) {
-        if (open_success && config_.mode_ == kAppednerSync) {
-            __CloseLogFile();
-        }
-        
         if (__OpenLogFile(config_.cachedir_)) {
-            __WriteFile(_data, _len, logfile_);
-            if (config_.mode_ == kAppednerAsync) {
-                __CloseLogFile();
-            }
+            __WriteFile(_data, _len, _stat);
         }
     }
 }
@@ -234,61 +579,65 @@ void XloggerAppender::__Log2File(const void* _data, size_t _len, bool _move_file
 bool XloggerAppender::__OpenLogFile(const std::string& _log_dir) {
     if (config_.logdir_.empty()) return false;
     
+    if (__IsLogFileReusable(_log_dir)) {
+        return true;
+    }
+    __CloseLogFile();
+    
     struct timeval tv;
     gettimeofday(&tv, NULL);
     
-    if (logfile_ != nullptr) {
-        time_t sec = tv.tv_sec;
-        tm tcur = *localtime((const time_t*)&sec);
-        tm filetm = *localtime(&openfiletime_);
-        
-        if (filetm.tm_year == tcur.tm_year && filetm.tm_mon == tcur.tm_mon && 
-            filetm.tm_mday == tcur.tm_mday && current_dir_ == _log_dir) {
-            return true;
-        }
-        
-        fclose(logfile_);
-        logfile_ = nullptr;
-    }
-    
     char logfilepath[1024] = {0};
-    __MakeLogFileName(tv, _log_dir, config_.nameprefix_.c_str(), std::string("xlog"), logfilepath, 1024);
+    long index = 0;
+    __MakeLogFileName(tv, _log_dir, config_.nameprefix_.c_str(), std::string("xlog"), logfilepath, 1024, &index);
     
-    openfiletime_ = tv.tv_sec;
     current_dir_ = _log_dir;
     
-    logfile_ = fopen(logfilepath, "ab");
-    if (logfile_ == nullptr) {
+    logfile_.SetSyncPolicy(config_.sync_policy_, config_.sync_interval_ms_);
+    if (!logfile_.Open(logfilepath)) {
         // Log error
         return false;
     }
+    inventory_.OnWritten(logfile_.Path(), logfile_.Size());
+    
+    if (max_file_size_ > 0) {
+        ScopedLock lock(mutex_roll_state_);
+        roll_state_.fileprefix = __MakeLogFileNamePrefix(tv, config_.nameprefix_.c_str());
+        roll_state_.index = index;
+        roll_state_.bytes = logfile_.Size();
+    }
     
     return true;
 }
 
-void XloggerAppender::__CloseLogFile() {
-    if (logfile_ == nullptr) return;
+// 同一目录、同一天、没被删除、没超过大小上限时继续用已打开的描述符
+bool XloggerAppender::__IsLogFileReusable(const std::string& _log_dir) {
+    if (!logfile_.IsOpen() || current_dir_ != _log_dir) return false;
+    if (max_file_size_ > 0 && logfile_.Size() >= max_file_size_) return false;
     
-    openfiletime_ = 0;
-    fclose(logfile_);
-    logfile_ = nullptr;
+    return logfile_.IsValid(time(NULL));
 }
 
-bool XloggerAppender::__WriteFile(const void* _data, size_t _len, FILE* _file) {
-    if (_file == nullptr) {
+void XloggerAppender::__CloseLogFile() {
+    // 索引先于 .xlog 关闭, 文件移走前合并中的索引项要落盘
+    index_.Close();
+    logfile_.Close();
+}
+
+bool XloggerAppender::__WriteFile(const void* _data, size_t _len, const LogBlockStat* _stat) {
+    if (!logfile_.Write(_data, _len)) {
         return false;
     }
+    if (_stat) index_.Append(logfile_.Path(), logfile_.LastOffset(), (uint32_t)_len, *_stat);
+    disk_monitor_.OnBytesWritten(_len);
+    LogRetention::Singleton()->OnFileWritten(retention_id_, logfile_.Path(), logfile_.Size());
+    inventory_.OnWritten(logfile_.Path(), logfile_.Size());
     
-    long before_len = ftell(_file);
-    if (before_len < 0) return false;
-    
-    if (1 != fwrite(_data, _len, 1, _file)) {
-        int err = ferror(_file);
-        ftruncate(fileno(_file), before_len);
-        fseek(_file, 0, SEEK_END);
-        return false;
+    if (max_file_size_ > 0) {
+        // 多进程模式下文件里还有别的进程写的内容
+        ScopedLock lock(mutex_roll_state_);
+        roll_state_.bytes = std::max(roll_state_.bytes + _len, logfile_.Size());
     }
-    
     return true;
 }
 
@@ -306,17 +655,46 @@ std::string XloggerAppender::__MakeLogFileNamePrefix(const timeval& _tv, const c
 }
 
 long XloggerAppender::__GetNextFileIndex(const std::string& _fileprefix, const std::string& _fileext) {
-    // Simplified implementation - can be enhanced later
-    return 0;
+    ScopedLock lock(mutex_roll_state_);
+    if (roll_state_.fileprefix != _fileprefix) {
+        __ScanRollState(_fileprefix, _fileext);
+    }
+    
+    // 只算不改: 真正切到下一个序号是在 __OpenLogFile 打开新文件之后
+    return roll_state_.bytes >= max_file_size_ ? roll_state_.index + 1 : roll_state_.index;
+}
+
+// 找出日志目录和缓存目录里当天最大的序号, 字节数取该序号在两个目录里的文件大小之和
+void XloggerAppender::__ScanRollState(const std::string& _fileprefix, const std::string& _fileext) {
+    roll_state_.fileprefix = _fileprefix;
+    roll_state_.index = 0;
+    roll_state_.bytes = 0;
+    
+    // 前缀是 nameprefix_YYYYMMDD, 清单里文件名已经解析出日期和序号
+    if (_fileprefix.length() < 8) return;
+    int day = atoi(_fileprefix.c_str() + _fileprefix.length() - 8);
+    
+    std::vector<LogInventory::Entry> entries;
+    inventory_.List(day, day, entries);
+    for (const auto& entry : entries) {
+        if (entry.index > roll_state_.index) {
+            roll_state_.index = entry.index;
+            roll_state_.bytes = 0;
+        }
+        if (entry.index == roll_state_.index) {
+            roll_state_.bytes += entry.size;
+        }
+    }
 }
 
 void XloggerAppender::__MakeLogFileName(const timeval& _tv, const std::string& _log_dir, const char* _prefix,
-                                        const std::string& _fileext, char* _filepath, unsigned int _len) {
+                                        const std::string& _fileext, char* _filepath, unsigned int _len, long* _index) {
     long index = 0;
     std::string logfilenameprefix = __MakeLogFileNamePrefix(_tv, _prefix);
     if (max_file_size_ > 0) {
         index = __GetNextFileIndex(logfilenameprefix, _fileext);
     }
+    if (_index) *_index = index;
     
     std::string logfilepath = _log_dir;
     logfilepath += "/";
@@ -348,18 +726,50 @@ bool XloggerAppender::__CacheLogs() {
         return false;
     }
     
-    // Check available space
-    static const uintmax_t kAvailableSizeThreshold = (uintmax_t)1 * 1024 * 1024 * 1024;  // 1G
-    boost::filesystem::space_info info = boost::filesystem::space(config_.cachedir_);
-    if (info.available < kAvailableSizeThreshold) {
+    // Check available space, 用监控缓存的结果
+    static const uint64_t kAvailableSizeThreshold = (uint64_t)1 * 1024 * 1024 * 1024;  // 1G
+    uint64_t available = disk_monitor_.Available(config_.cachedir_);
+    if (DiskMonitor::kUnknownAvailable == available || available < kAvailableSizeThreshold) {
         return false;
     }
     
     return true;
 }
 
-void XloggerAppender::__DelTimeoutFile(const std::string& _log_path) {
-    // Implementation can be added later
+// 保留时间和大小上限交给共用的清理线程执行
+void XloggerAppender::__UpdateRetention() {
+    LogRetention::Singleton()->SetMaxAliveTime(retention_id_, __MaxAliveTime());
+    LogRetention::Singleton()->SetQuota(retention_id_, config_.max_total_size_);
+    LogRetention::Singleton()->RequestSweep();
+}
+
+long XloggerAppender::__MaxAliveTime() const {
+    long alive_time = max_alive_time_;
+    if (disk_monitor_.Tier() >= kDiskPressureShrinkRetention
+        && config_.disk_pressure_.shrink_alive_time_ < alive_time) {
+        alive_time = config_.disk_pressure_.shrink_alive_time_;
+    }
+    return alive_time;
+}
+
+// 一般在时间轮线程上执行, 不持有 DiskMonitor 的锁, 可以直接写日志
+void XloggerAppender::__OnDiskPressure(TDiskPressureTier _from, TDiskPressureTier _to, uint64_t _available) {
+    if (log_close_) return;
+    
+    // 没配置压缩的实例在压力下打开压缩, 恢复后再关掉
+    if (!config_.is_compress_ && (_from >= kDiskPressureCompress) != (_to >= kDiskPressureCompress)) {
+        ScopedLock lock(mutex_buffer_async_);
+        if (log_buff_) log_buff_->SetCompress(_to >= kDiskPressureCompress);
+    }
+    
+    char msg[256] = {0};
+    snprintf(msg, sizeof(msg), "disk pressure tier %d -> %d, available:%" PRIu64 " min level:%d max alive time:%ld",
+             (int)_from, (int)_to, _available, (int)disk_monitor_.MinLevel(), __MaxAliveTime());
+    Write(NULL, msg);
+    
+    if ((_from >= kDiskPressureShrinkRetention) != (_to >= kDiskPressureShrinkRetention)) {
+        __UpdateRetention();
+    }
 }
 
 void XloggerAppender::SetMode(TAppenderMode _mode) {
@@ -379,26 +789,19 @@ void XloggerAppender::FlushSync() {
     
     if (log_buff_ == nullptr) return;
     
-    // 检查缓冲区是否有数据，避免重复刷新
-    // LogBuffer::Flush() 会调用 __Clear() 清空缓冲区，所以不会重复写入
-    if (log_buff_->GetData().Length() == 0) {
-        // 缓冲区为空，说明已经刷新过了，直接返回
-        // 这样可以避免重复落盘（例如：异步线程已经刷新，或者之前已经手动刷新过）
-        return;
-    }
-    
-    AutoBuffer tmp;
-    log_buff_->Flush(tmp);  // Flush 会调用 __Clear() 清空缓冲区
-    lock_buffer.unlock();
-    
-    if (tmp.Ptr()) {
-        __Log2File(tmp.Ptr(), tmp.Length(), false);
-    }
+    __WriteAttachments(lock_buffer);
+    if (log_buff_ == nullptr) return;
+    // 和异步线程排队落盘, 交出去的数据会被清空, 不会重复写入
+    log_buff_->FlushSegments(lock_buffer, [this](const void* _data, size_t _len, const LogBlockStat& _stat) {
+        __Flush2File(_data, _len, false, &_stat);
+    });
+    metrics_.SetBufferFill(log_buff_->GetData().Length(), log_buff_->SegmentLength());
 }
 
 void XloggerAppender::Close() {
     if (log_close_) return;
     
+    __RunOpenDeferred();
     log_close_ = true;
     {
         ScopedLock lock(mutex_buffer_async_);
@@ -409,13 +812,23 @@ void XloggerAppender::Close() {
         thread_async_->join();
         thread_async_.reset();
     }
+    // 快速打开时监控可能由异步线程启动, 线程退出后再停
+    disk_monitor_.Stop();
     
     __CloseLogFile();
     
+    LogRetention::Singleton()->Unregister(retention_id_);
+    retention_id_ = LogRetention::kInvalidModuleId;
+    inventory_.Save();
+    
     if (log_buff_) {
+        // 异步线程最后一轮之后才排进来的附件
+        ScopedLock lock(mutex_buffer_async_);
+        for (size_t i = attachments_.Clear(); 0 < i; --i) metrics_.OnDrop(kLogDropClosed, -1);
         delete log_buff_;
         log_buff_ = nullptr;
     }
+    LogBuffer::UnlockMmap(mmap_lock_);
 }
 
 void XloggerAppender::SetConsoleLog(bool _is_open) {
@@ -424,10 +837,20 @@ void XloggerAppender::SetConsoleLog(bool _is_open) {
 
 void XloggerAppender::SetMaxFileSize(uint64_t _max_byte_size) {
     max_file_size_ = _max_byte_size;
+    
+    // 上限为 0 期间没有维护切分状态, 下次用到时重新扫描
+    ScopedLock lock(mutex_roll_state_);
+    roll_state_.fileprefix.clear();
 }
 
 void XloggerAppender::SetMaxAliveDuration(long _max_time) {
     max_alive_time_ = _max_time;
+    __UpdateRetention();
+}
+
+void XloggerAppender::SetMaxTotalSize(uint64_t _max_byte_size) {
+    config_.max_total_size_ = _max_byte_size;
+    __UpdateRetention();
 }
 
 void XloggerAppender::GetLogFilePaths(std::vector<std::string>& _filepaths) {
@@ -461,75 +884,24 @@ void XloggerAppender::GetLogFileInfos(std::vector<LogFileInfo>& _fileinfos) {
         return;
     }
     
-    // Check cache first (performance optimization)
-    {
-        ScopedLock lock(mutex_file_cache_);
-        if (__IsCacheValid()) {
-            _fileinfos = file_cache_.fileinfos;
-            return;  // Return cached result
-        }
-    }
-    
-    // Cache invalid or not exists, scan file system
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    // 当天日志目录和缓存目录里各自序号最大的文件, 即正在写的那个
+    int today = LogInventory::DayOf(time(NULL));
+    std::vector<LogInventory::Entry> entries;
+    inventory_.List(today, today, entries);
     
-    // Get current day's log file info
-    char logfilepath[1024] = {0};
-    if (!config_.logdir_.empty()) {
-        __MakeLogFileName(tv, config_.logdir_, config_.nameprefix_.c_str(), std::string("xlog"), logfilepath, 1024);
-        if (boost::filesystem::exists(logfilepath)) {
-            try {
-                LogFileInfo info;
-                info.path = std::string(logfilepath);
-                info.size = boost::filesystem::file_size(logfilepath);
-                info.mtime = boost::filesystem::last_write_time(logfilepath);
-                info.is_cache = false;
-                _fileinfos.push_back(info);
-            } catch (const boost::filesystem::filesystem_error&) {
-                // Skip files that can't be accessed (may have been deleted)
-                // Clear cache if file access fails (file may have been deleted)
-                {
-                    ScopedLock lock(mutex_file_cache_);
-                    file_cache_.valid = false;
-                }
-            }
-        }
+    const LogInventory::Entry* current[2] = {NULL, NULL};
+    for (const auto& entry : entries) {
+        const LogInventory::Entry*& slot = current[entry.is_cache ? 1 : 0];
+        if (NULL == slot || entry.index > slot->index) slot = &entry;
     }
-    
-    // Get cache dir log file info (if exists)
-    if (!config_.cachedir_.empty()) {
-        char cachefilepath[1024] = {0};
-        __MakeLogFileName(tv, config_.cachedir_, config_.nameprefix_.c_str(), std::string("xlog"), cachefilepath, 1024);
-        if (boost::filesystem::exists(cachefilepath)) {
-            try {
-                LogFileInfo info;
-                info.path = std::string(cachefilepath);
-                info.size = boost::filesystem::file_size(cachefilepath);
-                info.mtime = boost::filesystem::last_write_time(cachefilepath);
-                info.is_cache = true;
-                _fileinfos.push_back(info);
-            } catch (const boost::filesystem::filesystem_error&) {
-                // Skip files that can't be accessed (may have been deleted)
-                // Clear cache if file access fails (file may have been deleted)
-                {
-                    ScopedLock lock(mutex_file_cache_);
-                    file_cache_.valid = false;
-                }
-            }
-        }
+    for (int i = 0; i < 2; ++i) {
+        if (current[i]) _fileinfos.push_back(__ToFileInfo(*current[i]));
     }
     
     // Sort by modification time (newest first)
     std::sort(_fileinfos.begin(), _fileinfos.end(), [](const LogFileInfo& a, const LogFileInfo& b) {
         return a.mtime > b.mtime;
     });
-    
-    // Update cache
-    {
-        ScopedLock lock(mutex_file_cache_);
-        __UpdateCache(_fileinfos);
-    }
 }
 
 void XloggerAppender::GetLogFileInfosByDays(std::vector<LogFileInfo>& _fileinfos, int _days_ago) {
@@ -547,23 +919,8 @@ void XloggerAppender::GetLogFileInfosByDays(std::vector<LogFileInfo>& _fileinfos
         return;  // Limit to 1 year
     }
     
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    tv.tv_sec -= _days_ago * (24 * 60 * 60);
-    
-    // Get log files for the specified day
-    std::string fileprefix = __MakeLogFileNamePrefix(tv, config_.nameprefix_.c_str());
-    std::string fileext = "xlog";
-    
-    // Scan log dir
-    if (!config_.logdir_.empty()) {
-        __GetFileInfosByPrefix(config_.logdir_, fileprefix, fileext, false, _fileinfos);
-    }
-    
-    // Scan cache dir
-    if (!config_.cachedir_.empty()) {
-        __GetFileInfosByPrefix(config_.cachedir_, fileprefix, fileext, true, _fileinfos);
-    }
+    int day = LogInventory::DayOf(time(NULL) - _days_ago * (24 * 60 * 60));
+    __ListFileInfos(day, day, _fileinfos);
     
     // Sort by modification time (newest first)
     std::sort(_fileinfos.begin(), _fileinfos.end(), [](const LogFileInfo& a, const LogFileInfo& b) {
@@ -589,37 +946,8 @@ void XloggerAppender::GetLogFileInfosByTimeRange(std::vector<LogFileInfo>& _file
         _start_time = _end_time - max_range;  // Adjust start_time to limit range
     }
     
-    // Calculate days between start and end
-    time_t start_day = _start_time / (24 * 60 * 60) * (24 * 60 * 60);  // Start of day
-    time_t end_day = _end_time / (24 * 60 * 60) * (24 * 60 * 60);      // Start of day
-    int days = (int)((end_day - start_day) / (24 * 60 * 60)) + 1;
-    
-    // Limit days to prevent excessive scanning
-    if (days > 30) {
-        days = 30;
-    }
-    
-    for (int i = 0; i <= days; ++i) {
-        time_t day_time = start_day + i * (24 * 60 * 60);
-        
-        // Convert to timeval for __MakeLogFileNamePrefix
-        struct timeval tv;
-        tv.tv_sec = day_time;
-        tv.tv_usec = 0;
-        
-        std::string fileprefix = __MakeLogFileNamePrefix(tv, config_.nameprefix_.c_str());
-        std::string fileext = "xlog";
-        
-        // Scan log dir
-        if (!config_.logdir_.empty()) {
-            __GetFileInfosByPrefix(config_.logdir_, fileprefix, fileext, false, _fileinfos);
-        }
-        
-        // Scan cache dir
-        if (!config_.cachedir_.empty()) {
-            __GetFileInfosByPrefix(config_.cachedir_, fileprefix, fileext, true, _fileinfos);
-        }
-    }
+    // 文件名日期落在范围内的文件, 清单里一次取出
+    __ListFileInfos(LogInventory::DayOf(_start_time), LogInventory::DayOf(_end_time), _fileinfos);
     
     // Filter by time range and sort
     _fileinfos.erase(
@@ -636,90 +964,178 @@ void XloggerAppender::GetLogFileInfosByTimeRange(std::vector<LogFileInfo>& _file
     });
 }
 
-// Helper function to get file infos by prefix
-void XloggerAppender::__GetFileInfosByPrefix(const std::string& _logdir, const std::string& _fileprefix,
-                                             const std::string& _fileext, bool _is_cache,
-                                             std::vector<LogFileInfo>& _fileinfos) {
-    boost::filesystem::path path(_logdir);
-    if (!boost::filesystem::is_directory(path)) {
+void XloggerAppender::GetLogRangesByTimeRange(std::vector<LogFileRange>& _ranges, int64_t _begin_ms, int64_t _end_ms) {
+    _ranges.clear();
+    
+    if ((config_.logdir_.empty() && config_.cachedir_.empty()) || _begin_ms > _end_ms) {
         return;
     }
     
-    boost::filesystem::directory_iterator end_iter;
-    for (boost::filesystem::directory_iterator iter(path); iter != end_iter; ++iter) {
-        if (boost::filesystem::is_regular_file(iter->status())) {
-            std::string filename = iter->path().filename().string();
-            // Check if filename starts with prefix and ends with .{fileext}
-            std::string expected_ext = "." + _fileext;
-            if (filename.length() >= _fileprefix.length() + expected_ext.length() &&
-                filename.substr(0, _fileprefix.length()) == _fileprefix &&
-                filename.substr(filename.length() - expected_ext.length()) == expected_ext) {
-                boost::filesystem::path filepath = boost::filesystem::path(_logdir) / filename;
-                try {
-                    LogFileInfo info;
-                    info.path = filepath.string();
-                    info.size = boost::filesystem::file_size(filepath);
-                    info.mtime = boost::filesystem::last_write_time(filepath);
-                    info.is_cache = _is_cache;
-                    _fileinfos.push_back(info);
-                } catch (const boost::filesystem::filesystem_error&) {
-                    // Skip files that can't be accessed (may have been deleted)
-                    continue;
-                }
+    // 文件名是创建那天的日期; 和 GetLogFileInfosByTimeRange 一样最多看 30 天.
+    // 不按 mtime <= 结束时间过滤: 范围之后还在写的文件也可能包含范围内的日志
+    time_t start_time = (time_t)(_begin_ms / 1000);
+    time_t end_time = (time_t)(_end_ms / 1000);
+    time_t max_range = 30 * 24 * 60 * 60;
+    if (end_time - start_time > max_range) {
+        start_time = end_time - max_range;
+    }
+    
+    // 清单按路径排好序, 不会重复
+    std::vector<LogFileInfo> infos;
+    __ListFileInfos(LogInventory::DayOf(start_time), LogInventory::DayOf(end_time), infos);
+    
+    {
+        // 合并中的索引项落盘, 否则正在写的文件最后一段只能整段返回
+        ScopedLock lock_file(mutex_log_file_);
+        index_.Flush();
+    }
+    
+    for (std::vector<LogFileInfo>::iterator iter = infos.begin(); iter != infos.end(); ++iter) {
+        if (iter->mtime < start_time) continue;
+        
+        std::vector<LogIndexRange> ranges;
+        if (!LogIndex::FindRanges(iter->path, _begin_ms, _end_ms, ranges)) {
+            // 没有索引时逐个读 block 头, 取第一个到最后一个命中 block 之间的区间
+            unsigned long begin_pos = 0;
+            unsigned long end_pos = 0;
+            std::string err_msg;
+            if (LogCrypt::GetPeriodLogsMs(iter->path.c_str(), _begin_ms, _end_ms, begin_pos, end_pos, err_msg)) {
+                LogFileRange range = {iter->path, begin_pos, end_pos - begin_pos};
+                _ranges.push_back(range);
             }
+            continue;
+        }
+        for (std::vector<LogIndexRange>::iterator range = ranges.begin(); range != ranges.end(); ++range) {
+            LogFileRange file_range = {iter->path, range->offset, range->length};
+            _ranges.push_back(file_range);
         }
     }
 }
 
-void XloggerAppender::ClearFileCache() {
-    ScopedLock lock(mutex_file_cache_);
-    file_cache_.fileinfos.clear();
-    file_cache_.cache_time = 0;
-    file_cache_.valid = false;
+bool XloggerAppender::QueryLogs(const LogQuery& _query, const LogQueryCallback& _callback, LogQueryStat* _stat) {
+    LogQueryEngine engine(_query, LogDecodeConfig());
+    if (!engine.IsValid()) return false;
+    
+    FlushSync();
+    
+    int64_t end_ms = 0 != _query.end_ms_ ? _query.end_ms_ : __TimestampMs(NULL);
+    int64_t begin_ms = 0 != _query.begin_ms_ ? _query.begin_ms_ : end_ms - 30LL * 24 * 60 * 60 * 1000;
+    
+    std::vector<LogFileRange> ranges;
+    GetLogRangesByTimeRange(ranges, begin_ms, end_ms);
+    
+    bool stopped = false;
+    LogQueryCallback callback = [&](const char* _record, size_t _len) {
+        stopped = !_callback(_record, _len);
+        return !stopped;
+    };
+    for (std::vector<LogFileRange>::iterator iter = ranges.begin(); iter != ranges.end() && !stopped; ++iter) {
+        std::string err_msg;
+        engine.QueryRange(iter->path, iter->offset, iter->length, callback, err_msg, _stat);
+    }
+    return true;
 }
 
-bool XloggerAppender::__IsCacheValid() {
-    if (!file_cache_.valid) {
-        return false;
+namespace {
+
+struct BundleFile {
+    std::string name;
+    std::string path;
+    int fd;
+    uint64_t size;
+    time_t mtime;
+    std::vector<LogIndexRange> ranges;
+};
+
+}  // namespace
+
+static void __AppendJsonString(std::string& _json, const std::string& _str) {
+    _json += '"';
+    for (std::string::const_iterator iter = _str.begin(); iter != _str.end(); ++iter) {
+        if ('"' == *iter || '\\' == *iter) _json += '\\';
+        if ((unsigned char)*iter >= 0x20) _json += *iter;
     }
-    
-    // Check if cache is for current day
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    time_t current_day = tv.tv_sec / (24 * 60 * 60) * (24 * 60 * 60);
-    
-    if (file_cache_.cache_time != current_day) {
-        return false;  // Cache is for a different day
+    _json += '"';
+}
+
+bool XloggerAppender::ExportBundle(int64_t _begin_ms, int64_t _end_ms, int _out_fd) {
+    if (0 > _out_fd || _begin_ms > _end_ms) return false;
+    
+    FlushSync();
+    
+    std::vector<LogFileRange> ranges;
+    GetLogRangesByTimeRange(ranges, _begin_ms, _end_ms);
+    
+    // 先打开所有文件并按当前长度截好区间, 之后文件被移动或删除也不影响已经打开的 fd
+    std::vector<BundleFile> files;
+    for (std::vector<LogFileRange>::iterator iter = ranges.begin(); iter != ranges.end(); ++iter) {
+        if (files.empty() || files.back().path != iter->path) {
+            int fd = ::open(iter->path.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (-1 == fd) continue;
+            if (0 != fstat(fd, &st)) {
+                ::close(fd);
+                continue;
+            }
+            
+            std::string filename = boost::filesystem::path(iter->path).filename().string();
+            bool is_cache = !config_.cachedir_.empty() && config_.cachedir_ != config_.logdir_
+                            && 0 == iter->path.compare(0, config_.cachedir_.size(), config_.cachedir_);
+            BundleFile file = {is_cache ? "cache/" + filename : filename, iter->path, fd, (uint64_t)st.st_size, st.st_mtime, std::vector<LogIndexRange>()};
+            files.push_back(file);
+        }
+        
+        BundleFile& file = files.back();
+        if (iter->offset >= file.size) continue;
+        LogIndexRange range = {iter->offset, std::min(iter->length, file.size - iter->offset)};
+        file.ranges.push_back(range);
     }
     
-    // Defensive check: verify at least one cached file still exists
-    // This prevents returning stale cache if files were deleted externally
-    // Full verification would be too expensive, so we do a lightweight check
-    if (!file_cache_.fileinfos.empty()) {
-        bool has_valid_file = false;
-        for (const auto& info : file_cache_.fileinfos) {
-            if (boost::filesystem::exists(info.path)) {
-                has_valid_file = true;
-                break;
-            }
+    for (std::vector<BundleFile>::iterator iter = files.begin(); iter != files.end();) {
+        if (!iter->ranges.empty()) {
+            ++iter;
+            continue;
         }
-        // If no cached files exist, cache is invalid
-        if (!has_valid_file) {
-            return false;
+        ::close(iter->fd);
+        iter = files.erase(iter);
+    }
+    
+    std::string manifest = "{\"module\":";
+    __AppendJsonString(manifest, config_.nameprefix_);
+    char buf[256] = {0};
+    snprintf(buf, sizeof(buf), ",\"begin_ms\":%" PRId64 ",\"end_ms\":%" PRId64 ",\"files\":[", _begin_ms, _end_ms);
+    manifest += buf;
+    for (std::vector<BundleFile>::iterator iter = files.begin(); iter != files.end(); ++iter) {
+        manifest += (iter == files.begin()) ? "{\"name\":" : ",{\"name\":";
+        __AppendJsonString(manifest, iter->name);
+        manifest += ",\"ranges\":[";
+        for (std::vector<LogIndexRange>::iterator range = iter->ranges.begin(); range != iter->ranges.end(); ++range) {
+            snprintf(buf, sizeof(buf), "%s[%" PRIu64 ",%" PRIu64 "]", range == iter->ranges.begin() ? "" : ",", range->offset, range->length);
+            manifest += buf;
         }
+        manifest += "]}";
     }
+    manifest += "]}\n";
     
-    return true;
+    LogBundleWriter writer(_out_fd);
+    bool ok = writer.AddBuffer("manifest.json", manifest, time(NULL));
+    for (std::vector<BundleFile>::iterator iter = files.begin(); iter != files.end(); ++iter) {
+        if (ok) ok = writer.AddFileRanges(iter->name, iter->fd, iter->ranges, iter->mtime);
+        ::close(iter->fd);
+    }
+    return ok && writer.Finish();
 }
 
-void XloggerAppender::__UpdateCache(const std::vector<LogFileInfo>& _fileinfos) {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    time_t current_day = tv.tv_sec / (24 * 60 * 60) * (24 * 60 * 60);
-    
-    file_cache_.fileinfos = _fileinfos;
-    file_cache_.cache_time = current_day;
-    file_cache_.valid = true;
+void XloggerAppender::__ListFileInfos(int _day_begin, int _day_end, std::vector<LogFileInfo>& _fileinfos) {
+    std::vector<LogInventory::Entry> entries;
+    inventory_.List(_day_begin, _day_end, entries);
+    for (const auto& entry : entries) {
+        _fileinfos.push_back(__ToFileInfo(entry));
+    }
+}
+
+void XloggerAppender::ClearFileCache() {
+    inventory_.Invalidate();
 }
 
 // Removed: GetLogFileInfosByTimeRangeWithCallback - progress callback not needed
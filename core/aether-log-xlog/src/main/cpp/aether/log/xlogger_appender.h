@@ -20,9 +20,18 @@
 #include "../common/xlogger/xloggerbase.h"
 #include "xlog_config.h"
 #include "log_buffer.h"
+#include "log_attachment.h"
+#include "log_file_writer.h"
+#include "disk_monitor.h"
+#include "log_retention.h"
+#include "log_index.h"
+#include "log_inventory.h"
+#include "log_metrics.h"
+#include "decoder/log_query.h"
 #include <string>
 #include <vector>
 #include <memory>
+#include <functional>
 #include <ctime>
 
 namespace aether {
@@ -35,6 +44,8 @@ class XloggerAppender {
     static void __Release(XloggerAppender* _appender);
 
     void Write(const XLoggerInfo* _info, const char* _log);
+    // 二进制附件随日志写入, 返回引用 id, 失败返回 0; 说明见 appender_attach
+    uint32_t Attach(const char* _name, const void* _data, size_t _len);
     void SetMode(TAppenderMode _mode);
     void Flush();
     void FlushSync();
@@ -42,6 +53,7 @@ class XloggerAppender {
     void SetConsoleLog(bool _is_open);
     void SetMaxFileSize(uint64_t _max_byte_size);
     void SetMaxAliveDuration(long _max_time);
+    void SetMaxTotalSize(uint64_t _max_byte_size);
     
     // Get log file paths for this module
     // Returns list of log file paths (log dir and cache dir if exists)
@@ -67,8 +79,33 @@ class XloggerAppender {
     void GetLogFileInfosByDays(std::vector<LogFileInfo>& _fileinfos, int _days_ago);
     void GetLogFileInfosByTimeRange(std::vector<LogFileInfo>& _fileinfos, time_t _start_time, time_t _end_time);
     
-    // Clear file list cache for this instance
+    // 按毫秒时间范围取日志所在的字节区间, 有 .idx 索引时只返回命中的 block, 没有时按 block 头取首尾命中之间的区间.
+    // 结果只会多不会少, 解码时仍按 block 头过滤
+    struct LogFileRange {
+        std::string path;
+        uint64_t offset;
+        uint64_t length;
+    };
+    void GetLogRangesByTimeRange(std::vector<LogFileRange>& _ranges, int64_t _begin_ms, int64_t _end_ms);
+    
+    // 在本模块的日志里查询, 先把缓冲区落盘; 不限时间时查最近 30 天.
+    // 端上没有服务端私钥, 加密的日志查不出内容, 只适合不加密的配置
+    bool QueryLogs(const LogQuery& _query, const LogQueryCallback& _callback, LogQueryStat* _stat = NULL);
+    
+    // 同步落盘后把 [_begin_ms, _end_ms] 命中的 block 区间打成一个 tar 包写到 _out_fd(文件、管道或 socket),
+    // 第一项 manifest.json 记录每个文件取了哪些区间. 失败时 _out_fd 里是不完整的包
+    bool ExportBundle(int64_t _begin_ms, int64_t _end_ms, int _out_fd);
+    
+    // 目录被外部改动过(拷入/删除日志文件)后调用, 下次查询重新列目录
     void ClearFileCache();
+
+    // 打开耗时, 快速打开时不含留给异步线程的部分
+    int64_t OpenTime() const { return open_time_; }
+    // 快速打开时排到异步线程做完收尾之后执行, 否则立即执行
+    void RunAfterOpen(const std::function<void()>& _task);
+    
+    // 写入、丢弃、落盘和等锁的统计, 从打开时开始累计
+    void GetMetrics(LogMetricsSnapshot& _snapshot) const;
     
 
  private:
@@ -76,35 +113,49 @@ class XloggerAppender {
     
     void __WriteSync(const XLoggerInfo* _info, const char* _log);
     void __WriteAsync(const XLoggerInfo* _info, const char* _log);
-    void __Log2File(const void* _data, size_t _len, bool _move_file);
+    typedef std::function<size_t(char*, size_t)> FrameSource;
+    bool __WriteFramesSync(const FrameSource& _next, int _level, int64_t _timestamp_ms, const char* _tag);
+    bool __WriteFramesAsync(ScopedLock& _lock, const FrameSource& _next, int _level, int64_t _timestamp_ms, const char* _tag);
+    void __FlushInline(ScopedLock& _lock);
+    void __WriteChunksSync(const XLoggerInfo* _info, const char* _log);
+    void __WriteChunksAsync(ScopedLock& _lock, const XLoggerInfo* _info, const char* _log);
+    void __WriteAttachments(ScopedLock& _lock);
+    void __Log2File(const void* _data, size_t _len, bool _move_file, const LogBlockStat* _stat);
     bool __OpenLogFile(const std::string& _log_dir);
+    bool __IsLogFileReusable(const std::string& _log_dir);
     void __CloseLogFile();
-    bool __WriteFile(const void* _data, size_t _len, FILE* _file);
+    bool __WriteFile(const void* _data, size_t _len, const LogBlockStat* _stat);
     void __AsyncLogThread();
     void __MakeLogFileName(const timeval& _tv, const std::string& _log_dir, const char* _prefix, 
-                          const std::string& _fileext, char* _filepath, unsigned int _len);
+                          const std::string& _fileext, char* _filepath, unsigned int _len, long* _index = NULL);
     std::string __MakeLogFileNamePrefix(const timeval& _tv, const char* _prefix);
     long __GetNextFileIndex(const std::string& _fileprefix, const std::string& _fileext);
+    void __ScanRollState(const std::string& _fileprefix, const std::string& _fileext);
     bool __CacheLogs();
-    void __DelTimeoutFile(const std::string& _log_path);
-    void __GetFileInfosByPrefix(const std::string& _logdir, const std::string& _fileprefix,
-                               const std::string& _fileext, bool _is_cache,
-                               std::vector<LogFileInfo>& _fileinfos);
-    
-    // File list cache helpers
-    bool __IsCacheValid();
-    void __UpdateCache(const std::vector<LogFileInfo>& _fileinfos);
+    void __UpdateRetention();
+    long __MaxAliveTime() const;
+    void __OnDiskPressure(TDiskPressureTier _from, TDiskPressureTier _to, uint64_t _available);
+    void __ListFileInfos(int _day_begin, int _day_end, std::vector<LogFileInfo>& _fileinfos);
+    void __MakeLogDirs();
+    void __RunOpenDeferred();
+    void __Flush2File(const void* _data, size_t _len, bool _move_file, const LogBlockStat* _stat);
+    void __WriteMetricsSummary();
 
  private:
     XLogConfig config_;
     LogBuffer* log_buff_ = nullptr;
+    LogAttachmentQueue attachments_;    // 等异步线程写的附件, 由 mutex_buffer_async_ 保护
     boost::iostreams::mapped_file mmap_file_;
+    int mmap_lock_ = -1;
     std::unique_ptr<Thread> thread_async_;
     Mutex mutex_buffer_async_;
     Mutex mutex_log_file_;
-    FILE* logfile_ = nullptr;
-    time_t openfiletime_ = 0;
+    LogFileWriter logfile_;
+    LogIndexWriter index_;
     std::string current_dir_;
+    // 写缓存目录还是日志目录, 只在重新打开文件时判断
+    bool write_cache_ = false;
+    bool cache_logs_ = false;
 #ifdef DEBUG
     bool consolelog_open_ = true;
 #else
@@ -114,24 +165,36 @@ class XloggerAppender {
     Condition cond_buffer_async_;
     uint64_t max_file_size_ = 0;
     long max_alive_time_ = 10 * 24 * 60 * 60;  // 10 days in second
+    LogRetention::ModuleId retention_id_ = LogRetention::kInvalidModuleId;
+    // 快速打开留给异步线程的工作和排在其后的任务, 由 mutex_buffer_async_ 保护; 执行期间持有 mutex_open_deferred_
+    Mutex mutex_open_deferred_;
+    bool open_pending_ = false;
+    std::vector<std::function<void()> > open_deferred_;
+    int64_t open_time_ = 0;
+    
+    LogMetrics metrics_;
+    uint64_t metrics_summary_us_ = 0;   // 上次写指标摘要的时间, 只在异步线程里用
 
     time_t last_time_ = 0;
     uint64_t last_tick_ = 0;
     char last_file_path_[1024] = {0};
     
-    std::unique_ptr<Thread> thread_timeout_cache_;
-    std::unique_ptr<Thread> thread_moveold_;
-    std::unique_ptr<Thread> thread_timeout_log_;
-    
-    // File list cache for current day (performance optimization)
-    struct FileListCache {
-        std::vector<LogFileInfo> fileinfos;
-        time_t cache_time;  // Day timestamp (start of day)
-        bool valid;
-        FileListCache() : cache_time(0), valid(false) {}
+    // 按大小切分的状态: 当天文件名前缀、正在写的序号和字节数.
+    // 每天第一次用到时扫描一次目录, 之后只在打开和写入时更新, 写路径上不再列目录
+    struct RollState {
+        std::string fileprefix;
+        long index;
+        uint64_t bytes;
+        RollState() : index(0), bytes(0) {}
     };
-    FileListCache file_cache_;
-    Mutex mutex_file_cache_;
+    RollState roll_state_;
+    Mutex mutex_roll_state_;
+    
+    // 文件清单, 列文件和切分序号都从这里取, 不再列目录
+    LogInventory inventory_;
+    
+    // 放在最后: 析构时最先停掉, 回调里会用到上面的成员
+    DiskMonitor disk_monitor_;
 };
 
 }  // namespace xlog
@@ -54,8 +54,10 @@ static std::map<std::string, bool>& GetHeaderWrittenMap() {
 // Helper function to write header information for a module instance
 // Note: This should only be called once per instance, when the instance is first created
 // Performance: Uses minimal locking - only checks/updates a flag, then releases lock before writing
-static void WriteHeaderInfo(XloggerCategory* _category, const std::string& _nameprefix) {
-    if (nullptr == _category) {
+// Writes go to the appender directly: with fast open this runs on the appender's async thread,
+// which is joined before the appender is released, while the category may already be gone
+static void WriteHeaderInfo(XloggerAppender* _appender, const std::string& _nameprefix) {
+    if (nullptr == _appender) {
         return;
     }
     
@@ -95,39 +97,39 @@ static void WriteHeaderInfo(XloggerCategory* _category, const std::string& _name
     char appender_info[728] = {0};
     snprintf(appender_info, sizeof(appender_info), "^^^^^^^^^^" __DATE__ "^^^" __TIME__ "^^^^^^^^^^%s", mark_info);
     
-    _category->Write(NULL, appender_info);
+    _appender->Write(NULL, appender_info);
     
     char logmsg[256] = {0};
-    snprintf(logmsg, sizeof(logmsg), "get mmap time: 0");
-    _category->Write(NULL, logmsg);
+    snprintf(logmsg, sizeof(logmsg), "appender open time: %" PRId64, _appender->OpenTime());
+    _appender->Write(NULL, logmsg);
     
-    _category->Write(NULL, "AETHER_PATH: " AETHER_PATH);
-    _category->Write(NULL, "AETHER_REVISION: " AETHER_REVISION);
-    _category->Write(NULL, "AETHER_BUILD_TIME: " AETHER_BUILD_TIME);
+    _appender->Write(NULL, "AETHER_PATH: " AETHER_PATH);
+    _appender->Write(NULL, "AETHER_REVISION: " AETHER_REVISION);
+    _appender->Write(NULL, "AETHER_BUILD_TIME: " AETHER_BUILD_TIME);
     
     if (strlen(AETHER_URL) > 0) {
         char url_msg[256] = {0};
         snprintf(url_msg, sizeof(url_msg), "AETHER_URL: %s", AETHER_URL);
-        _category->Write(NULL, url_msg);
+        _appender->Write(NULL, url_msg);
     }
     if (strlen(AETHER_TAG) > 0) {
         char tag_msg[256] = {0};
         snprintf(tag_msg, sizeof(tag_msg), "AETHER_BUILD_JOB: %s", AETHER_TAG);
-        _category->Write(NULL, tag_msg);
+        _appender->Write(NULL, tag_msg);
     }
     
     // Output custom header info if provided
     if (!sg_log_extra_msg.empty()) {
-        _category->Write(NULL, "=== Custom Header Info ===");
+        _appender->Write(NULL, "=== Custom Header Info ===");
         std::istringstream iss(sg_log_extra_msg);
         std::string line;
         while (std::getline(iss, line)) {
             if (!line.empty()) {
                 std::string formatted_line = "=== Header: " + line + " ===";
-                _category->Write(NULL, formatted_line.c_str());
+                _appender->Write(NULL, formatted_line.c_str());
             }
         }
-        _category->Write(NULL, "=== End Header Info ===");
+        _appender->Write(NULL, "=== End Header Info ===");
     }
     
     // Note: mode and space info are instance-specific, so we skip them here
@@ -140,6 +142,7 @@ XloggerCategory* NewXloggerInstance(const XLogConfig& _config, TLogLevel _level)
     }
 
     XloggerCategory* category = nullptr;
+    XloggerAppender* appender = nullptr;
     {
         ScopedLock lock(GetGlobalMutex());
         auto it = GetGlobalInstanceMap().find(_config.nameprefix_);
@@ -147,7 +150,7 @@ XloggerCategory* NewXloggerInstance(const XLogConfig& _config, TLogLevel _level)
             return it->second;
         }
 
-        XloggerAppender* appender = XloggerAppender::NewInstance(_config, 0);
+        appender = XloggerAppender::NewInstance(_config, 0);
 
         using namespace std::placeholders;
         category = XloggerCategory::NewInstance(reinterpret_cast<uintptr_t>(appender),
@@ -158,7 +161,8 @@ XloggerCategory* NewXloggerInstance(const XLogConfig& _config, TLogLevel _level)
     
     // Write header information for this module instance (only once)
     // Note: Lock is released here to avoid deadlock (WriteHeaderInfo will acquire its own lock)
-    WriteHeaderInfo(category, _config.nameprefix_);
+    // With fast open the header is written on the appender's async thread after its deferred open work
+    appender->RunAfterOpen(std::bind(&WriteHeaderInfo, appender, _config.nameprefix_));
     
     return category;
 }
@@ -294,6 +298,66 @@ void FlushModule(const char* _nameprefix, bool _is_sync) {
     }
 }
 
+bool ExportBundle(const char* _nameprefix, int64_t _begin_ms, int64_t _end_ms, int _out_fd) {
+    if (nullptr == _nameprefix) {
+        return false;
+    }
+    
+    XloggerCategory* category = nullptr;
+    {
+        ScopedLock lock(GetGlobalMutex());
+        auto it = GetGlobalInstanceMap().find(_nameprefix);
+        if (it == GetGlobalInstanceMap().end()) {
+            return false;
+        }
+        category = it->second;
+    }
+    
+    // 和 FlushModule 一样不持有全局锁导出, 拷贝大文件时不阻塞其他模块
+    XloggerAppender* appender = reinterpret_cast<XloggerAppender*>(category->GetAppender());
+    return appender != nullptr && appender->ExportBundle(_begin_ms, _end_ms, _out_fd);
+}
+
+bool GetMetrics(const char* _nameprefix, LogMetricsSnapshot& _snapshot) {
+    if (nullptr == _nameprefix || '\0' == _nameprefix[0]) {
+        appender_get_metrics(_snapshot);
+        return true;
+    }
+    
+    // 只读原子计数, 持有全局锁取快照, 不会和释放实例交错
+    ScopedLock lock(GetGlobalMutex());
+    auto it = GetGlobalInstanceMap().find(_nameprefix);
+    if (it == GetGlobalInstanceMap().end()) {
+        return false;
+    }
+    XloggerAppender* appender = reinterpret_cast<XloggerAppender*>(it->second->GetAppender());
+    if (appender == nullptr) {
+        return false;
+    }
+    appender->GetMetrics(_snapshot);
+    return true;
+}
+
+uint32_t Attach(const char* _nameprefix, const char* _name, const void* _data, size_t _len) {
+    if (nullptr == _nameprefix || '\0' == _nameprefix[0]) {
+        return appender_attach(_name, _data, _len);
+    }
+    
+    XloggerCategory* category = nullptr;
+    {
+        ScopedLock lock(GetGlobalMutex());
+        auto it = GetGlobalInstanceMap().find(_nameprefix);
+        if (it == GetGlobalInstanceMap().end()) {
+            return 0;
+        }
+        category = it->second;
+    }
+    
+    // 异步模式只复制数据排队, 同步模式要落盘, 都不持有全局锁
+    XloggerAppender* appender = reinterpret_cast<XloggerAppender*>(category->GetAppender());
+    return appender != nullptr ? appender->Attach(_name, _data, _len) : 0;
+}
+
 void SetConsoleLogOpen(uintptr_t _instance_ptr, bool _is_open) {
     if (0 == _instance_ptr) {
         appender_set_console_log(_is_open);
@@ -324,6 +388,20 @@ void SetMaxAliveTime(uintptr_t _instance_ptr, long _max_time) {
     }
 }
 
+void SetMaxTotalSize(uintptr_t _instance_ptr, uint64_t _max_byte_size) {
+    if (0 == _instance_ptr) {
+        appender_set_max_total_size(_max_byte_size);
+    } else {
+        XloggerCategory* category = reinterpret_cast<XloggerCategory*>(_instance_ptr);
+        XloggerAppender* appender = reinterpret_cast<XloggerAppender*>(category->GetAppender());
+        appender->SetMaxTotalSize(_max_byte_size);
+    }
+}
+
+void SetGlobalMaxTotalSize(uint64_t _max_byte_size) {
+    LogRetention::Singleton()->SetGlobalQuota(_max_byte_size);
+}
+
 void ClearFileCache(const char* _nameprefix) {
     if (nullptr == _nameprefix) {
         return;
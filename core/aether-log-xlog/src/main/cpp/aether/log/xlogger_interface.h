@@ -16,6 +16,7 @@
 #include <stdint.h>
 #include <vector>
 #include "xlog_config.h"
+#include "log_metrics.h"
 #include "../common/xlogger/xloggerbase.h"
 
 namespace aether {
@@ -54,12 +55,27 @@ void FlushAll(bool _is_sync);
 
 void FlushModule(const char* _nameprefix, bool _is_sync);
 
+// 同步落盘后把模块在 [_begin_ms, _end_ms] 内的日志打成 tar 包写到 _out_fd, 不关闭 _out_fd
+bool ExportBundle(const char* _nameprefix, int64_t _begin_ms, int64_t _end_ms, int _out_fd);
+
+// _nameprefix 为空时取默认的全局 appender; 模块不存在时返回 false
+bool GetMetrics(const char* _nameprefix, LogMetricsSnapshot& _snapshot);
+
+// 二进制附件随日志写入, 返回引用 id; _nameprefix 为空时写默认的全局 appender, 模块不存在或写入失败时返回 0
+uint32_t Attach(const char* _nameprefix, const char* _name, const void* _data, size_t _len);
+
 void SetConsoleLogOpen(uintptr_t _instance_ptr, bool _is_open);
 
 void SetMaxFileSize(uintptr_t _instance_ptr, long _max_file_size);
 
 void SetMaxAliveTime(uintptr_t _instance_ptr, long _max_time);
 
+// 0 表示默认的全局 appender; 超出时从最旧的文件删起
+void SetMaxTotalSize(uintptr_t _instance_ptr, uint64_t _max_byte_size);
+
+// 所有模块合计的日志大小上限, 0 表示不限
+void SetGlobalMaxTotalSize(uint64_t _max_byte_size);
+
 void ClearFileCache(const char* _nameprefix);
 
 void ClearAllFileCache();
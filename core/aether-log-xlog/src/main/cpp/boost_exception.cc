@@ -12,12 +12,19 @@
 
 #include <boost/throw_exception.hpp>
 #include <cstdlib>
+#ifdef __ANDROID__
 #include <android/log.h>
+#else
+#include <cstdio>
+#endif
 
 namespace aether_boost {
     void throw_exception( std::exception const & e ) {
+#ifdef __ANDROID__
         __android_log_write(ANDROID_LOG_ERROR, "aether_boost", e.what());
+#else
+        fprintf(stderr, "aether_boost: %s\n", e.what());
+#endif
         std::abort();
     }
 } // namespace aether_boost
-
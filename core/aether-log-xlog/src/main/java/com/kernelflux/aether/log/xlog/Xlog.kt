@@ -235,6 +235,37 @@ object Xlog {
     @JvmStatic
     external fun setConsoleLogOpen(isOpen: Boolean)
 
+    /**
+     * 打开后 native 层的 scope 追踪写成二进制事件（纳秒精度），不再每个 scope 写两行文本
+     * 事件随日志落盘，解码时可导出为 Chrome/Perfetto trace JSON
+     */
+    @JvmStatic
+    external fun setTraceMode(isOpen: Boolean)
+
+    /**
+     * 异步模式下的流水线压缩：写日志的线程只拷贝，写满的缓冲区段交给这么多个压缩线程并行压缩、加密，再按顺序落盘
+     * 日志量很大、单线程压缩跟不上时使用；0 表示在写日志的线程上压缩（默认），最多 8 个
+     * 对之后的 appenderOpen 和 newXlogInstance 生效
+     */
+    @JvmStatic
+    external fun setCompressThreads(threads: Int)
+
+    /**
+     * 多进程共用一个日志目录时，在打开日志前给每个进程设置不同的名字（如 "main"、"push"）
+     * 各进程的 mmap 缓冲区分开，追加同一个日志文件时加锁，解码时用 xlogdecode -m 按时间合并；传 null 关闭
+     * 对之后的 appenderOpen 和 newXlogInstance 生效
+     */
+    @JvmStatic
+    external fun setProcessName(processName: String?)
+
+    /**
+     * 日志 block 写第二版头部：带毫秒时间范围、进程号、级别和 tag 摘要，查询时不用解压就能跳过，xlogdecode -m 按进程合并
+     * 上游 Mars 的解码脚本读不了第二版，读日志的一方都换成 xlogdecode 后再打开；默认关闭
+     * 对之后的 appenderOpen 和 newXlogInstance 生效
+     */
+    @JvmStatic
+    external fun setBlockHeaderV2(enable: Boolean)
+
     @JvmStatic
     external fun appenderOpen(
         level: Int,
@@ -271,6 +302,38 @@ object Xlog {
     @JvmStatic
     external fun flushModule(moduleName: String, isSync: Boolean)
 
+    /**
+     * 把指定模块在时间范围内的日志打成一个 tar 包写到 fd（文件、管道或 socket），用于上传
+     * 包内第一项是 manifest.json，之后每个 .xlog 只包含命中时间范围的 block；数据在 native 层直接拷贝，不经过 Java 堆
+     * @param moduleName 模块名
+     * @param startTime 开始时间（毫秒时间戳）
+     * @param endTime 结束时间（毫秒时间戳）
+     * @param fd 输出的文件描述符（如 ParcelFileDescriptor.fd），调用方负责关闭
+     * @return 是否成功；失败时 fd 中可能是不完整的包
+     */
+    @JvmStatic
+    external fun exportBundle(moduleName: String, startTime: Long, endTime: Long, fd: Int): Boolean
+
+    /**
+     * 获取模块的运行指标，JSON 格式：写入条数和字节数、压缩/加密后的字节数、按原因和级别的丢弃数、
+     * 落盘次数和耗时分位数（微秒）、写入时等锁的次数和耗时分位数、当前缓冲区用量
+     * @param moduleName 模块名，空字符串表示默认实例
+     * @return 模块不存在时返回 null
+     */
+    @JvmStatic
+    external fun getMetrics(moduleName: String): String?
+
+    /**
+     * 二进制附件（抓包、截图、崩溃现场等）随日志写入，和文本日志一样压缩、加密，随日志文件清理和上传
+     * 数据在 native 层复制一份交给异步线程，立即返回；解码时用 xlogdecode -a 按 id 取出为文件
+     * @param moduleName 模块名，空字符串表示默认实例
+     * @param name 附件名，可为 null，最长 64 字节
+     * @param data 附件数据，最大 4MB
+     * @return 附件 id，可写进日志引用；模块不存在、已关闭或排队的附件过多时返回 0
+     */
+    @JvmStatic
+    external fun attach(moduleName: String, name: String?, data: ByteArray): Long
+
     /**
      * 获取指定模块的日志文件路径列表
      * @param moduleName 模块名